@@ -0,0 +1,781 @@
+/*
+
+ * ctorm | Simple web framework for C
+ * Written by ngn (https://ngn.tf) (2025)
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+ * HTTP/1.1 load generator used by "make bench", it uses keep-alive connections
+ * driven by epoll, with optional pipelining
+
+ * by default it runs in closed-loop mode, where every connection sends a new
+ * request as soon as it receives a response, with "-r" it runs in open-loop
+ * mode, where requests are scheduled at a constant rate and the latency is
+ * measured from the time a request was supposed to be sent, so a stalled server
+ * can't hide it's latency by slowing down the client (coordinated omission)
+
+ * results are printed to stdout as a single JSON object
+
+*/
+
+#define _GNU_SOURCE
+
+#include <netinet/tcp.h>
+#include <netinet/in.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#define BENCH_BUF_SIZE     (64 * 1024) // per-connection receive buffer size
+#define BENCH_OUT_SIZE     (16 * 1024) // per-connection send buffer size
+#define BENCH_PIPELINE_MAX (64)        // max pipelined requests per connection
+#define BENCH_PENDING_MAX  (1 << 20)   // max queued requests in open-loop mode
+
+// latency histogram, log-linear buckets with 1/64 relative precision
+#define BENCH_HIST_SUB  (64)
+#define BENCH_HIST_SIZE (BENCH_HIST_SUB * 42)
+
+#define NS_PER_SEC (1000000000ULL)
+
+#define bench_fail(fmt, ...) fprintf(stderr, "bench: " fmt "\n", ##__VA_ARGS__)
+
+struct bench_opts {
+  char    *host, *port, *path;
+  uint32_t conns;    // total connection count
+  uint32_t threads;  // thread count
+  uint32_t pipeline; // max in-flight requests per connection
+  uint32_t duration; // duration of the measurement (seconds)
+  uint32_t warmup;   // duration of the warmup (seconds)
+  double   rate;     // total request rate, 0 means closed-loop mode
+};
+
+struct bench_hist {
+  uint64_t counts[BENCH_HIST_SIZE];
+  uint64_t total, sum, max;
+};
+
+struct bench_conn {
+  int  fd;
+  bool connected;
+
+  char   out[BENCH_OUT_SIZE]; // data waiting to be sent
+  size_t out_len, out_off;
+
+  uint64_t sent[BENCH_PIPELINE_MAX]; // start times of the in-flight requests
+  uint32_t head, count;
+
+  char    in[BENCH_BUF_SIZE]; // received data waiting to be parsed
+  size_t  in_len;
+  int64_t skip; // remaining body bytes that don't fit in the buffer
+  int     code; // status code of the response that is being skipped
+};
+
+struct bench_thread {
+  struct bench_opts *opts;
+  struct addrinfo   *addr;
+  pthread_t          thread;
+
+  struct bench_conn *conns;
+  uint32_t           conn_count;
+  uint32_t           next_conn;
+
+  char  *req; // the request that is sent over and over again
+  size_t req_len;
+
+  uint64_t  interval; // time between scheduled requests (open-loop)
+  uint64_t  next;     // next scheduled request time (open-loop)
+  uint64_t *pending;  // scheduled but not yet sent requests (open-loop)
+  uint32_t  pending_head, pending_count;
+
+  uint64_t start, measure, end;
+
+  struct bench_hist hist;
+  uint64_t          requests, errors, non_2xx, bytes, dropped;
+  bool              failed;
+};
+
+uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+uint32_t bench_hist_index(uint64_t val) {
+  uint32_t msb = 0, shift = 0, indx = 0;
+
+  if (val < BENCH_HIST_SUB)
+    return val;
+
+  msb   = 63 - __builtin_clzll(val);
+  shift = msb - 6; // 2^6 = BENCH_HIST_SUB
+  indx  = BENCH_HIST_SUB * (shift + 1) + (val >> shift) - BENCH_HIST_SUB;
+
+  return indx >= BENCH_HIST_SIZE ? BENCH_HIST_SIZE - 1 : indx;
+}
+
+uint64_t bench_hist_value(uint32_t indx) {
+  uint32_t shift = 0;
+
+  if (indx < BENCH_HIST_SUB)
+    return indx;
+
+  // return the middle of the bucket
+  shift = indx / BENCH_HIST_SUB - 1;
+  return ((uint64_t)(indx % BENCH_HIST_SUB + BENCH_HIST_SUB) << shift) +
+         ((1ULL << shift) >> 1);
+}
+
+void bench_hist_add(struct bench_hist *hist, uint64_t val) {
+  hist->counts[bench_hist_index(val)]++;
+  hist->total++;
+  hist->sum += val;
+
+  if (val > hist->max)
+    hist->max = val;
+}
+
+void bench_hist_merge(struct bench_hist *dst, struct bench_hist *src) {
+  for (uint32_t i = 0; i < BENCH_HIST_SIZE; i++)
+    dst->counts[i] += src->counts[i];
+
+  dst->total += src->total;
+  dst->sum += src->sum;
+
+  if (src->max > dst->max)
+    dst->max = src->max;
+}
+
+uint64_t bench_hist_percentile(struct bench_hist *hist, double perc) {
+  uint64_t target = (uint64_t)(hist->total * perc / 100.0 + 0.5), sum = 0;
+
+  if (target == 0)
+    target = 1;
+
+  for (uint32_t i = 0; i < BENCH_HIST_SIZE; i++) {
+    if ((sum += hist->counts[i]) < target)
+      continue;
+
+    // never report more than the actual max value
+    uint64_t val = bench_hist_value(i);
+    return val > hist->max ? hist->max : val;
+  }
+
+  return hist->max;
+}
+
+bool bench_conn_open(struct bench_thread *t, struct bench_conn *conn, int ep) {
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = conn};
+  int                flag = 1;
+
+  conn->fd = socket(t->addr->ai_family,
+      SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+      t->addr->ai_protocol);
+
+  if (conn->fd < 0)
+    return false;
+
+  setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+  if (connect(conn->fd, t->addr->ai_addr, t->addr->ai_addrlen) < 0 &&
+      errno != EINPROGRESS) {
+    close(conn->fd);
+    conn->fd = -1;
+    return false;
+  }
+
+  conn->connected = false;
+  conn->out_len   = 0;
+  conn->out_off   = 0;
+  conn->in_len    = 0;
+  conn->head      = 0;
+  conn->count     = 0;
+  conn->skip      = -1;
+
+  return epoll_ctl(ep, EPOLL_CTL_ADD, conn->fd, &ev) == 0;
+}
+
+void bench_conn_close(struct bench_thread *t, struct bench_conn *conn) {
+  if (conn->fd < 0)
+    return;
+
+  // all the in-flight requests are lost
+  if (bench_now() >= t->measure)
+    t->errors += conn->count;
+
+  close(conn->fd);
+  conn->fd = -1;
+}
+
+bool bench_conn_flush(struct bench_conn *conn) {
+  ssize_t ret = 0;
+
+  while (conn->out_off < conn->out_len) {
+    ret = send(conn->fd,
+        conn->out + conn->out_off,
+        conn->out_len - conn->out_off,
+        MSG_NOSIGNAL);
+
+    if (ret < 0)
+      return errno == EAGAIN || errno == EINTR;
+
+    conn->out_off += ret;
+  }
+
+  conn->out_off = conn->out_len = 0;
+  return true;
+}
+
+bool bench_conn_push(
+    struct bench_thread *t, struct bench_conn *conn, uint64_t start) {
+  if (!conn->connected || conn->count >= t->opts->pipeline ||
+      conn->out_len + t->req_len > sizeof(conn->out))
+    return false;
+
+  memcpy(conn->out + conn->out_len, t->req, t->req_len);
+  conn->out_len += t->req_len;
+
+  conn->sent[(conn->head + conn->count++) % BENCH_PIPELINE_MAX] = start;
+  return true;
+}
+
+// fill the connections with new requests
+void bench_dispatch(struct bench_thread *t) {
+  struct bench_conn *conn = NULL;
+  uint32_t           i = 0, busy = 0;
+
+  // closed-loop, keep every connection's pipeline full
+  if (t->interval == 0) {
+    for (i = 0; i < t->conn_count; i++) {
+      conn = &t->conns[i];
+
+      while (bench_conn_push(t, conn, bench_now()))
+        continue;
+
+      if (conn->fd >= 0 && !bench_conn_flush(conn))
+        conn->connected = false;
+    }
+
+    return;
+  }
+
+  // open-loop, hand the scheduled requests to the connections round-robin
+  while (t->pending_count > 0 && busy < t->conn_count) {
+    conn         = &t->conns[t->next_conn];
+    t->next_conn = (t->next_conn + 1) % t->conn_count;
+
+    if (!bench_conn_push(t, conn, t->pending[t->pending_head])) {
+      busy++;
+      continue;
+    }
+
+    t->pending_head = (t->pending_head + 1) % BENCH_PENDING_MAX;
+    t->pending_count--;
+    busy = 0;
+
+    if (!bench_conn_flush(conn))
+      conn->connected = false;
+  }
+}
+
+// schedule the requests that are due (open-loop)
+void bench_schedule(struct bench_thread *t, uint64_t now) {
+  for (; t->next <= now; t->next += t->interval) {
+    if (t->pending_count >= BENCH_PENDING_MAX) {
+      t->dropped++;
+      continue;
+    }
+
+    t->pending[(t->pending_head + t->pending_count++) % BENCH_PENDING_MAX] =
+        t->next;
+  }
+}
+
+// parse the status code and the content length of a response header
+bool bench_parse_header(char *buf, size_t len, int *code, int64_t *clen) {
+  char *cur = buf, *end = buf + len;
+
+  if (len < 12 || strncmp(buf, "HTTP/1.", 7) != 0)
+    return false;
+
+  *code = atoi(buf + 9);
+  *clen = 0;
+
+  while (NULL != (cur = memchr(cur, '\n', end - cur)) && ++cur < end) {
+    if (end - cur > 15 && strncasecmp(cur, "content-length:", 15) == 0)
+      *clen = atoll(cur + 15);
+  }
+
+  return true;
+}
+
+void bench_complete(struct bench_thread *t, struct bench_conn *conn, int code) {
+  uint64_t now = bench_now(), start = conn->sent[conn->head];
+
+  conn->head = (conn->head + 1) % BENCH_PIPELINE_MAX;
+  conn->count--;
+
+  // only record the requests that are started after the warmup
+  if (start < t->measure || now > t->end)
+    return;
+
+  t->requests++;
+  bench_hist_add(&t->hist, now - start);
+
+  if (code < 200 || code > 299)
+    t->non_2xx++;
+}
+
+bool bench_conn_read(struct bench_thread *t, struct bench_conn *conn) {
+  char   *hend = NULL;
+  size_t  hlen = 0, total = 0;
+  ssize_t ret  = 0;
+  int64_t clen = 0;
+  int     code = 0;
+
+  while (true) {
+    if ((ret = recv(conn->fd,
+             conn->in + conn->in_len,
+             sizeof(conn->in) - conn->in_len,
+             0)) == 0)
+      return false;
+
+    if (ret < 0)
+      return errno == EAGAIN || errno == EINTR;
+
+    if (bench_now() >= t->measure)
+      t->bytes += ret;
+
+    conn->in_len += ret;
+
+    // skip the rest of a large body
+    if (conn->skip >= 0) {
+      if ((int64_t)conn->in_len < conn->skip) {
+        conn->skip -= conn->in_len;
+        conn->in_len = 0;
+        continue;
+      }
+
+      memmove(conn->in, conn->in + conn->skip, conn->in_len - conn->skip);
+      conn->in_len -= conn->skip;
+      conn->skip = -1;
+
+      bench_complete(t, conn, conn->code);
+    }
+
+    // parse all the complete responses in the buffer
+    while (conn->count > 0 && NULL != (hend = memmem(conn->in,
+                                           conn->in_len,
+                                           "\r\n\r\n",
+                                           4))) {
+      hlen = hend - conn->in + 4;
+
+      if (!bench_parse_header(conn->in, hlen, &code, &clen))
+        return false;
+
+      // body does not fit in the buffer, skip it as we receive it
+      if ((total = hlen + clen) > sizeof(conn->in)) {
+        conn->skip   = total - conn->in_len;
+        conn->code   = code;
+        conn->in_len = 0;
+        break;
+      }
+
+      if (total > conn->in_len)
+        break;
+
+      memmove(conn->in, conn->in + total, conn->in_len - total);
+      conn->in_len -= total;
+
+      bench_complete(t, conn, code);
+    }
+
+    // we should never have a full buffer without a complete header
+    if (conn->in_len >= sizeof(conn->in))
+      return false;
+  }
+}
+
+void *bench_thread(void *_t) {
+  struct bench_thread *t = _t;
+  struct epoll_event   evs[256], ev;
+  struct itimerspec    its;
+  struct bench_conn   *conn = NULL;
+  uint64_t             now = 0, timer_val = 0;
+  int                  ep = -1, timer = -1, cnt = 0, err = 0;
+  socklen_t            err_len = sizeof(err);
+
+  if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    bench_fail("failed to create epoll: %s", strerror(errno));
+    t->failed = true;
+    return NULL;
+  }
+
+  // open-loop mode uses a timer for scheduling the requests
+  if (t->interval > 0) {
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if (timer < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, timer, &ev) < 0) {
+      bench_fail("failed to create timer: %s", strerror(errno));
+      goto fail;
+    }
+  }
+
+  for (uint32_t i = 0; i < t->conn_count; i++) {
+    if (!bench_conn_open(t, &t->conns[i], ep)) {
+      bench_fail("failed to connect: %s", strerror(errno));
+      goto fail;
+    }
+  }
+
+  t->next = t->start;
+
+  while ((now = bench_now()) < t->end) {
+    if (t->interval > 0) {
+      bench_schedule(t, now);
+
+      // arm the timer for the next scheduled request
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_sec  = t->next / NS_PER_SEC;
+      its.it_value.tv_nsec = t->next % NS_PER_SEC;
+      timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL);
+    }
+
+    bench_dispatch(t);
+
+    if ((cnt = epoll_wait(ep, evs, sizeof(evs) / sizeof(evs[0]), 100)) < 0) {
+      if (errno == EINTR)
+        continue;
+
+      bench_fail("epoll_wait failed: %s", strerror(errno));
+      goto fail;
+    }
+
+    for (int i = 0; i < cnt; i++) {
+      // timer expired, requests are scheduled at the start of the loop
+      if (NULL == (conn = evs[i].data.ptr)) {
+        while (read(timer, &timer_val, sizeof(timer_val)) > 0)
+          continue;
+        continue;
+      }
+
+      // check the result of the non-blocking connect()
+      if (!conn->connected && (evs[i].events & EPOLLOUT)) {
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 ||
+            err != 0) {
+          bench_fail("failed to connect: %s", strerror(err));
+          goto fail;
+        }
+
+        // no need to wait for EPOLLOUT anymore
+        ev.events   = EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(ep, EPOLL_CTL_MOD, conn->fd, &ev);
+
+        conn->connected = true;
+      }
+
+      if ((evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+          bench_conn_read(t, conn))
+        continue;
+
+      if (!(evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        continue;
+
+      // connection is closed or it failed, open a new one
+      bench_conn_close(t, conn);
+
+      if (!bench_conn_open(t, conn, ep)) {
+        bench_fail("failed to reconnect: %s", strerror(errno));
+        goto fail;
+      }
+    }
+
+    // reconnect the connections that failed to send
+    for (uint32_t i = 0; i < t->conn_count; i++) {
+      conn = &t->conns[i];
+
+      if (conn->connected || conn->fd < 0 || conn->out_len == 0)
+        continue;
+
+      bench_conn_close(t, conn);
+
+      if (!bench_conn_open(t, conn, ep)) {
+        bench_fail("failed to reconnect: %s", strerror(errno));
+        goto fail;
+      }
+    }
+  }
+
+  // requests that never got a chance to be sent
+  t->dropped += t->pending_count;
+  goto end;
+
+fail:
+  t->failed = true;
+
+end:
+  for (uint32_t i = 0; i < t->conn_count; i++)
+    if (t->conns[i].fd >= 0)
+      close(t->conns[i].fd);
+
+  if (timer >= 0)
+    close(timer);
+
+  close(ep);
+  return NULL;
+}
+
+void bench_usage(char *name) {
+  fprintf(stderr,
+      "usage: %s [options] <host:port> [path]\n"
+      "  -c <num>  total connection count (default: 64)\n"
+      "  -t <num>  thread count (default: 2)\n"
+      "  -d <sec>  measurement duration (default: 10)\n"
+      "  -w <sec>  warmup duration (default: 1)\n"
+      "  -p <num>  pipelined requests per connection (default: 1)\n"
+      "  -r <num>  constant request rate, enables open-loop mode\n",
+      name);
+}
+
+bool bench_parse_addr(struct bench_opts *opts, char *addr) {
+  char *sep = strrchr(addr, ':');
+
+  if (NULL == sep || sep == addr || *(sep + 1) == 0)
+    return false;
+
+  *sep       = 0;
+  opts->host = addr;
+  opts->port = sep + 1;
+
+  // remove the brackets from an IPv6 address
+  if (*opts->host == '[' && *(sep - 1) == ']') {
+    *(sep - 1) = 0;
+    opts->host++;
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  struct bench_opts    opts = {NULL, NULL, "/", 64, 2, 1, 10, 1, 0};
+  struct addrinfo      hints, *addr = NULL;
+  struct bench_thread *threads = NULL, *t = NULL;
+  struct bench_hist   *hist    = NULL;
+  uint64_t             requests = 0, errors = 0, non_2xx = 0, bytes = 0;
+  uint64_t             dropped = 0, start = 0;
+  uint32_t             started = 0;
+  char                *req = NULL;
+  int                  opt = 0, ret = EXIT_FAILURE;
+  double               secs = 0;
+
+  while ((opt = getopt(argc, argv, "c:t:d:w:p:r:h")) != -1) {
+    switch (opt) {
+    case 'c':
+      opts.conns = atoi(optarg);
+      break;
+
+    case 't':
+      opts.threads = atoi(optarg);
+      break;
+
+    case 'd':
+      opts.duration = atoi(optarg);
+      break;
+
+    case 'w':
+      opts.warmup = atoi(optarg);
+      break;
+
+    case 'p':
+      opts.pipeline = atoi(optarg);
+      break;
+
+    case 'r':
+      opts.rate = atof(optarg);
+      break;
+
+    default:
+      bench_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc || !bench_parse_addr(&opts, argv[optind])) {
+    bench_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (optind + 1 < argc)
+    opts.path = argv[optind + 1];
+
+  if (opts.threads == 0 || opts.conns < opts.threads || opts.duration == 0 ||
+      opts.pipeline == 0 || opts.pipeline > BENCH_PIPELINE_MAX ||
+      opts.rate < 0) {
+    bench_fail("invalid options");
+    return EXIT_FAILURE;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(opts.host, opts.port, &hints, &addr) != 0) {
+    bench_fail("failed to resolve %s:%s", opts.host, opts.port);
+    return EXIT_FAILURE;
+  }
+
+  if (asprintf(&req,
+          "GET %s HTTP/1.1\r\nHost: %s:%s\r\nUser-Agent: ctorm-bench\r\n\r\n",
+          opts.path,
+          opts.host,
+          opts.port) < 0) {
+    bench_fail("failed to create the request");
+    goto end;
+  }
+
+  threads = calloc(opts.threads, sizeof(*threads));
+  hist    = calloc(1, sizeof(*hist));
+
+  if (NULL == threads || NULL == hist) {
+    bench_fail("failed to allocate memory");
+    goto end;
+  }
+
+  start = bench_now();
+
+  for (uint32_t i = 0; i < opts.threads; i++) {
+    t = &threads[i];
+
+    t->opts       = &opts;
+    t->addr       = addr;
+    t->req        = req;
+    t->req_len    = strlen(req);
+    t->conn_count = opts.conns / opts.threads + (i < opts.conns % opts.threads);
+    t->start      = start;
+    t->measure    = start + opts.warmup * NS_PER_SEC;
+    t->end        = t->measure + opts.duration * NS_PER_SEC;
+
+    if (opts.rate > 0) {
+      t->interval = NS_PER_SEC * opts.threads / opts.rate;
+      t->interval = t->interval == 0 ? 1 : t->interval;
+      t->pending  = calloc(BENCH_PENDING_MAX, sizeof(*t->pending));
+    }
+
+    t->conns = calloc(t->conn_count, sizeof(*t->conns));
+
+    if (NULL == t->conns || (opts.rate > 0 && NULL == t->pending)) {
+      bench_fail("failed to allocate memory");
+      goto end;
+    }
+
+    for (uint32_t c = 0; c < t->conn_count; c++)
+      t->conns[c].fd = -1;
+  }
+
+  for (; started < opts.threads; started++) {
+    if (pthread_create(&threads[started].thread,
+            NULL,
+            bench_thread,
+            &threads[started]) != 0) {
+      bench_fail("failed to create thread: %s", strerror(errno));
+      goto join;
+    }
+  }
+
+  ret = EXIT_SUCCESS;
+
+join:
+  for (uint32_t i = 0; i < started; i++) {
+    t = &threads[i];
+    pthread_join(t->thread, NULL);
+
+    if (t->failed)
+      ret = EXIT_FAILURE;
+
+    bench_hist_merge(hist, &t->hist);
+    requests += t->requests;
+    errors += t->errors;
+    non_2xx += t->non_2xx;
+    bytes += t->bytes;
+    dropped += t->dropped;
+  }
+
+  if (ret != EXIT_SUCCESS)
+    goto end;
+
+  secs = opts.duration;
+
+  printf("{\"host\":\"%s\",\"port\":\"%s\",\"path\":\"%s\",\"mode\":\"%s\","
+         "\"connections\":%u,\"threads\":%u,\"pipeline\":%u,\"rate\":%.0f,"
+         "\"duration_s\":%u,\"requests\":%llu,\"errors\":%llu,"
+         "\"non_2xx\":%llu,\"dropped\":%llu,\"throughput_rps\":%.2f,"
+         "\"transfer_bps\":%.2f,\"latency_us\":{\"mean\":%.2f,\"p50\":%.2f,"
+         "\"p90\":%.2f,\"p99\":%.2f,\"p99.9\":%.2f,\"max\":%.2f}}\n",
+      opts.host,
+      opts.port,
+      opts.path,
+      opts.rate > 0 ? "open" : "closed",
+      opts.conns,
+      opts.threads,
+      opts.pipeline,
+      opts.rate,
+      opts.duration,
+      (unsigned long long)requests,
+      (unsigned long long)errors,
+      (unsigned long long)non_2xx,
+      (unsigned long long)dropped,
+      requests / secs,
+      bytes / secs,
+      hist->total == 0 ? 0 : hist->sum / (double)hist->total / 1000.0,
+      bench_hist_percentile(hist, 50) / 1000.0,
+      bench_hist_percentile(hist, 90) / 1000.0,
+      bench_hist_percentile(hist, 99) / 1000.0,
+      bench_hist_percentile(hist, 99.9) / 1000.0,
+      hist->max / 1000.0);
+
+end:
+  if (NULL != threads) {
+    for (uint32_t i = 0; i < opts.threads; i++) {
+      free(threads[i].conns);
+      free(threads[i].pending);
+    }
+  }
+
+  freeaddrinfo(addr);
+  free(threads);
+  free(hist);
+  free(req);
+
+  return ret;
+}
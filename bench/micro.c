@@ -0,0 +1,476 @@
+/*
+
+ * ctorm | Simple web framework for C
+ * Written by ngn (https://ngn.tf) (2025)
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+ * microbenchmarks for the hot paths of the library, used by "make micro"
+
+ * every benchmark feeds an in-memory corpus to a single library function, and
+ * reports the average time, CPU cycles (TSC) and heap allocations per call,
+ * functions that need a socket are given a socketpair() backed connection,
+ * and the accept path is measured with the connections to a loopback listener
+
+ * this uses the internal headers, so it should be linked against the same
+ * build of libctorm
+
+*/
+
+#define _GNU_SOURCE
+
+#include "encoding.h"
+#include "headers.h"
+#include "http.h"
+#include "conn.h"
+#include "uri.h"
+#include "app.h"
+#include "req.h"
+#include "socket.h"
+
+#include <x86intrin.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#define MICRO_TARGET_NS (300 * 1000 * 1000ULL) // run every benchmark ~300ms
+#define MICRO_BATCH_MAX (32)                   // max requests in the socket
+
+#define micro_size(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+// internal function from app.c
+bool _ctorm_app_route_matches(struct ctorm_route *route, ctorm_req_t *req);
+
+// internal functions from socket.c
+bool _ctorm_socket_set_listen_opts(ctorm_app_t *app, int ssock, int family);
+int  _ctorm_socket_accept(struct ctorm_uring **ring, int ssock,
+     struct sockaddr *addr, socklen_t *len, int flags);
+
+/*
+
+ * allocation counter, malloc() and friends are interposed so the allocations
+ * done by libctorm (and by libc on it's behalf, such as strdup()) are counted
+
+*/
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+uint64_t micro_allocs = 0;
+
+void *malloc(size_t size) {
+  micro_allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  micro_allocs++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  micro_allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+#else
+
+uint64_t micro_allocs = 0; // not supported, always reported as 0
+
+#endif
+
+// benchmark function, should run the benchmarked operation "count" times
+typedef void (*micro_func_t)(uint64_t count);
+
+// realistic HTTP requests
+char *micro_requests[] = {
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    "GET /users/42/posts?page=2&sort=desc HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 "
+    "Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=3f2a9c8e7b6d5a4f; theme=dark\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Priority: u=0, i\r\n"
+    "\r\n",
+
+    "POST /api/v1/items HTTP/1.1\r\n"
+    "Host: api.example.com\r\n"
+    "Content-Type: application/json\r\n"
+    "Authorization: Bearer "
+    "eyJhbGciOiJIUzI1NiJ9.eyJzdWIiOiIxMjM0In0.c2lnbmF0\r\n"
+    "Content-Length: 26\r\n"
+    "\r\n"
+    "{\"name\":\"test\",\"count\":42}",
+};
+
+// route table, and the request paths matched against it
+char *micro_routes[] = {
+    "/",
+    "/login",
+    "/logout",
+    "/users",
+    "/users/:id",
+    "/users/:id/posts",
+    "/users/:id/posts/:post",
+    "/api/v1/items",
+    "/api/v1/items/:id",
+    "/api/v1/items/:id/tags",
+    "/api/v2/search",
+    "/blog/:slug",
+    "/blog/:lang/desc",
+    "/static/%",
+    "/admin/%/settings",
+    "/health",
+};
+
+char *micro_paths[] = {
+    "/",
+    "/users/42/posts",
+    "/api/v1/items/1337/tags",
+    "/static/style.css",
+    "/not/found/at/all",
+    "/health",
+};
+
+// query strings
+char *micro_queries[] = {
+    "page=2&sort=desc",
+    "q=hello+world&lang=en&safe=1&limit=50&offset=100",
+    "utm_source=newsletter&utm_medium=email&utm_campaign=spring%20sale&ref="
+    "https%3A%2F%2Fexample.com%2Fa%2Fb%3Fc%3Dd",
+    "name=%E2%9C%93%20checked&empty=&flag",
+};
+
+// request targets
+char *micro_targets[] = {
+    "/",
+    "/users/42/posts?page=2&sort=desc",
+    "/search?q=hello+world&lang=en&safe=1&limit=50&offset=100",
+    "/files/some%20directory/a%2Bb.txt",
+    "/api/v1/items/1337/tags#section",
+};
+
+// request headers, and the names that are looked up
+char *micro_headers[][2] = {
+    {"host",            "example.com"                          },
+    {"user-agent",      "Mozilla/5.0 (X11; Linux x86_64)"      },
+    {"accept",          "text/html,application/xhtml+xml"      },
+    {"accept-language", "en-US,en;q=0.5"                       },
+    {"accept-encoding", "gzip, deflate, br, zstd"              },
+    {"connection",      "keep-alive"                           },
+    {"cookie",          "session=3f2a9c8e7b6d5a4f; theme=dark"},
+    {"sec-fetch-dest",  "document"                             },
+    {"sec-fetch-mode",  "navigate"                             },
+    {"content-type",    "application/json"                     },
+};
+
+char *micro_header_names[] = {
+    "Host",
+    "content-length",
+    "Content-Type",
+    "transfer-encoding",
+    "connection",
+    "Cookie",
+};
+
+// prevents the compiler from optimizing away the results
+volatile uintptr_t micro_sink = 0;
+
+int micro_sock[2] = {-1, -1};
+
+uint64_t micro_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void micro_req_recv(uint64_t count) {
+  ctorm_conn_t conn = {.socket = micro_sock[0]};
+  ctorm_req_t  req;
+  uint64_t     i = 0, batch = 0, b = 0;
+  char        *cur = NULL;
+
+  while (i < count) {
+    batch = count - i > MICRO_BATCH_MAX ? MICRO_BATCH_MAX : count - i;
+
+    // queue a batch of requests in the socket, then parse them
+    for (b = 0; b < batch; b++) {
+      cur = micro_requests[(i + b) % micro_size(micro_requests)];
+
+      if (write(micro_sock[1], cur, strlen(cur)) < 0)
+        return;
+    }
+
+    for (b = 0; b < batch; b++, i++) {
+      ctorm_req_init(&req, &conn);
+      micro_sink += ctorm_req_recv(&req);
+      ctorm_req_free(&req);
+    }
+  }
+}
+
+struct ctorm_route micro_route_table[micro_size(micro_routes)];
+
+void micro_route_matches(uint64_t count) {
+  ctorm_conn_t conn = {.socket = -1};
+  ctorm_req_t  req;
+
+  for (uint64_t i = 0; i < count; i++) {
+    ctorm_req_init(&req, &conn);
+    req.method = CTORM_HTTP_GET;
+    req.path   = micro_paths[i % micro_size(micro_paths)];
+
+    // match the path against the entire route table, like ctorm_app_route()
+    for (uint32_t r = 0; r < micro_size(micro_route_table); r++) {
+      micro_sink += _ctorm_app_route_matches(&micro_route_table[r], &req);
+
+      ctorm_pair_next(req.params, param) {
+        free(param->key);
+        free(param->value);
+      }
+
+      ctorm_pair_free(req.params);
+      req.params = NULL;
+    }
+  }
+}
+
+ctorm_headers_t micro_header_table;
+
+void micro_headers_get(uint64_t count) {
+  for (uint64_t i = 0; i < count; i++)
+    micro_sink += (uintptr_t)ctorm_headers_get(micro_header_table,
+        micro_header_names[i % micro_size(micro_header_names)]);
+}
+
+void micro_query_parse(uint64_t count) {
+  ctorm_query_t *query = NULL;
+
+  for (uint64_t i = 0; i < count; i++) {
+    query = ctorm_query_parse(micro_queries[i % micro_size(micro_queries)], 0);
+    micro_sink += (uintptr_t)ctorm_query_get(query, "lang");
+    ctorm_query_free(query);
+  }
+}
+
+void micro_percent_decode(uint64_t count) {
+  char   buf[256];
+  char  *cur = NULL;
+  size_t len = 0;
+
+  for (uint64_t i = 0; i < count; i++) {
+    cur = micro_queries[i % micro_size(micro_queries)];
+    len = strlen(cur);
+
+    memcpy(buf, cur, len + 1);
+    micro_sink += ctorm_percent_decode(buf, len);
+  }
+}
+
+void micro_uri_parse_path(uint64_t count) {
+  ctorm_uri_t uri;
+
+  for (uint64_t i = 0; i < count; i++) {
+    ctorm_uri_init(&uri);
+    micro_sink += (uintptr_t)ctorm_uri_parse_path(
+        &uri, micro_targets[i % micro_size(micro_targets)]);
+    ctorm_uri_free(&uri);
+  }
+}
+
+ctorm_config_t     micro_config;
+ctorm_app_t        micro_app = {.config = &micro_config};
+struct sockaddr_in micro_listen_addr;
+int                micro_listener = -1;
+
+void micro_socket_accept(uint64_t count) {
+  struct ctorm_uring     *ring = NULL;
+  struct sockaddr_storage addr;
+  socklen_t               len = 0;
+  struct linger           rst = {.l_onoff = 1, .l_linger = 0};
+  int                     clients[MICRO_BATCH_MAX], sock = -1;
+  uint64_t                i = 0, batch = 0, b = 0;
+
+  while (i < count) {
+    batch = count - i > MICRO_BATCH_MAX ? MICRO_BATCH_MAX : count - i;
+
+    // queue a batch of connections in the listen backlog, then accept them
+    for (b = 0; b < batch; b++) {
+      clients[b] = socket(AF_INET, SOCK_STREAM, 0);
+
+      if (connect(clients[b], (struct sockaddr *)&micro_listen_addr,
+              sizeof(micro_listen_addr)) < 0)
+        return;
+
+      // reset the connection on close, so no TIME_WAIT sockets are left
+      setsockopt(clients[b], SOL_SOCKET, SO_LINGER, &rst, sizeof(rst));
+    }
+
+    for (b = 0; b < batch; b++, i++) {
+      len  = sizeof(addr);
+      sock = _ctorm_socket_accept(
+          &ring, micro_listener, (struct sockaddr *)&addr, &len, SOCK_CLOEXEC);
+
+      micro_sink += ctorm_socket_set_opts(&micro_app, sock, addr.ss_family);
+
+      close(clients[b]);
+      close(sock);
+    }
+  }
+}
+
+struct micro_bench {
+  const char  *name;
+  micro_func_t func;
+} micro_benches[] = {
+    {"req_recv",       micro_req_recv      },
+    {"route_matches",  micro_route_matches },
+    {"headers_get",    micro_headers_get   },
+    {"query_parse",    micro_query_parse   },
+    {"percent_decode", micro_percent_decode},
+    {"uri_parse_path", micro_uri_parse_path},
+    {"socket_accept",  micro_socket_accept },
+};
+
+void micro_run(struct micro_bench *bench) {
+  uint64_t count = 1, start = 0, elapsed = 0, cycles = 0, allocs = 0;
+
+  // find an iteration count that takes long enough to measure
+  for (;; count *= 2) {
+    start = micro_now();
+    bench->func(count);
+
+    if ((elapsed = micro_now() - start) >= MICRO_TARGET_NS / 20)
+      break;
+  }
+
+  count = count * MICRO_TARGET_NS / (elapsed == 0 ? 1 : elapsed);
+  count = count == 0 ? 1 : count;
+
+  // actual measurement
+  allocs = micro_allocs;
+  cycles = __rdtsc();
+  start  = micro_now();
+
+  bench->func(count);
+
+  elapsed = micro_now() - start;
+  cycles  = __rdtsc() - cycles;
+  allocs  = micro_allocs - allocs;
+
+  printf("%-16s %12llu %12.2f %12.2f %12.2f\n",
+      bench->name,
+      (unsigned long long)count,
+      elapsed / (double)count,
+      cycles / (double)count,
+      allocs / (double)count);
+}
+
+bool micro_setup(void) {
+  socklen_t len = sizeof(micro_listen_addr);
+
+  ctorm_http_load();
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, micro_sock) < 0) {
+    fprintf(stderr, "failed to create the socket pair: %s\n", strerror(errno));
+    return false;
+  }
+
+  for (uint32_t i = 0; i < micro_size(micro_routes); i++) {
+    micro_route_table[i].path   = micro_routes[i];
+    micro_route_table[i].method = CTORM_HTTP_GET;
+  }
+
+  // loopback listener with the default options, on a random port
+  ctorm_config_new(&micro_config);
+
+  micro_listen_addr.sin_family      = AF_INET;
+  micro_listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((micro_listener = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      !_ctorm_socket_set_listen_opts(&micro_app, micro_listener, AF_INET) ||
+      bind(micro_listener, (struct sockaddr *)&micro_listen_addr, len) < 0 ||
+      listen(micro_listener, MICRO_BATCH_MAX) < 0 ||
+      getsockname(
+          micro_listener, (struct sockaddr *)&micro_listen_addr, &len) < 0) {
+    fprintf(stderr, "failed to create the listener: %s\n", strerror(errno));
+    return false;
+  }
+
+  ctorm_headers_init(micro_header_table);
+
+  for (uint32_t i = 0; i < micro_size(micro_headers); i++)
+    ctorm_headers_set(
+        micro_header_table, micro_headers[i][0], micro_headers[i][1], false);
+
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (!micro_setup())
+    return EXIT_FAILURE;
+
+  printf("%-16s %12s %12s %12s %12s\n",
+      "benchmark",
+      "iterations",
+      "ns/op",
+      "cycles/op",
+      "allocs/op");
+
+  // run all the benchmarks, or only the ones specified as arguments
+  for (uint32_t i = 0; i < micro_size(micro_benches); i++) {
+    bool run = argc <= 1;
+
+    for (int a = 1; a < argc && !run; a++)
+      run = strcmp(argv[a], micro_benches[i].name) == 0;
+
+    if (run)
+      micro_run(&micro_benches[i]);
+  }
+
+  ctorm_headers_free(micro_header_table);
+  close(micro_sock[0]);
+  close(micro_sock[1]);
+  close(micro_listener);
+
+  return EXIT_SUCCESS;
+}
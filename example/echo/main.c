@@ -33,22 +33,63 @@ void POST_form(ctorm_req_t *req, ctorm_res_t *res) {
   RES_SET("cool", "yes");
 }
 
+void POST_upload(ctorm_req_t *req, ctorm_res_t *res) {
+  ctorm_part_t *part  = NULL;
+  uint32_t      count = 0;
+
+  if ((part = REQ_MULTIPART()) == NULL) {
+    RES_CODE(400);
+    RES_BODY("bad body");
+
+    ctorm_fail("failed to parse the multipart body: %s", ctorm_error());
+    return;
+  }
+
+  for (; NULL != part; part = part->next)
+    count++;
+
+  RES_FMT("parts: %u", count);
+}
+
+uint32_t visits = 0;
+
+void GET_visits(ctorm_req_t *req, ctorm_res_t *res) {
+  // responses that set a cookie are not cached
+  if (NULL != REQ_QUERY("cookie"))
+    RES_SET("set-cookie", "visited=1");
+
+  RES_FMT("visits: %u", ++visits);
+}
+
 void GET_index(ctorm_req_t *req, ctorm_res_t *res) {
   if (!RES_FILE("./example/echo/html/index.html"))
     ctorm_fail("failed to send index.html: %s", ctorm_error());
 }
 
-int main() {
+int main(int argc, char *argv[]) {
   // create the app configuration
   ctorm_config_t config;
   ctorm_config_new(&config);
 
+  // connections can also be handled on coroutines
+  config.coroutines = argc > 1 && strcmp(argv[1], "--coroutines") == 0;
+
   // create the app
   ctorm_app_t *app = ctorm_app_new(&config);
 
   // setup the routes
   GET(app, "/", GET_index);
   POST(app, "/post", POST_form);
+  POST(app, "/upload", POST_upload);
+  GET(app, "/visits", GET_visits);
+
+  // setup the response cache
+  ctorm_cache_opts_t opts = {
+      .ttl     = 10 * 1000,
+      .queries = (char *[]){"cookie", NULL},
+  };
+
+  ctorm_app_cache(app, "/visits", &opts);
 
   // setup the static route
   ctorm_app_static(app, "/static", "./example/echo/static");
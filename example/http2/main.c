@@ -0,0 +1,60 @@
+#include <ctorm.h>
+#include <string.h>
+
+// larger than the default flow control window (65535)
+#define LARGE_SIZE (256 * 1024)
+
+char large[LARGE_SIZE];
+
+void GET_index(ctorm_req_t *req, ctorm_res_t *res) {
+  RES_BODY("hello world!");
+}
+
+void GET_large(ctorm_req_t *req, ctorm_res_t *res) {
+  ctorm_res_body(res, large, sizeof(large));
+}
+
+void GET_header(ctorm_req_t *req, ctorm_res_t *res) {
+  char *value = REQ_GET("x-long");
+  RES_FMT("length: %zu", NULL == value ? 0 : strlen(value));
+}
+
+void POST_size(ctorm_req_t *req, ctorm_res_t *res) {
+  char    *chunk = NULL;
+  uint64_t total = 0;
+  int64_t  size  = 0;
+
+  while ((size = REQ_CHUNK(&chunk)) > 0)
+    total += size;
+
+  RES_FMT("size: %lu", total);
+}
+
+int main(int argc, char *argv[]) {
+  ctorm_config_t config;
+  ctorm_config_new(&config);
+
+  // accept HTTP/2 connections
+  config.http2 = true;
+
+  // connections can also be handled on coroutines
+  config.coroutines = argc > 1 && strcmp(argv[1], "--coroutines") == 0;
+
+  memset(large, 'a', sizeof(large));
+
+  // create the app
+  ctorm_app_t *app = ctorm_app_new(&config);
+
+  // setup the routes
+  GET(app, "/", GET_index);
+  GET(app, "/large", GET_large);
+  GET(app, "/header", GET_header);
+  POST(app, "/size", POST_size);
+
+  // run the app
+  if (!ctorm_app_run(app, "0.0.0.0:8088"))
+    ctorm_fail("failed to start the app: %s", ctorm_error());
+
+  // clean up
+  ctorm_app_free(app);
+}
@@ -56,6 +56,10 @@ void GET_user_list(ctorm_req_t *req, ctorm_res_t *res) {
   }
 }
 
+void GET_section_info(ctorm_req_t *req, ctorm_res_t *res) {
+  RES_FMT("section: %s", REQ_PARAM("section"));
+}
+
 void DELETE_user_delete(ctorm_req_t *req, ctorm_res_t *res) {
   char   *name = REQ_QUERY("name");
   user_t *cur = users, *prev = NULL;
@@ -134,10 +138,11 @@ int main() {
 
   GET(app, "/", GET_index);
 
-  ALL(app, "/user/*", user_auth);
+  USE(app, "/user", user_auth);
   DELETE(app, "/user/delete", DELETE_user_delete);
   POST(app, "/user/add", POST_user_add);
   GET(app, "/users", GET_user_list);
+  GET(app, "/:section/info", GET_section_info);
 
   if (!ctorm_app_run(app, "0.0.0.0:8084"))
     ctorm_fail("failed to start the app: %s", ctorm_error());
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 
 struct args {
   ctorm_app_t *app;
@@ -33,6 +34,30 @@ void hello_two(ctorm_req_t *req, ctorm_res_t *res) {
   RES_FMT("hello %s", name);
 }
 
+void hello_complete(ctorm_req_t *req, ctorm_res_t *res, void *data) {
+  RES_FMT("hello %s", NULL == name ? "stranger" : name);
+}
+
+void *hello_resume(void *defer) {
+  usleep(500 * 1000);
+  ctorm_defer_resume(defer, hello_complete, NULL);
+  return NULL;
+}
+
+void hello_slow(ctorm_req_t *req, ctorm_res_t *res) {
+  ctorm_defer_t *defer = RES_DEFER();
+  pthread_t      thread;
+
+  if (NULL == defer) {
+    ctorm_fail("failed to defer the response: %s", ctorm_error());
+    RES_CODE(500);
+    return;
+  }
+
+  pthread_create(&thread, NULL, hello_resume, defer);
+  pthread_detach(thread);
+}
+
 void *run(void *_args) {
   struct args *args = (void *)_args;
   ctorm_info("starting app %p on %s", args->app, args->addr);
@@ -43,14 +68,25 @@ void *run(void *_args) {
   return NULL;
 }
 
-int main() {
-  pthread_t thread;
+int main(int argc, char *argv[]) {
+  ctorm_config_t config;
+  pthread_t      thread;
 
-  ctorm_app_t *app_one = ctorm_app_new(NULL);
-  ctorm_app_t *app_two = ctorm_app_new(NULL);
+  ctorm_config_new(&config);
+
+  // connections can also be handled on coroutines
+  config.coroutines = argc > 1 && strcmp(argv[1], "--coroutines") == 0;
+
+  ctorm_app_t *app_one = ctorm_app_new(&config);
+  ctorm_app_t *app_two = ctorm_app_new(&config);
 
   ctorm_app_add(app_one, CTORM_HTTP_GET, "/", hello_one);
   ctorm_app_add(app_two, CTORM_HTTP_GET, "/", hello_two);
+  ctorm_app_add(app_two, CTORM_HTTP_GET, "/slow", hello_slow);
+
+  // deferred responses are not cached, but the route is
+  ctorm_cache_opts_t opts = {.ttl = 1000};
+  ctorm_app_cache(app_two, "/slow", &opts);
 
   struct args args_one = {app_one, "127.0.0.1:8085"};
   struct args args_two = {app_two, "127.0.0.1:8086"};
@@ -0,0 +1,103 @@
+#include <ctorm.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STREAM_COUNT (sizeof(names) / sizeof(*names))
+
+// every stream uses a different drop policy, with a small queue
+const char      *names[] = {"oldest", "newest", "client"};
+ctorm_sse_opts_t opts[]  = {
+    {.max_queue = 64 * 1024, .drop = CTORM_SSE_DROP_OLDEST},
+    {.max_queue = 64 * 1024, .drop = CTORM_SSE_DROP_NEWEST},
+    {.max_queue = 64 * 1024, .drop = CTORM_SSE_DROP_CLIENT},
+};
+ctorm_sse_t *streams[STREAM_COUNT];
+
+ctorm_sse_t *find_stream(ctorm_req_t *req) {
+  char    *name = REQ_PARAM("stream");
+  uint32_t i    = 0;
+
+  for (i = 0; i < STREAM_COUNT; i++)
+    if (strcmp(names[i], name) == 0)
+      return streams[i];
+
+  return NULL;
+}
+
+void GET_events(ctorm_req_t *req, ctorm_res_t *res) {
+  ctorm_sse_t *stream = find_stream(req);
+
+  if (NULL == stream) {
+    RES_CODE(404);
+    return;
+  }
+
+  SSE_SUBSCRIBE(stream);
+
+  // sent as the start of the stream
+  RES_BODY("retry: 1000\n\n");
+}
+
+void GET_publish(ctorm_req_t *req, ctorm_res_t *res) {
+  ctorm_sse_t *stream = find_stream(req);
+  char        *data = REQ_QUERY("data"), *count = REQ_QUERY("count");
+  char         event[4096];
+  int          i = 0, total = 0, len = 0;
+
+  if (NULL == stream) {
+    RES_CODE(404);
+    return;
+  }
+
+  if (NULL != data)
+    ctorm_sse_publish(stream, REQ_QUERY("event"), data);
+
+  // publish numbered events, which are large enough to fill the queues
+  else if (NULL != count) {
+    for (i = 0, total = atoi(count); i < total; i++) {
+      len = snprintf(event, sizeof(event), "%d ", i);
+      memset(event + len, 'x', sizeof(event) - len - 1);
+      event[sizeof(event) - 1] = 0;
+
+      ctorm_sse_publish(stream, NULL, event);
+    }
+  }
+
+  RES_FMT("clients: %lu", ctorm_sse_count(stream));
+}
+
+int main(int argc, char *argv[]) {
+  ctorm_config_t config;
+  uint32_t       i = 0;
+
+  ctorm_config_new(&config);
+
+  // connections can also be handled on coroutines
+  config.coroutines = argc > 1 && strcmp(argv[1], "--coroutines") == 0;
+
+  // create the event streams
+  for (i = 0; i < STREAM_COUNT; i++) {
+    if (NULL == (streams[i] = ctorm_sse_new(&opts[i]))) {
+      ctorm_fail("failed to create the stream: %s", ctorm_error());
+      return 1;
+    }
+  }
+
+  // create the app
+  ctorm_app_t *app = ctorm_app_new(&config);
+
+  // setup the routes
+  GET(app, "/events/:stream", GET_events);
+  GET(app, "/publish/:stream", GET_publish);
+
+  // run the app
+  if (!ctorm_app_run(app, "0.0.0.0:8089"))
+    ctorm_fail("failed to start the app: %s", ctorm_error());
+
+  // clean up
+  ctorm_app_free(app);
+
+  for (i = 0; i < STREAM_COUNT; i++)
+    ctorm_sse_free(streams[i]);
+}
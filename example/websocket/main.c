@@ -0,0 +1,46 @@
+#include <ctorm.h>
+#include <string.h>
+
+void ws_message(ctorm_ws_t *ws, ctorm_ws_op_t op, char *data, uint64_t size) {
+  // send the message back
+  if (!ctorm_ws_send(ws, op, data, size))
+    ctorm_fail("failed to send the message: %s", ctorm_error());
+}
+
+void ws_close(ctorm_ws_t *ws, uint16_t code) {
+  ctorm_info("connection closed (%u)", code);
+}
+
+void GET_echo(ctorm_req_t *req, ctorm_res_t *res) {
+  ctorm_ws_opts_t opts = {
+      .message  = ws_message,
+      .close    = ws_close,
+      .max_size = 16 * 1024 * 1024,
+  };
+
+  if (!WS_UPGRADE(&opts)) {
+    RES_CODE(400);
+    RES_BODY("bad upgrade request");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  ctorm_config_t config;
+  ctorm_config_new(&config);
+
+  // connections can also be handled on coroutines
+  config.coroutines = argc > 1 && strcmp(argv[1], "--coroutines") == 0;
+
+  // create the app
+  ctorm_app_t *app = ctorm_app_new(&config);
+
+  // setup the WebSocket route
+  GET(app, "/echo", GET_echo);
+
+  // run the app
+  if (!ctorm_app_run(app, "0.0.0.0:8087"))
+    ctorm_fail("failed to start the app: %s", ctorm_error());
+
+  // clean up
+  ctorm_app_free(app);
+}
@@ -7,11 +7,13 @@
 #pragma once
 
 #include "config.h"
+#include "cache.h"
 
 #include "http.h"
 #include "pair.h"
 #include "pool.h"
 #include "util.h"
+#include "cpu.h"
 
 #include "req.h"
 #include "res.h"
@@ -33,33 +35,160 @@ typedef void ctorm_app_t;
 */
 typedef void (*ctorm_route_t)(ctorm_req_t *, ctorm_res_t *);
 
+// max middleware count, see the middleware field of ctorm_req_t
+#define CTORM_MIDDLEWARE_MAX (sizeof(uint64_t) * 8)
+
+/*!
+
+ * @brief Web server statistics
+
+ * Counters of the web server, you can obtain them using @ref ctorm_app_stats.
+ * In prefork mode, these are the totals of all the worker processes
+
+*/
+typedef struct {
+  uint32_t workers;     /// running worker processes, 0 if prefork is disabled
+  uint64_t restarts;    /// number of the restarted worker processes
+  uint64_t requests;    /// number of the handled requests
+  uint64_t connections; /// number of the open connections
+} ctorm_app_stats_t;
+
 #ifndef CTORM_EXPORT
 
+#include "co.h"
+
+#include <sys/types.h>
+#include <time.h>
+
+// a single handler in a compiled handler chain
+struct ctorm_handler {
+  ctorm_route_t            handler;
+  uint64_t                 bit;    // middleware bit (see ctorm_req_t)
+  struct ctorm_middleware *prefix; // checked against the request path
+};
+
+struct ctorm_middleware {
+  char    *path;  // prefix or route path, NULL for global middleware
+  uint32_t len;   // length of the path
+  bool     route; // is this a per-route middleware?
+
+  bool                all;
+  ctorm_http_method_t method;
+  ctorm_route_t       handler;
+  uint64_t            bit;
+
+  struct ctorm_middleware *next;
+};
+
 struct ctorm_route {
   char               *path;
   bool                all;
   ctorm_http_method_t method;
   ctorm_route_t       handler;
+
+  // middleware and the route handler, compiled by ctorm_app_run()
+  struct ctorm_handler *chain;
+  uint32_t              chain_len;
+  ctorm_cache_opts_t   *cache; // response cache options, NULL if not cached
+
   struct ctorm_route *next;
 };
 
+// response cache options for a route path, see ctorm_app_cache()
+struct ctorm_cache_rule {
+  char                    *path;
+  ctorm_cache_opts_t       opts;
+  struct ctorm_cache_rule *next;
+};
+
+// a single app local
+struct ctorm_local {
+  char *name;
+  void *value;
+};
+
+// read-only hash table of the app locals, built when the app is started
+struct ctorm_locals {
+  uint32_t           mask;      // table size - 1 (table size is a power of 2)
+  struct ctorm_local entries[]; // open addressing with linear probing
+};
+
+struct ctorm_locals *ctorm_locals_new(ctorm_pair_t *list);
+void                *ctorm_locals_get(struct ctorm_locals *locals, char *name);
+
+#define CTORM_LISTEN_MAX (16) // max listening address count of an app
+
+// listening socket of the app, see ctorm_app_listen()
+struct ctorm_listener {
+  char *addr; // address to listen on
+  int   sock; // listening socket, -1 if it's not created
+};
+
+// counters of a single worker process, each on it's own cache line
+struct ctorm_stats_slot {
+  pid_t    pid;         // worker process, 0 if it's not running
+  time_t   start;       // start time of the worker process
+  uint64_t requests;    // handled requests
+  uint64_t connections; // open connections
+} __attribute__((aligned(64)));
+
+// shared memory that contains the counters of all the workers
+struct ctorm_stats {
+  uint64_t                size;     // size of the mapping
+  uint64_t                restarts; // restarted worker processes
+  struct ctorm_stats_slot slots[];  // one for each worker (or just one)
+};
+
+// updates a counter of the current worker
+#define ctorm_stats_add(app, counter, n)                                       \
+  __atomic_add_fetch(                                                          \
+      &(app)->stats->slots[(app)->worker].counter, n, __ATOMIC_RELAXED)
+
 typedef struct ctorm_app {
   bool running; // is the app running?
   int  error;   // last error the app encountered
 
-  pthread_t       thread;    // thread the app is running in
-  pthread_mutex_t req_mutex; // locked before processing a request
-  pthread_mutex_t mod_mutex; // locked before modifying the app
+  pthread_t        thread;    // thread the app is running in
+  ctorm_co_mutex_t req_mutex; // locked before processing a request
+  pthread_mutex_t  mod_mutex; // locked before modifying the app
+
+  // open connections, see ctorm_socket_drain()
+  pthread_mutex_t           conn_mutex;  // locked while accessing the lists
+  pthread_cond_t            conn_cond;   // signaled when a connection is closed
+  struct ctorm_socket_data *conns;       // list of the open connections
+  struct ctorm_socket_data *spare;       // closed connections, for reuse
+  uint32_t                  spare_count; // closed connection count
+  uint32_t                  conn_count;  // open connection count
+  bool                      draining; // waiting for the connections to close?
 
   // routes
-  ctorm_route_t       default_route;
-  struct ctorm_route *routes;
+  ctorm_route_t            default_route;
+  struct ctorm_route      *routes;
+  struct ctorm_middleware *middleware;
+  uint32_t                 middleware_count;
+
+  struct ctorm_cache_rule *cache_rules; // response cache rules
+  ctorm_cache_t           *cache;       // response cache, shared by the routes
 
   cu_str_t static_path; // static route path
   cu_str_t static_dir;  // static route directory
 
-  ctorm_pair_t *locals; // local vars (passed to every request)
-  ctorm_pool_t *pool;   // web server thread pool
+  ctorm_pair_t         *locals;      // local vars (passed to every request)
+  struct ctorm_locals  *local_table; // hashed locals, see ctorm_app_run()
+  ctorm_pool_t         *pool;        // web server thread pool
+  struct ctorm_ws_loop *ws_loop;     // WebSocket event loop
+  struct ctorm_logger  *logger;      // request logger
+
+  ctorm_cpus_t          *cpus;     // CPUs to run the threads on
+  struct ctorm_co_loop **co_loops; // coroutine loops (one for each CPU core)
+  uint32_t               co_count; // coroutine loop count
+  uint32_t               co_next;  // loop for the next connection
+
+  struct ctorm_stats *stats;  // counters, shared with the worker processes
+  uint32_t            worker; // index of the current worker process
+
+  struct ctorm_listener listeners[CTORM_LISTEN_MAX]; // listening addresses
+  uint32_t              listener_count;              // listening address count
 
   ctorm_config_t *config;            // web server configuration
   bool            is_default_config; // using the default configuration?
@@ -67,6 +196,8 @@ typedef struct ctorm_app {
   struct ctorm_app *next;
 } ctorm_app_t;
 
+bool ctorm_app_setup(ctorm_app_t *app); // creates the threads of the app
+
 void ctorm_app_route(ctorm_app_t *app, ctorm_req_t *req, ctorm_res_t *res);
 
 #endif
@@ -84,11 +215,28 @@ void ctorm_app_route(ctorm_app_t *app, ctorm_req_t *req, ctorm_res_t *res);
 */
 ctorm_app_t *ctorm_app_new(ctorm_config_t *config);
 
+/*!
+
+ * Add an address for the provided web server to listen on. The address is
+ * either a "host:port" TCP address, a "unix:/path" Unix socket path, or an
+ * abstract Unix socket name in the "unix:@name" format. All the connections
+ * are handled by the same threads (or worker processes) of the app, so you
+ * should add all the addresses before calling @ref ctorm_app_run
+
+ * @param[in] app:  ctorm server application
+ * @param[in] addr: Address that the web server should listen on
+ * @return          Returns false if an error occurs, you can obtain the error
+ *                  from the errno
+
+*/
+bool ctorm_app_listen(ctorm_app_t *app, const char *addr);
+
 /*!
 
  * Start the provided web server on the provided host address. Please note that
  * this will hang the current thread until the server is stopped by @ref
- * ctorm_app_stop
+ * ctorm_app_stop. The address is added with @ref ctorm_app_listen, so it can
+ * also be a Unix socket, and it can be NULL if you already added the addresses
 
  * @param[in] app:  ctorm server application
  * @param[in] addr: Host address that the web server should start on
@@ -113,8 +261,38 @@ bool ctorm_app_stop(ctorm_app_t *app);
 
 /*!
 
- * Get or a set local variable. These locals will be copied to every single
- * request, making them accessible from every route.
+ * Get the current thread count of the app's thread pool. If the pool_max option
+ * is larger than the pool_size, the pool is elastic, and this count changes
+ * between these options depending on the load, so it can be used for
+ * monitoring the pool
+
+ * @param[in] app: ctorm server application
+ * @return    Returns the thread count of the pool
+
+*/
+uint32_t ctorm_app_threads(ctorm_app_t *app);
+
+/*!
+
+ * Get the statistics of the provided web server. In prefork mode, the counters
+ * of the worker processes are stored in the shared memory, so this function
+ * returns the totals of all the workers, it can be called from both the parent
+ * process and the workers (for example in a route handler)
+
+ * @param[in]  app:   ctorm server application
+ * @param[out] stats: Web server statistics
+ * @return     Returns false if an error occurs, you can obtain the error from
+ *             the errno
+
+*/
+bool ctorm_app_stats(ctorm_app_t *app, ctorm_app_stats_t *stats);
+
+/*!
+
+ * Set a local variable. These locals are shared with every single request,
+ * making them accessible from every route. Locals should be set before
+ * calling @ref ctorm_app_run, setting a local while the app is running fails
+ * with @ref CTORM_ERR_APP_RUNNING
 
  * @param[in] app:   ctorm server application
  * @param[in] name:  Local name
@@ -141,6 +319,62 @@ bool ctorm_app_local(ctorm_app_t *app, char *name, void *value);
 bool ctorm_app_add(
     ctorm_app_t *app, int method, char *path, ctorm_route_t handler);
 
+/*!
+
+ * Add a middleware to the web server. Middleware are called before the route
+ * handlers, in the order they are added. If no prefix is provided (or if the
+ * prefix is "/"), middleware is global and it will be called for all the
+ * requests. Otherwise it will be called for the routes that are added under
+ * the prefix (for example "/api" prefix is used for "/api" and "/api/:id"
+ * routes), and for the unhandled requests under the prefix. A middleware can
+ * cancel the request with @ref ctorm_req_t::cancel to stop the processing
+
+ * @param[in] app:     ctorm server application
+ * @param[in] prefix:  Path prefix for the middleware, can be NULL
+ * @param[in] handler: Middleware handler function
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_app_use(ctorm_app_t *app, char *prefix, ctorm_route_t handler);
+
+/*!
+
+ * Add a middleware for a specific route. Route middleware are called after the
+ * global and the prefix middleware, only for the routes that are added with the
+ * same path and the same method
+
+ * @param[in] app:     ctorm server application
+ * @param[in] method:  HTTP method of the route, -1 for all the methods
+ * @param[in] path:    Path of the route
+ * @param[in] handler: Middleware handler function
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_app_use_route(
+    ctorm_app_t *app, int method, char *path, ctorm_route_t handler);
+
+/*!
+
+ * Enable the response cache for the GET routes with the provided path. After
+ * a response is created by the route handler, same response is sent to all the
+ * requests with the same cache key, until the TTL of the response expires. The
+ * cache key is created from the request path, and the queries and the headers
+ * specified in the options. Only the successful (200) responses are cached, and
+ * when multiple requests miss the cache at the same time, only one of them
+ * calls the route handler while the others wait for its response. Middleware
+ * are still called for all the requests
+
+ * @param[in] app:  ctorm server application
+ * @param[in] path: Path of the route
+ * @param[in] opts: Response cache options
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_app_cache(ctorm_app_t *app, char *path, ctorm_cache_opts_t *opts);
+
 /*!
 
  * Set the default route handler for all the unhandled routes
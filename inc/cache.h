@@ -0,0 +1,78 @@
+/*!
+
+ * @file
+ * @brief Header file for the response cache options and functions
+
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*!
+
+ * @brief Response cache options
+
+ * Options for the response cache of a route, you can enable the response cache
+ * for a route using @ref ctorm_app_cache
+
+*/
+typedef struct {
+  uint32_t ttl;     /// time-to-live of the cached responses (in milliseconds)
+  char   **queries; /// NULL terminated list of queries that are used in the key
+  char   **headers; /// NULL terminated list of headers that are used in the key
+} ctorm_cache_opts_t;
+
+#ifndef CTORM_EXPORT
+
+#include "req.h"
+#include "res.h"
+
+#include <pthread.h>
+
+#define CTORM_CACHE_BUCKETS    64 // hash table size of a single shard
+#define CTORM_CACHE_SHARDS_MAX 64 // max shard count
+
+struct ctorm_cache_entry {
+  uint64_t hash;    // hash of the key
+  char    *key;     // cache key, see ctorm_cache_key()
+  uint16_t code;    // status code of the response
+  char    *data;    // serialized stable headers, followed by the body
+  uint32_t size;    // size of the serialized headers and the body
+  uint32_t ttl;     // time-to-live (in milliseconds)
+  uint64_t expires; // expiration time (monotonic, in milliseconds)
+  uint32_t refs;    // reference count, entry is freed when it reaches 0
+  bool     ready;   // is the response stored? (false while it's being created)
+  bool     linked;  // is the entry in the hash table?
+
+  struct ctorm_co *waiting; // coroutines that wait for the pending entry
+
+  struct ctorm_cache_shard *shard; // shard that contains the entry
+  struct ctorm_cache_entry *next;  // next entry in the same bucket
+};
+
+struct ctorm_cache_shard {
+  pthread_mutex_t mutex;  // locked while accessing the shard
+  pthread_cond_t  cond;   // signaled when a pending entry is stored or removed
+  uint64_t        used;   // total size of the responses in the shard
+  uint64_t        budget; // max total size of the responses in the shard
+
+  struct ctorm_cache_entry *buckets[CTORM_CACHE_BUCKETS];
+};
+
+typedef struct ctorm_cache {
+  uint32_t                 count;    // shard count
+  struct ctorm_cache_shard shards[]; // shards, selected by the hash of the key
+} ctorm_cache_t;
+
+ctorm_cache_t *ctorm_cache_new(uint64_t size);
+void           ctorm_cache_free(ctorm_cache_t *cache);
+
+char *ctorm_cache_key(ctorm_req_t *req, ctorm_cache_opts_t *opts);
+struct ctorm_cache_entry *ctorm_cache_get(
+    ctorm_cache_t *cache, char *key, uint32_t ttl, bool wait, bool *hit);
+bool ctorm_cache_put(struct ctorm_cache_entry *entry, ctorm_res_t *res);
+bool ctorm_cache_stable(char *name); // is the header stored in the cache?
+void ctorm_cache_release(struct ctorm_cache_entry *entry);
+
+#endif
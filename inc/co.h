@@ -0,0 +1,96 @@
+#pragma once
+#ifndef CTORM_EXPORT
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cpu.h"
+
+#define CTORM_CO_STACK_SIZE (256 * 1024) // stack size of a coroutine
+#define CTORM_CO_STACK_POOL (64)         // max unused stacks kept by a loop
+#define CTORM_CO_EVENTS     (64)         // max events to get from epoll
+
+typedef void (*ctorm_co_func_t)(void *data);
+
+struct ctorm_co {
+  void           *sp;    // saved stack pointer
+  char           *stack; // stack mapping (starts with the guard page)
+  ctorm_co_func_t func;  // function that the coroutine runs
+  void           *data;  // data to pass to the function
+  bool            done;  // did the function return?
+
+  struct ctorm_co_loop *loop; // loop that runs the coroutine
+
+  // file descriptor the coroutine is waiting for
+  int    fd;
+  time_t deadline; // wait deadline, 0 if there is no timeout
+  bool   failed;   // did the wait time out, or the loop stop?
+
+  struct ctorm_co *prev, *next;
+};
+
+// coroutine that is not yet started
+struct ctorm_co_work {
+  ctorm_co_func_t       func;
+  void                 *data;
+  struct ctorm_co_work *next;
+};
+
+struct ctorm_co_loop {
+  int             epfd;   // epoll file descriptor
+  int             wakefd; // eventfd used to wake up the loop thread
+  pthread_t       thread; // loop thread
+  pthread_mutex_t mutex;  // locked while accessing the work queue
+  bool            stop;   // should the loop stop?
+
+  void            *sp;      // saved stack pointer of the loop thread
+  struct ctorm_co *current; // coroutine that is running
+  uint64_t         count;   // coroutine count
+  bool             closing; // is the loop waiting for the coroutines to end?
+
+  struct ctorm_co      *ready, *ready_tail; // coroutines that can run
+  struct ctorm_co      *waiting;            // coroutines that wait for I/O
+  struct ctorm_co      *stacks;             // unused coroutines (and stacks)
+  uint32_t              stack_count;        // unused coroutine count
+  struct ctorm_co_work *head, *tail;        // work queue
+  struct ctorm_co      *woken;              // woken up by the other threads
+};
+
+// mutex that parks the waiting coroutines, instead of blocking their loop
+typedef struct {
+  pthread_mutex_t  mutex;   // locked while accessing the state
+  pthread_cond_t   cond;    // signaled for the threads that wait for the lock
+  bool             locked;  // is the lock held?
+  uint32_t         threads; // count of the threads that wait for the lock
+  struct ctorm_co *head, *tail; // coroutines that wait for the lock
+} ctorm_co_mutex_t;
+
+struct ctorm_co_loop *ctorm_co_loop_new(ctorm_cpus_t *cpus, uint32_t index);
+bool ctorm_co_start(struct ctorm_co_loop *loop, ctorm_co_func_t func,
+    void *data);
+void ctorm_co_loop_stop(struct ctorm_co_loop *loop);
+void ctorm_co_loop_free(struct ctorm_co_loop *loop);
+
+bool ctorm_co_active(void);
+bool ctorm_co_wait(int fd, uint32_t events, time_t timeout);
+void ctorm_co_yield(void);
+
+/*
+
+ * parking switches to the loop until the coroutine is resumed, a coroutine
+ * should be added to a wait list before parking, so it can be resumed by an
+ * another coroutine or a thread
+
+*/
+struct ctorm_co *ctorm_co_self(void); // current coroutine, NULL if there's none
+void             ctorm_co_park(void);
+void             ctorm_co_resume(struct ctorm_co *co);
+
+bool ctorm_co_mutex_init(ctorm_co_mutex_t *mutex);
+void ctorm_co_mutex_destroy(ctorm_co_mutex_t *mutex);
+void ctorm_co_lock(ctorm_co_mutex_t *mutex);
+void ctorm_co_unlock(ctorm_co_mutex_t *mutex);
+
+#endif
@@ -3,6 +3,19 @@
 #include <stdint.h>
 #include <time.h>
 
+/*!
+
+ * @brief Request log formats
+
+ * Formats that can be used for the request logs, see the log_format option of
+ * @ref ctorm_config_t
+
+*/
+typedef enum {
+  CTORM_LOG_TEXT, /// colored, human readable text
+  CTORM_LOG_JSON, /// structured JSON object per line (JSON lines)
+} ctorm_log_format_t;
+
 /*!
 
  * @brief Web server application configuration
@@ -16,9 +29,30 @@ typedef struct {
   bool     handle_signal;   /// disables SIGINT handler (which stops app_run())
   bool     server_header;   /// disable the "Server: ctorm" header
   bool     lock_request;    /// locks threads until the request handler returns
+  bool     io_uring;        /// use io_uring for the socket I/O (if available)
+  bool     http2;           /// accept cleartext HTTP/2 (h2c) connections
+  bool     coroutines;      /// handle the connections on coroutines
+  char    *cpus;            /// CPUs to run the threads on (i.e. "0-3,8-11")
   time_t   tcp_timeout; /// TCP socket timeout for sending and receiving data
+  time_t   drain_timeout; /// max time to wait for the requests when stopping
+  char    *handoff_path;  /// Unix socket to pass the listener to a new process
   uint32_t max_connections; /// max parallel connection count
   uint32_t pool_size;       /// app threadpool size
+  uint32_t pool_max;        /// max threadpool size, pool grows when busy
+  uint32_t workers;         /// worker process count, 0 to disable prefork
+
+  uint32_t backlog;      /// listen backlog, 0 to use max_connections
+  time_t   defer_accept; /// accept when the request arrives (max wait time)
+  uint32_t fastopen;     /// TCP Fast Open queue size, 0 to disable
+  uint32_t rcvbuf_size;  /// socket receive buffer size, 0 for the default
+  uint32_t sndbuf_size;  /// socket send buffer size, 0 for the default
+
+  ctorm_log_format_t log_format; /// request log format
+  char              *log_path;   /// request log file, NULL to use stdout
+  uint32_t           log_queue;  /// per-thread request log queue size
+
+  uint64_t cache_size;    /// max response cache size (in bytes), 0 to disable
+  uint64_t max_body_size; /// max request body size (in bytes), 0 for no limit
 } ctorm_config_t;
 
 /*!
@@ -1,19 +1,36 @@
 #pragma once
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CTORM_CONN_BUF_SIZE 4096 // size of the connection receive buffer
 
 typedef struct {
-  int             socket;
-  struct sockaddr addr;
+  int                     socket;
+  struct sockaddr_storage addr; // large enough for the IPv6 addresses
+
+  char     buf[CTORM_CONN_BUF_SIZE]; // receive buffer
+  uint32_t buf_pos;                  // position of the unread data
+  uint32_t buf_len;                  // end of the unread data
+
+  struct ctorm_uring *ring;    // io_uring of the thread, NULL if not used
+  time_t              timeout; // receive timeout (in seconds)
+  bool                idle;    // is it waiting for a new request?
 } ctorm_conn_t;
 
 char *ctorm_conn_ip(ctorm_conn_t *conn, char *buf);
 
 #ifndef CTORM_EXPORT
 
-#define ctorm_conn_recv(conn, buf, len, flags)                                 \
-  recv((conn)->socket, buf, len, flags)
-#define ctorm_conn_send(conn, buf, len, flags)                                 \
-  send((conn)->socket, buf, len, flags)
+int64_t ctorm_conn_recv(ctorm_conn_t *conn, void *buf, uint64_t len, int flags);
+int64_t ctorm_conn_chunk(ctorm_conn_t *conn, char **chunk, uint64_t max);
+char   *ctorm_conn_peek(ctorm_conn_t *conn, uint32_t len);
+#define ctorm_conn_skip(conn, len) ((conn)->buf_pos += (len))
+bool ctorm_conn_sendv(ctorm_conn_t *conn, struct iovec *iov, int count);
+bool ctorm_conn_sendfile(ctorm_conn_t *conn, struct iovec *iov, int count,
+    int fd, off_t offset, uint64_t size);
 void ctorm_conn_close(ctorm_conn_t *conn);
 
 #endif
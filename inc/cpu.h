@@ -0,0 +1,25 @@
+#pragma once
+#ifndef CTORM_EXPORT
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct ctorm_cpu {
+  uint32_t id;   // CPU number
+  uint32_t node; // NUMA node of the CPU
+};
+
+// CPUs to run the app threads on, sorted by their NUMA nodes
+typedef struct ctorm_cpus {
+  uint32_t         count;
+  struct ctorm_cpu list[];
+} ctorm_cpus_t;
+
+ctorm_cpus_t *ctorm_cpus_new(char *list);
+void          ctorm_cpus_attr(ctorm_cpus_t *cpus, pthread_attr_t *attr,
+             uint32_t index, bool node);
+void          ctorm_cpus_pin(ctorm_cpus_t *cpus);
+#define ctorm_cpus_free(cpus) free(cpus)
+
+#endif
@@ -36,6 +36,8 @@
 #include "res.h"
 #include "log.h"
 #include "error.h"
+#include "sse.h"
+#include "ws.h"
 
 #define CTORM_VERSION "1.8.1" /// ctorm version number
 
@@ -129,12 +131,39 @@
 */
 #define TRACE(app, path, func) ctorm_app_add(app, CTORM_HTTP_TRACE, path, func)
 
+/*!
+
+ * Add a middleware for all the routes under the given prefix, use "/" as the
+ * prefix to add a global middleware
+
+ * @param[in] app:    Web server created with @ref ctorm_app_new
+ * @param[in] prefix: Path prefix
+ * @param[in] func:   Middleware handler function, see @ref ctorm_route_t
+
+*/
+#define USE(app, prefix, func) ctorm_app_use(app, prefix, func)
+
+/*!
+
+ * Add a middleware for all the routes with the given path, regardless of the
+ * HTTP method of the route
+
+ * @param[in] app:  Web server created with @ref ctorm_app_new
+ * @param[in] path: Route path
+ * @param[in] func: Middleware handler function, see @ref ctorm_route_t
+
+*/
+#define USE_ROUTE(app, path, func) ctorm_app_use_route(app, -1, path, func)
+
 //! Macro for @ref ctorm_req_method
 #define REQ_METHOD() ctorm_req_method(req)
 
 //! Macro for @ref ctorm_req_body
 #define REQ_BODY(buffer, size) ctorm_req_body(req, buffer, size)
 
+//! Macro for @ref ctorm_req_chunk
+#define REQ_CHUNK(chunk) ctorm_req_chunk(req, chunk)
+
 //! Macro for @ref ctorm_req_get
 #define REQ_GET(header) ctorm_req_get(req, header)
 
@@ -153,6 +182,12 @@
 //! Macro for @ref ctorm_req_json
 #define REQ_JSON() ctorm_req_json(req)
 
+//! Macro for @ref ctorm_req_multipart
+#define REQ_MULTIPART() ctorm_req_multipart(req)
+
+//! Macro for @ref ctorm_req_part
+#define REQ_PART(name) ctorm_req_part(req, name)
+
 //! Macro for @ref ctorm_req_ip
 #define REQ_IP(buf) ctorm_req_ip(req, buf)
 
@@ -202,3 +237,12 @@
 
 //! Macro for @ref ctorm_res_redirect
 #define RES_REDIRECT(uri) ctorm_res_redirect(res, uri)
+
+//! Macro for @ref ctorm_res_defer
+#define RES_DEFER() ctorm_res_defer(res)
+
+//! Macro for @ref ctorm_ws_upgrade
+#define WS_UPGRADE(opts) ctorm_ws_upgrade(req, res, opts)
+
+//! Macro for @ref ctorm_sse_subscribe
+#define SSE_SUBSCRIBE(sse) ctorm_sse_subscribe(sse, req, res)
@@ -1,7 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
-#include "pair.h"
 
 #if __has_include(<cjson/cJSON.h>)
 #include <cjson/cJSON.h>
@@ -46,14 +46,38 @@ void ctorm_json_free(cJSON *json);
 
 // URI query encoding
 
-typedef ctorm_pair_t ctorm_query_t; /// Stores URL query data
+typedef struct ctorm_query ctorm_query_t; /// Stores URL query data
+
+#ifndef CTORM_EXPORT
+
+struct ctorm_query_pair {
+  char *key;   // key name, points to the query buffer
+  char *value; // value (may be NULL), points to the query buffer
+};
+
+struct ctorm_query {
+  bool     decoded; // are the pairs percent decoded?
+  uint32_t count;   // pair count
+
+  /*
+
+   * pairs and the query data are stored in the same allocation, right after
+   * this structure, pairs point to the copy of the query data, which is split
+   * and percent decoded in place
+
+  */
+  struct ctorm_query_pair pairs[];
+};
+
+#endif
 
 /*!
 
  * Parse the URL query data from the provided data buffer. Parsed data will be
  * stored in a @ref ctorm_query_t structure, which will be returned as the
- * result. When you are done with the query data, you need to free this
- * structure with @ref ctorm_query_free
+ * result. The data buffer is copied, so it can be modified or freed after this
+ * call. When you are done with the query data, you need to free this structure
+ * with @ref ctorm_query_free
 
  * @param[in] data: Data buffer
  * @param[in] size: Size of the data buffer. If no size is specified, NULL
@@ -97,3 +121,33 @@ void ctorm_query_free(ctorm_query_t *data);
 
 */
 uint32_t ctorm_percent_decode(char *data, uint32_t size);
+
+// SHA-1 hashing
+
+/*!
+
+ * Calculate the SHA-1 digest of the provided data buffer. SHA-1 is not secure,
+ * it's only provided for the protocols that require it (such as WebSocket)
+
+ * @param[in]  data:   Data buffer
+ * @param[in]  size:   Size of the data buffer
+ * @param[out] digest: Buffer for the 20 byte digest
+
+*/
+void ctorm_sha1(const void *data, uint64_t size, uint8_t *digest);
+
+// base64 encoding
+
+/*!
+
+ * Base64 encode the provided data buffer. Encoded data is NULL terminated and
+ * written to the output buffer, which should be at least ((size + 2) / 3) * 4
+ * + 1 bytes
+
+ * @param[in]  data: Data buffer
+ * @param[in]  size: Size of the data buffer
+ * @param[out] out:  Output buffer
+ * @return     Length of the encoded data
+
+*/
+uint32_t ctorm_base64_encode(const void *data, uint32_t size, char *out);
@@ -13,8 +13,12 @@
 */
 typedef enum {
   CTORM_ERR_BAD_TCP_TIMEOUT = 9900,
+  CTORM_ERR_BAD_DRAIN_TIMEOUT,
+  CTORM_ERR_BAD_DEFER_ACCEPT,
   CTORM_ERR_BAD_POOL_SIZE,
   CTORM_ERR_BAD_MAX_CONN_COUNT,
+  CTORM_ERR_BAD_LOG_FORMAT,
+  CTORM_ERR_BAD_LOG_QUEUE_SIZE,
   CTORM_ERR_BAD_RESPONSE_CODE,
   CTORM_ERR_BAD_CONTENT_TYPE,
   CTORM_ERR_BAD_BUFFER,
@@ -26,6 +30,12 @@ typedef enum {
   CTORM_ERR_BAD_PORT,
   CTORM_ERR_BAD_PATH,
   CTORM_ERR_BAD_QUERY,
+  CTORM_ERR_BAD_CACHE_TTL,
+  CTORM_ERR_BAD_WS_UPGRADE,
+  CTORM_ERR_BAD_SSE_DROP,
+  CTORM_ERR_BAD_HPACK,
+  CTORM_ERR_BAD_CPU_LIST,
+  CTORM_ERR_BAD_MULTIPART,
 
   CTORM_ERR_BAD_APP_PTR,
   CTORM_ERR_BAD_ADDR_PTR,
@@ -41,6 +51,11 @@ typedef enum {
   CTORM_ERR_BAD_AUTHORITY_PTR,
   CTORM_ERR_BAD_HOST_PTR,
   CTORM_ERR_BAD_PATH_PTR,
+  CTORM_ERR_BAD_WS_PTR,
+  CTORM_ERR_BAD_WS_OPTS_PTR,
+  CTORM_ERR_BAD_SSE_PTR,
+  CTORM_ERR_BAD_DEFER_PTR,
+  CTORM_ERR_BAD_PART_PTR,
 
   CTORM_ERR_SCHEME_TOO_LARGE,
   CTORM_ERR_USERINFO_TOO_LARGE,
@@ -57,6 +72,7 @@ typedef enum {
   CTORM_ERR_FCNTL_FAIL,
   CTORM_ERR_ALLOC_FAIL,
   CTORM_ERR_READ_FAIL,
+  CTORM_ERR_WRITE_FAIL,
   CTORM_ERR_MUTEX_FAIL,
   CTORM_ERR_SEEK_FAIL,
   CTORM_ERR_JSON_FAIL,
@@ -64,12 +80,19 @@ typedef enum {
   CTORM_ERR_SOCKET_FAIL,
   CTORM_ERR_BIND_FAIL,
   CTORM_ERR_ACCEPT_FAIL,
+  CTORM_ERR_LOG_FAIL,
+  CTORM_ERR_FORK_FAIL,
 
   CTORM_ERR_NOT_EXISTS,
   CTORM_ERR_NO_READ_PERM,
   CTORM_ERR_NO_JSON_SUPPORT,
+  CTORM_ERR_NO_DEFER_SUPPORT,
   CTORM_ERR_EMPTY_BODY,
   CTORM_ERR_EMPTY_QUERY,
+  CTORM_ERR_APP_RUNNING,
+  CTORM_ERR_MIDDLEWARE_LIMIT,
+  CTORM_ERR_LISTENER_LIMIT,
+  CTORM_ERR_WS_CLOSED,
 
   CTORM_ERR_UNKNOWN
 } ctorm_error_t;
@@ -0,0 +1,72 @@
+#pragma once
+#ifndef CTORM_EXPORT
+
+#include "hpack.h"
+#include "conn.h"
+#include "req.h"
+#include "res.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CTORM_H2_PREFACE     "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define CTORM_H2_PREFACE_LEN (sizeof(CTORM_H2_PREFACE) - 1)
+#define CTORM_H2_FRAME_MAX   (16384)       // max frame payload size we accept
+#define CTORM_H2_BLOCK_MAX   (64 * 1024)   // max header block size
+#define CTORM_H2_STREAMS_MAX (100)         // max concurrent stream count
+#define CTORM_H2_WINDOW      (65535)       // default flow control window size
+#define CTORM_H2_BODY_MAX    (1024 * 1024) // default max request body size
+
+struct ctorm_h2_stream {
+  uint32_t    id;
+  bool        done;   // is the request completely received?
+  bool        reset;  // is the stream reset by the client?
+  bool        bad;    // is the request malformed?
+  bool        large;  // is the request body too large?
+  bool        early;  // is the request rejected before it's completed?
+  bool        method; // received the method pseudo-header?
+  uint32_t    fields; // received regular header field count
+  int64_t     window; // send window of the stream
+  int64_t     recv;   // receive window of the stream
+  ctorm_req_t req;    // request of the stream
+
+  // buffered request body
+  char    *body;
+  uint64_t body_len, body_cap;
+
+  struct ctorm_h2_stream *next;
+};
+
+struct ctorm_h2 {
+  struct ctorm_app *app;
+  ctorm_conn_t     *conn;
+  ctorm_hpack_t     hpack; // HPACK decoder context
+
+  // settings of the client
+  uint32_t max_frame;   // max frame payload size
+  uint32_t init_window; // initial window size of the streams
+
+  int64_t  window;  // send window of the connection
+  int64_t  recv;    // receive window of the connection
+  uint32_t last_id; // last stream ID used by the client
+  uint32_t count;   // open stream count
+  uint32_t error;   // connection error code
+  bool     goaway;  // is the connection closing?
+
+  struct ctorm_h2_stream *streams; // list of the streams (in the order opened)
+
+  // header block that is being received (HEADERS and CONTINUATION frames)
+  uint32_t block_id;
+  bool     block_end; // END_STREAM flag of the HEADERS frame
+  uint8_t *block;
+  uint32_t block_len, block_cap;
+
+  uint8_t frame[CTORM_H2_FRAME_MAX]; // payload of the received frame
+};
+
+bool ctorm_h2_preface(ctorm_conn_t *conn);
+bool ctorm_h2_upgrade(ctorm_req_t *req, ctorm_res_t *res);
+void ctorm_h2_handle(
+    struct ctorm_app *app, ctorm_conn_t *conn, ctorm_req_t *req);
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+#ifndef CTORM_EXPORT
+
+#include "app.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// passes the listening sockets to a new process over a Unix socket
+struct ctorm_handoff {
+  ctorm_app_t *app;    // app with the listening sockets to pass
+  char        *path;   // path of the Unix socket
+  int          sock;   // Unix socket that the new process connects to
+  pthread_t    thread; // thread that waits for the new process
+  bool         passed; // are the listening sockets passed?
+};
+
+// receives up to CTORM_LISTEN_MAX listening sockets, returns the count
+int32_t               ctorm_handoff_recv(char *path, int *fds);
+struct ctorm_handoff *ctorm_handoff_new(ctorm_app_t *app, char *path);
+void                  ctorm_handoff_free(struct ctorm_handoff *handoff);
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+#ifndef CTORM_EXPORT
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CTORM_HPACK_TABLE_SIZE 4096 // default dynamic table size (in bytes)
+#define CTORM_HPACK_STATIC     61   // static table entry count
+#define CTORM_HPACK_STRING_MAX 8192 // max size of a decoded string
+
+// dynamic table entry, name and the value are stored in the same allocation
+struct ctorm_hpack_entry {
+  char    *name, *value;
+  uint32_t name_len, value_len;
+};
+
+// HPACK decoder context (see RFC 7541)
+typedef struct {
+  struct ctorm_hpack_entry *entries; // ring of the dynamic table entries
+  uint32_t                  cap;     // capacity of the ring
+  uint32_t                  pos;     // index of the newest entry
+  uint32_t                  count;   // number of the entries
+  uint32_t                  size;    // size of the dynamic table
+  uint32_t                  max;     // max size of the dynamic table
+  uint32_t                  limit;   // max size that the peer can set
+} ctorm_hpack_t;
+
+// called for every decoded header field
+typedef bool (*ctorm_hpack_field_t)(void *data, char *name, uint32_t name_len,
+    char *value, uint32_t value_len);
+
+bool ctorm_hpack_init(ctorm_hpack_t *hpack, uint32_t limit);
+void ctorm_hpack_free(ctorm_hpack_t *hpack);
+
+bool ctorm_hpack_decode(ctorm_hpack_t *hpack, uint8_t *buf, uint32_t size,
+    ctorm_hpack_field_t field, void *data);
+uint32_t ctorm_hpack_encode(
+    uint8_t *buf, uint32_t size, char *name, char *value);
+
+#endif
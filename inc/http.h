@@ -158,6 +158,7 @@ typedef enum {
 typedef enum {
   CTORM_HTTP_1_0, /// HTTP/1.0 (RFC 1945)
   CTORM_HTTP_1_1, /// HTTP/1.1 (RFC 7230, 7231)
+  CTORM_HTTP_2,   /// HTTP/2 (RFC 9113)
 } ctorm_http_version_t;
 
 /// HTTP response code type
@@ -186,6 +187,7 @@ extern struct ctorm_http_method_desc ctorm_http_methods[];
 #define CTORM_HTTP_CONTENT_TYPE      "content-type"
 #define CTORM_HTTP_DATE              "date"
 #define CTORM_HTTP_SERVER            "server"
+#define CTORM_HTTP_EXPECT            "expect"
 
 // static values calculated at compile time
 #define CTORM_HTTP_VERSION_LEN 8   // "HTTP/x.x"
@@ -208,9 +210,15 @@ void ctorm_http_load(void);
 #define ctorm_http_code_is_error(code)                                         \
   ((code) >= 400 && CTORM_HTTP_CODE_MAX >= (code))
 
-// get version/method from the string representation of it
-bool ctorm_http_version(char *buf, ctorm_http_version_t *version);
-bool ctorm_http_method(char *buf, ctorm_http_method_t *method);
+/*
+
+ * get version/method from the start of a buffer, buffer should at least contain
+ * 8 bytes, ctorm_http_method() returns the length of the method including the
+ * space after it, or 0 if the buffer does not start with a method
+
+*/
+bool     ctorm_http_version(char *buf, ctorm_http_version_t *version);
+uint32_t ctorm_http_method(char *buf, ctorm_http_method_t *method);
 
 /*
 
@@ -1,8 +1,24 @@
 #pragma once
 
+#include "config.h"
+#include "app.h"
+
 #include "req.h"
 #include "res.h"
 
+/*!
+
+ * @brief Request logger statistics
+
+ * Counters of the asynchronous request logger, you can obtain them using @ref
+ * ctorm_log_stats
+
+*/
+typedef struct {
+  uint64_t written; /// number of request log entries written
+  uint64_t dropped; /// number of request log entries dropped due to overflow
+} ctorm_log_stats_t;
+
 #ifndef CTORM_EXPORT
 
 #define FG_RED     "\x1b[31m"
@@ -15,7 +31,7 @@
 #define FG_GRAY    "\x1b[37m"
 #define FG_RESET   "\x1b[0m"
 
-#define log(req, res, pt, ...) ctorm_log(req, res, pt)
+#define log(logger, req, res, pt) ctorm_logger_push(logger, req, res, pt)
 #define info(fmt, ...)         ctorm_info(fmt, ##__VA_ARGS__)
 #define warn(fmt, ...)         ctorm_warn(fmt, ##__VA_ARGS__)
 #define fail(fmt, ...)         ctorm_fail(fmt, ##__VA_ARGS__)
@@ -28,7 +44,59 @@
 #define debug(...) asm("nop")
 #endif
 
-int ctorm_log(ctorm_req_t *req, ctorm_res_t *res, uint64_t time);
+#define CTORM_LOG_PATH_MAX 200 // max logged path length (rest is truncated)
+
+// a single request log entry, stored in the per-thread queues
+struct ctorm_log_entry {
+  time_t   stamp;  // cached time the entry was queued at
+  uint64_t time;   // request processing time (in microseconds)
+  uint16_t code;   // HTTP response code
+  uint8_t  method; // HTTP request method
+  char     path[CTORM_LOG_PATH_MAX];
+};
+
+// lock-free single producer single consumer queue, owned by a single thread
+struct ctorm_log_ring {
+  struct ctorm_log_entry *entries;
+  uint32_t                head;    // written by the producer thread
+  uint32_t                tail;    // written by the logger thread
+  uint64_t                dropped; // entries dropped since the last flush
+  uint32_t                owners;  // see CTORM_LOG_RING_THREAD
+  struct ctorm_log_ring  *next;
+};
+
+// owners of a queue, queue is freed after both of them release it
+#define CTORM_LOG_RING_THREAD (1 << 0) // producer thread, until it exits
+#define CTORM_LOG_RING_LOGGER (1 << 1) // logger, until it drains the queue
+
+typedef struct ctorm_logger {
+  uint64_t id; // unique ID to detect stale thread local queues
+
+  int                fd;     // output file descriptor
+  ctorm_log_format_t format; // output format
+  uint32_t           size;   // per-thread queue size (power of two)
+
+  struct ctorm_log_ring *rings; // per-thread queues
+  volatile time_t        now;   // cached time, updated by the logger thread
+
+  time_t   stamp_time; // time of the cached stamp
+  char     stamp[64];  // cached, formatted time stamp
+  uint32_t stamp_len;  // length of the cached stamp
+
+  uint64_t written; // total written entries
+  uint64_t dropped; // total dropped entries
+
+  bool            active; // is the logger thread running?
+  pthread_t       thread; // logger thread
+  pthread_mutex_t mutex;  // locked before modifying the queue list
+  pthread_cond_t  cond;   // used to wake up the logger thread
+} ctorm_logger_t;
+
+ctorm_logger_t *ctorm_logger_new(ctorm_config_t *config);
+bool ctorm_logger_push(
+    ctorm_logger_t *logger, ctorm_req_t *req, ctorm_res_t *res, uint64_t time);
+void ctorm_logger_free(ctorm_logger_t *logger);
+
 int ctorm_debug(const char *fmt, ...);
 
 #endif
@@ -66,3 +134,17 @@ int ctorm_warn(const char *fmt, ...);
 
 */
 int ctorm_fail(const char *fmt, ...);
+
+/*!
+
+ * Get the request logger statistics of the provided web server. Request logs
+ * are written by a separate logger thread, if the request log queue of a thread
+ * is full, new entries are dropped instead of blocking the request
+
+ * @param[in]  app:   ctorm server application
+ * @param[out] stats: Request logger statistics
+ * @return     Returns false if an error occurs, you can obtain the error from
+ *             the errno
+
+*/
+bool ctorm_log_stats(ctorm_app_t *app, ctorm_log_stats_t *stats);
@@ -0,0 +1,60 @@
+/*!
+
+ * @file
+ * @brief Header file for the multipart/form-data parser
+
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*!
+
+ * @brief Part of a multipart/form-data body
+
+ * Small form fields are kept in the memory, files and large fields are written
+ * to unlinked temporary files while the body is received, so the memory used
+ * for an upload does not depend on the file size. A body can have at most
+ * CTORM_MULTIPART_PARTS_MAX parts, which limits the memory and the temporary
+ * files used by a single request
+
+*/
+typedef struct ctorm_part {
+  char    *name;     /// name of the form field
+  char    *filename; /// file name, NULL if the part is not a file
+  char    *type;     /// content type of the part, NULL if not specified
+  char    *value;    /// value of the part, NULL if it's in a temporary file
+  int      fd;       /// temporary file of the part, -1 if it's in the memory
+  uint64_t size;     /// size of the part value (in bytes)
+
+  struct ctorm_part *next; /// next part of the body
+} ctorm_part_t;
+
+#ifndef CTORM_EXPORT
+
+#define CTORM_MULTIPART_BUF_SIZE     (16 * 1024) // size of the parser buffer
+#define CTORM_MULTIPART_VALUE_MAX    (16 * 1024) // max in-memory value size
+#define CTORM_MULTIPART_BOUNDARY_MAX (70)        // see RFC 2046 section 5.1.1
+#define CTORM_MULTIPART_PARTS_MAX    (64)        // max part count of a body
+
+// reads the body to the buffer, returns 0 at the end of the body
+typedef int64_t (*ctorm_multipart_read_t)(void *data, char *buf, int64_t size);
+
+ctorm_part_t *ctorm_multipart_parse(
+    char *type, ctorm_multipart_read_t read, void *data);
+void ctorm_multipart_free(ctorm_part_t *parts);
+
+#endif
+
+/*!
+
+ * Save the part value to a file. If the part is in a temporary file, it's
+ * copied in the kernel with copy_file_range(), without reading it to the memory
+
+ * @param[in] part: Part of a multipart/form-data body
+ * @param[in] path: Path of the file to create
+ * @return    Returns true if the value is saved, false if not
+
+*/
+bool ctorm_part_save(ctorm_part_t *part, char *path);
@@ -15,3 +15,7 @@
 #ifndef CTORM_JSON_SUPPORT
 #define CTORM_JSON_SUPPORT 1
 #endif
+
+#ifndef CTORM_URING_SUPPORT
+#define CTORM_URING_SUPPORT 1
+#endif
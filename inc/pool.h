@@ -5,6 +5,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "cpu.h"
+
+#define CTORM_POOL_IDLE_TIMEOUT 10 // secs before an idle extra thread exits
+
 typedef void (*ctorm_pool_func_t)(void *data);
 
 struct ctorm_work {
@@ -15,23 +19,36 @@ struct ctorm_work {
   struct ctorm_work *next; // next work
 };
 
-typedef struct {
+// a worker thread slot of the pool
+struct ctorm_worker {
+  struct ctorm_pool *pool;
+  struct ctorm_work *work; // ongoing (running) work of the thread
+  bool               used; // is there a thread for this slot?
+};
+
+typedef struct ctorm_pool {
   bool     active;  // is the thread pool active
   uint32_t running; // running thread count
-  uint32_t total;   // total thread count
-  uint32_t len;     // work queue length
+  uint32_t idle;    // threads that are waiting for work
+  uint32_t min;     // min thread count, extra threads exit when idle
+  uint32_t total;   // max thread count
+  uint32_t len;     // work queue length (including the ongoing works)
+  uint32_t queued;  // works that are not yet picked up by a thread
 
   pthread_mutex_t mutex;     // locked before reading/writing from the pool
   pthread_cond_t  work_cond; // used to wait for new work
   pthread_cond_t  done_cond; // used to wait for threads to complete a work
   pthread_cond_t  exit_cond; // used to wait for threads to exit
 
-  struct ctorm_work **ongoing; // list of ongoing (running) works
-  struct ctorm_work  *head;    // head of the work queue
-  struct ctorm_work  *tail;    // tail (end) of the work queue
+  ctorm_cpus_t        *cpus;    // CPUs to pin the threads to
+  struct ctorm_worker *workers; // worker thread slots
+  struct ctorm_work   *head;    // head of the work queue
+  struct ctorm_work   *tail;    // tail (end) of the work queue
+  struct ctorm_work   *spare;   // completed works, reused for the new ones
 } ctorm_pool_t;
 
-ctorm_pool_t *ctorm_pool_new(uint32_t count);
+ctorm_pool_t *ctorm_pool_new(uint32_t min, uint32_t max, ctorm_cpus_t *cpus);
+uint32_t      ctorm_pool_size(ctorm_pool_t *pool);
 uint32_t      ctorm_pool_remaining(ctorm_pool_t *pool);
 void          ctorm_pool_wait(ctorm_pool_t *pool, uint32_t count);
 bool          ctorm_pool_add(ctorm_pool_t *pool, ctorm_pool_func_t start,
@@ -0,0 +1,18 @@
+#pragma once
+#ifndef CTORM_EXPORT
+
+#include "app.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CTORM_PREFORK_DELAY (1) // min seconds between the restarts of a worker
+
+struct ctorm_stats *ctorm_stats_new(uint32_t workers);
+void ctorm_stats_get(
+    struct ctorm_stats *stats, uint32_t workers, ctorm_app_stats_t *out);
+void ctorm_stats_free(struct ctorm_stats *stats);
+
+bool ctorm_prefork_run(ctorm_app_t *app);
+
+#endif
@@ -6,6 +6,7 @@
 */
 #pragma once
 
+#include "multipart.h"
 #include "encoding.h"
 #include "headers.h"
 
@@ -24,9 +25,12 @@
 typedef struct {
   ctorm_conn_t *conn; /// client connection
 
-  ctorm_pair_t     *locals; /// local variables to pass along with the request
-  bool              cancel; /// is the request cancelled?
-  ctorm_http_code_t code;   /// default HTTP response code for this request
+  ctorm_pair_t        *locals;     /// local variables set for this request
+  struct ctorm_locals *app_locals; /// app locals (shared, read-only)
+
+  bool              cancel;     /// is the request cancelled?
+  ctorm_http_code_t code;       /// default HTTP response code for this request
+  uint64_t          middleware; /// bitmap of the middleware that already ran
 
   ctorm_http_method_t  method;  /// HTTP method (GET, POST, PUT etc.)
   ctorm_http_version_t version; /// HTTP version number (HTTP/1.1 etc.)
@@ -35,13 +39,22 @@ typedef struct {
   char *host;   /// target host
   char *path;   /// target path (URL decoded, does not include queries)
 
-  ctorm_query_t *queries; /// HTTP queries (for example "?key=1")
+  char          *query;      /// target query (not URL decoded, not terminated)
+  uint32_t       query_size; /// size of the target query
+  ctorm_query_t *queries;    /// HTTP queries (parsed on first access)
+  int            query_err;  /// error of the failed query parse (internal)
   ctorm_pair_t  *params;  /// HTTP path parameters (for example "/blog/:slug")
 
-  ctorm_headers_t headers;   /// HTTP headers
-  int64_t         body_size; /// remaining size of HTTP request body
-  cJSON          *body_json; /// JSON decoded body
-  ctorm_query_t  *body_form; /// URL form decoded body
+  ctorm_headers_t headers;    /// HTTP headers
+  int64_t         body_size;  /// remaining size of HTTP request body
+  char           *body;       /// received body (if it's already received)
+  bool            expect;     /// is the client waiting for "100 Continue"?
+  cJSON          *body_json;  /// JSON decoded body
+  ctorm_query_t  *body_form;  /// URL form decoded body
+  ctorm_part_t   *body_parts; /// multipart/form-data body parts
+
+  struct ctorm_ws  *ws;  /// WebSocket for the upgraded connection (internal)
+  struct ctorm_sse *sse; /// event stream the client subscribed to (internal)
 } ctorm_req_t;
 
 #ifndef CTORM_EXPORT
@@ -49,6 +62,7 @@ typedef struct {
 void ctorm_req_init(ctorm_req_t *req, ctorm_conn_t *conn); // init HTTP request
 void ctorm_req_free(ctorm_req_t *req); // free a HTTP request
 bool ctorm_req_recv(ctorm_req_t *req); // receive the HTTP request
+bool ctorm_req_parse_target(ctorm_req_t *req); // parse the request target
 
 #endif
 
@@ -122,6 +136,19 @@ char *ctorm_req_get(ctorm_req_t *req, char *header);
 */
 int64_t ctorm_req_body(ctorm_req_t *req, char *buf, int64_t size);
 
+/*!
+
+ * Receive the next chunk of the request body, without copying it. Chunk points
+ * to the receive buffer of the connection, so it's only valid until the next
+ * call
+
+ * @param[in]  req: HTTP request
+ * @param[out] chunk: Pointer to the start of the chunk
+ * @return     Size of the chunk, 0 at the end of the body, -1 on failure
+
+*/
+int64_t ctorm_req_chunk(ctorm_req_t *req, char **chunk);
+
 /*!
 
  * Copy the sender's IPv4 or IPv6 address to the provided buffer as string.
@@ -143,7 +170,7 @@ int64_t ctorm_req_body(ctorm_req_t *req, char *buf, int64_t size);
  * @return    Socket address (struct sockaddr)
 
 */
-#define ctorm_req_addr(req) ((req)->conn->addr)
+#define ctorm_req_addr(req) (*(struct sockaddr *)&(req)->conn->addr)
 
 /*!
 
@@ -174,6 +201,31 @@ ctorm_query_t *ctorm_req_form(ctorm_req_t *req);
 */
 cJSON *ctorm_req_json(ctorm_req_t *req);
 
+/*!
+
+ * Parse multipart/form-data body. Body is parsed while it's received, small
+ * fields are kept in the memory and the files are written to temporary files,
+ * see @ref ctorm_part_t. Do NOT free the returned parts, this is done
+ * internally when the processing of the request is complete
+
+ * @param[in] req: HTTP request
+ * @return    List of the body parts
+
+*/
+ctorm_part_t *ctorm_req_multipart(ctorm_req_t *req);
+
+/*!
+
+ * Get a part of the multipart/form-data body by it's name. Body is parsed on
+ * the first call, see @ref ctorm_req_multipart
+
+ * @param[in] req: HTTP request
+ * @param[in] name: Form field name
+ * @return    Body part with the given name
+
+*/
+ctorm_part_t *ctorm_req_part(ctorm_req_t *req, char *name);
+
 /*!
 
  * Check if the HTTP request will persist or not. This is explained in the
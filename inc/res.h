@@ -11,6 +11,7 @@
 
 #include "conn.h"
 #include "http.h"
+#include "req.h"
 
 /*!
 
@@ -30,14 +31,71 @@ typedef struct {
   char    *body;      /// HTTP response body
   uint32_t body_size; /// HTTP response body size
   int      body_fd;   /// file descriptor associated with the body
+
+  struct ctorm_cache_entry *cache;  /// response cache entry (internal)
+  struct ctorm_defer       *defer;  /// deferred response (internal)
+  bool                      stream; /// keep the connection open (internal)
 } ctorm_res_t;
 
+#ifdef CTORM_EXPORT
+
+typedef void ctorm_defer_t;
+
+#else
+
+typedef struct ctorm_defer ctorm_defer_t;
+
+#endif
+
+/*!
+
+ * @brief Deferred response resume function
+
+ * Type for the function that completes a deferred response, it's called with
+ * the request, the response and the data passed to @ref ctorm_defer_resume
+
+*/
+typedef void (*ctorm_resume_t)(ctorm_req_t *, ctorm_res_t *, void *);
+
 #ifndef CTORM_EXPORT
 
+#include <pthread.h>
+#include <sys/time.h>
+
+struct ctorm_defer {
+  pthread_mutex_t mutex;   // locked while accessing the state
+  bool            moved;   // is the request moved to the deferred response?
+  bool            resumed; // is ctorm_defer_resume() called?
+
+  ctorm_resume_t resume; // completes the response, may be NULL
+  void          *data;   // data to pass to the resume function
+
+  struct ctorm_socket_data *socket; // connection of the request
+  struct timeval            start;  // receive time of the request
+  ctorm_req_t               req;
+  ctorm_res_t               res;
+};
+
+// moves the request and the response, called after the handler returns
+void ctorm_defer_move(struct ctorm_defer *defer,
+    struct ctorm_socket_data *socket, ctorm_req_t *req, ctorm_res_t *res,
+    struct timeval *start);
+void ctorm_defer_free(struct ctorm_defer *defer);
+
 void ctorm_res_init(ctorm_res_t *res, ctorm_conn_t *conn); // init HTTP response
 void ctorm_res_free(ctorm_res_t *res); // free a HTTP response
 bool ctorm_res_send(ctorm_res_t *res); // send the HTTP response
 
+/*
+
+ * serialize the status line and the headers, returns the required size, if
+ * cached is true, the headers that are stored in the response cache (and the
+ * end of the head) are skipped, see ctorm_cache_put()
+
+*/
+uint32_t ctorm_res_head(
+    ctorm_res_t *res, char *buf, uint32_t size, bool cached);
+
 #endif
 
 /*!
@@ -160,3 +218,40 @@ void ctorm_res_del(ctorm_res_t *res, char *name);
 
 */
 void ctorm_res_redirect(ctorm_res_t *res, char *uri);
+
+/*!
+
+ * Defer the response, so the route handler can return without completing it.
+ * The connection is not sent any response until @ref ctorm_defer_resume is
+ * called for the returned deferred response, which may be done from any
+ * thread. While the response is deferred, no thread is blocked for the
+ * request. After calling this function, the route handler should not access
+ * the request or the response, and it should not be processed by the other
+ * routes (see @ref REQ_CANCEL). Calling this function multiple times returns
+ * the same deferred response. Responses can't be deferred for HTTP/2 requests,
+ * or for the requests subscribed to an event stream
+
+ * @param[in] res: HTTP response
+ * @return    Returns the deferred response, or NULL if an error occurs, you can
+ *            obtain the error from the errno
+
+*/
+ctorm_defer_t *ctorm_res_defer(ctorm_res_t *res);
+
+/*!
+
+ * Resume a deferred response. The resume function is called with the request
+ * and the response on one of the app threads, and the response is sent after
+ * it returns. It should be called exactly once for each deferred response,
+ * and all the deferred responses should be resumed before the app is freed
+
+ * @param[in] defer:  Deferred response, see @ref ctorm_res_defer
+ * @param[in] resume: Function that completes the response, NULL to send the
+ *                    response as it is
+ * @param[in] data:   Data to pass to the resume function
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_defer_resume(
+    ctorm_defer_t *defer, ctorm_resume_t resume, void *data);
@@ -4,10 +4,21 @@
 #include "app.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/socket.h>
 #include <netdb.h>
 
-bool ctorm_socket_resolve(char *addr, struct addrinfo *info);
-bool ctorm_socket_set_opts(ctorm_app_t *app, int sockfd);
-bool ctorm_socket_start(ctorm_app_t *app, char *addr);
+#define CTORM_SOCKET_SPARE_MAX (256) // max closed connections kept for reuse
+
+bool ctorm_socket_resolve(
+    char *addr, struct sockaddr_storage *info, socklen_t *len);
+bool ctorm_socket_set_opts(ctorm_app_t *app, int sockfd, int family);
+bool ctorm_socket_start(ctorm_app_t *app);
+bool ctorm_socket_serve(ctorm_app_t *app);
+void ctorm_socket_drain(ctorm_app_t *app);
+void ctorm_socket_free_spare(ctorm_app_t *app);
+
+// continues a connection with a deferred response, see ctorm_res_defer()
+struct ctorm_socket_data;
+void ctorm_socket_resume(struct ctorm_socket_data *data);
 
 #endif
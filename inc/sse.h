@@ -0,0 +1,157 @@
+/*!
+
+ * @file
+ * @brief Header file for the Server-Sent Events functions and definitions
+
+*/
+#pragma once
+
+#include "req.h"
+#include "res.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*!
+
+ * @brief Drop policy of an event stream
+
+ * Specifies what to do when a client can't keep up with the published events,
+ * and it's send queue is full
+
+*/
+typedef enum {
+  CTORM_SSE_DROP_OLDEST = 0, /// drop the oldest queued events (default)
+  CTORM_SSE_DROP_NEWEST = 1, /// drop the new event
+  CTORM_SSE_DROP_CLIENT = 2, /// close the client connection
+} ctorm_sse_drop_t;
+
+#ifdef CTORM_EXPORT
+
+typedef void ctorm_sse_t;
+
+#else
+
+typedef struct ctorm_sse ctorm_sse_t;
+
+#endif
+
+/*!
+
+ * @brief Event stream options
+
+ * Options for an event stream, which are passed to @ref ctorm_sse_new
+
+*/
+typedef struct {
+  uint64_t         max_queue; /// max queued bytes per client, 0 for 256 KiB
+  ctorm_sse_drop_t drop;      /// what to do when a client's queue is full
+} ctorm_sse_opts_t;
+
+#ifndef CTORM_EXPORT
+
+#include <pthread.h>
+
+#define CTORM_SSE_MAX_QUEUE (256 * 1024) // default max queue size per client
+#define CTORM_SSE_EVENTS    (64)         // max epoll events per wait
+#define CTORM_SSE_IOV_MAX   (16)         // max events per write
+
+// serialized event, shared by all the clients it's queued for
+struct ctorm_sse_event {
+  uint32_t refs; // reference count (protected by the stream mutex)
+  uint32_t size; // size of the serialized event
+  char     data[];
+};
+
+struct ctorm_sse_client {
+  int  socket;
+  bool writing; // is the client waiting for EPOLLOUT?
+  bool dead;    // is the connection shutdown? (freed by the loop thread)
+
+  // ring of the queued events
+  struct ctorm_sse_event **queue;
+  uint32_t                 queue_pos; // index of the first queued event
+  uint32_t                 queue_len; // number of the queued events
+  uint32_t                 queue_cap; // capacity of the ring (power of 2)
+  uint32_t                 sent;      // sent bytes of the first event
+  uint64_t                 queued;    // total queued bytes
+
+  struct ctorm_sse_client *prev, *next;
+};
+
+struct ctorm_sse {
+  ctorm_sse_opts_t opts;
+  pthread_mutex_t  mutex;  // locked while accessing the clients
+  pthread_t        thread; // loop thread that flushes the slow clients
+  int              epfd;   // epoll file descriptor
+  int              stopfd; // eventfd used to stop the loop thread
+  uint64_t         count;  // number of the clients
+
+  struct ctorm_sse_client *head; // list of the clients
+};
+
+void ctorm_sse_add(struct ctorm_sse *sse, ctorm_conn_t *conn);
+
+#endif
+
+/*!
+
+ * Create a new event stream, multiple clients can subscribe to a stream, and
+ * the events published to the stream are sent to all of them
+
+ * @param[in] opts: Event stream options, NULL to use the default options
+ * @return    Returns the event stream, or NULL if an error occurs, you can
+ *            obtain the error from the errno
+
+*/
+ctorm_sse_t *ctorm_sse_new(ctorm_sse_opts_t *opts);
+
+/*!
+
+ * Close all the client connections of the event stream, and free it. The
+ * stream should not be used by any route handler after calling this function
+
+ * @param[in] sse: Event stream
+
+*/
+void ctorm_sse_free(ctorm_sse_t *sse);
+
+/*!
+
+ * Subscribe the client to the event stream. Should be called from a route
+ * handler, it sets the "text/event-stream" response. After the response is
+ * sent, connection is kept open and the published events are sent to it. Any
+ * data in the response body is sent as the start of the stream
+
+ * @param[in] sse: Event stream
+ * @param[in] req: HTTP request
+ * @param[in] res: HTTP response
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_sse_subscribe(ctorm_sse_t *sse, ctorm_req_t *req, ctorm_res_t *res);
+
+/*!
+
+ * Publish an event to all the clients of the event stream. The event is
+ * serialized once, and the same buffer is queued for all the clients
+
+ * @param[in] sse:   Event stream
+ * @param[in] event: Event name, NULL for the default ("message") event
+ * @param[in] data:  Event data, may contain multiple lines
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_sse_publish(ctorm_sse_t *sse, const char *event, const char *data);
+
+/*!
+
+ * Get the number of the clients that are subscribed to the event stream
+
+ * @param[in] sse: Event stream
+ * @return    Number of the clients
+
+*/
+uint64_t ctorm_sse_count(ctorm_sse_t *sse);
@@ -17,5 +17,7 @@ bool  ctorm_uri_parse(ctorm_uri_t *uri, char *str);
 char *ctorm_uri_parse_auth(ctorm_uri_t *uri, char *auth);
 char *ctorm_uri_parse_host(ctorm_uri_t *uri, char *addr);
 char *ctorm_uri_parse_path(ctorm_uri_t *uri, char *path);
+char *ctorm_uri_split_path(
+    char *path, uint32_t *path_len, char **query, uint32_t *query_len);
 
 #endif
@@ -0,0 +1,44 @@
+#pragma once
+#ifndef CTORM_EXPORT
+
+#include <sys/socket.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CTORM_URING_ENTRIES 64      // submission queue size
+#define CTORM_URING_CHUNK   (65536) // max size of a single splice
+
+struct ctorm_uring {
+  int fd; // io_uring file descriptor
+
+  // submission queue
+  uint32_t            *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  uint32_t             sq_pending; // queued but not yet submitted SQEs
+
+  // completion queue
+  uint32_t            *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  // mapped ring memory
+  void  *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+
+  int  pipe[2];   // pipe used to splice files to the socket
+  bool accepting; // is the multishot accept armed?
+};
+
+struct ctorm_uring *ctorm_uring_new(uint32_t entries);
+struct ctorm_uring *ctorm_uring_thread(void);
+void                ctorm_uring_free(struct ctorm_uring *ring);
+
+int     ctorm_uring_accept(struct ctorm_uring *ring, int sock, int flags);
+int64_t ctorm_uring_recv(struct ctorm_uring *ring, int sock, void *buf,
+    uint64_t len, int flags, time_t timeout);
+int64_t ctorm_uring_sendmsg(
+    struct ctorm_uring *ring, int sock, struct msghdr *msg);
+bool ctorm_uring_sendfile(struct ctorm_uring *ring, int sock,
+    struct msghdr *msg, int fd, off_t offset, uint64_t size);
+
+#endif
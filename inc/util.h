@@ -41,5 +41,7 @@ bool     cu_contains(char *str, char c);
 bool     cu_streq(char *s1, char *s2);
 bool     cu_strcmpu(char *s1, char *s2, char end);
 uint32_t cu_strlen(char *str);
+bool     cu_has_token(char *value, char *token);
+void     cu_switch(void **sp, void *to);
 
 #endif
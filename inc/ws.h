@@ -0,0 +1,174 @@
+/*!
+
+ * @file
+ * @brief Header file for the WebSocket (RFC 6455) functions and definitions
+
+*/
+#pragma once
+
+#include "req.h"
+#include "res.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*!
+
+ * @brief WebSocket frame opcodes
+
+ * Opcodes of the WebSocket frames, see section "5.2. Base Framing Protocol" of
+ * RFC 6455
+
+*/
+typedef enum {
+  CTORM_WS_CONT   = 0x0, /// continuation frame
+  CTORM_WS_TEXT   = 0x1, /// text frame
+  CTORM_WS_BINARY = 0x2, /// binary frame
+  CTORM_WS_CLOSE  = 0x8, /// connection close frame
+  CTORM_WS_PING   = 0x9, /// ping frame
+  CTORM_WS_PONG   = 0xa, /// pong frame
+} ctorm_ws_op_t;
+
+#ifdef CTORM_EXPORT
+
+typedef void ctorm_ws_t;
+
+#else
+
+typedef struct ctorm_ws ctorm_ws_t;
+
+#endif
+
+/*!
+
+ * @brief WebSocket options
+
+ * Handlers and the options for a WebSocket connection, which are passed to
+ * @ref ctorm_ws_upgrade. All the handlers are optional
+
+*/
+typedef struct {
+  void (*open)(ctorm_ws_t *ws); /// called when the connection is established
+
+  /// called for every complete message (fragmented messages are reassembled),
+  /// data is only valid until the handler returns
+  void (*message)(ctorm_ws_t *ws, ctorm_ws_op_t op, char *data, uint64_t size);
+
+  /// called when the connection is closed, ws is freed after this call
+  void (*close)(ctorm_ws_t *ws, uint16_t code);
+
+  uint64_t max_size; /// max message size, 0 to use the default (1 MiB)
+  void    *data;     /// user data, see @ref ctorm_ws_data
+} ctorm_ws_opts_t;
+
+#ifndef CTORM_EXPORT
+
+#include "pool.h"
+#include <pthread.h>
+
+#define CTORM_WS_MAX_SIZE (1024 * 1024) // default max message size
+#define CTORM_WS_EVENTS   (64)          // max epoll events per wait
+
+// event loop that watches the idle WebSocket connections
+struct ctorm_ws_loop {
+  int             epfd;   // epoll file descriptor
+  int             stopfd; // eventfd used to stop the loop thread
+  pthread_t       thread; // loop thread
+  pthread_mutex_t mutex;  // locked while accessing the connection list
+  ctorm_pool_t   *pool;   // pool that handles the readable connections
+
+  struct ctorm_ws *head; // list of the connections
+};
+
+struct ctorm_ws {
+  ctorm_conn_t          conn; // connection (and it's receive buffer)
+  ctorm_ws_opts_t       opts; // handlers and the options
+  struct ctorm_app     *app;  // app that accepted the connection
+  struct ctorm_ws_loop *loop; // event loop of the app
+  pthread_mutex_t       send_mutex;
+  bool                  closing; // is the close frame sent?
+  bool                  armed;   // is the connection added to epoll?
+
+  // state of the current frame
+  bool     in_frame;
+  bool     fin;
+  uint8_t  op;
+  uint8_t  mask[4];
+  uint8_t  mask_pos;
+  uint64_t left; // remaining payload size
+
+  // current (possibly fragmented) message
+  uint8_t  msg_op; // opcode of the message, 0 if there is no message
+  char    *msg;
+  uint64_t msg_len;
+  uint64_t msg_cap;
+
+  struct ctorm_ws *prev, *next;
+};
+
+void ctorm_ws_free(struct ctorm_ws *ws);
+void ctorm_ws_start(struct ctorm_app *app, struct ctorm_ws *ws,
+    ctorm_conn_t *conn);
+void ctorm_ws_loop_stop(struct ctorm_ws_loop *loop);
+void ctorm_ws_loop_free(struct ctorm_ws_loop *loop);
+
+#endif
+
+/*!
+
+ * Accept a WebSocket upgrade request. Should be called from a route handler,
+ * it checks the upgrade request, and sets the "101 Switching Protocols"
+ * response. After the response is sent, connection is handled with the
+ * provided handlers. Idle connections don't occupy a thread, so many
+ * connections can share the threads of the app
+
+ * @param[in] req:  HTTP request
+ * @param[in] res:  HTTP response
+ * @param[in] opts: WebSocket handlers and options
+ * @return    Returns false if the request is not a valid upgrade request, you
+ *            can obtain the error from the errno
+
+*/
+bool ctorm_ws_upgrade(
+    ctorm_req_t *req, ctorm_res_t *res, ctorm_ws_opts_t *opts);
+
+/*!
+
+ * Send a message to the WebSocket connection, this function can be called from
+ * any thread until the close handler of the connection returns
+
+ * @param[in] ws:   WebSocket connection
+ * @param[in] op:   Message opcode (@ref CTORM_WS_TEXT, @ref CTORM_WS_BINARY or
+ *                  @ref CTORM_WS_PING)
+ * @param[in] data: Message data
+ * @param[in] size: Size of the message data
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_ws_send(
+    ctorm_ws_t *ws, ctorm_ws_op_t op, const void *data, uint64_t size);
+
+/*!
+
+ * Start closing the WebSocket connection by sending a close frame, close
+ * handler is called after the connection is closed
+
+ * @param[in] ws:   WebSocket connection
+ * @param[in] code: Close status code (1000 for a normal closure)
+ * @return    Returns false if an error occurs, you can obtain the error from
+ *            the errno
+
+*/
+bool ctorm_ws_close(ctorm_ws_t *ws, uint16_t code);
+
+/*!
+
+ * Get the user data of the WebSocket connection, which is set with the data
+ * option of @ref ctorm_ws_opts_t
+
+ * @param[in] ws: WebSocket connection
+ * @return    User data
+
+*/
+void *ctorm_ws_data(ctorm_ws_t *ws);
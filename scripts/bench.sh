@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# runs the load generator against the example applications, and prints the
+# results as a JSON array, options can be changed with the environment variables
+
+export LD_LIBRARY_PATH='./dist'
+
+duration="${BENCH_DURATION:-10}"
+warmup="${BENCH_WARMUP:-1}"
+connections="${BENCH_CONNECTIONS:-64}"
+threads="${BENCH_THREADS:-2}"
+pipeline="${BENCH_PIPELINE:-1}"
+rate="${BENCH_RATE:-0}"
+
+# example name, address and the path that will be requested
+benchmarks=(
+  "hello 127.0.0.1:8080 /"
+  "echo 127.0.0.1:8081 /static/style.css"
+  "params 127.0.0.1:8082 /echo/bench/path"
+  "locals 127.0.0.1:8083 /?username=bench"
+)
+
+function run_bench(){
+  local name="${1}" addr="${2}" path="${3}" args=()
+
+  ./dist/example_${name} > /dev/null &
+  sleep 1
+
+  args+=(-d "${duration}" -w "${warmup}" -c "${connections}")
+  args+=(-t "${threads}" -p "${pipeline}")
+  [ "${rate}" != "0" ] && args+=(-r "${rate}")
+
+  result=$(./dist/bench_load "${args[@]}" "${addr}" "${path}")
+  res=$?
+
+  kill -9 $!
+  wait $! 2> /dev/null
+
+  [ $res -ne 0 ] && return 1
+  printf '{"name":"%s","result":%s}' "${name}" "${result}"
+}
+
+echo "["
+
+for i in "${!benchmarks[@]}"; do
+  run_bench ${benchmarks[$i]} || exit 1
+  [ $i -lt $((${#benchmarks[@]}-1)) ] && echo "," || echo
+done
+
+echo "]"
@@ -8,13 +8,25 @@ examples=(
   "locals"
   "middleware"
   "multithread"
+  "websocket"
+  "http2"
+  "sse"
+)
+# examples that are also tested with coroutines
+coroutine_examples=(
+  "echo"
+  "multithread"
+  "websocket"
+  "http2"
+  "sse"
 )
 index="${1}"
 
 function run_example(){
-  echo "${1}: testing..."
+  name="${1}${2:+ (${2#--})}"
+  echo "${name}: testing..."
 
-  ./dist/example_${1} &
+  ./dist/example_${1} ${2} &
   sleep 1
 
   bash ./scripts/test_${1}.sh
@@ -23,11 +35,11 @@ function run_example(){
   kill -9 $!
 
   if [ $res -ne 0 ]; then
-    echo "${1}: failed"
+    echo "${name}: failed"
     return 1
   fi
 
-  echo "${1}: success"
+  echo "${name}: success"
   return 0
 }
 
@@ -46,3 +58,7 @@ fi
 for example in "${examples[@]}"; do
   run_example "${example}" || exit 1
 done
+
+for example in "${coroutine_examples[@]}"; do
+  run_example "${example}" --coroutines || exit 1
+done
@@ -9,4 +9,48 @@ if [[ "${data}" != "message: testing" ]]; then
   exit 1
 fi
 
+data=$(curl -X POST 'http://127.0.0.1:8081/upload' \
+  -F 'title=testing' -F 'file=@./example/echo/html/index.html' --silent)
+
+if [[ "${data}" != "parts: 2" ]]; then
+  echo 'fail (2)'
+  exit 1
+fi
+
+# a body with too many parts should be rejected
+parts=()
+
+for i in $(seq 65); do
+  parts+=(-F "file${i}=@./example/echo/html/index.html")
+done
+
+code=$(curl -X POST 'http://127.0.0.1:8081/upload' "${parts[@]}" \
+  --silent --output /dev/null --write-out '%{http_code}')
+
+if [[ "${code}" != "400" ]]; then
+  echo 'fail (3)'
+  exit 1
+fi
+
+# cached response should be sent with the status line of the request
+first=$(curl 'http://127.0.0.1:8081/visits' --silent)
+data=$(curl --http1.0 'http://127.0.0.1:8081/visits' --silent --include)
+
+if [[ "${first}" != "visits: 1" ]] || [[ "${data}" != "HTTP/1.0 200"* ]] ||
+   [[ "${data}" != *"content-type: text/plain; charset=utf-8"* ]] ||
+   [[ "${data}" != *"visits: 1" ]]; then
+  echo 'fail (4)'
+  exit 1
+fi
+
+# responses with a cookie should not be cached
+curl 'http://127.0.0.1:8081/visits?cookie=1' --silent -o /dev/null
+data=$(curl 'http://127.0.0.1:8081/visits?cookie=1' --silent --include)
+
+if [[ "${data}" != *"set-cookie: visited=1"* ]] ||
+   [[ "${data}" != *"visits: 3" ]]; then
+  echo 'fail (5)'
+  exit 1
+fi
+
 echo 'success'
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+url='http://127.0.0.1:8088'
+tmp=$(mktemp -d)
+trap 'rm -rf "${tmp}"' EXIT
+
+# prior knowledge
+data=$(curl --http2-prior-knowledge "${url}/" --silent \
+  --write-out ' %{http_version}')
+
+if [[ "${data}" != "hello world! 2" ]]; then
+  echo 'fail (1)'
+  exit 1
+fi
+
+# HTTP/1.1 upgrade
+data=$(curl --http2 "${url}/" --silent --write-out ' %{http_version}')
+
+if [[ "${data}" != "hello world! 2" ]]; then
+  echo 'fail (2)'
+  exit 1
+fi
+
+# request body that is sent with multiple DATA frames
+head -c 524288 /dev/urandom > "${tmp}/body"
+
+data=$(curl --http2-prior-knowledge -X POST "${url}/size" \
+  --data-binary "@${tmp}/body" --silent)
+
+if [[ "${data}" != "size: 524288" ]]; then
+  echo 'fail (3)'
+  exit 1
+fi
+
+# header block that is larger than a frame is sent with CONTINUATION frames
+value=$(head -c 8000 /dev/zero | tr '\0' 'a')
+headers=(-H "x-long: ${value}")
+
+for i in $(seq 5); do
+  headers+=(-H "x-pad-${i}: ${value}")
+done
+
+data=$(curl --http2-prior-knowledge "${url}/header" "${headers[@]}" --silent)
+
+if [[ "${data}" != "length: 8000" ]]; then
+  echo 'fail (4)'
+  exit 1
+fi
+
+# with small client windows, the server has to wait for WINDOW_UPDATE frames
+size=$(nghttp --window-bits=14 --connection-window-bits=14 "${url}/large" |
+  wc -c)
+
+if [[ "${size}" != "262144" ]]; then
+  echo 'fail (5)'
+  exit 1
+fi
+
+# request body that is larger than the default limit (1 MiB) is rejected
+# before it's completely sent
+head -c 4194304 /dev/zero > "${tmp}/large"
+
+data=$(nghttp --verbose --data "${tmp}/large" "${url}/size")
+
+if [[ "${data}" != *":status: 413"* ]] ||
+   [[ "${data}" != *"RST_STREAM"*"NO_ERROR"* ]]; then
+  echo 'fail (6)'
+  exit 1
+fi
+
+# server should still accept requests on other connections
+data=$(curl --http2-prior-knowledge "${url}/" --silent)
+
+if [[ "${data}" != "hello world!" ]]; then
+  echo 'fail (7)'
+  exit 1
+fi
+
+echo 'success'
@@ -13,6 +13,15 @@ if ! test_users 'John 23'; then
   exit 1
 fi
 
+code=$(curl --silent 'http://127.0.0.1:8084/user/add' \
+  -H 'Content-Type: application/json'                  \
+  --data '{"name": "test", "age": 42}' -o /dev/null -w '%{http_code}')
+
+if [[ "${code}" != "403" ]]; then
+  echo 'fail (2)'
+  exit 1
+fi
+
 curl --silent 'http://127.0.0.1:8084/user/add' \
   -H 'Content-Type: application/json'          \
   -H 'Authorization: secretpassword'           \
@@ -22,7 +31,23 @@ curl -X DELETE --silent 'http://127.0.0.1:8084/user/delete?name=John' \
   -H 'Authorization: secretpassword' -o /dev/null
 
 if ! test_users 'test 42'; then
-  echo 'fail (2)'
+  echo 'fail (3)'
+  exit 1
+fi
+
+# prefix middleware should be called for the routes with URL parameters
+code=$(curl --silent 'http://127.0.0.1:8084/user/info' \
+  -o /dev/null -w '%{http_code}')
+
+if [[ "${code}" != "403" ]]; then
+  echo 'fail (4)'
+  exit 1
+fi
+
+data=$(curl --silent 'http://127.0.0.1:8084/posts/info')
+
+if [[ "${data}" != "section: posts" ]]; then
+  echo 'fail (5)'
   exit 1
 fi
 
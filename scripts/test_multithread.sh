@@ -3,10 +3,23 @@
 curl -s 'http://127.0.0.1:8085/?name=test' -o /dev/null
 res=$(curl -s 'http://127.0.0.1:8086')
 
-if [[ "${res}" == "hello test" ]]; then
-  echo "success"
-  exit 0
+if [[ "${res}" != "hello test" ]]; then
+  echo "fail (1)"
+  exit 1
 fi
 
-echo "fail"
-exit 1
+# concurrent requests for a deferred response on a cached route
+curl -s --max-time 5 'http://127.0.0.1:8086/slow' -o /tmp/ctorm_slow_1 &
+curl -s --max-time 5 'http://127.0.0.1:8086/slow' -o /tmp/ctorm_slow_2
+wait
+
+res="$(cat /tmp/ctorm_slow_1) $(cat /tmp/ctorm_slow_2)"
+rm -f /tmp/ctorm_slow_1 /tmp/ctorm_slow_2
+
+if [[ "${res}" != "hello test hello test" ]]; then
+  echo "fail (2)"
+  exit 1
+fi
+
+echo "success"
+exit 0
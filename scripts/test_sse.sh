@@ -0,0 +1,136 @@
+#!/bin/bash
+
+python3 - << 'EOF_PY'
+from urllib.request import urlopen
+import socket, sys
+
+addr = ("127.0.0.1", 8089)
+
+# large enough to fill the socket buffers and the queue (64 KiB) of a client
+count = 2048
+
+def fail(n: int):
+    print("fail (%d)" % n)
+    sys.exit(1)
+
+def publish(stream: str, query: str) -> str:
+    url = "http://%s:%d/publish/%s?%s" % (addr + (stream, query))
+    return urlopen(url, timeout=10).read().decode()
+
+def subscribe(stream: str, slow: bool = False) -> tuple:
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+
+    # small receive buffer, so the client can't keep up with the events
+    if slow:
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+
+    s.settimeout(10)
+    s.connect(addr)
+    s.sendall(("GET /events/%s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" % stream)
+              .encode())
+
+    res = b""
+    while b"\r\n\r\n" not in res:
+        chunk = s.recv(4096)
+        if not chunk:
+            fail(1)
+        res += chunk
+
+    head, body = res.split(b"\r\n\r\n", 1)
+
+    if not head.startswith(b"HTTP/1.1 200") or \
+       b"content-type: text/event-stream" not in head:
+        fail(2)
+
+    return s, body
+
+# reads the events until the connection is closed, or until it's idle
+def read(s: socket.socket, body: bytes) -> tuple:
+    closed = False
+    s.settimeout(1)
+
+    try:
+        while True:
+            chunk = s.recv(65536)
+            if not chunk:
+                closed = True
+                break
+            body += chunk
+    except socket.timeout:
+        pass
+
+    s.settimeout(10)
+    return body, closed
+
+# returns the numbers of the received numbered events
+def numbers(body: bytes) -> list:
+    events = body.split(b"\n\n")[1:-1]
+    return [int(ev.split(b" ")[1]) for ev in events]
+
+# subscribe a client, publish and check the event framing
+s, body = subscribe("oldest")
+
+if publish("oldest", "event=update&data=one%0Atwo") != "clients: 1":
+    fail(3)
+
+if publish("oldest", "data=hello") != "clients: 1":
+    fail(4)
+
+expected = b"retry: 1000\n\nevent: update\ndata: one\ndata: two\n\n" \
+           b"data: hello\n\n"
+
+while len(body) < len(expected):
+    chunk = s.recv(4096)
+    if not chunk:
+        fail(5)
+    body += chunk
+
+if body != expected:
+    fail(6)
+
+s.close()
+
+# oldest events of a slow client are dropped, and the newest ones are received
+s, body = subscribe("oldest", True)
+publish("oldest", "count=%d" % count)
+body, closed = read(s, body)
+nums = numbers(body)
+
+if closed or len(nums) >= count or nums[-1] != count - 1 or \
+   nums != sorted(nums):
+    fail(7)
+
+s.close()
+
+# newest events of a slow client are dropped, and the client stays subscribed
+s, body = subscribe("newest", True)
+publish("newest", "count=%d" % count)
+body, closed = read(s, body)
+nums = numbers(body)
+
+if closed or len(nums) >= count or nums != list(range(len(nums))):
+    fail(8)
+
+publish("newest", "data=after")
+body, closed = read(s, body)
+
+if closed or not body.endswith(b"\n\ndata: after\n\n"):
+    fail(9)
+
+s.close()
+
+# slow client is disconnected
+s, body = subscribe("client", True)
+publish("client", "count=%d" % count)
+body, closed = read(s, body)
+nums = numbers(body)
+
+if not closed or len(nums) >= count or nums != list(range(len(nums))):
+    fail(10)
+
+if publish("client", "data=after") != "clients: 0":
+    fail(11)
+
+s.close()
+print("success")
+EOF_PY
@@ -0,0 +1,89 @@
+#!/bin/bash
+
+python3 - << 'EOF_PY'
+from hashlib import sha1
+from base64 import b64encode
+from struct import pack
+import socket, sys, os
+
+key = b64encode(os.urandom(16)).decode()
+magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+def frame(op: int, data: bytes, fin: bool = True) -> bytes:
+    mask = os.urandom(4)
+    head = bytes([(0x80 if fin else 0) | op])
+
+    if len(data) < 126:
+        head += bytes([0x80 | len(data)])
+    elif len(data) < 65536:
+        head += bytes([0x80 | 126]) + pack("!H", len(data))
+    else:
+        head += bytes([0x80 | 127]) + pack("!Q", len(data))
+
+    key = (mask * (len(data) // 4 + 1))[:len(data)]
+    data = (int.from_bytes(data, "big") ^ int.from_bytes(key, "big"))
+    return head + mask + data.to_bytes(len(key), "big")
+
+def recv(s: socket.socket, size: int) -> bytes:
+    data = b""
+
+    while len(data) < size:
+        chunk = s.recv(size - len(data))
+        if not chunk:
+            raise Exception("connection closed")
+        data += chunk
+
+    return data
+
+def read(s: socket.socket) -> tuple:
+    head = recv(s, 2)
+    size = head[1] & 0x7f
+
+    if size == 126:
+        size = int.from_bytes(recv(s, 2), "big")
+    elif size == 127:
+        size = int.from_bytes(recv(s, 8), "big")
+
+    return head[0] & 0x0f, recv(s, size)
+
+def fail(n: int):
+    print("fail (%d)" % n)
+    sys.exit(1)
+
+s = socket.create_connection(("127.0.0.1", 8087), timeout=10)
+s.sendall(("GET /echo HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+           "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+           "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % key)
+          .encode())
+
+res = b""
+while b"\r\n\r\n" not in res:
+    res += s.recv(1)
+
+accept = b64encode(sha1((key + magic).encode()).digest()).decode()
+
+if not res.startswith(b"HTTP/1.1 101") or accept.encode() not in res:
+    fail(1)
+
+s.sendall(frame(0x1, b"testing"))
+if read(s) != (0x1, b"testing"):
+    fail(2)
+
+big = os.urandom(1000)
+s.sendall(frame(0x2, big[:500], False) + frame(0x9, b"ping") +
+          frame(0x0, big[500:]))
+if read(s) != (0xa, b"ping") or read(s) != (0x2, big):
+    fail(3)
+
+# large message, that doesn't fit in the socket buffers
+big = os.urandom(8 * 1024 * 1024)
+s.sendall(frame(0x2, big))
+if read(s) != (0x2, big):
+    fail(4)
+
+s.sendall(frame(0x8, pack("!H", 1000)))
+if read(s) != (0x8, pack("!H", 1000)):
+    fail(5)
+
+print("success")
+EOF_PY
@@ -18,6 +18,7 @@
 
 */
 
+#include "prefork.h"
 #include "socket.h"
 #include "error.h"
 
@@ -30,6 +31,8 @@
 #include "res.h"
 #include "app.h"
 #include "log.h"
+#include "ws.h"
+#include "co.h"
 
 #include <pthread.h>
 #include <stdbool.h>
@@ -112,14 +115,22 @@ ctorm_app_t *ctorm_app_new(ctorm_config_t *config) {
   app->config        = config;
   app->running       = false;
 
-  if (NULL == (app->pool = ctorm_pool_new(config->pool_size))) {
-    errno = CTORM_ERR_POOL_FAIL;
-    goto fail;
-  }
+  if (NULL != config->cpus &&
+      NULL == (app->cpus = ctorm_cpus_new(config->cpus)))
+    goto fail; // errno set by ctorm_cpus_new()
+
+  if (NULL == (app->stats = ctorm_stats_new(config->workers)))
+    goto fail; // errno set by ctorm_stats_new()
+
+  // in prefork mode the threads are created by the worker processes
+  if (0 == config->workers && !ctorm_app_setup(app))
+    goto fail; // errno set by ctorm_app_setup()
 
   if ((config->lock_request &&
-          pthread_mutex_init(&app->req_mutex, NULL) != 0) ||
-      pthread_mutex_init(&app->mod_mutex, NULL) != 0) {
+          !ctorm_co_mutex_init(&app->req_mutex)) ||
+      pthread_mutex_init(&app->mod_mutex, NULL) != 0 ||
+      pthread_mutex_init(&app->conn_mutex, NULL) != 0 ||
+      pthread_cond_init(&app->conn_cond, NULL) != 0) {
     errno = CTORM_ERR_MUTEX_FAIL;
     goto fail;
   }
@@ -136,27 +147,90 @@ void ctorm_app_free(ctorm_app_t *app) {
   if (NULL == app)
     return;
 
+  // stop the WebSocket event loop, so it doesn't add more work to the pool
+  ctorm_ws_loop_stop(app->ws_loop);
+
+  // stop the coroutine loops, this waits for the coroutines to complete
+  for (uint32_t i = 0; NULL != app->co_loops && i < app->co_count; i++)
+    ctorm_co_loop_stop(app->co_loops[i]);
+
   // free the server's thread pool
   if (NULL != app->pool) {
     ctorm_pool_free(app->pool);
     app->pool = NULL;
   }
 
+  // close the remaining WebSocket connections
+  ctorm_ws_loop_free(app->ws_loop);
+  app->ws_loop = NULL;
+
+  // free the coroutine loops
+  for (uint32_t i = 0; NULL != app->co_loops && i < app->co_count; i++)
+    ctorm_co_loop_free(app->co_loops[i]);
+
+  free(app->co_loops);
+  app->co_loops = NULL;
+
+  // free the objects of the closed connections, after all of them are closed
+  ctorm_socket_free_spare(app);
+
+  ctorm_cpus_free(app->cpus);
+  app->cpus = NULL;
+
+  ctorm_stats_free(app->stats);
+  app->stats = NULL;
+
+  for (uint32_t i = 0; i < app->listener_count; i++)
+    free(app->listeners[i].addr);
+  app->listener_count = 0;
+
+  // stop the request logger, after the pool so no thread is using it
+  ctorm_logger_free(app->logger);
+  app->logger = NULL;
+
   // free the routes
   struct ctorm_route *prev = NULL;
 
   while (app->routes != NULL) {
     prev        = app->routes;
     app->routes = app->routes->next;
+    free(prev->chain);
     free(prev);
   }
 
+  // free the middleware
+  struct ctorm_middleware *mw = NULL;
+
+  while (app->middleware != NULL) {
+    mw              = app->middleware;
+    app->middleware = app->middleware->next;
+    free(mw);
+  }
+
+  // free the response cache and the cache rules
+  struct ctorm_cache_rule *rule = NULL;
+
+  while (app->cache_rules != NULL) {
+    rule             = app->cache_rules;
+    app->cache_rules = app->cache_rules->next;
+    free(rule);
+  }
+
+  ctorm_cache_free(app->cache);
+  app->cache = NULL;
+
+  // free the locals
+  ctorm_pair_free(app->locals);
+  free(app->local_table);
+
   pthread_mutex_destroy(&app->mod_mutex);
+  pthread_mutex_destroy(&app->conn_mutex);
+  pthread_cond_destroy(&app->conn_cond);
 
   if (NULL != app->config) {
     // destroy the request mutex
     if (app->config->lock_request)
-      pthread_mutex_destroy(&app->req_mutex);
+      ctorm_co_mutex_destroy(&app->req_mutex);
 
     // free the configuration if it's default
     if (app->is_default_config)
@@ -168,14 +242,333 @@ void ctorm_app_free(ctorm_app_t *app) {
   free(app);
 }
 
-bool ctorm_app_run(ctorm_app_t *app, const char *addr) {
+bool _ctorm_app_add_middleware(ctorm_app_t *app, char *path, bool route,
+    int method, ctorm_route_t handler) {
+  app_check_ptr(false);
+
+  if (NULL != path && *path != '/') {
+    errno = CTORM_ERR_BAD_PATH;
+    return false;
+  }
+
+  if (app->running) {
+    errno = CTORM_ERR_APP_RUNNING;
+    return false;
+  }
+
+  // every middleware needs a bit in the middleware bitmap of the request
+  if (app->middleware_count >= CTORM_MIDDLEWARE_MAX) {
+    errno = CTORM_ERR_MIDDLEWARE_LIMIT;
+    return false;
+  }
+
+  struct ctorm_middleware *new = NULL, **cur = &app->middleware;
+
+  if ((new = calloc(1, sizeof(*new))) == NULL) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  // "/" prefix is same as no prefix
+  if (NULL != path && (route || !cu_streq(path, "/"))) {
+    new->path = path;
+    new->len  = cu_strlen(path);
+  }
+
+  new->route   = route;
+  new->method  = method < 0 ? 0 : method;
+  new->all     = method < 0;
+  new->handler = handler;
+  new->bit     = 1ULL << app->middleware_count++;
+
+  // middleware are called in the order they are added
+  while (NULL != *cur)
+    cur = &(*cur)->next;
+
+  *cur = new;
+  return true;
+}
+
+bool ctorm_app_use(ctorm_app_t *app, char *prefix, ctorm_route_t handler) {
+  return _ctorm_app_add_middleware(app, prefix, false, -1, handler);
+}
+
+bool ctorm_app_use_route(
+    ctorm_app_t *app, int method, char *path, ctorm_route_t handler) {
+  if (NULL == path) {
+    errno = CTORM_ERR_BAD_PATH_PTR;
+    return false;
+  }
+
+  return _ctorm_app_add_middleware(app, path, true, method, handler);
+}
+
+// checks if the path is under the prefix of a (global or prefix) middleware
+bool _ctorm_app_prefix_matches(struct ctorm_middleware *mw, char *path) {
+  if (NULL == mw->path)
+    return true;
+
+  if (NULL == path || strncmp(mw->path, path, mw->len) != 0)
+    return false;
+
+  return path[mw->len] == 0 || path[mw->len] == '/' ||
+         mw->path[mw->len - 1] == '/';
+}
+
+/*
+
+ * checks if a middleware may be called for a route, prefix middleware are
+ * checked against the request path when the route is called, since a route
+ * with URL parameters or wildcards can match paths under any prefix
+
+*/
+bool _ctorm_app_middleware_applies(
+    struct ctorm_middleware *mw, struct ctorm_route *route) {
+  if (!mw->route)
+    return NULL != strchr(route->path, '%') ||
+           NULL != strstr(route->path, "/:") ||
+           _ctorm_app_prefix_matches(mw, route->path);
+
+  if (!cu_streq(mw->path, route->path))
+    return false;
+
+  return mw->all || (!route->all && mw->method == route->method);
+}
+
+bool ctorm_app_cache(ctorm_app_t *app, char *path, ctorm_cache_opts_t *opts) {
+  app_check_ptr(false);
+
+  if (NULL == path) {
+    errno = CTORM_ERR_BAD_PATH_PTR;
+    return false;
+  }
+
+  if (*path != '/') {
+    errno = CTORM_ERR_BAD_PATH;
+    return false;
+  }
+
+  if (NULL == opts || opts->ttl == 0) {
+    errno = CTORM_ERR_BAD_CACHE_TTL;
+    return false;
+  }
+
+  // cache rules are applied to the routes when the app is started
+  if (app->running) {
+    errno = CTORM_ERR_APP_RUNNING;
+    return false;
+  }
+
+  struct ctorm_cache_rule *new = NULL;
+
+  if ((new = calloc(1, sizeof(*new))) == NULL) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  new->path        = path;
+  new->opts        = *opts;
+  new->next        = app->cache_rules;
+  app->cache_rules = new;
+  return true;
+}
+
+// finds the response cache options for a route, if there is any
+ctorm_cache_opts_t *_ctorm_app_cache_opts(
+    ctorm_app_t *app, struct ctorm_route *route) {
+  struct ctorm_cache_rule *rule = app->cache_rules;
+
+  // only GET responses are cached
+  if (app->config->cache_size == 0 ||
+      (!route->all && route->method != CTORM_HTTP_GET))
+    return NULL;
+
+  for (; NULL != rule; rule = rule->next)
+    if (cu_streq(rule->path, route->path))
+      return &rule->opts;
+
+  return NULL;
+}
+
+/*
+
+ * compiles the handler chain of every route, which contains all the middleware
+ * that applies to the route, followed by the route handler itself, so routing
+ * a request does not need to check every middleware
+
+*/
+bool _ctorm_app_compile(ctorm_app_t *app) {
+  struct ctorm_middleware *mw    = NULL;
+  struct ctorm_route      *route = NULL;
+  struct ctorm_handler    *cur   = NULL;
+  uint32_t                 count = 0;
+
+  for (route = app->routes; NULL != route; route = route->next) {
+    free(route->chain);
+    route->chain_len = 0;
+
+    for (count = 1, mw = app->middleware; NULL != mw; mw = mw->next)
+      if (_ctorm_app_middleware_applies(mw, route))
+        count++;
+
+    if (NULL == (cur = route->chain = malloc(sizeof(*cur) * count))) {
+      errno = CTORM_ERR_ALLOC_FAIL;
+      return false;
+    }
+
+    // global and prefix middleware first, then the route middleware
+    for (mw = app->middleware; NULL != mw; mw = mw->next)
+      if (!mw->route && _ctorm_app_middleware_applies(mw, route))
+        *(cur++) = (struct ctorm_handler){
+            mw->handler, mw->bit, NULL == mw->path ? NULL : mw};
+
+    for (mw = app->middleware; NULL != mw; mw = mw->next)
+      if (mw->route && _ctorm_app_middleware_applies(mw, route))
+        *(cur++) = (struct ctorm_handler){mw->handler, mw->bit, NULL};
+
+    *cur             = (struct ctorm_handler){route->handler, 0, NULL};
+    route->chain_len = count;
+    route->cache     = _ctorm_app_cache_opts(app, route);
+  }
+
+  return true;
+}
+
+// starts an event loop for every CPU core to run the coroutines
+bool _ctorm_app_co_start(ctorm_app_t *app) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  // if the CPUs are listed, only use them
+  if (NULL != app->cpus)
+    count = app->cpus->count;
+
+  if (count < 1)
+    count = 1;
+
+  if (NULL == (app->co_loops = calloc(count, sizeof(*app->co_loops)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  for (app->co_count = 0; app->co_count < count; app->co_count++)
+    if (NULL == (app->co_loops[app->co_count] =
+                         ctorm_co_loop_new(app->cpus, app->co_count)))
+      goto fail;
+
+  return true;
+
+fail:
+  while (app->co_count > 0) {
+    ctorm_co_loop_stop(app->co_loops[--app->co_count]);
+    ctorm_co_loop_free(app->co_loops[app->co_count]);
+  }
+
+  free(app->co_loops);
+  app->co_loops = NULL;
+  return false; // errno set by ctorm_co_loop_new()
+}
+
+bool ctorm_app_setup(ctorm_app_t *app) {
+  ctorm_config_t *config = app->config;
+
+  if (NULL == app->pool &&
+      NULL == (app->pool = ctorm_pool_new(
+                   config->pool_size, config->pool_max, app->cpus))) {
+    errno = CTORM_ERR_POOL_FAIL;
+    return false;
+  }
+
+  if (!config->disable_logging && NULL == app->logger &&
+      NULL == (app->logger = ctorm_logger_new(config)))
+    return false; // errno set by ctorm_logger_new()
+
+  // start the coroutine loops, connections are handled by them
+  if (config->coroutines && NULL == app->co_loops &&
+      !_ctorm_app_co_start(app))
+    return false; // errno set by _ctorm_app_co_start()
+
+  return true;
+}
+
+bool ctorm_app_listen(ctorm_app_t *app, const char *addr) {
   app_check_ptr(false);
 
+  struct ctorm_listener *listener = NULL;
+
   if (NULL == addr) {
     errno = CTORM_ERR_BAD_ADDR_PTR;
     return false;
   }
 
+  // listening sockets are created when the app is started
+  if (app->running) {
+    errno = CTORM_ERR_APP_RUNNING;
+    return false;
+  }
+
+  // app may be started multiple times with the same address
+  for (uint32_t i = 0; i < app->listener_count; i++)
+    if (cu_streq(app->listeners[i].addr, (char *)addr))
+      return true;
+
+  if (app->listener_count >= CTORM_LISTEN_MAX) {
+    errno = CTORM_ERR_LISTENER_LIMIT;
+    return false;
+  }
+
+  listener = &app->listeners[app->listener_count];
+
+  if (NULL == (listener->addr = strdup(addr))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  listener->sock = -1;
+  app->listener_count++;
+  return true;
+}
+
+bool ctorm_app_run(ctorm_app_t *app, const char *addr) {
+  app_check_ptr(false);
+
+  if (NULL != addr && !ctorm_app_listen(app, addr))
+    return false; // errno set by ctorm_app_listen()
+
+  if (0 == app->listener_count) {
+    errno = CTORM_ERR_BAD_ADDR_PTR;
+    return false;
+  }
+
+  /*
+
+   * setup everything that may fail before adding the app to the signal list,
+   * so a failed run doesn't leave the app in the list
+
+   * build the hash table for the app locals, which is shared with all the
+   * requests, since this table is not modified while the app is running, the
+   * requests can access it without any locking
+
+  */
+  free(app->local_table);
+
+  if (NULL == (app->local_table = ctorm_locals_new(app->locals)))
+    return false; // errno set by ctorm_locals_new()
+
+  // compile the handler chains of the routes
+  if (!_ctorm_app_compile(app))
+    return false; // errno set by _ctorm_app_compile()
+
+  // create the response cache, if any of the routes use it
+  if (NULL != app->cache_rules && app->config->cache_size != 0 &&
+      NULL == app->cache) {
+    if (NULL == (app->cache = ctorm_cache_new(app->config->cache_size)))
+      return false; // errno set by ctorm_cache_new()
+  }
+
+  // coroutines may be enabled after creating the app, workers setup their own
+  if (0 == app->config->workers && !ctorm_app_setup(app))
+    return false; // errno set by ctorm_app_setup()
+
   struct sigaction sa;
   bool             ret = false;
 
@@ -213,9 +606,14 @@ bool ctorm_app_run(ctorm_app_t *app, const char *addr) {
   app->thread = pthread_self();
 
   // start the web server and wait until it's done
-  app->running = true;
-  ret          = ctorm_socket_start(app, (char *)addr);
-  app->running = false;
+  app->running  = true;
+  app->draining = false;
+  ret           = ctorm_socket_start(app);
+  app->running  = false;
+
+  // let the ongoing requests complete before returning
+  if (app->config->drain_timeout > 0)
+    ctorm_socket_drain(app);
 
   // if signal handling is enabled, remove app from the signal list
   if (app->config->handle_signal) {
@@ -236,6 +634,7 @@ bool ctorm_app_run(ctorm_app_t *app, const char *addr) {
     // remove the signal handler if the list is empty
     if (NULL == _ctorm_signal_head) {
       // modify the signal action to use the default handler
+      sigemptyset(&sa.sa_mask);
       sa.sa_handler = SIG_DFL;
       sa.sa_flags   = 0;
 
@@ -260,7 +659,96 @@ bool ctorm_app_stop(ctorm_app_t *app) {
   return true;
 }
 
+uint32_t ctorm_app_threads(ctorm_app_t *app) {
+  app_check_ptr(0);
+  return NULL == app->pool ? 0 : ctorm_pool_size(app->pool);
+}
+
+bool ctorm_app_stats(ctorm_app_t *app, ctorm_app_stats_t *stats) {
+  app_check_ptr(false);
+
+  if (NULL == stats) {
+    errno = CTORM_ERR_BAD_DATA_PTR;
+    return false;
+  }
+
+  ctorm_stats_get(app->stats, app->config->workers, stats);
+  return true;
+}
+
+// FNV-1a hash of the local name
+uint32_t _ctorm_locals_hash(char *name) {
+  uint32_t hash = 2166136261u;
+
+  for (; *name != 0; name++)
+    hash = (hash ^ (uint8_t)*name) * 16777619u;
+
+  return hash;
+}
+
+struct ctorm_locals *ctorm_locals_new(ctorm_pair_t *list) {
+  struct ctorm_locals *locals = NULL;
+  uint32_t             size = 2, count = 0, i = 0;
+
+  // keep the table at most half full, so the probe sequences stay short
+  ctorm_pair_next(list, local) count++;
+
+  while (size < count * 2)
+    size *= 2;
+
+  if (NULL == (locals = calloc(
+                   1, sizeof(*locals) + sizeof(locals->entries[0]) * size))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  locals->mask = size - 1;
+
+  // list is in reverse insertion order, so the latest value of a name is kept
+  ctorm_pair_next(list, local) {
+    for (i = _ctorm_locals_hash(local->key) & locals->mask;
+        NULL != locals->entries[i].name;
+        i = (i + 1) & locals->mask)
+      if (cu_streq(locals->entries[i].name, local->key))
+        break;
+
+    if (NULL != locals->entries[i].name)
+      continue;
+
+    locals->entries[i].name  = local->key;
+    locals->entries[i].value = local->value;
+  }
+
+  return locals;
+}
+
+void *ctorm_locals_get(struct ctorm_locals *locals, char *name) {
+  if (NULL == locals || NULL == name)
+    return NULL;
+
+  uint32_t i = _ctorm_locals_hash(name) & locals->mask;
+
+  for (; NULL != locals->entries[i].name; i = (i + 1) & locals->mask)
+    if (cu_streq(locals->entries[i].name, name))
+      return locals->entries[i].value;
+
+  return NULL;
+}
+
 bool ctorm_app_local(ctorm_app_t *app, char *name, void *value) {
+  app_check_ptr(false);
+
+  if (NULL == name) {
+    errno = CTORM_ERR_BAD_LOCAL_PTR;
+    return false;
+  }
+
+  // the local table is read-only while the app is running
+  if (app->running) {
+    errno = CTORM_ERR_APP_RUNNING;
+    return false;
+  }
+
   return NULL != ctorm_pair_add(&app->locals, name, value);
 }
 
@@ -286,6 +774,12 @@ bool ctorm_app_add(
     return false;
   }
 
+  // routes are compiled when the app is started
+  if (app->running) {
+    errno = CTORM_ERR_APP_RUNNING;
+    return false;
+  }
+
   struct ctorm_route *new = NULL, *cur = NULL;
 
   if ((new = calloc(1, sizeof(*new))) == NULL) {
@@ -415,26 +909,100 @@ end:
   return ret;
 }
 
+void _ctorm_app_call(ctorm_req_t *req, ctorm_res_t *res,
+    struct ctorm_handler *cur, uint32_t len) {
+  for (; len > 0 && !req->cancel; cur++, len--) {
+    // skip the middleware that is already called by another matching route
+    if (req->middleware & cur->bit)
+      continue;
+
+    // skip the prefix middleware if the request path is not under the prefix
+    if (NULL != cur->prefix &&
+        !_ctorm_app_prefix_matches(cur->prefix, req->path))
+      continue;
+
+    req->middleware |= cur->bit;
+    cur->handler(req, res);
+  }
+}
+
+/*
+
+ * calls the middleware of a cached route and looks up the response cache,
+ * returns true if the route handler does not need to be called
+
+*/
+bool _ctorm_app_cache_hit(ctorm_app_t *app, struct ctorm_route *route,
+    ctorm_req_t *req, ctorm_res_t *res) {
+  char *key = NULL;
+  bool  hit = false;
+
+  // middleware are called for every request (they may cancel the request)
+  _ctorm_app_call(req, res, route->chain, route->chain_len - 1);
+
+  if (req->cancel)
+    return true;
+
+  /*
+
+   * pending entry is stored in the response, response is cached when it's
+   * sent, requests are routed with the request mutex locked, so we can't wait
+   * for a pending response while holding it
+
+  */
+  if (NULL != (key = ctorm_cache_key(req, route->cache)))
+    res->cache = ctorm_cache_get(app->cache, key, route->cache->ttl,
+        !app->config->lock_request, &hit);
+
+  return hit;
+}
+
 void ctorm_app_route(ctorm_app_t *app, ctorm_req_t *req, ctorm_res_t *res) {
-  struct ctorm_route *cur     = NULL;
-  bool                handled = false;
+  struct ctorm_middleware *mw      = NULL;
+  struct ctorm_route      *cur     = NULL;
+  bool                     handled = false;
 
-  // copy the locals to the request
-  ctorm_pair_next(app->locals, local)
-      ctorm_req_local(req, local->key, local->value);
+  // share the app locals with the request
+  req->app_locals = app->local_table;
 
   // call the routes, stop if a route cancels the request
   for (cur = app->routes; !req->cancel && NULL != cur; cur = cur->next) {
-    if (_ctorm_app_route_matches(cur, req)) {
-      cur->handler(req, res);
-      handled = true;
-    }
+    if (!_ctorm_app_route_matches(cur, req))
+      continue;
+
+    handled = true;
+
+    /*
+
+     * if we have a cached response, skip the route handler and the next
+     * routes, cached responses are serialized as HTTP/1.1, so they are not
+     * used for HTTP/2
+
+    */
+    if (NULL != cur->cache && NULL == res->cache &&
+        req->method == CTORM_HTTP_GET && req->version != CTORM_HTTP_2 &&
+        _ctorm_app_cache_hit(app, cur, req, res))
+      break;
+
+    _ctorm_app_call(req, res, cur->chain, cur->chain_len);
   }
 
   // if we found at least one matching route, then route is complete
   if (handled)
     return;
 
+  // otherwise call the global and the prefix middleware for the request
+  for (mw = app->middleware; !req->cancel && NULL != mw; mw = mw->next) {
+    if (mw->route || !_ctorm_app_prefix_matches(mw, req->path))
+      continue;
+
+    req->middleware |= mw->bit;
+    mw->handler(req, res);
+  }
+
+  if (req->cancel)
+    return;
+
   // if not check if we have a static route configured
   while (!cu_str_empty(&app->static_path) && !cu_str_empty(&app->static_dir) &&
          CTORM_HTTP_GET == req->method) {
@@ -0,0 +1,442 @@
+#include "cache.h"
+#include "error.h"
+#include "util.h"
+#include "co.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+// appends a string to the key buffer, see ctorm_cache_key()
+#define cache_key_add(str)                                                     \
+  do {                                                                         \
+    len = cu_strlen(str);                                                      \
+    if (NULL != key)                                                           \
+      memcpy(key + size, str, len);                                            \
+    size += len;                                                               \
+  } while (0)
+
+// appends a string to the header buffer, see _ctorm_cache_head()
+#define cache_head_add(str, len)                                               \
+  do {                                                                         \
+    if (NULL != buf)                                                           \
+      memcpy(buf + total, str, len);                                           \
+    total += (len);                                                            \
+  } while (0)
+
+/*
+
+ * headers of a response that are stored in the cache, other headers (such as
+ * the date, or the connection header) are created for every request
+
+*/
+static char *_ctorm_cache_headers[] = {
+    "content-type",
+    "content-language",
+    "content-encoding",
+    "content-disposition",
+    "cache-control",
+    "expires",
+    "last-modified",
+    "etag",
+    "vary",
+    NULL,
+};
+
+uint64_t _ctorm_cache_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a hash of the cache key
+uint64_t _ctorm_cache_hash(char *key) {
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (; *key != 0; key++)
+    hash = (hash ^ (uint8_t)*key) * 1099511628211ULL;
+
+  return hash;
+}
+
+void _ctorm_cache_entry_free(struct ctorm_cache_entry *entry) {
+  free(entry->key);
+  free(entry->data);
+  free(entry);
+}
+
+// wakes up the requests that wait for a pending entry, shard should be locked
+void _ctorm_cache_wake(struct ctorm_cache_entry *entry) {
+  struct ctorm_co *co = NULL;
+
+  pthread_cond_broadcast(&entry->shard->cond);
+
+  while (NULL != (co = entry->waiting)) {
+    entry->waiting = co->next;
+    ctorm_co_resume(co);
+  }
+}
+
+// removes the entry from the hash table, shard should be locked
+void _ctorm_cache_unlink(struct ctorm_cache_entry *entry) {
+  struct ctorm_cache_shard  *shard = entry->shard;
+  struct ctorm_cache_entry **cur   = NULL;
+  uint32_t                   i     = 0;
+
+  for (; i < CTORM_CACHE_BUCKETS; i++) {
+    for (cur = &shard->buckets[i]; NULL != *cur; cur = &(*cur)->next) {
+      if (*cur != entry)
+        continue;
+
+      *cur          = entry->next;
+      entry->linked = false;
+
+      if (entry->ready)
+        shard->used -= entry->size;
+
+      // if no one is using the entry, we can free it
+      if (entry->refs == 0)
+        _ctorm_cache_entry_free(entry);
+
+      return;
+    }
+  }
+}
+
+// removes entries until the shard fits in it's budget, shard should be locked
+void _ctorm_cache_evict(
+    struct ctorm_cache_shard *shard, struct ctorm_cache_entry *keep) {
+  struct ctorm_cache_entry *cur = NULL, *next = NULL, *oldest = NULL;
+  uint64_t                  now = _ctorm_cache_now();
+  uint32_t                  i   = 0;
+
+  // first remove all the expired entries
+  for (i = 0; shard->used > shard->budget && i < CTORM_CACHE_BUCKETS; i++) {
+    for (cur = shard->buckets[i]; NULL != cur; cur = next) {
+      next = cur->next;
+
+      if (cur->ready && cur != keep && cur->expires <= now)
+        _ctorm_cache_unlink(cur);
+    }
+  }
+
+  // then remove the entries that are closest to expiring
+  while (shard->used > shard->budget) {
+    for (oldest = NULL, i = 0; i < CTORM_CACHE_BUCKETS; i++)
+      for (cur = shard->buckets[i]; NULL != cur; cur = cur->next)
+        if (cur->ready && cur != keep &&
+            (NULL == oldest || cur->expires < oldest->expires))
+          oldest = cur;
+
+    if (NULL == oldest)
+      break;
+
+    _ctorm_cache_unlink(oldest);
+  }
+}
+
+ctorm_cache_t *ctorm_cache_new(uint64_t size) {
+  ctorm_cache_t *cache = NULL;
+  long           count = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t       i     = 0;
+
+  // use a shard per CPU, so the threads rarely wait for each other
+  if (count < 1)
+    count = 1;
+  else if (count > CTORM_CACHE_SHARDS_MAX)
+    count = CTORM_CACHE_SHARDS_MAX;
+
+  if (NULL == (cache = calloc(
+                   1, sizeof(*cache) + sizeof(cache->shards[0]) * count))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  for (; i < count; i++) {
+    if (pthread_mutex_init(&cache->shards[i].mutex, NULL) != 0 ||
+        pthread_cond_init(&cache->shards[i].cond, NULL) != 0) {
+      errno = CTORM_ERR_MUTEX_FAIL;
+      ctorm_cache_free(cache);
+      return NULL;
+    }
+
+    cache->shards[i].budget = size / count;
+    cache->count++;
+  }
+
+  return cache;
+}
+
+void ctorm_cache_free(ctorm_cache_t *cache) {
+  if (NULL == cache)
+    return;
+
+  struct ctorm_cache_entry *cur = NULL, *next = NULL;
+  uint32_t                  i = 0, b = 0;
+
+  for (; i < cache->count; i++) {
+    for (b = 0; b < CTORM_CACHE_BUCKETS; b++) {
+      for (cur = cache->shards[i].buckets[b]; NULL != cur; cur = next) {
+        next = cur->next;
+        _ctorm_cache_entry_free(cur);
+      }
+    }
+
+    pthread_mutex_destroy(&cache->shards[i].mutex);
+    pthread_cond_destroy(&cache->shards[i].cond);
+  }
+
+  free(cache);
+}
+
+char *ctorm_cache_key(ctorm_req_t *req, ctorm_cache_opts_t *opts) {
+  char    *key = NULL, **name = NULL, *value = NULL;
+  uint32_t size = 0, len = 0;
+
+  /*
+
+   * key is created in two passes, first pass calculates the size and the
+   * second pass copies the data, the key looks like this:
+
+   * /path\n?query=value\nheader:value
+
+  */
+  for (;;) {
+    size = 0;
+    cache_key_add(req->path);
+
+    for (name = opts->queries; NULL != name && NULL != *name; name++) {
+      cache_key_add("\n?");
+      cache_key_add(*name);
+
+      if (NULL != (value = ctorm_req_query(req, *name))) {
+        cache_key_add("=");
+        cache_key_add(value);
+      }
+    }
+
+    for (name = opts->headers; NULL != name && NULL != *name; name++) {
+      cache_key_add("\n");
+      cache_key_add(*name);
+
+      if (NULL != (value = ctorm_req_get(req, *name))) {
+        cache_key_add(":");
+        cache_key_add(value);
+      }
+    }
+
+    if (NULL != key)
+      break;
+
+    if (NULL == (key = malloc(size + 1))) {
+      errno = CTORM_ERR_ALLOC_FAIL;
+      return NULL;
+    }
+  }
+
+  key[size] = 0;
+  return key;
+}
+
+/*
+
+ * returns the entry for the key, and takes the ownership of the key, if the
+ * entry contains a response, hit is set to true, otherwise a new pending entry
+ * is returned, and the caller should create the response and store it with
+ * ctorm_cache_put(), all the other requests with the same key will wait for it
+
+ * if wait is false (for example when the caller holds a lock that is needed to
+ * create the response), instead of waiting for a pending entry, NULL is
+ * returned, and the caller should create the response without caching it
+
+*/
+struct ctorm_cache_entry *ctorm_cache_get(
+    ctorm_cache_t *cache, char *key, uint32_t ttl, bool wait, bool *hit) {
+  uint64_t                   hash   = _ctorm_cache_hash(key);
+  struct ctorm_cache_shard  *shard  = &cache->shards[hash % cache->count];
+  struct ctorm_cache_entry **bucket = NULL, *entry = NULL;
+  struct ctorm_co           *co     = NULL;
+
+  bucket = &shard->buckets[(hash / cache->count) % CTORM_CACHE_BUCKETS];
+  pthread_mutex_lock(&shard->mutex);
+
+find:
+  for (entry = *bucket; NULL != entry; entry = entry->next)
+    if (entry->hash == hash && cu_streq(entry->key, key))
+      break;
+
+  // another request is creating the response, wait for it to be stored
+  if (NULL != entry && !entry->ready) {
+    if (!wait) {
+      pthread_mutex_unlock(&shard->mutex);
+
+      free(key);
+      *hit = false;
+      return NULL;
+    }
+
+    // on a coroutine, the response may be created by the same thread
+    if (NULL != (co = ctorm_co_self())) {
+      co->next       = entry->waiting;
+      entry->waiting = co;
+
+      pthread_mutex_unlock(&shard->mutex);
+      ctorm_co_park();
+      pthread_mutex_lock(&shard->mutex);
+    }
+
+    else
+      pthread_cond_wait(&shard->cond, &shard->mutex);
+
+    goto find;
+  }
+
+  if (NULL != entry && entry->expires > _ctorm_cache_now()) {
+    entry->refs++;
+    pthread_mutex_unlock(&shard->mutex);
+
+    free(key);
+    *hit = true;
+    return entry;
+  }
+
+  // remove the expired entry
+  if (NULL != entry)
+    _ctorm_cache_unlink(entry);
+
+  if (NULL == (entry = calloc(1, sizeof(*entry)))) {
+    pthread_mutex_unlock(&shard->mutex);
+
+    free(key);
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  entry->hash   = hash;
+  entry->key    = key;
+  entry->ttl    = ttl;
+  entry->refs   = 1;
+  entry->linked = true;
+  entry->shard  = shard;
+  entry->next   = *bucket;
+  *bucket       = entry;
+
+  pthread_mutex_unlock(&shard->mutex);
+
+  *hit = false;
+  return entry;
+}
+
+bool ctorm_cache_stable(char *name) {
+  char **cur = _ctorm_cache_headers;
+
+  for (; NULL != *cur; cur++)
+    if (ctorm_headers_cmp(*cur, name))
+      return true;
+
+  return false;
+}
+
+// serializes the stable headers and the content length of the response
+uint32_t _ctorm_cache_head(ctorm_res_t *res, char *buf) {
+  ctorm_header_pos_t pos;
+  uint32_t           total = 0, len = 0;
+  char               line[64];
+
+  ctorm_headers_start(&pos);
+
+  while (ctorm_headers_next(res->headers, &pos)) {
+    if (!ctorm_cache_stable(pos.name))
+      continue;
+
+    len = cu_strlen(pos.name);
+    cache_head_add(pos.name, len);
+    cache_head_add(": ", 2);
+
+    len = cu_strlen(pos.value);
+    cache_head_add(pos.value, len);
+    cache_head_add("\r\n", 2);
+  }
+
+  len = snprintf(
+      line, sizeof(line), "content-length: %u\r\n\r\n", res->body_size);
+  cache_head_add(line, len);
+
+  return total;
+}
+
+bool ctorm_cache_put(struct ctorm_cache_entry *entry, ctorm_res_t *res) {
+  struct ctorm_cache_shard *shard = entry->shard;
+  uint32_t                  head = 0, size = 0;
+  char                     *data = NULL;
+
+  // entry already contains a response
+  if (entry->ready)
+    return true;
+
+  // only cache the successful responses that are stored in the memory
+  if (200 != res->code || res->body_fd > 0 || res->stream)
+    goto fail;
+
+  // don't share the cookies, or the responses that close the connection
+  if (NULL != ctorm_headers_get(res->headers, "set-cookie") ||
+      cu_has_token(ctorm_headers_get(res->headers, "connection"), "close"))
+    goto fail;
+
+  head = _ctorm_cache_head(res, NULL);
+  size = head + res->body_size;
+
+  if (size > shard->budget || NULL == (data = malloc(size)))
+    goto fail;
+
+  _ctorm_cache_head(res, data);
+  memcpy(data + head, res->body, res->body_size);
+
+  pthread_mutex_lock(&shard->mutex);
+
+  entry->code    = res->code;
+  entry->data    = data;
+  entry->size    = size;
+  entry->expires = _ctorm_cache_now() + entry->ttl;
+  entry->ready   = true;
+  shard->used += size;
+
+  _ctorm_cache_evict(shard, entry);
+
+  _ctorm_cache_wake(entry);
+  pthread_mutex_unlock(&shard->mutex);
+  return true;
+
+fail:
+  // remove the pending entry, so the waiting requests can create the response
+  pthread_mutex_lock(&shard->mutex);
+
+  if (entry->linked)
+    _ctorm_cache_unlink(entry);
+
+  _ctorm_cache_wake(entry);
+  pthread_mutex_unlock(&shard->mutex);
+  return false;
+}
+
+void ctorm_cache_release(struct ctorm_cache_entry *entry) {
+  if (NULL == entry)
+    return;
+
+  struct ctorm_cache_shard *shard = entry->shard;
+  pthread_mutex_lock(&shard->mutex);
+
+  // response is never stored, remove the pending entry
+  if (!entry->ready && entry->linked) {
+    _ctorm_cache_unlink(entry);
+    _ctorm_cache_wake(entry);
+  }
+
+  if (--entry->refs == 0 && !entry->linked)
+    _ctorm_cache_entry_free(entry);
+
+  pthread_mutex_unlock(&shard->mutex);
+}
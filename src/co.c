@@ -0,0 +1,583 @@
+#include "error.h"
+#include "util.h"
+#include "co.h"
+#include "log.h"
+
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// callee-saved registers that are pushed to the stack by cu_switch()
+#if defined(__x86_64__)
+#define CO_REGS (6)
+#else
+#define CO_REGS (4)
+#endif
+
+// event loop of the current thread, NULL if it's not a loop thread
+__thread struct ctorm_co_loop *_ctorm_co_loop = NULL;
+
+// first function that runs on the stack of a new coroutine
+void _ctorm_co_entry(void) {
+  struct ctorm_co_loop *loop = _ctorm_co_loop;
+  struct ctorm_co      *co   = loop->current;
+
+  co->func(co->data);
+  co->done = true;
+
+  // switch back to the loop, a done coroutine is never switched to again
+  cu_switch(&co->sp, loop->sp);
+}
+
+struct ctorm_co *_ctorm_co_new(
+    struct ctorm_co_loop *loop, ctorm_co_func_t func, void *data) {
+  long             page = sysconf(_SC_PAGESIZE);
+  struct ctorm_co *co   = NULL;
+  uintptr_t       *sp   = NULL;
+
+  // reuse an unused coroutine (and it's stack) if possible
+  if (NULL != (co = loop->stacks)) {
+    loop->stacks = co->next;
+    loop->stack_count--;
+    goto init;
+  }
+
+  if (NULL == (co = calloc(1, sizeof(*co)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  /*
+
+   * the first page of the mapping is the guard page, so a stack overflow
+   * crashes the program instead of silently corrupting the memory, the memory
+   * of the stack is only allocated when it's used
+
+  */
+  co->stack = mmap(NULL, page + CTORM_CO_STACK_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+
+  if (MAP_FAILED == co->stack) {
+    free(co);
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  if (mprotect(co->stack, page, PROT_NONE) != 0) {
+    munmap(co->stack, page + CTORM_CO_STACK_SIZE);
+    free(co);
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+init:
+  co->loop     = loop;
+  co->func     = func;
+  co->data     = data;
+  co->done     = false;
+  co->fd       = -1;
+  co->deadline = 0;
+  co->failed   = false;
+  co->prev     = NULL;
+  co->next     = NULL;
+
+  /*
+
+   * setup the stack like it's saved by cu_switch(), so switching to it pops
+   * the (zeroed) registers and returns to _ctorm_co_entry(), the entry
+   * function is called with a 16 byte aligned stack, and with a NULL return
+   * address, as it never returns
+
+  */
+  sp = (uintptr_t *)((uintptr_t)(co->stack + page + CTORM_CO_STACK_SIZE) &
+                     ~(uintptr_t)15);
+
+  *--sp = 0;
+  *--sp = (uintptr_t)_ctorm_co_entry;
+  sp -= CO_REGS;
+  memset(sp, 0, CO_REGS * sizeof(*sp));
+
+  co->sp = sp;
+  loop->count++;
+  return co;
+}
+
+void _ctorm_co_release(struct ctorm_co_loop *loop, struct ctorm_co *co) {
+  loop->count--;
+
+  // keep the stack for the next coroutine, unless we have enough of them
+  if (loop->stack_count < CTORM_CO_STACK_POOL) {
+    co->next     = loop->stacks;
+    loop->stacks = co;
+    loop->stack_count++;
+    return;
+  }
+
+  munmap(co->stack, sysconf(_SC_PAGESIZE) + CTORM_CO_STACK_SIZE);
+  free(co);
+}
+
+// adds the coroutine to the end of the ready queue
+void _ctorm_co_ready(struct ctorm_co_loop *loop, struct ctorm_co *co) {
+  co->next = NULL;
+
+  if (NULL == loop->ready_tail)
+    loop->ready = co;
+  else
+    loop->ready_tail->next = co;
+
+  loop->ready_tail = co;
+}
+
+// stops waiting for I/O and adds the coroutine to the ready queue
+void _ctorm_co_wake(
+    struct ctorm_co_loop *loop, struct ctorm_co *co, bool failed) {
+  if (NULL != co->prev)
+    co->prev->next = co->next;
+  else
+    loop->waiting = co->next;
+
+  if (NULL != co->next)
+    co->next->prev = co->prev;
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, co->fd, NULL);
+
+  co->failed = failed;
+  co->prev   = NULL;
+  _ctorm_co_ready(loop, co);
+}
+
+// switches to the coroutines that were ready before the call
+void _ctorm_co_run(struct ctorm_co_loop *loop) {
+  struct ctorm_co *co = NULL, *last = loop->ready_tail;
+
+  while (NULL != (co = loop->ready)) {
+    if (NULL == (loop->ready = co->next))
+      loop->ready_tail = NULL;
+
+    loop->current = co;
+    cu_switch(&loop->sp, co->sp);
+    loop->current = NULL;
+
+    if (co->done)
+      _ctorm_co_release(loop, co);
+
+    // coroutines that yielded during this round run in the next one
+    if (co == last)
+      break;
+  }
+}
+
+// creates coroutines for the queued works, and runs the woken up coroutines
+void _ctorm_co_queue(struct ctorm_co_loop *loop) {
+  struct ctorm_co_work *work = NULL, *next = NULL;
+  struct ctorm_co      *co = NULL, *woken = NULL;
+  uint64_t              val = 0;
+
+  if (read(loop->wakefd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+    debug("failed to read the coroutine loop eventfd: %s", strerror(errno));
+
+  pthread_mutex_lock(&loop->mutex);
+
+  work        = loop->head;
+  woken       = loop->woken;
+  loop->head  = loop->tail = NULL;
+  loop->woken = NULL;
+
+  // the loop stops after all the coroutines are done
+  if (loop->stop)
+    loop->closing = true;
+
+  pthread_mutex_unlock(&loop->mutex);
+
+  for (; NULL != woken; woken = co) {
+    co = woken->next;
+    _ctorm_co_ready(loop, woken);
+  }
+
+  for (; NULL != work; work = next) {
+    next = work->next;
+
+    if (NULL != (co = _ctorm_co_new(loop, work->func, work->data)))
+      _ctorm_co_ready(loop, co);
+
+    /*
+
+     * if we can't create a coroutine, call the function on the loop thread,
+     * it can't wait for I/O so it should fail quickly, and release the data
+
+    */
+    else {
+      debug("failed to create a coroutine: %s", ctorm_error());
+      work->func(work->data);
+    }
+
+    free(work);
+  }
+}
+
+// coroutine loop thread, runs the coroutines and waits for their I/O
+void *_ctorm_co_loop_thread(void *_loop) {
+  struct ctorm_co_loop *loop = _loop;
+  struct ctorm_co      *co = NULL, *next = NULL;
+  struct epoll_event    events[CTORM_CO_EVENTS];
+  int                   count = 0, i = 0, timeout = 0;
+  time_t                now = 0;
+
+  _ctorm_co_loop = loop;
+
+  for (;;) {
+    _ctorm_co_run(loop);
+
+    // when the loop is stopping, all the waits fail
+    if (loop->closing) {
+      while (NULL != loop->waiting)
+        _ctorm_co_wake(loop, loop->waiting, true);
+
+      if (0 == loop->count)
+        break;
+    }
+
+    // don't sleep if there are ready coroutines, check the timeouts every sec
+    if (NULL != loop->ready)
+      timeout = 0;
+    else if (NULL != loop->waiting)
+      timeout = 1000;
+    else
+      timeout = -1;
+
+    if ((count = epoll_wait(loop->epfd, events, CTORM_CO_EVENTS, timeout)) <
+        0) {
+      if (errno == EINTR)
+        continue;
+
+      debug("coroutine loop failed: %s", strerror(errno));
+      loop->closing = true;
+      continue;
+    }
+
+    for (i = 0; i < count; i++) {
+      if (NULL == events[i].data.ptr)
+        _ctorm_co_queue(loop);
+      else
+        _ctorm_co_wake(loop, events[i].data.ptr, false);
+    }
+
+    if (NULL == loop->waiting)
+      continue;
+
+    now = time(NULL);
+
+    for (co = loop->waiting; NULL != co; co = next) {
+      next = co->next;
+
+      if (0 != co->deadline && co->deadline <= now)
+        _ctorm_co_wake(loop, co, true);
+    }
+  }
+
+  _ctorm_co_loop = NULL;
+  return NULL;
+}
+
+struct ctorm_co_loop *ctorm_co_loop_new(ctorm_cpus_t *cpus, uint32_t index) {
+  struct ctorm_co_loop *loop = NULL;
+  struct epoll_event    ev   = {.events = EPOLLIN, .data.ptr = NULL};
+  pthread_attr_t        attr;
+
+  if (NULL == (loop = calloc(1, sizeof(*loop)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  loop->wakefd = -1;
+
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    goto fail_free;
+
+  if ((loop->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+      epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0)
+    goto fail_close;
+
+  if (pthread_mutex_init(&loop->mutex, NULL) != 0) {
+    errno = CTORM_ERR_MUTEX_FAIL;
+    goto fail_close;
+  }
+
+  // pin the loop to it's CPU, so the coroutine stacks stay in the local memory
+  pthread_attr_init(&attr);
+
+  if (NULL != cpus)
+    ctorm_cpus_attr(cpus, &attr, index, false);
+
+  if (pthread_create(&loop->thread, &attr, _ctorm_co_loop_thread, loop) != 0) {
+    pthread_attr_destroy(&attr);
+    pthread_mutex_destroy(&loop->mutex);
+    goto fail_close;
+  }
+
+  pthread_attr_destroy(&attr);
+  return loop;
+
+fail_close:
+  if (loop->wakefd >= 0)
+    close(loop->wakefd);
+  close(loop->epfd);
+
+fail_free:
+  free(loop);
+  return NULL;
+}
+
+bool ctorm_co_start(
+    struct ctorm_co_loop *loop, ctorm_co_func_t func, void *data) {
+  struct ctorm_co_work *work  = NULL;
+  uint64_t              val   = 1;
+  bool                  empty = false;
+
+  if (NULL == (work = malloc(sizeof(*work)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  work->func = func;
+  work->data = data;
+  work->next = NULL;
+
+  pthread_mutex_lock(&loop->mutex);
+
+  if (loop->stop) {
+    pthread_mutex_unlock(&loop->mutex);
+    free(work);
+    errno = CTORM_ERR_POOL_FAIL;
+    return false;
+  }
+
+  empty = NULL == loop->tail && NULL == loop->woken;
+
+  if (NULL == loop->tail)
+    loop->head = work;
+  else
+    loop->tail->next = work;
+
+  loop->tail = work;
+  pthread_mutex_unlock(&loop->mutex);
+
+  // if the queue was not empty, the loop thread is already woken up
+  if (empty && write(loop->wakefd, &val, sizeof(val)) < 0)
+    debug("failed to wake up the coroutine loop: %s", strerror(errno));
+
+  return true;
+}
+
+void ctorm_co_loop_stop(struct ctorm_co_loop *loop) {
+  uint64_t val = 1;
+
+  if (NULL == loop)
+    return;
+
+  pthread_mutex_lock(&loop->mutex);
+  loop->stop = true;
+  pthread_mutex_unlock(&loop->mutex);
+
+  // wake up the loop thread, and wait for the coroutines to complete
+  if (write(loop->wakefd, &val, sizeof(val)) == sizeof(val))
+    pthread_join(loop->thread, NULL);
+}
+
+void ctorm_co_loop_free(struct ctorm_co_loop *loop) {
+  struct ctorm_co *co = NULL;
+
+  if (NULL == loop)
+    return;
+
+  while (NULL != (co = loop->stacks)) {
+    loop->stacks = co->next;
+    munmap(co->stack, sysconf(_SC_PAGESIZE) + CTORM_CO_STACK_SIZE);
+    free(co);
+  }
+
+  pthread_mutex_destroy(&loop->mutex);
+  close(loop->wakefd);
+  close(loop->epfd);
+  free(loop);
+}
+
+bool ctorm_co_active(void) {
+  return NULL != _ctorm_co_loop && NULL != _ctorm_co_loop->current;
+}
+
+bool ctorm_co_wait(int fd, uint32_t events, time_t timeout) {
+  struct ctorm_co_loop *loop = _ctorm_co_loop;
+  struct ctorm_co      *co   = NULL;
+  struct epoll_event    ev   = {.events = events};
+
+  // not running on a coroutine, caller should fail with the I/O error
+  if (NULL == loop || NULL == (co = loop->current))
+    return false;
+
+  if (loop->closing) {
+    errno = ECANCELED;
+    return false;
+  }
+
+  ev.data.ptr = co;
+
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    return false;
+
+  co->fd       = fd;
+  co->deadline = timeout > 0 ? time(NULL) + timeout : 0;
+  co->prev     = NULL;
+
+  if (NULL != (co->next = loop->waiting))
+    co->next->prev = co;
+  loop->waiting = co;
+
+  // switch back to the loop until the fd is ready
+  cu_switch(&co->sp, loop->sp);
+
+  if (co->failed) {
+    errno = loop->closing ? ECANCELED : ETIMEDOUT;
+    return false;
+  }
+
+  return true;
+}
+
+void ctorm_co_yield(void) {
+  struct ctorm_co_loop *loop = _ctorm_co_loop;
+  struct ctorm_co      *co   = NULL;
+
+  if (NULL == loop || NULL == (co = loop->current))
+    return;
+
+  _ctorm_co_ready(loop, co);
+  cu_switch(&co->sp, loop->sp);
+}
+
+struct ctorm_co *ctorm_co_self(void) {
+  return NULL == _ctorm_co_loop ? NULL : _ctorm_co_loop->current;
+}
+
+void ctorm_co_park(void) {
+  struct ctorm_co_loop *loop = _ctorm_co_loop;
+  struct ctorm_co      *co   = NULL;
+
+  // the coroutine is only added to the ready queue by the loop thread
+  if (NULL != loop && NULL != (co = loop->current))
+    cu_switch(&co->sp, loop->sp);
+}
+
+// adds a parked coroutine to the ready queue of it's loop, from any thread
+void ctorm_co_resume(struct ctorm_co *co) {
+  struct ctorm_co_loop *loop  = co->loop;
+  uint64_t              val   = 1;
+  bool                  empty = false;
+
+  if (_ctorm_co_loop == loop) {
+    _ctorm_co_ready(loop, co);
+    return;
+  }
+
+  pthread_mutex_lock(&loop->mutex);
+
+  empty       = NULL == loop->tail && NULL == loop->woken;
+  co->next    = loop->woken;
+  loop->woken = co;
+
+  pthread_mutex_unlock(&loop->mutex);
+
+  // if the queue was not empty, the loop thread is already woken up
+  if (empty && write(loop->wakefd, &val, sizeof(val)) < 0)
+    debug("failed to wake up the coroutine loop: %s", strerror(errno));
+}
+
+bool ctorm_co_mutex_init(ctorm_co_mutex_t *mutex) {
+  memset(mutex, 0, sizeof(*mutex));
+
+  if (pthread_mutex_init(&mutex->mutex, NULL) != 0)
+    return false;
+
+  if (pthread_cond_init(&mutex->cond, NULL) != 0) {
+    pthread_mutex_destroy(&mutex->mutex);
+    return false;
+  }
+
+  return true;
+}
+
+void ctorm_co_mutex_destroy(ctorm_co_mutex_t *mutex) {
+  pthread_mutex_destroy(&mutex->mutex);
+  pthread_cond_destroy(&mutex->cond);
+}
+
+void ctorm_co_lock(ctorm_co_mutex_t *mutex) {
+  struct ctorm_co *co = ctorm_co_self();
+
+  pthread_mutex_lock(&mutex->mutex);
+
+  if (!mutex->locked) {
+    mutex->locked = true;
+    pthread_mutex_unlock(&mutex->mutex);
+    return;
+  }
+
+  // threads that are not running a coroutine can just block
+  if (NULL == co) {
+    for (mutex->threads++; mutex->locked;)
+      pthread_cond_wait(&mutex->cond, &mutex->mutex);
+
+    mutex->threads--;
+    mutex->locked = true;
+    pthread_mutex_unlock(&mutex->mutex);
+    return;
+  }
+
+  /*
+
+   * the mutex may be held by an another coroutine of the same thread, so
+   * blocking here would never release it, instead park the coroutine until
+   * the lock is passed to it by ctorm_co_unlock()
+
+  */
+  co->next = NULL;
+
+  if (NULL == mutex->tail)
+    mutex->head = co;
+  else
+    mutex->tail->next = co;
+
+  mutex->tail = co;
+  pthread_mutex_unlock(&mutex->mutex);
+
+  ctorm_co_park();
+}
+
+void ctorm_co_unlock(ctorm_co_mutex_t *mutex) {
+  struct ctorm_co *co = NULL;
+
+  pthread_mutex_lock(&mutex->mutex);
+
+  // pass the lock to the first parked coroutine
+  if (NULL != (co = mutex->head)) {
+    if (NULL == (mutex->head = co->next))
+      mutex->tail = NULL;
+
+    pthread_mutex_unlock(&mutex->mutex);
+    ctorm_co_resume(co);
+    return;
+  }
+
+  mutex->locked = false;
+
+  if (mutex->threads > 0)
+    pthread_cond_signal(&mutex->cond);
+
+  pthread_mutex_unlock(&mutex->mutex);
+}
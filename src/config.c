@@ -20,8 +20,26 @@ ctorm_config_t *ctorm_config_new(ctorm_config_t *config) {
   config->handle_signal   = true;
   config->server_header   = true;
   config->lock_request    = true;
+  config->io_uring        = false;
+  config->http2           = false;
+  config->coroutines      = false;
+  config->cpus            = NULL;
   config->tcp_timeout     = 10;
+  config->drain_timeout   = 0;
+  config->handoff_path    = NULL;
   config->pool_size       = 30;
+  config->pool_max        = 0;
+  config->workers         = 0;
+  config->backlog         = 0;
+  config->defer_accept    = 0;
+  config->fastopen        = 0;
+  config->rcvbuf_size     = 0;
+  config->sndbuf_size     = 0;
+  config->log_format      = CTORM_LOG_TEXT;
+  config->log_path        = NULL;
+  config->log_queue       = 512;
+  config->cache_size      = 16 * 1024 * 1024;
+  config->max_body_size   = 0;
 
   return config;
 }
@@ -41,15 +59,37 @@ bool ctorm_config_check(ctorm_config_t *config) {
     warn("setting the TCP timeout to 0 may allow attackers to DoS your "
          "application");
 
+  if (config->drain_timeout < 0) {
+    errno = CTORM_ERR_BAD_DRAIN_TIMEOUT;
+    return false;
+  }
+
+  if (config->defer_accept < 0) {
+    errno = CTORM_ERR_BAD_DEFER_ACCEPT;
+    return false;
+  }
+
   if (config->max_connections <= 0) {
     errno = CTORM_ERR_BAD_MAX_CONN_COUNT;
     return false;
   }
 
-  if (config->pool_size <= 0) {
+  if (config->pool_size <= 0 ||
+      (config->pool_max != 0 && config->pool_max < config->pool_size)) {
     errno = CTORM_ERR_BAD_POOL_SIZE;
     return false;
   }
 
+  if (config->log_format != CTORM_LOG_TEXT &&
+      config->log_format != CTORM_LOG_JSON) {
+    errno = CTORM_ERR_BAD_LOG_FORMAT;
+    return false;
+  }
+
+  if (!config->disable_logging && config->log_queue == 0) {
+    errno = CTORM_ERR_BAD_LOG_QUEUE_SIZE;
+    return false;
+  }
+
   return true;
 }
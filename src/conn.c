@@ -1,13 +1,38 @@
 #include <netinet/in.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "error.h"
+#include "uring.h"
 #include "conn.h"
+#include "co.h"
 #include "log.h"
 
+// receives data from the socket, using the I/O backend of the connection
+#define conn_recv(buf, len, flags) _ctorm_conn_recv(conn, buf, len, flags)
+
+int64_t _ctorm_conn_recv(
+    ctorm_conn_t *conn, void *buf, uint64_t len, int flags) {
+  int64_t ret = 0;
+
+  if (NULL != conn->ring)
+    return ctorm_uring_recv(
+        conn->ring, conn->socket, buf, len, flags, conn->timeout);
+
+  // on a coroutine the socket is non-blocking, so wait until it's readable
+  while ((ret = recv(conn->socket, buf, len, flags)) < 0 && errno == EAGAIN &&
+         ctorm_co_wait(conn->socket, EPOLLIN, conn->timeout))
+    continue;
+
+  return ret;
+}
+
 char *ctorm_conn_ip(ctorm_conn_t *conn, char *buf) {
   if (NULL == buf)
     buf = calloc(1, INET6_ADDRSTRLEN + 1);
@@ -17,7 +42,7 @@ char *ctorm_conn_ip(ctorm_conn_t *conn, char *buf) {
     return NULL;
   }
 
-  switch (conn->addr.sa_family) {
+  switch (conn->addr.ss_family) {
   case AF_INET:
     inet_ntop(AF_INET,
         &((struct sockaddr_in *)&conn->addr)->sin_addr,
@@ -31,11 +56,177 @@ char *ctorm_conn_ip(ctorm_conn_t *conn, char *buf) {
         buf,
         INET6_ADDRSTRLEN);
     break;
+
+  // Unix socket clients don't have an IP address
+  default:
+    buf[0] = '\0';
   }
 
   return buf;
 }
 
+int64_t ctorm_conn_recv(
+    ctorm_conn_t *conn, void *buf, uint64_t len, int flags) {
+  uint64_t total = 0, avail = 0;
+  int64_t  ret   = 0;
+
+  while (total < len) {
+    // copy the buffered data first
+    if ((avail = conn->buf_len - conn->buf_pos) > 0) {
+      if (avail > len - total)
+        avail = len - total;
+
+      memcpy((char *)buf + total, conn->buf + conn->buf_pos, avail);
+      total += avail;
+
+      // peeking does not consume the buffered data
+      if (flags & MSG_PEEK)
+        break;
+
+      conn->buf_pos += avail;
+      continue;
+    }
+
+    // like recv(), only wait for more data if MSG_WAITALL is specified
+    if (total > 0 && !(flags & MSG_WAITALL))
+      break;
+
+    // no need to copy large reads through the buffer
+    if (len - total >= sizeof(conn->buf) && !(flags & MSG_PEEK))
+      ret = conn_recv((char *)buf + total, len - total, flags);
+
+    // otherwise fill the buffer as much as we can
+    else if ((ret = conn_recv(conn->buf, sizeof(conn->buf), 0)) > 0) {
+      conn->buf_pos = 0;
+      conn->buf_len = ret;
+      continue;
+    }
+
+    if (ret <= 0)
+      return total > 0 ? (int64_t)total : ret;
+
+    total += ret;
+  }
+
+  return total;
+}
+
+int64_t ctorm_conn_chunk(ctorm_conn_t *conn, char **chunk, uint64_t max) {
+  uint64_t avail = conn->buf_len - conn->buf_pos;
+  int64_t  ret   = 0;
+
+  // fill the buffer if there's no buffered data left
+  if (0 == avail) {
+    if ((ret = conn_recv(conn->buf, sizeof(conn->buf), 0)) <= 0) {
+      // connection is closed before we received the data
+      if (ret == 0)
+        errno = ECONNRESET;
+      return -1;
+    }
+
+    conn->buf_pos = 0;
+    conn->buf_len = avail = ret;
+  }
+
+  if (avail > max)
+    avail = max;
+
+  // return the buffered data without copying it
+  *chunk = conn->buf + conn->buf_pos;
+  conn->buf_pos += avail;
+  return avail;
+}
+
+char *ctorm_conn_peek(ctorm_conn_t *conn, uint32_t len) {
+  if (len > sizeof(conn->buf)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  int64_t ret = 0;
+
+  if (conn->buf_len - conn->buf_pos >= len)
+    return conn->buf + conn->buf_pos;
+
+  // move the unread data to the start of the buffer to make room
+  memmove(conn->buf, conn->buf + conn->buf_pos, conn->buf_len - conn->buf_pos);
+  conn->buf_len -= conn->buf_pos;
+  conn->buf_pos = 0;
+
+  while (conn->buf_len < len) {
+    ret = conn_recv(
+        conn->buf + conn->buf_len, sizeof(conn->buf) - conn->buf_len, 0);
+
+    if (ret <= 0) {
+      // connection is closed before we received enough data
+      if (ret == 0)
+        errno = ECONNRESET;
+      return NULL;
+    }
+
+    conn->buf_len += ret;
+  }
+
+  return conn->buf;
+}
+
+bool ctorm_conn_sendv(ctorm_conn_t *conn, struct iovec *iov, int count) {
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = count};
+  int64_t       ret = 0;
+
+  while (msg.msg_iovlen > 0) {
+    if (NULL != conn->ring)
+      ret = ctorm_uring_sendmsg(conn->ring, conn->socket, &msg);
+    else
+      ret = sendmsg(conn->socket, &msg, MSG_NOSIGNAL);
+
+    // on a coroutine, wait until the socket is writable
+    if (ret < 0 && errno == EAGAIN &&
+        ctorm_co_wait(conn->socket, EPOLLOUT, conn->timeout))
+      continue;
+
+    if (ret < 0)
+      return false;
+
+    // skip the buffers that are completely sent
+    for (; msg.msg_iovlen > 0 && (uint64_t)ret >= msg.msg_iov->iov_len;
+        msg.msg_iov++, msg.msg_iovlen--)
+      ret -= msg.msg_iov->iov_len;
+
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + ret;
+      msg.msg_iov->iov_len -= ret;
+    }
+  }
+
+  return true;
+}
+
+bool ctorm_conn_sendfile(ctorm_conn_t *conn, struct iovec *iov, int count,
+    int fd, off_t offset, uint64_t size) {
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = count};
+  ssize_t       ret = 0;
+
+  // io_uring sends the buffers and the file with linked operations
+  if (NULL != conn->ring)
+    return ctorm_uring_sendfile(
+        conn->ring, conn->socket, count > 0 ? &msg : NULL, fd, offset, size);
+
+  if (!ctorm_conn_sendv(conn, iov, count))
+    return false;
+
+  while (size > 0) {
+    if ((ret = sendfile(conn->socket, fd, &offset, size)) > 0)
+      size -= ret;
+
+    else if (ret == 0 || errno != EAGAIN ||
+             !ctorm_co_wait(conn->socket, EPOLLOUT, conn->timeout))
+      return false;
+  }
+
+  return true;
+}
+
 void ctorm_conn_close(ctorm_conn_t *conn) {
   if (NULL != conn && conn->socket > 0)
     close(conn->socket);
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+
+#include "error.h"
+#include "util.h"
+#include "cpu.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <stdio.h>
+
+// get the NUMA node of the CPU from sysfs, 0 if the system is not NUMA
+uint32_t _ctorm_cpu_node(uint32_t cpu) {
+  char           path[64];
+  struct dirent *ent  = NULL;
+  DIR           *dir  = NULL;
+  uint32_t       node = 0;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+
+  if (NULL == (dir = opendir(path)))
+    return 0;
+
+  // CPU directory contains a link to it's node, such as "node1"
+  while (NULL != (ent = readdir(dir))) {
+    if (cu_startswith(ent->d_name, "node") && cu_is_digit(ent->d_name[4])) {
+      node = strtoul(ent->d_name + 4, NULL, 10);
+      break;
+    }
+  }
+
+  closedir(dir);
+  return node;
+}
+
+// parses a CPU list in the sysfs list format, such as "0-3,8,10-11"
+bool _ctorm_cpus_parse(char *list, cpu_set_t *set) {
+  unsigned long first = 0, last = 0;
+  char         *end   = NULL;
+
+  CPU_ZERO(set);
+
+  while (true) {
+    if (!cu_is_digit(*list))
+      return false;
+
+    first = last = strtoul(list, &end, 10);
+
+    if ('-' == *end) {
+      if (!cu_is_digit(*(list = end + 1)))
+        return false;
+      last = strtoul(list, &end, 10);
+    }
+
+    if (first > last || last >= CPU_SETSIZE)
+      return false;
+
+    for (; first <= last; first++)
+      CPU_SET(first, set);
+
+    if ('\0' == *end)
+      return true;
+
+    if (',' != *end)
+      return false;
+
+    list = end + 1;
+  }
+}
+
+ctorm_cpus_t *ctorm_cpus_new(char *list) {
+  ctorm_cpus_t    *cpus = NULL;
+  struct ctorm_cpu cpu;
+  cpu_set_t        set;
+  uint32_t         i = 0, k = 0;
+
+  if (NULL == list || !_ctorm_cpus_parse(list, &set)) {
+    errno = CTORM_ERR_BAD_CPU_LIST;
+    return NULL;
+  }
+
+  if (NULL == (cpus = malloc(sizeof(*cpus) + CPU_COUNT(&set) * sizeof(cpu)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  cpus->count = 0;
+
+  for (i = 0; i < CPU_SETSIZE; i++) {
+    if (!CPU_ISSET(i, &set))
+      continue;
+
+    cpu.id   = i;
+    cpu.node = _ctorm_cpu_node(i);
+
+    // keep the CPUs of the same node together (insertion sort)
+    for (k = cpus->count; k > 0 && cpus->list[k - 1].node > cpu.node; k--)
+      cpus->list[k] = cpus->list[k - 1];
+
+    cpus->list[k] = cpu;
+    cpus->count++;
+  }
+
+  debug("using %u CPUs from the list \"%s\"", cpus->count, list);
+  return cpus;
+}
+
+void ctorm_cpus_attr(
+    ctorm_cpus_t *cpus, pthread_attr_t *attr, uint32_t index, bool node) {
+  struct ctorm_cpu *cpu = &cpus->list[index % cpus->count];
+  cpu_set_t         set;
+
+  CPU_ZERO(&set);
+
+  // pin to the CPU, or to all the listed CPUs of it's node
+  for (uint32_t i = 0; i < cpus->count; i++)
+    if (cpus->list[i].id == cpu->id ||
+        (node && cpus->list[i].node == cpu->node))
+      CPU_SET(cpus->list[i].id, &set);
+
+  pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+void ctorm_cpus_pin(ctorm_cpus_t *cpus) {
+  cpu_set_t set;
+  int       ret = 0;
+
+  CPU_ZERO(&set);
+
+  for (uint32_t i = 0; i < cpus->count; i++)
+    CPU_SET(cpus->list[i].id, &set);
+
+  if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+    debug("failed to set the CPU affinity: %s", strerror(ret));
+}
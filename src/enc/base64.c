@@ -0,0 +1,32 @@
+#include "encoding.h"
+
+#include <stdint.h>
+
+static const char _ctorm_base64_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+uint32_t ctorm_base64_encode(const void *data, uint32_t size, char *out) {
+  const uint8_t *pos = data;
+  uint32_t       len = 0, val = 0;
+
+  // every 3 bytes are encoded as 4 chars
+  for (; size >= 3; size -= 3, pos += 3) {
+    val        = pos[0] << 16 | pos[1] << 8 | pos[2];
+    out[len++] = _ctorm_base64_table[(val >> 18) & 63];
+    out[len++] = _ctorm_base64_table[(val >> 12) & 63];
+    out[len++] = _ctorm_base64_table[(val >> 6) & 63];
+    out[len++] = _ctorm_base64_table[val & 63];
+  }
+
+  // encode the remaining bytes with padding
+  if (size > 0) {
+    val        = pos[0] << 16 | (size > 1 ? pos[1] << 8 : 0);
+    out[len++] = _ctorm_base64_table[(val >> 18) & 63];
+    out[len++] = _ctorm_base64_table[(val >> 12) & 63];
+    out[len++] = size > 1 ? _ctorm_base64_table[(val >> 6) & 63] : '=';
+    out[len++] = '=';
+  }
+
+  out[len] = 0;
+  return len;
+}
@@ -3,7 +3,19 @@
 
 #include <stdlib.h>
 #include <stdint.h>
-#include <stdio.h>
+
+// value of every hex digit plus one, so the chars that are not hex digits are 0
+static const uint8_t _ctorm_hex_table[256] = {
+    // clang-format off
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+    ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    // clang-format on
+};
+
+#define ctorm_is_hex(c)  (_ctorm_hex_table[(uint8_t)(c)] != 0)
+#define ctorm_hex_val(c) (_ctorm_hex_table[(uint8_t)(c)] - 1)
 
 uint32_t ctorm_percent_decode(char *data, uint32_t size) {
   if (NULL == data)
@@ -16,7 +28,11 @@ uint32_t ctorm_percent_decode(char *data, uint32_t size) {
   uint32_t len = 0;
   uint8_t  val = 0;
 
-  for (; *cur != 0 && size > 0; cur++, pos++, size--, len++) {
+  // skip the leading chars that don't need decoding, no need to copy them
+  for (; *cur != 0 && size > 0 && *cur != '%' && *cur != '+'; size--, len++)
+    cur++;
+
+  for (pos = cur; *cur != 0 && size > 0; cur++, pos++, size--, len++) {
     switch (*cur) {
     // '+' in percent encoding means space
     case '+':
@@ -26,11 +42,10 @@ uint32_t ctorm_percent_decode(char *data, uint32_t size) {
     // '%' marks the start of a percent encoded char
     case '%':
       // we need at least 3 chars for a proper encoding
-      if (size < 3)
+      if (size < 3 || !ctorm_is_hex(cur[1]) || !ctorm_is_hex(cur[2]))
         break;
 
-      // scan the next 2 chars as hex
-      sscanf(cur + 1, "%02hhx", &val);
+      val = ctorm_hex_val(cur[1]) << 4 | ctorm_hex_val(cur[2]);
 
       // ignore encoded NULL bytes for safety
       if (val == 0)
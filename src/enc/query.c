@@ -1,12 +1,12 @@
 #include "encoding.h"
 
 #include "error.h"
-#include "pair.h"
 #include "util.h"
 
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #define QUERY_KEY_MAX   (256)
 #define QUERY_VALUE_MAX (1024)
@@ -18,114 +18,103 @@ ctorm_query_t *ctorm_query_parse(char *data, uint32_t size) {
   if (size == 0)
     size = cu_strlen(data);
 
-  ctorm_query_t *query  = NULL;
-  bool           is_key = true;
-  cu_str_t       cur;
+  ctorm_query_t *query = NULL;
+  uint32_t       count = 1, i = 0;
+  char          *buf = NULL, *end = NULL, *key = NULL, *value = NULL;
 
-  // clear the string structure
-  cu_str_clear(&cur);
+  // every '&' separates a pair, so this gives us the max pair count
+  for (; i < size; i++)
+    if (data[i] == '&')
+      count++;
 
-  for (; size > 0; size--, data++) {
-    // check the size of the current string buffer
-    if (is_key && cur.len > QUERY_KEY_MAX) {
-      errno = CTORM_ERR_QUERY_KEY_TOO_LARGE;
-      goto fail;
-    }
-
-    if (!is_key && cur.len > QUERY_VALUE_MAX) {
-      errno = CTORM_ERR_QUERY_VALUE_TOO_LARGE;
-      goto fail;
-    }
-
-    /*
-
-     * key=value
-     *    ^
-     * at this position we should add a new pair, as we have read the entire key
-     * into the buffer
-
-     * however it is possible that the data just starts with '=' so we also
-     * check if the buffer is empty to make sure we don't add a pair with an
-     * empty key
-
-   */
-    if (*data == '=' && is_key && !cu_str_empty(&cur)) {
-      // percent decode the current string buffer and create a new pair
-      cur.len = ctorm_percent_decode(cur.buf, cur.len);
-      ctorm_pair_add(&query, cur.buf, NULL);
-
-      cu_str_clear(&cur);
-      is_key = false;
-      continue;
-    }
-
-    if ((*data != '&' && size != 1) || is_key) {
-      cu_str_add(&cur, *data);
-      continue;
-    }
+  // pairs and the copy of the query data are stored in a single allocation
+  if (NULL == (query = malloc(sizeof(*query) +
+                              sizeof(query->pairs[0]) * count + size + 1))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
 
-    /*
+  buf = (char *)(query->pairs + count);
+  memcpy(buf, data, size);
+  buf[size] = 0;
 
-     * key=value\0
-     *         ^
+  query->decoded = false;
+  query->count   = 0;
 
-     * at this position we should the 'e' before moving on and adding the value
-     * to the last pair
+  /*
 
-    */
-    if (*data != '&' && !is_key)
-      cu_str_add(&cur, *data);
+   * key=value&other_key=other_value
+   * ^        ^
+   * key      end
 
-    /*
+   * every pair is split in place by replacing the '=' and '&' with NULL
+   * terminators, percent decoding is deferred until a value is requested
 
-     * key=value&other_key=other_value
-     *          ^
+  */
+  for (key = buf; key < buf + size; key = end + 1) {
+    if (NULL == (end = memchr(key, '&', buf + size - key)))
+      end = buf + size;
 
-     * at this point we have the entire value in the string buffer, we can just
-     * add the value to the last pair, associating it with the last key we added
+    *end = 0;
 
-    */
-    if (cu_str_empty(&cur))
+    // ignore the pairs with no value or an empty key
+    if (NULL == (value = memchr(key, '=', end - key)) || value == key)
       continue;
 
-    // percent decode the query value
-    cur.len = ctorm_percent_decode(cur.buf, cur.len);
+    *value++ = 0;
 
-    // store it in the last pair
-    if (NULL != query)
-      query->value = cur.buf;
+    // check the size of the key and the value
+    if (value - key - 1 > QUERY_KEY_MAX) {
+      errno = CTORM_ERR_QUERY_KEY_TOO_LARGE;
+      goto fail;
+    }
 
-    cu_str_clear(&cur);
-    is_key = true;
-  }
+    if (end - value > QUERY_VALUE_MAX) {
+      errno = CTORM_ERR_QUERY_VALUE_TOO_LARGE;
+      goto fail;
+    }
 
-  cu_str_free(&cur);
+    query->pairs[query->count].key     = key;
+    query->pairs[query->count++].value = *value == 0 ? NULL : value;
+  }
 
-  if (NULL == query)
-    errno = CTORM_ERR_EMPTY_QUERY;
+  if (query->count != 0)
+    return query;
 
-  return query;
+  errno = CTORM_ERR_EMPTY_QUERY;
 
 fail:
-  cu_str_free(&cur);
-  ctorm_query_free(query);
+  free(query);
   return NULL;
 }
 
 char *ctorm_query_get(ctorm_query_t *query, char *name) {
-  if ((query = ctorm_pair_find(query, name)) == NULL)
+  if (NULL == query || NULL == name) {
+    errno = EINVAL;
     return NULL;
-  return query->value;
-}
+  }
 
-void ctorm_query_free(ctorm_query_t *query) {
-  if (NULL == query)
-    return;
+  uint32_t i = 0;
 
-  ctorm_pair_next(query, cur) {
-    free(cur->key);
-    free(cur->value);
+  // percent decode all the pairs when the query is first accessed
+  if (!query->decoded) {
+    for (; i < query->count; i++) {
+      ctorm_percent_decode(query->pairs[i].key, 0);
+      ctorm_percent_decode(query->pairs[i].value, 0);
+    }
+
+    query->decoded = true;
   }
 
-  ctorm_pair_free(query);
+  // search backwards, so the last value of a repeated key is returned
+  for (i = query->count; i > 0; i--)
+    if (cu_streq(query->pairs[i - 1].key, name))
+      return query->pairs[i - 1].value;
+
+  errno = EFAULT;
+  return NULL;
+}
+
+void ctorm_query_free(ctorm_query_t *query) {
+  free(query);
 }
@@ -0,0 +1,78 @@
+#include "encoding.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#define sha1_rol(val, n) (((val) << (n)) | ((val) >> (32 - (n))))
+
+// processes a single 64 byte block, see RFC 3174 section 6.1
+void _ctorm_sha1_block(uint32_t *state, const uint8_t *block) {
+  uint32_t w[80], a = state[0], b = state[1], c = state[2], d = state[3],
+                  e = state[4], f = 0, k = 0, tmp = 0;
+  uint8_t i = 0;
+
+  for (; i < 16; i++)
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+           (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+
+  for (; i < 80; i++)
+    w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  for (i = 0; i < 80; i++) {
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+
+    tmp = sha1_rol(a, 5) + f + e + k + w[i];
+    e   = d;
+    d   = c;
+    c   = sha1_rol(b, 30);
+    b   = a;
+    a   = tmp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void ctorm_sha1(const void *data, uint64_t size, uint8_t *digest) {
+  uint32_t state[5] = {
+      0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+  const uint8_t *pos  = data;
+  uint64_t       bits = size * 8;
+  uint8_t        block[64], i = 0;
+
+  for (; size >= sizeof(block); size -= sizeof(block), pos += sizeof(block))
+    _ctorm_sha1_block(state, pos);
+
+  // pad the last block, and append the message length (in bits)
+  memset(block, 0, sizeof(block));
+  memcpy(block, pos, size);
+  block[size] = 0x80;
+
+  if (size >= sizeof(block) - 8) {
+    _ctorm_sha1_block(state, block);
+    memset(block, 0, sizeof(block));
+  }
+
+  for (i = 0; i < 8; i++)
+    block[sizeof(block) - 1 - i] = bits >> (i * 8);
+
+  _ctorm_sha1_block(state, block);
+
+  for (i = 0; i < 20; i++)
+    digest[i] = state[i / 4] >> (24 - (i % 4) * 8);
+}
@@ -11,8 +11,12 @@ struct ctorm_error_desc {
 
 struct ctorm_error_desc _ctorm_err_descs[] = {
     {CTORM_ERR_BAD_TCP_TIMEOUT,       "invalid TCP timeout"                   },
+    {CTORM_ERR_BAD_DRAIN_TIMEOUT,     "invalid drain timeout"                 },
+    {CTORM_ERR_BAD_DEFER_ACCEPT,      "invalid deferred accept timeout"       },
     {CTORM_ERR_BAD_POOL_SIZE,         "invalid pool size"                     },
     {CTORM_ERR_BAD_MAX_CONN_COUNT,    "invalid max connection count"          },
+    {CTORM_ERR_BAD_LOG_FORMAT,        "invalid request log format"            },
+    {CTORM_ERR_BAD_LOG_QUEUE_SIZE,    "invalid request log queue size"        },
     {CTORM_ERR_BAD_RESPONSE_CODE,     "specified response code is invalid"    },
     {CTORM_ERR_BAD_CONTENT_TYPE,
      "body is not using the requested content type"                           },
@@ -25,6 +29,12 @@ struct ctorm_error_desc _ctorm_err_descs[] = {
     {CTORM_ERR_BAD_PORT,              "bad port number"                       },
     {CTORM_ERR_BAD_PATH,              "invalid path"                          },
     {CTORM_ERR_BAD_QUERY,             "invalid query"                         },
+    {CTORM_ERR_BAD_CACHE_TTL,         "invalid cache TTL"                     },
+    {CTORM_ERR_BAD_WS_UPGRADE,        "invalid WebSocket upgrade request"     },
+    {CTORM_ERR_BAD_SSE_DROP,          "invalid event stream drop policy"      },
+    {CTORM_ERR_BAD_HPACK,             "invalid HPACK header block"            },
+    {CTORM_ERR_BAD_CPU_LIST,          "invalid CPU list"                      },
+    {CTORM_ERR_BAD_MULTIPART,         "invalid multipart body"                },
 
     {CTORM_ERR_BAD_APP_PTR,           "invalid app pointer"                   },
     {CTORM_ERR_BAD_ADDR_PTR,          "invalid address pointer"               },
@@ -39,6 +49,11 @@ struct ctorm_error_desc _ctorm_err_descs[] = {
     {CTORM_ERR_BAD_AUTHORITY_PTR,     "invalid URI authority pointer"         },
     {CTORM_ERR_BAD_HOST_PTR,          "invalid host pointer"                  },
     {CTORM_ERR_BAD_PATH_PTR,          "invalid path pointer"                  },
+    {CTORM_ERR_BAD_WS_PTR,            "invalid WebSocket pointer"             },
+    {CTORM_ERR_BAD_WS_OPTS_PTR,       "invalid WebSocket options pointer"     },
+    {CTORM_ERR_BAD_SSE_PTR,           "invalid event stream pointer"          },
+    {CTORM_ERR_BAD_DEFER_PTR,         "invalid deferred response pointer"     },
+    {CTORM_ERR_BAD_PART_PTR,          "invalid multipart part pointer"        },
 
     {CTORM_ERR_SCHEME_TOO_LARGE,      "URI scheme is too large"               },
     {CTORM_ERR_USERINFO_TOO_LARGE,    "URI userinfo is too large"             },
@@ -56,18 +71,26 @@ struct ctorm_error_desc _ctorm_err_descs[] = {
     {CTORM_ERR_ALLOC_FAIL,            "memory allocation failed"              },
     {CTORM_ERR_SEEK_FAIL,             "file seek failed"                      },
     {CTORM_ERR_READ_FAIL,             "failed to read the file"               },
+    {CTORM_ERR_WRITE_FAIL,            "failed to write the file"              },
     {CTORM_ERR_MUTEX_FAIL,            "failed to initialize thread mutex"     },
     {CTORM_ERR_JSON_FAIL,             "cJSON failed, use cJSON_GetErrorPtr()" },
     {CTORM_ERR_RESOLVE_FAIL,          "failed to resolve the address"         },
     {CTORM_ERR_SOCKET_FAIL,           "failed to create socket"               },
     {CTORM_ERR_BIND_FAIL,             "failed to bind the socket"             },
     {CTORM_ERR_ACCEPT_FAIL,           "failed to accept new connection"       },
+    {CTORM_ERR_LOG_FAIL,              "failed to start the request logger"    },
+    {CTORM_ERR_FORK_FAIL,             "failed to create a worker process"     },
 
     {CTORM_ERR_NOT_EXISTS,            "file does not exist"                   },
     {CTORM_ERR_NO_READ_PERM,          "missing read permission"               },
     {CTORM_ERR_NO_JSON_SUPPORT,       "library not compiled with JSON support"},
+    {CTORM_ERR_NO_DEFER_SUPPORT,      "response can't be deferred"            },
     {CTORM_ERR_EMPTY_BODY,            "body is empty"                         },
     {CTORM_ERR_EMPTY_QUERY,           "query does not contain any values"     },
+    {CTORM_ERR_APP_RUNNING,           "app is already running"                },
+    {CTORM_ERR_MIDDLEWARE_LIMIT,      "too many middleware handlers"          },
+    {CTORM_ERR_LISTENER_LIMIT,        "too many listening addresses"          },
+    {CTORM_ERR_WS_CLOSED,             "WebSocket connection is closing"       },
 
     {CTORM_ERR_UNKNOWN,               "unknown error"                         },
     {0,                               NULL                                    }
@@ -0,0 +1,927 @@
+#include "headers.h"
+#include "error.h"
+
+#include "conn.h"
+#include "http.h"
+#include "util.h"
+
+#include "app.h"
+#include "req.h"
+#include "res.h"
+#include "log.h"
+#include "h2.h"
+#include "co.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+// frame types, see "6. Frame Definitions" of RFC 9113
+#define H2_DATA          (0x0)
+#define H2_HEADERS       (0x1)
+#define H2_PRIORITY      (0x2)
+#define H2_RST_STREAM    (0x3)
+#define H2_SETTINGS      (0x4)
+#define H2_PUSH_PROMISE  (0x5)
+#define H2_PING          (0x6)
+#define H2_GOAWAY        (0x7)
+#define H2_WINDOW_UPDATE (0x8)
+#define H2_CONTINUATION  (0x9)
+
+// frame flags
+#define H2_FLAG_ACK         (0x1)
+#define H2_FLAG_END_STREAM  (0x1)
+#define H2_FLAG_END_HEADERS (0x4)
+#define H2_FLAG_PADDED      (0x8)
+#define H2_FLAG_PRIORITY    (0x20)
+
+// error codes, see "7. Error Codes"
+#define H2_NO_ERROR           (0x0)
+#define H2_PROTOCOL_ERROR     (0x1)
+#define H2_INTERNAL_ERROR     (0x2)
+#define H2_FLOW_CONTROL_ERROR (0x3)
+#define H2_STREAM_CLOSED      (0x5)
+#define H2_FRAME_SIZE_ERROR   (0x6)
+#define H2_REFUSED_STREAM     (0x7)
+#define H2_COMPRESSION_ERROR  (0x9)
+#define H2_ENHANCE_YOUR_CALM  (0xb)
+
+// settings, see "6.5.2. Defined Settings"
+#define H2_SETTINGS_ENABLE_PUSH            (0x2)
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS (0x3)
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE    (0x4)
+#define H2_SETTINGS_MAX_FRAME_SIZE         (0x5)
+#define H2_SETTINGS_MAX_HEADER_LIST_SIZE   (0x6)
+
+#define H2_HEAD_SIZE   (9)          // frame header size
+#define H2_WINDOW_MAX  (0x7fffffff) // max flow control window size
+#define H2_FRAME_LIMIT (0xffffff)   // max frame size the client can set
+
+#define h2_u16(p) ((uint16_t)(p)[0] << 8 | (p)[1])
+#define h2_u32(p)                                                              \
+  ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | (uint32_t)(p)[2] << 8 |   \
+      (p)[3])
+#define h2_put_u32(p, v)                                                       \
+  do {                                                                         \
+    (p)[0] = (uint8_t)((v) >> 24);                                             \
+    (p)[1] = (uint8_t)((v) >> 16);                                             \
+    (p)[2] = (uint8_t)((v) >> 8);                                              \
+    (p)[3] = (uint8_t)(v);                                                     \
+  } while (0)
+
+#define h2_debug(f, ...)                                                       \
+  debug("(" FG_BOLD "socket " FG_CYAN "%d" FG_RESET FG_BOLD " HTTP/2" FG_RESET \
+        ") " f,                                                                \
+      h2->conn->socket,                                                        \
+      ##__VA_ARGS__)
+
+// request thread lock/unlock macro
+#define h2_lock()                                                              \
+  if (h2->app->config->lock_request)                                           \
+  ctorm_co_lock(&h2->app->req_mutex)
+#define h2_unlock()                                                            \
+  if (h2->app->config->lock_request)                                           \
+  ctorm_co_unlock(&h2->app->req_mutex)
+
+// connection-specific header fields are not allowed, see "8.2.2"
+bool _ctorm_h2_is_conn_header(char *name) {
+  return cu_streq(name, "connection") || cu_streq(name, "keep-alive") ||
+         cu_streq(name, "proxy-connection") ||
+         cu_streq(name, "transfer-encoding") || cu_streq(name, "upgrade");
+}
+
+// sets the connection error, returns false to close the connection
+bool _ctorm_h2_error(struct ctorm_h2 *h2, uint32_t code) {
+  h2_debug("connection error: %u", code);
+  h2->error = code;
+  return false;
+}
+
+bool _ctorm_h2_send(struct ctorm_h2 *h2, uint8_t type, uint8_t flags,
+    uint32_t id, void *payload, uint32_t size) {
+  uint8_t      head[H2_HEAD_SIZE];
+  struct iovec iov[2];
+
+  head[0] = size >> 16;
+  head[1] = size >> 8;
+  head[2] = size;
+  head[3] = type;
+  head[4] = flags;
+  h2_put_u32(head + 5, id);
+
+  iov[0].iov_base = head;
+  iov[0].iov_len  = sizeof(head);
+  iov[1].iov_base = payload;
+  iov[1].iov_len  = size;
+
+  return ctorm_conn_sendv(h2->conn, iov, size > 0 ? 2 : 1);
+}
+
+// sends a RST_STREAM or a WINDOW_UPDATE frame
+bool _ctorm_h2_send_u32(
+    struct ctorm_h2 *h2, uint8_t type, uint32_t id, uint32_t value) {
+  uint8_t payload[4];
+  h2_put_u32(payload, value);
+  return _ctorm_h2_send(h2, type, 0, id, payload, sizeof(payload));
+}
+
+struct ctorm_h2_stream *_ctorm_h2_find(struct ctorm_h2 *h2, uint32_t id) {
+  struct ctorm_h2_stream *stream = h2->streams;
+
+  while (NULL != stream && stream->id != id)
+    stream = stream->next;
+
+  return stream;
+}
+
+struct ctorm_h2_stream *_ctorm_h2_open(struct ctorm_h2 *h2, uint32_t id) {
+  struct ctorm_h2_stream *stream = NULL, **tail = &h2->streams;
+
+  if (NULL == (stream = calloc(1, sizeof(*stream)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  ctorm_req_init(&stream->req, h2->conn);
+  stream->req.version = CTORM_HTTP_2;
+  stream->id          = id;
+  stream->window      = h2->init_window;
+  stream->recv        = CTORM_H2_WINDOW;
+
+  // streams are responded in the order they are opened
+  while (NULL != *tail)
+    tail = &(*tail)->next;
+  *tail = stream;
+
+  h2->count++;
+  return stream;
+}
+
+void _ctorm_h2_close(struct ctorm_h2 *h2, struct ctorm_h2_stream *stream) {
+  struct ctorm_h2_stream **cur = &h2->streams;
+
+  while (*cur != stream)
+    cur = &(*cur)->next;
+  *cur = stream->next;
+
+  ctorm_req_free(&stream->req);
+  free(stream->body);
+  free(stream);
+
+  h2->count--;
+}
+
+// called for every header field of a request, stream is NULL for trailers
+bool _ctorm_h2_field(void *_stream, char *name, uint32_t name_len,
+    char *value, uint32_t value_len) {
+  struct ctorm_h2_stream *stream = _stream;
+  ctorm_req_t            *req    = NULL;
+  char                    method[CTORM_HTTP_METHOD_MAX + 1];
+  uint32_t                i = 0;
+
+  if (NULL == stream || stream->bad)
+    return true;
+
+  req = &stream->req;
+
+  // 8.3.1. Request Pseudo-Header Fields
+  if (*name == ':') {
+    // pseudo-header fields can't appear after the regular fields
+    if (stream->fields > 0)
+      goto bad;
+
+    if (cu_streq(name, ":method")) {
+      if (stream->method || value_len > CTORM_HTTP_METHOD_MAX)
+        goto bad;
+
+      // ctorm_http_method() expects a space after the method
+      memset(method, ' ', sizeof(method));
+      memcpy(method, value, value_len);
+
+      if (ctorm_http_method(method, &req->method) != value_len + 1)
+        goto bad;
+
+      stream->method = true;
+    }
+
+    else if (cu_streq(name, ":path")) {
+      if (NULL != req->target || value_len == 0)
+        goto bad;
+
+      if (NULL == (req->target = strdup(value)))
+        return false;
+    }
+
+    else if (cu_streq(name, ":authority")) {
+      if (NULL != req->host)
+        goto bad;
+
+      if (NULL == (req->host = strdup(value)))
+        return false;
+    }
+
+    else if (!cu_streq(name, ":scheme"))
+      goto bad;
+
+    return true;
+  }
+
+  if (++stream->fields > CTORM_HTTP_HEADER_MAX ||
+      !ctorm_http_is_valid_header_name(name, name_len) ||
+      !ctorm_http_is_valid_header_value(value, value_len) ||
+      _ctorm_h2_is_conn_header(name))
+    goto bad;
+
+  // 8.2.1. Field Validity, field names must be lowercase
+  for (i = 0; i < name_len; i++)
+    if (name[i] >= 'A' && name[i] <= 'Z')
+      goto bad;
+
+  // TE header field is only allowed with the "trailers" value
+  if (cu_streq(name, "te") && !cu_streq(value, "trailers"))
+    goto bad;
+
+  ctorm_headers_set(req->headers, strdup(name), strdup(value), true);
+  return true;
+
+bad:
+  stream->bad = true;
+  return true;
+}
+
+// called when the complete request is received, checks the request
+void _ctorm_h2_done(struct ctorm_h2_stream *stream) {
+  ctorm_req_t *req = &stream->req;
+  char        *len = NULL, *host = NULL;
+
+  stream->done   = true;
+  req->body      = stream->body;
+  req->body_size = stream->body_len;
+
+  if (stream->bad)
+    goto bad;
+
+  // CONNECT requests are not supported
+  if (!stream->method || NULL == req->target ||
+      CTORM_HTTP_CONNECT == req->method || !ctorm_req_parse_target(req))
+    goto bad;
+
+  // if no authority is specified, read the host from the host header
+  if (NULL == req->host && NULL != (host = ctorm_req_get(req, "host")) &&
+      NULL == (req->host = strdup(host)))
+    goto bad;
+
+  // content-length should match the received body, see "8.1.1"
+  if (NULL != (len = ctorm_req_get(req, CTORM_HTTP_CONTENT_LENGTH)) &&
+      (uint64_t)atol(len) != stream->body_len)
+    goto bad;
+
+  if (stream->body_len > 0 && !ctorm_http_method_allows_req_body(req->method))
+    goto bad;
+
+  if (stream->body_len == 0 && ctorm_http_method_needs_req_body(req->method))
+    goto bad;
+
+  req->code = 200;
+  return;
+
+bad:
+  stream->bad = true;
+  req->code   = stream->large ? 413 : 400;
+}
+
+// appends data to the header block that is being received
+bool _ctorm_h2_block(struct ctorm_h2 *h2, uint8_t *data, uint32_t size) {
+  uint8_t *block = NULL;
+
+  if (h2->block_len + size > CTORM_H2_BLOCK_MAX)
+    return _ctorm_h2_error(h2, H2_ENHANCE_YOUR_CALM);
+
+  if (h2->block_len + size > h2->block_cap) {
+    if (NULL == (block = realloc(h2->block, h2->block_len + size)))
+      return _ctorm_h2_error(h2, H2_INTERNAL_ERROR);
+
+    h2->block     = block;
+    h2->block_cap = h2->block_len + size;
+  }
+
+  memcpy(h2->block + h2->block_len, data, size);
+  h2->block_len += size;
+
+  return true;
+}
+
+// decodes the received header block, opens a new stream if needed
+bool _ctorm_h2_headers(struct ctorm_h2 *h2) {
+  struct ctorm_h2_stream *stream = _ctorm_h2_find(h2, h2->block_id);
+  uint32_t                id     = h2->block_id;
+  bool                    refuse = false;
+  void                   *data   = NULL;
+
+  h2->block_id = 0;
+
+  // trailers should end the stream, and they are ignored
+  if (NULL != stream) {
+    if (stream->done || !h2->block_end)
+      return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+  }
+
+  // client streams use odd IDs that always increase
+  else if (id % 2 == 0 || id <= h2->last_id)
+    return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+  // refuse the stream if we have too many or if we are closing
+  else if ((refuse = h2->goaway || h2->count >= CTORM_H2_STREAMS_MAX))
+    h2->last_id = id;
+
+  else if (NULL == (data = stream = _ctorm_h2_open(h2, h2->last_id = id)))
+    return _ctorm_h2_error(h2, H2_INTERNAL_ERROR);
+
+  // header block is decoded even if it's ignored to update the HPACK context
+  if (!ctorm_hpack_decode(
+          &h2->hpack, h2->block, h2->block_len, _ctorm_h2_field, data))
+    return _ctorm_h2_error(h2, H2_COMPRESSION_ERROR);
+
+  if (refuse)
+    return _ctorm_h2_send_u32(h2, H2_RST_STREAM, id, H2_REFUSED_STREAM);
+
+  if (h2->block_end)
+    _ctorm_h2_done(stream);
+
+  return true;
+}
+
+// removes the padding of a DATA or a HEADERS frame
+bool _ctorm_h2_unpad(uint8_t **data, uint32_t *size, uint8_t flags) {
+  uint8_t pad = 0;
+
+  if (!(flags & H2_FLAG_PADDED))
+    return true;
+
+  if (*size < 1 || (pad = **data) >= *size)
+    return false;
+
+  *data += 1;
+  *size -= pad + 1;
+
+  return true;
+}
+
+bool _ctorm_h2_data(struct ctorm_h2 *h2, uint8_t flags, uint32_t id,
+    uint8_t *data, uint32_t size) {
+  struct ctorm_h2_stream *stream = _ctorm_h2_find(h2, id);
+  uint64_t                max    = h2->app->config->max_body_size;
+  uint32_t                total  = size;
+  char                   *body   = NULL;
+
+  if (id == 0 || (NULL == stream && id > h2->last_id))
+    return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+  if (!_ctorm_h2_unpad(&data, &size, flags))
+    return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+  // client should not send more than the window we advertised
+  if ((h2->recv -= total) < 0)
+    return _ctorm_h2_error(h2, H2_FLOW_CONTROL_ERROR);
+
+  /*
+
+   * the body is either buffered in a stream (which is limited by the stream
+   * window below) or discarded, so the connection window is always returned
+
+  */
+  if (total > 0) {
+    if (!_ctorm_h2_send_u32(h2, H2_WINDOW_UPDATE, 0, total))
+      return false;
+    h2->recv += total;
+  }
+
+  // response to a rejected request may be sent before the complete body
+  if (NULL != stream && stream->early)
+    return true;
+
+  if (NULL == stream || stream->done)
+    return _ctorm_h2_send_u32(h2, H2_RST_STREAM, id, H2_STREAM_CLOSED);
+
+  if ((stream->recv -= total) < 0) {
+    stream->reset = true;
+    return _ctorm_h2_send_u32(h2, H2_RST_STREAM, id, H2_FLOW_CONTROL_ERROR);
+  }
+
+  // whole body is buffered before routing, so it's always limited
+  if (max == 0)
+    max = CTORM_H2_BODY_MAX;
+
+  // reject the request without waiting for the rest of the body
+  if (stream->body_len + size > max) {
+    stream->bad = stream->large = true;
+    stream->early = !(flags & H2_FLAG_END_STREAM);
+    _ctorm_h2_done(stream);
+    return true;
+  }
+
+  if (size > 0 && !stream->bad) {
+    if (stream->body_len + size > stream->body_cap) {
+      stream->body_cap = (stream->body_len + size) * 2;
+
+      if (NULL == (body = realloc(stream->body, stream->body_cap)))
+        return _ctorm_h2_error(h2, H2_INTERNAL_ERROR);
+
+      stream->body = body;
+    }
+
+    memcpy(stream->body + stream->body_len, data, size);
+    stream->body_len += size;
+  }
+
+  if (flags & H2_FLAG_END_STREAM)
+    _ctorm_h2_done(stream);
+
+  // no need to update the stream window if the stream is complete
+  else if (total > 0) {
+    if (!_ctorm_h2_send_u32(h2, H2_WINDOW_UPDATE, id, total))
+      return false;
+    stream->recv += total;
+  }
+
+  return true;
+}
+
+bool _ctorm_h2_settings(
+    struct ctorm_h2 *h2, uint8_t flags, uint8_t *data, uint32_t size) {
+  struct ctorm_h2_stream *stream = NULL;
+  uint32_t                value = 0, i = 0;
+  int64_t                 delta = 0;
+
+  if (flags & H2_FLAG_ACK)
+    return size == 0 || _ctorm_h2_error(h2, H2_FRAME_SIZE_ERROR);
+
+  if (size % 6 != 0)
+    return _ctorm_h2_error(h2, H2_FRAME_SIZE_ERROR);
+
+  for (i = 0; i < size; i += 6) {
+    value = h2_u32(data + i + 2);
+
+    switch (h2_u16(data + i)) {
+    case H2_SETTINGS_ENABLE_PUSH:
+      if (value > 1)
+        return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+      break;
+
+    // 6.9.2. Initial Flow-Control Window Size
+    case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+      if (value > H2_WINDOW_MAX)
+        return _ctorm_h2_error(h2, H2_FLOW_CONTROL_ERROR);
+
+      delta           = (int64_t)value - h2->init_window;
+      h2->init_window = value;
+
+      for (stream = h2->streams; NULL != stream; stream = stream->next)
+        stream->window += delta;
+      break;
+
+    case H2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < CTORM_H2_FRAME_MAX || value > H2_FRAME_LIMIT)
+        return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+      h2->max_frame = value;
+      break;
+    }
+  }
+
+  return _ctorm_h2_send(h2, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+}
+
+bool _ctorm_h2_window(
+    struct ctorm_h2 *h2, uint32_t id, uint8_t *data, uint32_t size) {
+  struct ctorm_h2_stream *stream = NULL;
+  uint32_t                inc    = 0;
+
+  if (size != 4)
+    return _ctorm_h2_error(h2, H2_FRAME_SIZE_ERROR);
+
+  inc = h2_u32(data) & H2_WINDOW_MAX;
+
+  if (id == 0) {
+    if (inc == 0 || (h2->window += inc) > H2_WINDOW_MAX)
+      return _ctorm_h2_error(h2, H2_FLOW_CONTROL_ERROR);
+    return true;
+  }
+
+  // window of a closed stream may be updated, just ignore it
+  if (NULL == (stream = _ctorm_h2_find(h2, id)))
+    return true;
+
+  if (inc == 0 || (stream->window += inc) > H2_WINDOW_MAX) {
+    stream->reset = true;
+    return _ctorm_h2_send_u32(h2, H2_RST_STREAM, id, H2_FLOW_CONTROL_ERROR);
+  }
+
+  return true;
+}
+
+// receives and handles a single frame
+bool _ctorm_h2_recv(struct ctorm_h2 *h2) {
+  struct ctorm_h2_stream *stream = NULL;
+  uint8_t                 head[H2_HEAD_SIZE], type = 0, flags = 0;
+  uint8_t                *data = h2->frame;
+  uint32_t                size = 0, id = 0;
+
+  if (ctorm_conn_recv(h2->conn, head, sizeof(head), MSG_WAITALL) !=
+      sizeof(head))
+    return false;
+
+  size  = head[0] << 16 | head[1] << 8 | head[2];
+  type  = head[3];
+  flags = head[4];
+  id    = h2_u32(head + 5) & H2_WINDOW_MAX;
+
+  if (size > CTORM_H2_FRAME_MAX)
+    return _ctorm_h2_error(h2, H2_FRAME_SIZE_ERROR);
+
+  if (size > 0 &&
+      ctorm_conn_recv(h2->conn, data, size, MSG_WAITALL) != (int64_t)size)
+    return false;
+
+  // header block can't be interrupted by other frames, see "4.3"
+  if (h2->block_id != 0 && (type != H2_CONTINUATION || id != h2->block_id))
+    return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+  switch (type) {
+  case H2_DATA:
+    return _ctorm_h2_data(h2, flags, id, data, size);
+
+  case H2_HEADERS:
+    if (id == 0 || !_ctorm_h2_unpad(&data, &size, flags))
+      return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+    // stream dependency and the weight are ignored
+    if (flags & H2_FLAG_PRIORITY) {
+      if (size < 5)
+        return _ctorm_h2_error(h2, H2_FRAME_SIZE_ERROR);
+
+      data += 5;
+      size -= 5;
+    }
+
+    h2->block_id  = id;
+    h2->block_end = flags & H2_FLAG_END_STREAM;
+    h2->block_len = 0;
+
+    if (!_ctorm_h2_block(h2, data, size))
+      return false;
+
+    return !(flags & H2_FLAG_END_HEADERS) || _ctorm_h2_headers(h2);
+
+  case H2_CONTINUATION:
+    if (h2->block_id == 0)
+      return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+    if (!_ctorm_h2_block(h2, data, size))
+      return false;
+
+    return !(flags & H2_FLAG_END_HEADERS) || _ctorm_h2_headers(h2);
+
+  case H2_RST_STREAM:
+    if (id == 0 || id > h2->last_id)
+      return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+    if (size != 4)
+      return _ctorm_h2_error(h2, H2_FRAME_SIZE_ERROR);
+
+    if (NULL != (stream = _ctorm_h2_find(h2, id)))
+      stream->reset = true;
+
+    return true;
+
+  case H2_SETTINGS:
+    if (id != 0)
+      return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+    return _ctorm_h2_settings(h2, flags, data, size);
+
+  case H2_PING:
+    if (id != 0)
+      return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+    if (size != 8)
+      return _ctorm_h2_error(h2, H2_FRAME_SIZE_ERROR);
+
+    return (flags & H2_FLAG_ACK) ||
+           _ctorm_h2_send(h2, H2_PING, H2_FLAG_ACK, 0, data, size);
+
+  case H2_GOAWAY:
+    if (id != 0)
+      return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+
+    // complete the open streams, and then close the connection
+    h2->goaway = true;
+    return true;
+
+  case H2_WINDOW_UPDATE:
+    return _ctorm_h2_window(h2, id, data, size);
+
+  // clients can't push
+  case H2_PUSH_PROMISE:
+    return _ctorm_h2_error(h2, H2_PROTOCOL_ERROR);
+  }
+
+  // PRIORITY frames and the unknown frame types are ignored
+  return true;
+}
+
+// appends a header field to the response header block, see _ctorm_h2_head()
+#define h2_head_add(name, value)                                               \
+  do {                                                                         \
+    len = ctorm_hpack_encode(                                                  \
+        buf + total, total <= size ? size - total : 0, name, value);           \
+    total += len;                                                              \
+  } while (0)
+
+// encodes the response header block, returns the required size
+uint32_t _ctorm_h2_head(ctorm_res_t *res, uint8_t *buf, uint32_t size) {
+  ctorm_header_pos_t pos;
+  uint32_t           total = 0, len = 0;
+  char               value[24];
+
+  snprintf(value, sizeof(value), "%hu", res->code);
+  h2_head_add(":status", value);
+
+  ctorm_headers_start(&pos);
+
+  while (ctorm_headers_next(res->headers, &pos))
+    if (!_ctorm_h2_is_conn_header(pos.name))
+      h2_head_add(pos.name, pos.value);
+
+  snprintf(value, sizeof(value), "%u", res->body_size);
+  h2_head_add(CTORM_HTTP_CONTENT_LENGTH, value);
+
+  return total;
+}
+
+// sends the response header block with HEADERS and CONTINUATION frames
+bool _ctorm_h2_send_head(struct ctorm_h2 *h2, struct ctorm_h2_stream *stream,
+    ctorm_res_t *res, bool end) {
+  uint8_t  stack[1024], *head = stack, type = H2_HEADERS, flags = 0;
+  uint32_t size = 0, pos = 0, len = 0;
+  bool     ret  = true;
+
+  // encode the header block, use the heap if it's too large
+  if ((size = _ctorm_h2_head(res, head, sizeof(stack))) > sizeof(stack)) {
+    if (NULL == (head = malloc(size))) {
+      errno = CTORM_ERR_ALLOC_FAIL;
+      return false;
+    }
+
+    _ctorm_h2_head(res, head, size);
+  }
+
+  for (; ret && pos < size; pos += len, type = H2_CONTINUATION) {
+    if ((len = size - pos) > h2->max_frame)
+      len = h2->max_frame;
+
+    flags = type == H2_HEADERS && end ? H2_FLAG_END_STREAM : 0;
+
+    if (pos + len == size)
+      flags |= H2_FLAG_END_HEADERS;
+
+    ret = _ctorm_h2_send(h2, type, flags, stream->id, head + pos, len);
+  }
+
+  if (head != stack)
+    free(head);
+
+  return ret;
+}
+
+// sends the response body with DATA frames, respecting the flow control
+bool _ctorm_h2_send_body(
+    struct ctorm_h2 *h2, struct ctorm_h2_stream *stream, ctorm_res_t *res) {
+  uint8_t  buf[CTORM_H2_FRAME_MAX], *data = NULL;
+  uint32_t sent = 0;
+  int64_t  len  = 0;
+
+  while (sent < res->body_size) {
+    // wait for the client to open the flow control windows
+    while (!stream->reset && (h2->window <= 0 || stream->window <= 0))
+      if (!_ctorm_h2_recv(h2))
+        return false;
+
+    if (stream->reset)
+      return true;
+
+    len = res->body_size - sent;
+    len = len > h2->window ? h2->window : len;
+    len = len > stream->window ? stream->window : len;
+    len = len > (int64_t)sizeof(buf) ? (int64_t)sizeof(buf) : len;
+
+    if (res->body_fd > 0) {
+      if ((len = read(res->body_fd, buf, len)) <= 0) {
+        h2_debug("failed to read the body: %s", ctorm_error());
+        return _ctorm_h2_send_u32(
+            h2, H2_RST_STREAM, stream->id, H2_INTERNAL_ERROR);
+      }
+
+      data = buf;
+    }
+
+    else
+      data = (uint8_t *)res->body + sent;
+
+    sent += len;
+    h2->window -= len;
+    stream->window -= len;
+
+    if (!_ctorm_h2_send(h2,
+            H2_DATA,
+            sent == res->body_size ? H2_FLAG_END_STREAM : 0,
+            stream->id,
+            data,
+            len))
+      return false;
+  }
+
+  return true;
+}
+
+bool _ctorm_h2_respond(struct ctorm_h2 *h2, struct ctorm_h2_stream *stream) {
+  ctorm_logger_t *logger = h2->app->logger;
+  ctorm_req_t    *req    = &stream->req;
+  bool            ret = false, end = false;
+  struct timeval  start, stop;
+  ctorm_res_t     res;
+
+  ctorm_res_init(&res, h2->conn);
+  res.version = CTORM_HTTP_2;
+  res.code    = req->code;
+
+  // if disabled, remove the server header from the response
+  if (!h2->app->config->server_header)
+    ctorm_res_del(&res, CTORM_HTTP_SERVER);
+
+  if (NULL != logger)
+    gettimeofday(&start, NULL);
+
+  if (!stream->bad) {
+    h2_lock();
+    ctorm_app_route(h2->app, req, &res);
+    h2_unlock();
+  }
+
+  // event streams need the HTTP/1.1 connection
+  if (res.stream) {
+    ctorm_res_clear(&res);
+    ctorm_res_del(&res, CTORM_HTTP_CONTENT_TYPE);
+
+    res.code   = 505;
+    res.stream = false;
+  }
+
+  h2_debug("sending a %d response on stream %u", res.code, stream->id);
+
+  // HEAD responses and the empty responses end with the header block
+  end = CTORM_HTTP_HEAD == req->method || 0 == res.body_size;
+
+  if (!(ret = _ctorm_h2_send_head(h2, stream, &res, end) &&
+              (end || _ctorm_h2_send_body(h2, stream, &res))))
+    h2_debug("failed to send the response: %s", ctorm_error());
+
+  else if (!stream->bad) {
+    ctorm_stats_add(h2->app, requests, 1);
+
+    if (NULL != logger) {
+      gettimeofday(&stop, NULL);
+
+      uint64_t stop_val  = 1000000 * stop.tv_sec + stop.tv_usec;
+      uint64_t start_val = 1000000 * start.tv_sec + start.tv_usec;
+
+      log(logger, req, &res, stop_val - start_val);
+    }
+  }
+
+  // tell the client to stop sending the rest of the body, see "8.1"
+  if (ret && stream->early)
+    ret = _ctorm_h2_send_u32(h2, H2_RST_STREAM, stream->id, H2_NO_ERROR);
+
+  ctorm_res_free(&res);
+  return ret;
+}
+
+bool ctorm_h2_preface(ctorm_conn_t *conn) {
+  // only peek the start of the preface, "PRI" is not a valid HTTP/1.x method
+  char *buf = ctorm_conn_peek(conn, 8);
+  return NULL != buf && memcmp(buf, CTORM_H2_PREFACE, 8) == 0;
+}
+
+bool ctorm_h2_upgrade(ctorm_req_t *req, ctorm_res_t *res) {
+  // 3.2. Starting HTTP/2 for "http" URIs (obsoleted by RFC 9113, but common)
+  if (req->version != CTORM_HTTP_1_1 || req->body_size != 0 ||
+      NULL == ctorm_req_get(req, "http2-settings") ||
+      !cu_has_token(ctorm_req_get(req, "upgrade"), "h2c") ||
+      !cu_has_token(ctorm_req_get(req, "connection"), "upgrade") ||
+      !cu_has_token(ctorm_req_get(req, "connection"), "http2-settings"))
+    return false;
+
+  res->code = 101;
+  ctorm_res_set(res, "connection", "Upgrade");
+  ctorm_res_set(res, "upgrade", "h2c");
+
+  return ctorm_res_send(res);
+}
+
+void ctorm_h2_handle(
+    struct ctorm_app *app, ctorm_conn_t *conn, ctorm_req_t *req) {
+  struct ctorm_h2_stream *stream = NULL, *next = NULL;
+  struct ctorm_h2        *h2     = calloc(1, sizeof(*h2));
+  uint8_t preface[CTORM_H2_PREFACE_LEN], goaway[8], settings[18] = {
+      0, H2_SETTINGS_MAX_CONCURRENT_STREAMS, 0, 0, 0, 0,
+      0, H2_SETTINGS_INITIAL_WINDOW_SIZE,    0, 0, 0, 0,
+      0, H2_SETTINGS_MAX_HEADER_LIST_SIZE,   0, 0, 0, 0,
+  };
+
+  if (NULL == h2)
+    return;
+
+  h2->app         = app;
+  h2->conn        = conn;
+  h2->max_frame   = CTORM_H2_FRAME_MAX;
+  h2->init_window = CTORM_H2_WINDOW;
+  h2->window      = CTORM_H2_WINDOW;
+  h2->recv        = CTORM_H2_WINDOW;
+
+  if (!ctorm_hpack_init(&h2->hpack, CTORM_HPACK_TABLE_SIZE))
+    goto end;
+
+  // server preface is a SETTINGS frame, see "3.4. HTTP/2 Connection Preface"
+  h2_put_u32(settings + 2, CTORM_H2_STREAMS_MAX);
+  h2_put_u32(settings + 8, CTORM_H2_WINDOW);
+  h2_put_u32(settings + 14, CTORM_H2_BLOCK_MAX);
+
+  if (!_ctorm_h2_send(h2, H2_SETTINGS, 0, 0, settings, sizeof(settings)))
+    goto end;
+
+  // upgraded request is responded on the stream 1
+  if (NULL != req) {
+    if (NULL == (stream = _ctorm_h2_open(h2, h2->last_id = 1)))
+      goto end;
+
+    memcpy(&stream->req, req, sizeof(*req));
+    ctorm_req_init(req, conn);
+
+    stream->req.version = CTORM_HTTP_2;
+    stream->method      = true;
+    stream->done        = true;
+  }
+
+  if (ctorm_conn_recv(conn, preface, sizeof(preface), MSG_WAITALL) !=
+          sizeof(preface) ||
+      memcmp(preface, CTORM_H2_PREFACE, sizeof(preface)) != 0) {
+    h2_debug("received an invalid connection preface");
+    h2->error = H2_PROTOCOL_ERROR;
+    goto end;
+  }
+
+  while (true) {
+    // respond to the complete requests, and close the reset streams
+    for (stream = h2->streams; NULL != stream; stream = next) {
+      next = stream->next;
+
+      if (stream->done && !stream->reset && !_ctorm_h2_respond(h2, stream))
+        goto end;
+
+      if (stream->done || stream->reset)
+        _ctorm_h2_close(h2, stream);
+    }
+
+    if (h2->goaway && NULL == h2->streams)
+      break;
+
+    // wait for a new request, or close the connection if the app is draining
+    __atomic_store_n(&conn->idle, NULL == h2->streams, __ATOMIC_SEQ_CST);
+
+    if (NULL == h2->streams &&
+        __atomic_load_n(&app->draining, __ATOMIC_SEQ_CST))
+      break;
+
+    if (!_ctorm_h2_recv(h2))
+      break;
+  }
+
+end:
+  h2_debug("closing the connection");
+
+  h2_put_u32(goaway, h2->last_id);
+  h2_put_u32(goaway + 4, h2->error);
+  _ctorm_h2_send(h2, H2_GOAWAY, 0, 0, goaway, sizeof(goaway));
+
+  while (NULL != h2->streams)
+    _ctorm_h2_close(h2, h2->streams);
+
+  ctorm_hpack_free(&h2->hpack);
+  free(h2->block);
+  free(h2);
+}
@@ -0,0 +1,180 @@
+#include "handoff.h"
+#include "error.h"
+#include "log.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// control message that carries the listening sockets
+union ctorm_handoff_ctrl {
+  struct cmsghdr hdr;
+  char           buf[CMSG_SPACE(sizeof(int) * CTORM_LISTEN_MAX)];
+};
+
+bool _ctorm_handoff_addr(struct sockaddr_un *addr, char *path) {
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = CTORM_ERR_BAD_PATH_PTR;
+    return false;
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+
+  return true;
+}
+
+int32_t ctorm_handoff_recv(char *path, int *fds) {
+  union ctorm_handoff_ctrl ctrl;
+  struct sockaddr_un       addr;
+  struct cmsghdr          *cmsg  = NULL;
+  int32_t                  count = 0;
+  int                      sock  = -1;
+  char                     byte  = 0;
+
+  struct iovec  iov = {.iov_base = &byte, .iov_len = 1};
+  struct msghdr msg = {
+      .msg_iov        = &iov,
+      .msg_iovlen     = 1,
+      .msg_control    = ctrl.buf,
+      .msg_controllen = sizeof(ctrl.buf),
+  };
+
+  if (!_ctorm_handoff_addr(&addr, path) ||
+      (sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  // if no process is running, there is nothing to receive
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return -1;
+  }
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) == 1 &&
+      NULL != (cmsg = CMSG_FIRSTHDR(&msg)) && SOL_SOCKET == cmsg->cmsg_level &&
+      SCM_RIGHTS == cmsg->cmsg_type) {
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+  }
+
+  close(sock);
+  return count;
+}
+
+void *_ctorm_handoff_thread(void *_handoff) {
+  struct ctorm_handoff    *handoff = _handoff;
+  ctorm_app_t             *app     = handoff->app;
+  union ctorm_handoff_ctrl ctrl;
+  struct cmsghdr          *cmsg = NULL;
+  int                      conn = -1;
+  char                     byte = 0;
+
+  struct iovec  iov = {.iov_base = &byte, .iov_len = 1};
+  struct msghdr msg = {
+      .msg_iov        = &iov,
+      .msg_iovlen     = 1,
+      .msg_control    = ctrl.buf,
+      .msg_controllen = CMSG_SPACE(sizeof(int) * app->listener_count),
+  };
+
+  memset(&ctrl, 0, sizeof(ctrl));
+  cmsg             = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * app->listener_count);
+
+  for (uint32_t i = 0; i < app->listener_count; i++)
+    memcpy(CMSG_DATA(cmsg) + sizeof(int) * i, &app->listeners[i].sock,
+        sizeof(int));
+
+  // ctorm_handoff_free() shuts down the socket, which stops the accept()
+  while ((conn = accept(handoff->sock, NULL, NULL)) >= 0) {
+    handoff->passed = sendmsg(conn, &msg, MSG_NOSIGNAL) == 1;
+    close(conn);
+
+    if (!handoff->passed)
+      continue;
+
+    // new process accepts the connections now, we can stop
+    debug("passed the listening sockets to the new process");
+    ctorm_app_stop(app);
+    break;
+  }
+
+  return NULL;
+}
+
+struct ctorm_handoff *ctorm_handoff_new(ctorm_app_t *app, char *path) {
+  struct ctorm_handoff *handoff = NULL;
+  struct sockaddr_un    addr;
+  int                   ret = 0;
+
+  if (!_ctorm_handoff_addr(&addr, path))
+    return NULL;
+
+  if (NULL == (handoff = calloc(1, sizeof(*handoff)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  handoff->app  = app;
+  handoff->path = path;
+
+  if ((handoff->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+    errno = CTORM_ERR_SOCKET_FAIL;
+    goto fail;
+  }
+
+  // remove the socket of the previous process, it already passed the listener
+  unlink(path);
+
+  if (bind(handoff->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    debug("failed to bind the handoff socket: %s", strerror(errno));
+    errno = CTORM_ERR_BIND_FAIL;
+    goto fail;
+  }
+
+  // only the processes of the same user should get the listener
+  chmod(path, S_IRUSR | S_IWUSR);
+
+  if (listen(handoff->sock, 1) < 0) {
+    errno = CTORM_ERR_LISTEN_FAIL;
+    goto fail;
+  }
+
+  if ((ret = pthread_create(
+           &handoff->thread, NULL, _ctorm_handoff_thread, handoff)) != 0) {
+    errno = ret;
+    goto fail;
+  }
+
+  return handoff;
+
+fail:
+  if (handoff->sock >= 0)
+    close(handoff->sock);
+
+  free(handoff);
+  return NULL;
+}
+
+void ctorm_handoff_free(struct ctorm_handoff *handoff) {
+  if (NULL == handoff)
+    return;
+
+  shutdown(handoff->sock, SHUT_RDWR);
+  pthread_join(handoff->thread, NULL);
+  close(handoff->sock);
+
+  // Unix socket is now used by the new process
+  if (!handoff->passed)
+    unlink(handoff->path);
+
+  free(handoff);
+}
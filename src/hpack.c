@@ -0,0 +1,457 @@
+#include "hpack.h"
+#include "error.h"
+#include "util.h"
+
+#include <strings.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define hpack_entry(n, v) {n, v, sizeof(n) - 1, sizeof(v) - 1}
+
+// static table, see "Appendix A. Static Table Definition" of RFC 7541
+struct ctorm_hpack_entry _ctorm_hpack_static[CTORM_HPACK_STATIC] = {
+    hpack_entry(":authority", ""),
+    hpack_entry(":method", "GET"),
+    hpack_entry(":method", "POST"),
+    hpack_entry(":path", "/"),
+    hpack_entry(":path", "/index.html"),
+    hpack_entry(":scheme", "http"),
+    hpack_entry(":scheme", "https"),
+    hpack_entry(":status", "200"),
+    hpack_entry(":status", "204"),
+    hpack_entry(":status", "206"),
+    hpack_entry(":status", "304"),
+    hpack_entry(":status", "400"),
+    hpack_entry(":status", "404"),
+    hpack_entry(":status", "500"),
+    hpack_entry("accept-charset", ""),
+    hpack_entry("accept-encoding", "gzip, deflate"),
+    hpack_entry("accept-language", ""),
+    hpack_entry("accept-ranges", ""),
+    hpack_entry("accept", ""),
+    hpack_entry("access-control-allow-origin", ""),
+    hpack_entry("age", ""),
+    hpack_entry("allow", ""),
+    hpack_entry("authorization", ""),
+    hpack_entry("cache-control", ""),
+    hpack_entry("content-disposition", ""),
+    hpack_entry("content-encoding", ""),
+    hpack_entry("content-language", ""),
+    hpack_entry("content-length", ""),
+    hpack_entry("content-location", ""),
+    hpack_entry("content-range", ""),
+    hpack_entry("content-type", ""),
+    hpack_entry("cookie", ""),
+    hpack_entry("date", ""),
+    hpack_entry("etag", ""),
+    hpack_entry("expect", ""),
+    hpack_entry("expires", ""),
+    hpack_entry("from", ""),
+    hpack_entry("host", ""),
+    hpack_entry("if-match", ""),
+    hpack_entry("if-modified-since", ""),
+    hpack_entry("if-none-match", ""),
+    hpack_entry("if-range", ""),
+    hpack_entry("if-unmodified-since", ""),
+    hpack_entry("last-modified", ""),
+    hpack_entry("link", ""),
+    hpack_entry("location", ""),
+    hpack_entry("max-forwards", ""),
+    hpack_entry("proxy-authenticate", ""),
+    hpack_entry("proxy-authorization", ""),
+    hpack_entry("range", ""),
+    hpack_entry("referer", ""),
+    hpack_entry("refresh", ""),
+    hpack_entry("retry-after", ""),
+    hpack_entry("server", ""),
+    hpack_entry("set-cookie", ""),
+    hpack_entry("strict-transport-security", ""),
+    hpack_entry("transfer-encoding", ""),
+    hpack_entry("user-agent", ""),
+    hpack_entry("vary", ""),
+    hpack_entry("via", ""),
+    hpack_entry("www-authenticate", ""),
+};
+
+/*
+
+ * Huffman code (see "Appendix B. Huffman Code" of RFC 7541) is canonical, so
+ * instead of the code table, we store the symbols sorted by their codes, and
+ * the first code, the code count and the index of the first symbol for every
+ * code length
+
+*/
+#define HPACK_HUFF_MIN 5  // min code length
+#define HPACK_HUFF_MAX 30 // max code length (EOS)
+
+const uint8_t _ctorm_hpack_huff_syms[256] = {
+    48,  49,  50,  97,  99,  101, 105, 111, 115, 116, 32,  37,  45,  46,  47,
+    51,  52,  53,  54,  55,  56,  57,  61,  65,  95,  98,  100, 102, 103, 104,
+    108, 109, 110, 112, 114, 117, 58,  66,  67,  68,  69,  70,  71,  72,  73,
+    74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38,  42,  44,  59,  88,  90,  33,
+    34,  40,  41,  63,  39,  43,  124, 35,  62,  0,   36,  64,  91,  93,  126,
+    94,  125, 60,  96,  123, 92,  195, 208, 128, 130, 131, 162, 184, 194, 224,
+    226, 153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173, 178, 181,
+    185, 186, 187, 189, 190, 196, 198, 228, 232, 233, 1,   135, 137, 138, 139,
+    140, 141, 143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174,
+    175, 180, 182, 183, 188, 191, 197, 231, 239, 9,   142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201, 202,
+    205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211, 212, 214,
+    221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254, 2,
+    3,   4,   5,   6,   7,   8,   11,  12,  14,  15,  16,  17,  18,  19,  20,
+    21,  23,  24,  25,  26,  27,  28,  29,  30,  31,  127, 220, 249, 10,  13,
+    22,
+};
+
+const uint32_t _ctorm_hpack_huff_first[HPACK_HUFF_MAX + 1] = {0, 0, 0, 0, 0,
+    0x0, 0x14, 0x5c, 0xf8, 0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc, 0, 0,
+    0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8, 0xffffea, 0x1ffffec,
+    0x3ffffe0, 0x7ffffde, 0xfffffe2, 0, 0x3ffffffc};
+
+const uint8_t _ctorm_hpack_huff_count[HPACK_HUFF_MAX + 1] = {0, 0, 0, 0, 0,
+    10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15,
+    19, 29, 0, 3};
+
+const uint8_t _ctorm_hpack_huff_index[HPACK_HUFF_MAX + 1] = {0, 0, 0, 0, 0, 0,
+    10, 36, 68, 0, 74, 79, 82, 84, 90, 92, 0, 0, 0, 95, 98, 106, 119, 145, 174,
+    186, 190, 205, 224, 0, 253};
+
+bool ctorm_hpack_init(ctorm_hpack_t *hpack, uint32_t limit) {
+  memset(hpack, 0, sizeof(*hpack));
+
+  // every entry is at least 32 bytes, see "4.1. Calculating Table Size"
+  hpack->cap   = limit / 32 + 1;
+  hpack->max   = limit;
+  hpack->limit = limit;
+
+  if (NULL == (hpack->entries = calloc(hpack->cap, sizeof(*hpack->entries)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  return true;
+}
+
+// removes the oldest entries until the table size is less than the size
+void _ctorm_hpack_evict(ctorm_hpack_t *hpack, uint32_t size) {
+  struct ctorm_hpack_entry *entry = NULL;
+
+  while (hpack->count > 0 && hpack->size > size) {
+    entry = &hpack->entries[(hpack->pos + hpack->cap - hpack->count + 1) %
+                            hpack->cap];
+
+    hpack->size -= entry->name_len + entry->value_len + 32;
+    hpack->count--;
+
+    free(entry->name);
+    entry->name = entry->value = NULL;
+  }
+}
+
+void ctorm_hpack_free(ctorm_hpack_t *hpack) {
+  if (NULL == hpack->entries)
+    return;
+
+  _ctorm_hpack_evict(hpack, 0);
+  free(hpack->entries);
+  hpack->entries = NULL;
+}
+
+// adds a new entry to the dynamic table, see "4.4. Entry Eviction When Adding"
+bool _ctorm_hpack_add(ctorm_hpack_t *hpack, char *name, uint32_t name_len,
+    char *value, uint32_t value_len) {
+  struct ctorm_hpack_entry *entry = NULL;
+  uint32_t                  size  = name_len + value_len + 32;
+
+  // entry larger than the table empties the table, and it's not added
+  if (size > hpack->max) {
+    _ctorm_hpack_evict(hpack, 0);
+    return true;
+  }
+
+  _ctorm_hpack_evict(hpack, hpack->max - size);
+
+  hpack->pos = (hpack->pos + 1) % hpack->cap;
+  entry      = &hpack->entries[hpack->pos];
+
+  if (NULL == (entry->name = malloc(name_len + value_len + 2))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  entry->value     = entry->name + name_len + 1;
+  entry->name_len  = name_len;
+  entry->value_len = value_len;
+
+  memcpy(entry->name, name, name_len);
+  entry->name[name_len] = 0;
+  memcpy(entry->value, value, value_len);
+  entry->value[value_len] = 0;
+
+  hpack->size += size;
+  hpack->count++;
+
+  return true;
+}
+
+// gets a static or dynamic table entry, see "2.3.3. Index Address Space"
+struct ctorm_hpack_entry *_ctorm_hpack_get(
+    ctorm_hpack_t *hpack, uint32_t index) {
+  if (index == 0)
+    return NULL;
+
+  if (index <= CTORM_HPACK_STATIC)
+    return &_ctorm_hpack_static[index - 1];
+
+  if ((index -= CTORM_HPACK_STATIC + 1) >= hpack->count)
+    return NULL;
+
+  return &hpack->entries[(hpack->pos + hpack->cap - index) % hpack->cap];
+}
+
+// decodes an integer with a N bit prefix, see "5.1. Integer Representation"
+bool _ctorm_hpack_int(
+    uint8_t **pos, uint8_t *end, uint8_t bits, uint32_t *value) {
+  uint8_t  mask  = (1 << bits) - 1, shift = 0;
+  uint64_t val   = *((*pos)++) & mask;
+
+  if (val < mask) {
+    *value = val;
+    return true;
+  }
+
+  do {
+    if (*pos >= end || shift > 28)
+      return false;
+
+    val += (uint64_t)(**pos & 0x7f) << shift;
+    shift += 7;
+  } while (*((*pos)++) & 0x80);
+
+  if (val > UINT32_MAX)
+    return false;
+
+  *value = val;
+  return true;
+}
+
+// decodes a Huffman encoded string, returns the decoded size or -1 on failure
+int64_t _ctorm_hpack_huff(uint8_t *src, uint32_t size, char *dst) {
+  uint32_t code = 0, len = 0, total = 0, i = 0;
+  uint8_t  bit = 0;
+
+  for (i = 0; i < size * 8; i++) {
+    bit  = (src[i / 8] >> (7 - i % 8)) & 1;
+    code = code << 1 | bit;
+
+    if (++len < HPACK_HUFF_MIN)
+      continue;
+
+    // if the code is not complete, continue with the next bit (EOS can't be
+    // used in a string, so it's never complete)
+    if (code - _ctorm_hpack_huff_first[len] >=
+        _ctorm_hpack_huff_count[len]) {
+      if (len >= HPACK_HUFF_MAX)
+        return -1;
+      continue;
+    }
+
+    if (total >= CTORM_HPACK_STRING_MAX)
+      return -1;
+
+    dst[total++] = _ctorm_hpack_huff_syms[_ctorm_hpack_huff_index[len] + code -
+                                          _ctorm_hpack_huff_first[len]];
+    code = len = 0;
+  }
+
+  // padding should be the most significant bits of EOS (all ones)
+  if (len >= 8 || code != (1u << len) - 1)
+    return -1;
+
+  return total;
+}
+
+// decodes a string literal, see "5.2. String Literal Representation"
+bool _ctorm_hpack_string(
+    uint8_t **pos, uint8_t *end, char *dst, uint32_t *len) {
+  bool     huff = **pos & 0x80;
+  uint32_t size = 0;
+  int64_t  ret  = 0;
+
+  if (!_ctorm_hpack_int(pos, end, 7, &size) || size > (uint64_t)(end - *pos))
+    return false;
+
+  if (!huff) {
+    if (size > CTORM_HPACK_STRING_MAX)
+      return false;
+
+    memcpy(dst, *pos, size);
+    *len = size;
+  }
+
+  else if ((ret = _ctorm_hpack_huff(*pos, size, dst)) < 0)
+    return false;
+
+  else
+    *len = ret;
+
+  *pos += size;
+  dst[*len] = 0;
+  return true;
+}
+
+bool ctorm_hpack_decode(ctorm_hpack_t *hpack, uint8_t *buf, uint32_t size,
+    ctorm_hpack_field_t field, void *data) {
+  char     name[CTORM_HPACK_STRING_MAX + 1], value[CTORM_HPACK_STRING_MAX + 1];
+  uint8_t *pos = buf, *end = buf + size;
+  uint32_t index = 0, name_len = 0, value_len = 0;
+  bool     indexing = false, update = true;
+
+  struct ctorm_hpack_entry *entry = NULL;
+
+  while (pos < end) {
+    // 6.1. Indexed Header Field Representation
+    if (*pos & 0x80) {
+      if (!_ctorm_hpack_int(&pos, end, 7, &index) ||
+          NULL == (entry = _ctorm_hpack_get(hpack, index)))
+        goto fail;
+
+      if (!field(data, entry->name, entry->name_len, entry->value,
+              entry->value_len))
+        return false;
+
+      update = false;
+      continue;
+    }
+
+    // 6.3. Dynamic Table Size Update (only allowed at the start of the block)
+    if ((*pos & 0xe0) == 0x20) {
+      if (!update || !_ctorm_hpack_int(&pos, end, 5, &index) ||
+          index > hpack->limit)
+        goto fail;
+
+      _ctorm_hpack_evict(hpack, hpack->max = index);
+      continue;
+    }
+
+    // 6.2. Literal Header Field Representation
+    indexing = (*pos & 0xc0) == 0x40;
+    update   = false;
+
+    if (!_ctorm_hpack_int(&pos, end, indexing ? 6 : 4, &index))
+      goto fail;
+
+    // copy the indexed name, as the entry may be evicted
+    if (index != 0) {
+      if (NULL == (entry = _ctorm_hpack_get(hpack, index)))
+        goto fail;
+
+      memcpy(name, entry->name, (name_len = entry->name_len) + 1);
+    }
+
+    else if (pos >= end || !_ctorm_hpack_string(&pos, end, name, &name_len))
+      goto fail;
+
+    if (pos >= end || !_ctorm_hpack_string(&pos, end, value, &value_len))
+      goto fail;
+
+    if (indexing &&
+        !_ctorm_hpack_add(hpack, name, name_len, value, value_len))
+      return false;
+
+    if (!field(data, name, name_len, value, value_len))
+      return false;
+  }
+
+  return true;
+
+fail:
+  errno = CTORM_ERR_BAD_HPACK;
+  return false;
+}
+
+// encodes an integer with a N bit prefix, returns the size
+uint8_t _ctorm_hpack_put_int(
+    uint8_t *buf, uint8_t flags, uint8_t bits, uint32_t value) {
+  uint8_t mask = (1 << bits) - 1, size = 1;
+
+  if (value < mask) {
+    if (NULL != buf)
+      buf[0] = flags | value;
+    return size;
+  }
+
+  if (NULL != buf)
+    buf[0] = flags | mask;
+
+  for (value -= mask; value >= 0x80; value >>= 7, size++)
+    if (NULL != buf)
+      buf[size] = (value & 0x7f) | 0x80;
+
+  if (NULL != buf)
+    buf[size] = value;
+
+  return size + 1;
+}
+
+/*
+
+ * encodes a header field without indexing and Huffman encoding, the static
+ * table is used when it's possible, returns the encoded size, and only writes
+ * the field if it fits in the buffer
+
+*/
+uint32_t ctorm_hpack_encode(
+    uint8_t *buf, uint32_t size, char *name, char *value) {
+  uint32_t name_len = cu_strlen(name), value_len = cu_strlen(value);
+  uint32_t index = 0, total = 0, i = 0;
+
+  struct ctorm_hpack_entry *entry = NULL;
+
+  for (i = 0; i < CTORM_HPACK_STATIC; i++) {
+    entry = &_ctorm_hpack_static[i];
+
+    if (entry->name_len != name_len || strncasecmp(entry->name, name, name_len))
+      continue;
+
+    // 6.1. Indexed Header Field Representation, whole field is in the table
+    if (entry->value_len > 0 && cu_streq(entry->value, value)) {
+      if ((total = _ctorm_hpack_put_int(NULL, 0x80, 7, i + 1)) <= size)
+        _ctorm_hpack_put_int(buf, 0x80, 7, i + 1);
+      return total;
+    }
+
+    // otherwise only use the name
+    if (index == 0)
+      index = i + 1;
+  }
+
+  // 6.2.2. Literal Header Field without Indexing
+  total = _ctorm_hpack_put_int(NULL, 0, 4, index);
+
+  if (index == 0)
+    total += _ctorm_hpack_put_int(NULL, 0, 7, name_len) + name_len;
+
+  total += _ctorm_hpack_put_int(NULL, 0, 7, value_len) + value_len;
+
+  if (total > size)
+    return total;
+
+  buf += _ctorm_hpack_put_int(buf, 0, 4, index);
+
+  // header field names must be lowercase
+  if (index == 0) {
+    buf += _ctorm_hpack_put_int(buf, 0, 7, name_len);
+
+    for (i = 0; i < name_len; i++)
+      *(buf++) = name[i] >= 'A' && name[i] <= 'Z' ? name[i] | 32 : name[i];
+  }
+
+  buf += _ctorm_hpack_put_int(buf, 0, 7, value_len);
+  memcpy(buf, value, value_len);
+
+  return total;
+}
@@ -3,6 +3,7 @@
 #include "log.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 // list of HTTP request method descriptions */
@@ -47,16 +48,51 @@ void ctorm_http_load() {
   _ctorm_http_loaded = true;
 }
 
+/*
+
+ * HTTP versions and methods are recognized by loading the first 8 bytes of the
+ * buffer as a (little endian) integer and comparing it against these constants,
+ * which are calculated at compile time
+
+*/
+#define http_word(a, b, c, d, e, f, g, h)                                      \
+  ((uint64_t)(a) | (uint64_t)(b) << 8 | (uint64_t)(c) << 16 |                 \
+      (uint64_t)(d) << 24 | (uint64_t)(e) << 32 | (uint64_t)(f) << 40 |        \
+      (uint64_t)(g) << 48 | (uint64_t)(h) << 56)
+
+#define HTTP_WORD_1_0     http_word('H', 'T', 'T', 'P', '/', '1', '.', '0')
+#define HTTP_WORD_1_1     http_word('H', 'T', 'T', 'P', '/', '1', '.', '1')
+#define HTTP_WORD_GET     http_word('G', 'E', 'T', 0, 0, 0, 0, 0)
+#define HTTP_WORD_PUT     http_word('P', 'U', 'T', 0, 0, 0, 0, 0)
+#define HTTP_WORD_HEAD    http_word('H', 'E', 'A', 'D', 0, 0, 0, 0)
+#define HTTP_WORD_POST    http_word('P', 'O', 'S', 'T', 0, 0, 0, 0)
+#define HTTP_WORD_TRACE   http_word('T', 'R', 'A', 'C', 'E', 0, 0, 0)
+#define HTTP_WORD_DELETE  http_word('D', 'E', 'L', 'E', 'T', 'E', 0, 0)
+#define HTTP_WORD_CONNECT http_word('C', 'O', 'N', 'N', 'E', 'C', 'T', 0)
+#define HTTP_WORD_OPTIONS http_word('O', 'P', 'T', 'I', 'O', 'N', 'S', 0)
+
+// used to find the first space in a word (see "determine if a word has a byte
+// equal to n" from https://graphics.stanford.edu/~seander/bithacks.html)
+#define HTTP_WORD_ONES   (0x0101010101010101ULL)
+#define HTTP_WORD_HIGHS  (0x8080808080808080ULL)
+#define HTTP_WORD_SPACES (0x2020202020202020ULL)
+
+static inline uint64_t _ctorm_http_word(char *buf) {
+  uint64_t word = 0;
+  memcpy(&word, buf, sizeof(word)); // compiles to a single (unaligned) load
+  return word;
+}
+
 bool ctorm_http_version(char *buf, ctorm_http_version_t *version) {
   if (NULL == buf || NULL == version)
     return false;
 
-  if (cu_streq(buf, "HTTP/1.1")) {
+  switch (_ctorm_http_word(buf)) {
+  case HTTP_WORD_1_1:
     *version = CTORM_HTTP_1_1;
     return true;
-  }
 
-  else if (cu_streq(buf, "HTTP/1.0")) {
+  case HTTP_WORD_1_0:
     *version = CTORM_HTTP_1_0;
     return true;
   }
@@ -64,20 +100,60 @@ bool ctorm_http_version(char *buf, ctorm_http_version_t *version) {
   return false;
 }
 
-bool ctorm_http_method(char *buf, ctorm_http_method_t *method) {
+uint32_t ctorm_http_method(char *buf, ctorm_http_method_t *method) {
   if (NULL == buf || NULL == method)
-    return false;
+    return 0;
+
+  uint64_t word = _ctorm_http_word(buf), spaces = word ^ HTTP_WORD_SPACES;
+  uint32_t len  = 0;
+
+  // find the space after the method, which marks the length of the method
+  if (0 == (spaces = (spaces - HTTP_WORD_ONES) & ~spaces & HTTP_WORD_HIGHS))
+    return 0;
+
+  // remove the space and the rest of the buffer from the word
+  len = __builtin_ctzll(spaces) / 8;
+  word &= (1ULL << (len * 8)) - 1;
+
+  switch (word) {
+  case HTTP_WORD_GET:
+    *method = CTORM_HTTP_GET;
+    break;
 
-  struct ctorm_http_method_desc *desc = &ctorm_http_methods[0];
+  case HTTP_WORD_POST:
+    *method = CTORM_HTTP_POST;
+    break;
 
-  for (; NULL != desc->name; desc++) {
-    if (cu_streq((char *)desc->name, buf)) {
-      *method = desc - &ctorm_http_methods[0];
-      return true;
-    }
+  case HTTP_WORD_PUT:
+    *method = CTORM_HTTP_PUT;
+    break;
+
+  case HTTP_WORD_HEAD:
+    *method = CTORM_HTTP_HEAD;
+    break;
+
+  case HTTP_WORD_DELETE:
+    *method = CTORM_HTTP_DELETE;
+    break;
+
+  case HTTP_WORD_OPTIONS:
+    *method = CTORM_HTTP_OPTIONS;
+    break;
+
+  case HTTP_WORD_CONNECT:
+    *method = CTORM_HTTP_CONNECT;
+    break;
+
+  case HTTP_WORD_TRACE:
+    *method = CTORM_HTTP_TRACE;
+    break;
+
+  default:
+    return 0;
   }
 
-  return false;
+  // method is followed by a space
+  return len + 1;
 }
 
 bool ctorm_http_is_valid_header_name(char *name, uint32_t size) {
@@ -1,3 +1,4 @@
+#include "error.h"
 #include "util.h"
 #include "http.h"
 
@@ -5,7 +6,14 @@
 #include "req.h"
 #include "res.h"
 
+#include <sys/uio.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <time.h>
 
@@ -46,35 +54,462 @@ int _ctorm_log_prefix(FILE *stream, const char *color, const char *prefix) {
       prefix);
 }
 
-int _ctorm_log_req(ctorm_req_t *req, ctorm_res_t *res) {
-  return fprintf(stdout,
-      FG_RESET FG_CYAN " %hu " FG_GREEN "%" cu_macro_to_str(
-          CTORM_HTTP_METHOD_MAX) "s %s" FG_RESET "\n",
-      res->code,
-      ctorm_req_method(req),
-      req->path);
-}
+// request logger flush interval, and the max entry count for a single writev()
+#define LOG_INTERVAL_NS (50 * 1000 * 1000)
+#define LOG_BATCH_MAX   (64)
+#define LOG_LINE_MAX    (CTORM_LOG_PATH_MAX * 6 + 128)
+
+// used to give every logger an unique ID
+uint64_t _ctorm_logger_ids = 1;
 
-int ctorm_log(ctorm_req_t *req, ctorm_res_t *res, uint64_t time) {
-  int size = _ctorm_log_prefix(stdout, FG_MAGENTA, "log");
+// per-thread request log queue, and the ID of the logger that owns it
+__thread struct ctorm_log_ring *_ctorm_log_ring       = NULL;
+__thread uint64_t               _ctorm_log_ring_owner = 0;
 
+// used to release the queue of a thread when it exits
+pthread_once_t _ctorm_log_ring_once = PTHREAD_ONCE_INIT;
+pthread_key_t  _ctorm_log_ring_key;
+
+int _ctorm_log_time(char *buf, size_t size, uint64_t time) {
   // check if the time is valid or not
   if (time == 0)
-    size += fprintf(stdout, FG_YELLO "???ms" FG_RESET);
+    return snprintf(buf, size, FG_YELLO "???ms" FG_RESET);
 
   // print as microseconds (1000000μs = 1s)
   else if (time < 1000)
-    size += fprintf(stdout, FG_YELLO LOG_MICROSECOND FG_RESET, time);
+    return snprintf(buf, size, FG_YELLO LOG_MICROSECOND FG_RESET, time);
 
   // print as milliseconds (1000ms = 1s)
   else if ((time /= 1000) < 1000)
-    size += fprintf(stdout, FG_YELLO LOG_MILLISECOND FG_RESET, time);
+    return snprintf(buf, size, FG_YELLO LOG_MILLISECOND FG_RESET, time);
 
   // print as seconds
+  return snprintf(buf, size, FG_YELLO LOG_SECOND FG_RESET, time / 1000);
+}
+
+int _ctorm_log_json_str(char *buf, size_t size, char *str) {
+  size_t len = 0;
+
+  for (; *str != 0 && len + 7 < size; str++) {
+    switch (*str) {
+    case '"':
+    case '\\':
+      buf[len++] = '\\';
+      buf[len++] = *str;
+      break;
+
+    default:
+      // escape the control characters
+      if ((uint8_t)*str < 0x20)
+        len += snprintf(buf + len, size - len, "\\u%04x", (uint8_t)*str);
+      else
+        buf[len++] = *str;
+    }
+  }
+
+  buf[len] = 0;
+  return len;
+}
+
+void _ctorm_logger_stamp(ctorm_logger_t *logger, time_t now) {
+  struct tm tm;
+
+  // the stamp is only formatted once per second
+  if (logger->stamp_time == now && logger->stamp_len > 0)
+    return;
+
+  logger->stamp_time = now;
+  logger->stamp_len  = 0;
+
+  switch (logger->format) {
+  case CTORM_LOG_TEXT:
+    if (NULL == localtime_r(&now, &tm))
+      return;
+
+    logger->stamp_len = snprintf(logger->stamp,
+        sizeof(logger->stamp),
+        FG_GRAY "%02d/%02d/%04d %02d:%02d:%02d" FG_RESET " " FG_MAGENTA
+                "%5s" FG_BOLD FG_RESET " ",
+        tm.tm_mday,
+        tm.tm_mon + 1,
+        (tm.tm_year + 1900),
+        tm.tm_hour,
+        tm.tm_min,
+        tm.tm_sec,
+        "log");
+    break;
+
+  case CTORM_LOG_JSON:
+    if (NULL == gmtime_r(&now, &tm))
+      return;
+
+    logger->stamp_len = strftime(logger->stamp,
+        sizeof(logger->stamp),
+        "{\"time\":\"%Y-%m-%dT%H:%M:%SZ\",",
+        &tm);
+    break;
+  }
+}
+
+int _ctorm_logger_fmt(
+    ctorm_logger_t *logger, struct ctorm_log_entry *entry, char *buf) {
+  char path[LOG_LINE_MAX];
+  int  size = 0;
+
+  switch (logger->format) {
+  case CTORM_LOG_TEXT:
+    size = _ctorm_log_time(buf, LOG_LINE_MAX, entry->time);
+    size += snprintf(buf + size,
+        LOG_LINE_MAX - size,
+        FG_RESET FG_CYAN " %hu " FG_GREEN "%" cu_macro_to_str(
+            CTORM_HTTP_METHOD_MAX) "s %s" FG_RESET "\n",
+        entry->code,
+        ctorm_http_method_name(entry->method),
+        entry->path);
+    break;
+
+  case CTORM_LOG_JSON:
+    _ctorm_log_json_str(path, sizeof(path), entry->path);
+    size = snprintf(buf,
+        LOG_LINE_MAX,
+        "\"code\":%hu,\"method\":\"%s\",\"path\":\"%s\","
+        "\"duration_us\":%llu}\n",
+        entry->code,
+        ctorm_http_method_name(entry->method),
+        path,
+        (unsigned long long)entry->time);
+    break;
+  }
+
+  return size >= LOG_LINE_MAX ? LOG_LINE_MAX - 1 : size;
+}
+
+void _ctorm_logger_writev(ctorm_logger_t *logger, struct iovec *iov, int cnt) {
+  ssize_t ret = 0;
+
+  while (cnt > 0) {
+    if ((ret = writev(logger->fd, iov, cnt)) < 0) {
+      if (EINTR == errno)
+        continue;
+      return;
+    }
+
+    // skip the completely written vectors, and adjust the partial one
+    for (; cnt > 0 && (size_t)ret >= iov->iov_len; cnt--, iov++)
+      ret -= iov->iov_len;
+
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+}
+
+// releases the queue for one of it's owners, frees it if it has no owners left
+void _ctorm_logger_ring_release(struct ctorm_log_ring *ring, uint32_t owner) {
+  if (0 != __atomic_and_fetch(&ring->owners, ~owner, __ATOMIC_ACQ_REL))
+    return;
+
+  free(ring->entries);
+  free(ring);
+}
+
+// called when a thread with a queue exits
+void _ctorm_logger_ring_exit(void *ring) {
+  _ctorm_logger_ring_release(ring, CTORM_LOG_RING_THREAD);
+}
+
+void _ctorm_logger_ring_key_init(void) {
+  pthread_key_create(&_ctorm_log_ring_key, _ctorm_logger_ring_exit);
+}
+
+// removes the queue of an exited thread from the list, and releases it
+void _ctorm_logger_ring_remove(
+    ctorm_logger_t *logger, struct ctorm_log_ring *ring) {
+  struct ctorm_log_ring **cur = &logger->rings;
+
+  pthread_mutex_lock(&logger->mutex);
+
+  while (*cur != ring)
+    cur = &(*cur)->next;
+
+  *cur = ring->next;
+  pthread_mutex_unlock(&logger->mutex);
+
+  _ctorm_logger_ring_release(ring, CTORM_LOG_RING_LOGGER);
+}
+
+void _ctorm_logger_flush(ctorm_logger_t *logger) {
+  struct iovec           iov[LOG_BATCH_MAX * 2];
+  char                   lines[LOG_BATCH_MAX][LOG_LINE_MAX];
+  struct ctorm_log_ring *ring = NULL, *next = NULL;
+  uint32_t               head = 0, tail = 0;
+  uint64_t               dropped = 0;
+  int                    cnt = 0, size = 0;
+  bool                   exited  = false;
+
+  // other threads only add queues to the start of the list
+  pthread_mutex_lock(&logger->mutex);
+  ring = logger->rings;
+  pthread_mutex_unlock(&logger->mutex);
+
+  for (; NULL != ring; ring = next) {
+    next = ring->next;
+
+    // if the thread exited, it won't add more entries after these
+    exited = !(__atomic_load_n(&ring->owners, __ATOMIC_ACQUIRE) &
+               CTORM_LOG_RING_THREAD);
+    head   = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail = ring->tail;
+
+    for (; tail != head; tail++) {
+      struct ctorm_log_entry *entry = &ring->entries[tail & (logger->size - 1)];
+
+      // stamp changed (or the batch is full), write the current batch
+      if (cnt > 0 && (entry->stamp != logger->stamp_time ||
+                         cnt >= LOG_BATCH_MAX * 2)) {
+        _ctorm_logger_writev(logger, iov, cnt);
+        __atomic_add_fetch(&logger->written, cnt / 2, __ATOMIC_RELAXED);
+        cnt = 0;
+      }
+
+      _ctorm_logger_stamp(logger, entry->stamp);
+      size = _ctorm_logger_fmt(logger, entry, lines[cnt / 2]);
+
+      // all the entries in a batch share the same cached stamp
+      iov[cnt].iov_base     = logger->stamp;
+      iov[cnt].iov_len      = logger->stamp_len;
+      iov[cnt + 1].iov_base = lines[cnt / 2];
+      iov[cnt + 1].iov_len  = size;
+      cnt += 2;
+    }
+
+    // entries are formatted, release them to the producer
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+
+    // all the entries of the exited thread are formatted, so it can be freed
+    if (exited)
+      _ctorm_logger_ring_remove(logger, ring);
+  }
+
+  if (cnt > 0) {
+    _ctorm_logger_writev(logger, iov, cnt);
+    __atomic_add_fetch(&logger->written, cnt / 2, __ATOMIC_RELAXED);
+  }
+
+  if (dropped > 0) {
+    __atomic_add_fetch(&logger->dropped, dropped, __ATOMIC_RELAXED);
+    ctorm_warn("request log queue is full, dropped %llu entries",
+        (unsigned long long)dropped);
+  }
+}
+
+void *_ctorm_logger_thread(void *_logger) {
+  ctorm_logger_t *logger = _logger;
+  struct timespec wake;
+  bool            active = true;
+
+  while (active) {
+    pthread_mutex_lock(&logger->mutex);
+
+    clock_gettime(CLOCK_REALTIME, &wake);
+
+    if ((wake.tv_nsec += LOG_INTERVAL_NS) >= 1000000000) {
+      wake.tv_nsec -= 1000000000;
+      wake.tv_sec++;
+    }
+
+    // wait for the next flush, or until the logger is stopped
+    if (logger->active)
+      pthread_cond_timedwait(&logger->cond, &logger->mutex, &wake);
+
+    active = logger->active;
+    pthread_mutex_unlock(&logger->mutex);
+
+    // update the cached time, and write all the queued entries
+    logger->now = time(NULL);
+    _ctorm_logger_flush(logger);
+  }
+
+  return NULL;
+}
+
+struct ctorm_log_ring *_ctorm_logger_ring_new(ctorm_logger_t *logger) {
+  struct ctorm_log_ring *ring = calloc(1, sizeof(*ring));
+
+  if (NULL == ring)
+    return NULL;
+
+  if (NULL == (ring->entries = calloc(logger->size, sizeof(*ring->entries)))) {
+    free(ring);
+    return NULL;
+  }
+
+  ring->owners = CTORM_LOG_RING_THREAD | CTORM_LOG_RING_LOGGER;
+
+  // add the queue to the logger's list
+  pthread_mutex_lock(&logger->mutex);
+  ring->next    = logger->rings;
+  logger->rings = ring;
+  pthread_mutex_unlock(&logger->mutex);
+
+  return ring;
+}
+
+ctorm_logger_t *ctorm_logger_new(ctorm_config_t *config) {
+  ctorm_logger_t *logger = calloc(1, sizeof(*logger));
+
+  if (NULL == logger) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  logger->id     = __atomic_fetch_add(&_ctorm_logger_ids, 1, __ATOMIC_RELAXED);
+  logger->format = config->log_format;
+  logger->now    = time(NULL);
+  logger->fd     = STDOUT_FILENO;
+
+  // round the queue size up to a power of two
+  for (logger->size = 1; logger->size < config->log_queue;)
+    logger->size <<= 1;
+
+  if (NULL != config->log_path &&
+      (logger->fd = open(config->log_path,
+           O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+           0644)) < 0) {
+    free(logger);
+    errno = CTORM_ERR_LOG_FAIL;
+    return NULL;
+  }
+
+  pthread_mutex_init(&logger->mutex, NULL);
+  pthread_cond_init(&logger->cond, NULL);
+  logger->active = true;
+
+  if (pthread_create(&logger->thread, NULL, _ctorm_logger_thread, logger) !=
+      0) {
+    logger->active = false;
+    ctorm_logger_free(logger);
+    errno = CTORM_ERR_LOG_FAIL;
+    return NULL;
+  }
+
+  return logger;
+}
+
+bool ctorm_logger_push(
+    ctorm_logger_t *logger, ctorm_req_t *req, ctorm_res_t *res, uint64_t time) {
+  struct ctorm_log_ring  *ring  = _ctorm_log_ring;
+  struct ctorm_log_entry *entry = NULL;
+  uint32_t                head = 0, len = 0;
+
+  if (NULL == logger)
+    return false;
+
+  // get a queue for the current thread, if we don't already have one
+  if (_ctorm_log_ring_owner != logger->id) {
+    pthread_once(&_ctorm_log_ring_once, _ctorm_logger_ring_key_init);
+
+    if (NULL == (ring = _ctorm_logger_ring_new(logger)))
+      return false;
+
+    // thread no longer uses the queue of the previous logger
+    if (NULL != _ctorm_log_ring)
+      _ctorm_logger_ring_release(_ctorm_log_ring, CTORM_LOG_RING_THREAD);
+
+    _ctorm_log_ring       = ring;
+    _ctorm_log_ring_owner = logger->id;
+    pthread_setspecific(_ctorm_log_ring_key, ring);
+  }
+
+  head = ring->head;
+
+  // if the queue is full, drop the entry instead of waiting
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= logger->size) {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  entry         = &ring->entries[head & (logger->size - 1)];
+  entry->stamp  = logger->now;
+  entry->time   = time;
+  entry->code   = res->code;
+  entry->method = req->method;
+
+  // copy the path, truncate it if it's too long
+  if (NULL != req->path && (len = cu_strlen(req->path)) >= CTORM_LOG_PATH_MAX)
+    len = CTORM_LOG_PATH_MAX - 1;
+
+  memcpy(entry->path, req->path, len);
+  entry->path[len] = 0;
+
+  // publish the entry to the logger thread
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void ctorm_logger_free(ctorm_logger_t *logger) {
+  struct ctorm_log_ring *ring = NULL;
+
+  if (NULL == logger)
+    return;
+
+  // stop the logger thread, it will flush the remaining entries before exiting
+  pthread_mutex_lock(&logger->mutex);
+
+  if (logger->active) {
+    logger->active = false;
+    pthread_cond_signal(&logger->cond);
+    pthread_mutex_unlock(&logger->mutex);
+    pthread_join(logger->thread, NULL);
+  }
+
   else
-    size += fprintf(stdout, FG_YELLO LOG_SECOND FG_RESET, time / 1000);
+    pthread_mutex_unlock(&logger->mutex);
+
+  // release all the queues, queues of the running threads are freed on exit
+  while (NULL != (ring = logger->rings)) {
+    logger->rings = ring->next;
+    _ctorm_logger_ring_release(ring, CTORM_LOG_RING_LOGGER);
+  }
+
+  if (STDOUT_FILENO != logger->fd)
+    close(logger->fd);
+
+  pthread_mutex_destroy(&logger->mutex);
+  pthread_cond_destroy(&logger->cond);
+  free(logger);
+}
+
+bool ctorm_log_stats(ctorm_app_t *app, ctorm_log_stats_t *stats) {
+  if (NULL == app) {
+    errno = CTORM_ERR_BAD_APP_PTR;
+    return false;
+  }
+
+  if (NULL == stats) {
+    errno = CTORM_ERR_BAD_DATA_PTR;
+    return false;
+  }
+
+  memset(stats, 0, sizeof(*stats));
+
+  if (NULL == app->logger)
+    return true;
+
+  pthread_mutex_lock(&app->logger->mutex);
+
+  stats->written = __atomic_load_n(&app->logger->written, __ATOMIC_RELAXED);
+  stats->dropped = __atomic_load_n(&app->logger->dropped, __ATOMIC_RELAXED);
+
+  // include the entries dropped since the last flush
+  for (struct ctorm_log_ring *ring = app->logger->rings; NULL != ring;
+       ring                        = ring->next)
+    stats->dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
 
-  return size + _ctorm_log_req(req, res);
+  pthread_mutex_unlock(&app->logger->mutex);
+  return true;
 }
 
 int ctorm_info(const char *msg, ...) {
@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include "multipart.h"
+#include "error.h"
+#include "log.h"
+
+#include <sys/sendfile.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+struct ctorm_multipart {
+  ctorm_multipart_read_t read; // reads the body
+  void                  *data; // data passed to the read function
+  bool                   eof;  // is the complete body received?
+
+  char     delim[CTORM_MULTIPART_BOUNDARY_MAX + 5]; // CRLF, "--" and boundary
+  uint32_t delim_len;
+
+  char     buf[CTORM_MULTIPART_BUF_SIZE]; // received body data
+  uint32_t pos, len;                      // start and end of the unread data
+};
+
+// checks the name of the header line that ends at the colon
+#define multipart_header_is(line, colon, name)                                 \
+  ((colon) - (line) == sizeof(name) - 1 &&                                     \
+      strncasecmp(line, name, sizeof(name) - 1) == 0)
+
+// gets a parameter from a header value, such as the boundary or the name
+char *_ctorm_multipart_param(char *value, char *end, char *name) {
+  int64_t name_len = strlen(name);
+  char   *param = NULL, *cur = NULL;
+  int64_t i = 0;
+
+  while (NULL != (value = memchr(value, ';', end - value))) {
+    for (value++; value < end && (' ' == *value || '\t' == *value); value++)
+      continue;
+
+    if (end - value <= name_len || '=' != value[name_len] ||
+        strncasecmp(value, name, name_len) != 0)
+      continue;
+
+    // token value ends with a separator
+    if ('"' != *(value += name_len + 1)) {
+      for (cur = value; cur < end && ';' != *cur && ' ' != *cur; cur++)
+        continue;
+      return strndup(value, cur - value);
+    }
+
+    // quoted string value may contain escaped characters
+    if (NULL == (param = malloc(end - value)))
+      return NULL;
+
+    for (cur = value + 1; cur < end && '"' != *cur; cur++) {
+      if ('\\' == *cur && cur + 1 < end)
+        cur++;
+      param[i++] = *cur;
+    }
+
+    param[i] = 0;
+    return param;
+  }
+
+  return NULL;
+}
+
+// creates a temporary file for a part, it's unlinked so only the fd remains
+int _ctorm_multipart_tmp(void) {
+  char *dir = getenv("TMPDIR"), path[PATH_MAX];
+  int   fd  = -1;
+
+  if (NULL == dir || '\0' == *dir)
+    dir = "/tmp";
+
+  snprintf(path, sizeof(path), "%s/ctorm-XXXXXX", dir);
+
+  if ((fd = mkstemp(path)) < 0) {
+    debug("failed to create a temporary file in %s: %s", dir, strerror(errno));
+    errno = CTORM_ERR_WRITE_FAIL;
+    return -1;
+  }
+
+  unlink(path);
+  return fd;
+}
+
+bool _ctorm_multipart_write(int fd, char *data, uint64_t size) {
+  ssize_t ret = 0;
+
+  for (; size > 0; data += ret, size -= ret) {
+    if ((ret = write(fd, data, size)) <= 0) {
+      errno = CTORM_ERR_WRITE_FAIL;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// appends data to the part value, moves it to a temporary file if needed
+bool _ctorm_multipart_append(ctorm_part_t *part, char *data, uint64_t size) {
+  char *value = NULL;
+
+  if (0 == size)
+    return true;
+
+  // keep the small fields in the memory
+  if (part->fd < 0 && NULL == part->filename &&
+      part->size + size <= CTORM_MULTIPART_VALUE_MAX) {
+    if (NULL == (value = realloc(part->value, part->size + size + 1))) {
+      errno = CTORM_ERR_ALLOC_FAIL;
+      return false;
+    }
+
+    memcpy(value + part->size, data, size);
+    part->size += size;
+    value[part->size] = 0;
+    part->value       = value;
+    return true;
+  }
+
+  if (part->fd < 0) {
+    if ((part->fd = _ctorm_multipart_tmp()) < 0 ||
+        !_ctorm_multipart_write(part->fd, part->value, part->size))
+      return false;
+
+    free(part->value);
+    part->value = NULL;
+  }
+
+  if (!_ctorm_multipart_write(part->fd, data, size))
+    return false;
+
+  part->size += size;
+  return true;
+}
+
+// creates a new part from the header lines, each line ends with a CRLF
+ctorm_part_t *_ctorm_multipart_part(char *line, char *end) {
+  ctorm_part_t *part  = NULL;
+  char         *colon = NULL, *eol = NULL, *value = NULL;
+
+  if (NULL == (part = calloc(1, sizeof(*part))) ||
+      NULL == (part->value = calloc(1, 1))) {
+    free(part);
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  part->fd = -1;
+
+  for (; line < end; line = eol + 2) {
+    eol = memmem(line, end - line, "\r\n", 2);
+
+    if (NULL == (colon = memchr(line, ':', eol - line)))
+      continue;
+
+    for (value = colon + 1; value < eol && (' ' == *value || '\t' == *value);
+        value++)
+      continue;
+
+    if (multipart_header_is(line, colon, "content-disposition")) {
+      part->name     = _ctorm_multipart_param(value, eol, "name");
+      part->filename = _ctorm_multipart_param(value, eol, "filename");
+    }
+
+    else if (multipart_header_is(line, colon, "content-type"))
+      part->type = strndup(value, eol - value);
+  }
+
+  // every form-data part should have a name, see RFC 7578 section 4.2
+  if (NULL == part->name) {
+    ctorm_multipart_free(part);
+    errno = CTORM_ERR_BAD_MULTIPART;
+    return NULL;
+  }
+
+  return part;
+}
+
+// moves the unread data to the start of the buffer, and receives more data
+bool _ctorm_multipart_fill(struct ctorm_multipart *mp) {
+  int64_t ret = 0, size = 0;
+
+  memmove(mp->buf, mp->buf + mp->pos, mp->len - mp->pos);
+  mp->len -= mp->pos;
+  mp->pos = 0;
+
+  // body ended before the last delimiter, or a header block is too large
+  if (mp->eof || mp->len == sizeof(mp->buf)) {
+    errno = CTORM_ERR_BAD_MULTIPART;
+    return false;
+  }
+
+  size = sizeof(mp->buf) - mp->len;
+
+  if ((ret = mp->read(mp->data, mp->buf + mp->len, size)) < 0)
+    return false; // errno is set by the read function
+
+  mp->eof = ret == 0;
+  mp->len += ret;
+  return true;
+}
+
+// searches the unread data of the buffer
+#define multipart_find(mp, str, size)                                          \
+  ((char *)memmem((mp)->buf + (mp)->pos, (mp)->len - (mp)->pos, str, size))
+
+// skips the data until the delimiter, or appends it to the part
+bool _ctorm_multipart_until_delim(
+    struct ctorm_multipart *mp, ctorm_part_t *part) {
+  uint32_t keep  = mp->delim_len - 1, size = 0;
+  char    *found = NULL;
+
+  while (NULL == (found = multipart_find(mp, mp->delim, mp->delim_len))) {
+    // delimiter may start at the end of the buffer, so keep the end
+    if (mp->len - mp->pos > keep) {
+      size = mp->len - mp->pos - keep;
+
+      if (NULL != part &&
+          !_ctorm_multipart_append(part, mp->buf + mp->pos, size))
+        return false;
+
+      mp->pos += size;
+    }
+
+    if (!_ctorm_multipart_fill(mp))
+      return false;
+  }
+
+  size = found - mp->buf - mp->pos;
+
+  if (NULL != part && !_ctorm_multipart_append(part, mp->buf + mp->pos, size))
+    return false;
+
+  mp->pos = found - mp->buf + mp->delim_len;
+  return true;
+}
+
+ctorm_part_t *ctorm_multipart_parse(
+    char *type, ctorm_multipart_read_t read, void *data) {
+  struct ctorm_multipart *mp   = NULL;
+  ctorm_part_t           *head = NULL, **tail = &head;
+  char                   *boundary = NULL, *found = NULL;
+  uint32_t                count    = 0;
+
+  boundary = _ctorm_multipart_param(type, type + strlen(type), "boundary");
+
+  if (NULL == boundary || '\0' == *boundary ||
+      strlen(boundary) > CTORM_MULTIPART_BOUNDARY_MAX) {
+    free(boundary);
+    errno = CTORM_ERR_BAD_MULTIPART;
+    return NULL;
+  }
+
+  if (NULL == (mp = calloc(1, sizeof(*mp)))) {
+    free(boundary);
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  mp->read      = read;
+  mp->data      = data;
+  mp->delim_len = sprintf(mp->delim, "\r\n--%s", boundary);
+  free(boundary);
+
+  // first delimiter may not follow a CRLF, so start the buffer with one
+  memcpy(mp->buf, "\r\n", mp->len = 2);
+
+  // skip the preamble
+  if (!_ctorm_multipart_until_delim(mp, NULL))
+    goto fail;
+
+  while (true) {
+    // last delimiter is followed by "--", others are followed by a CRLF
+    while (mp->len - mp->pos < 2)
+      if (!_ctorm_multipart_fill(mp))
+        goto fail;
+
+    if (memcmp(mp->buf + mp->pos, "--", 2) == 0)
+      break;
+
+    // every part may use a temporary file, so limit the part count
+    if (memcmp(mp->buf + mp->pos, "\r\n", 2) != 0 ||
+        ++count > CTORM_MULTIPART_PARTS_MAX) {
+      errno = CTORM_ERR_BAD_MULTIPART;
+      goto fail;
+    }
+
+    // header block ends with an empty line (it may be the CRLF above)
+    while (NULL == (found = multipart_find(mp, "\r\n\r\n", 4)))
+      if (!_ctorm_multipart_fill(mp))
+        goto fail;
+
+    *tail = _ctorm_multipart_part(mp->buf + mp->pos + 2, found + 2);
+
+    if (NULL == *tail)
+      goto fail;
+
+    mp->pos = found - mp->buf + 4;
+
+    // part value ends with the next delimiter
+    if (!_ctorm_multipart_until_delim(mp, *tail))
+      goto fail;
+
+    if ((*tail)->fd >= 0)
+      lseek((*tail)->fd, 0, SEEK_SET);
+
+    tail = &(*tail)->next;
+  }
+
+  free(mp);
+
+  if (NULL == head)
+    errno = CTORM_ERR_EMPTY_BODY;
+
+  return head;
+
+fail:
+  ctorm_multipart_free(head);
+  free(mp);
+  return NULL;
+}
+
+void ctorm_multipart_free(ctorm_part_t *parts) {
+  ctorm_part_t *next = NULL;
+
+  for (; NULL != parts; parts = next) {
+    next = parts->next;
+
+    if (parts->fd >= 0)
+      close(parts->fd);
+
+    free(parts->name);
+    free(parts->filename);
+    free(parts->type);
+    free(parts->value);
+    free(parts);
+  }
+}
+
+// copies the temporary file of a part in the kernel
+bool _ctorm_multipart_copy(int in, int out, uint64_t size) {
+  off64_t in_off = 0;
+  off_t   offset = 0;
+  ssize_t ret    = 0;
+
+  while (size > 0 &&
+         (ret = copy_file_range(in, &in_off, out, NULL, size, 0)) > 0)
+    size -= ret;
+
+  if (0 == size)
+    return true;
+
+  // copy_file_range() is not supported between all the file systems
+  if (ret < 0 && (EXDEV == errno || ENOSYS == errno || EINVAL == errno ||
+                     EOPNOTSUPP == errno)) {
+    for (offset = in_off; size > 0; size -= ret)
+      if ((ret = sendfile(out, in, &offset, size)) <= 0)
+        break;
+  }
+
+  if (0 == size)
+    return true;
+
+  errno = CTORM_ERR_WRITE_FAIL;
+  return false;
+}
+
+bool ctorm_part_save(ctorm_part_t *part, char *path) {
+  bool ret = false;
+  int  fd  = -1;
+
+  if (NULL == part) {
+    errno = CTORM_ERR_BAD_PART_PTR;
+    return false;
+  }
+
+  if (NULL == path) {
+    errno = CTORM_ERR_BAD_PATH_PTR;
+    return false;
+  }
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    errno = CTORM_ERR_WRITE_FAIL;
+    return false;
+  }
+
+  if (part->fd < 0)
+    ret = _ctorm_multipart_write(fd, part->value, part->size);
+  else
+    ret = _ctorm_multipart_copy(part->fd, fd, part->size);
+
+  close(fd);
+  return ret;
+}
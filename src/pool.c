@@ -5,7 +5,10 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
 #define pool_debug(f, ...)                                                     \
   debug("(thread %p) " f, pthread_self(), ##__VA_ARGS__)
@@ -14,9 +17,6 @@
 #define pool_lock()   pthread_mutex_lock(&pool->mutex)
 #define pool_unlock() pthread_mutex_unlock(&pool->mutex)
 
-// get the ongoing (current) work of the thread
-#define POOL_WORK (pool->ongoing[id])
-
 // start & stop the provided work
 #define pool_work_start(work) ((work)->start((work)->data))
 #define pool_work_stop(work)  ((work)->stop((work)->data))
@@ -31,54 +31,81 @@ struct ctorm_work *_ctorm_pool_work(ctorm_pool_t *pool) {
   if (NULL == (pool->head = work->next))
     pool->tail = NULL;
 
+  pool->queued--;
   return work;
 }
 
-// the worker function
-void *_ctorm_pool_worker(void *_pool) {
-  ctorm_pool_t *pool = _pool;
-  uint32_t      id   = 0;
+// waits for new work, returns false if an extra thread should exit
+bool _ctorm_pool_idle(ctorm_pool_t *pool) {
+  struct timespec deadline;
 
-  pool_lock();
-  id = pool->running++;
-  pool_unlock();
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += CTORM_POOL_IDLE_TIMEOUT;
+
+  while (pool->active && NULL == pool->head) {
+    pool_debug("waiting for new work");
+
+    if (pool->running <= pool->min)
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+
+    // an extra thread exits if it doesn't get any work for a while
+    else if (pthread_cond_timedwait(
+                 &pool->work_cond, &pool->mutex, &deadline) == ETIMEDOUT &&
+             NULL == pool->head && pool->running > pool->min)
+      return false;
+  }
+
+  return true;
+}
+
+// the worker function
+void *_ctorm_pool_worker(void *_worker) {
+  struct ctorm_worker *worker = _worker;
+  ctorm_pool_t        *pool   = worker->pool;
+  struct ctorm_work   *work   = NULL;
 
   while (true) {
     pool_lock();
 
     // hold the thread until we get a work
-    while (pool->active && NULL == pool->head) {
-      pool_debug("waiting for new work");
-      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+    pool->idle++;
+
+    if (!_ctorm_pool_idle(pool)) {
+      pool->idle--;
+      pool_debug("exiting the idle worker");
+      break;
     }
 
+    pool->idle--;
+
     if (!pool->active)
       break;
 
-    POOL_WORK = _ctorm_pool_work(pool);
+    work = worker->work = _ctorm_pool_work(pool);
     pool_unlock();
 
     // check if we got any work
-    if (NULL == POOL_WORK)
+    if (NULL == work)
       continue;
 
     // do the work
-    pool_debug("picked up new work: %p (%p)", POOL_WORK, POOL_WORK->start);
-    pool_work_start(POOL_WORK);
+    pool_debug("picked up new work: %p (%p)", work, work->start);
+    pool_work_start(work);
 
-    // free the work
-    pool_debug("completed work: %p (%p)", POOL_WORK, POOL_WORK->start);
-    struct ctorm_work *saved = POOL_WORK;
-    POOL_WORK                = NULL;
-    free(saved);
+    // keep the completed work for reuse, see ctorm_pool_add()
+    pool_debug("completed work: %p (%p)", work, work->start);
+    pool_lock();
+    worker->work = NULL;
+    work->next   = pool->spare;
+    pool->spare  = work;
 
     // notify the main thread
-    pool_lock();
     pool->len--;
     pthread_cond_broadcast(&pool->done_cond);
     pool_unlock();
   }
 
+  worker->used = false;
   pool->running--;
   pthread_cond_signal(&pool->exit_cond);
   pool_unlock();
@@ -87,37 +114,85 @@ void *_ctorm_pool_worker(void *_pool) {
   return NULL;
 }
 
-ctorm_pool_t *ctorm_pool_new(uint32_t count) {
+// creates a new worker thread, pool should be locked
+bool _ctorm_pool_spawn(ctorm_pool_t *pool) {
+  struct ctorm_worker *worker = NULL;
+  pthread_attr_t       attr;
+  pthread_t            thread;
+  uint32_t             id = 0;
+  int                  ret = 0;
+
+  // find an unused worker slot
+  while (id < pool->total && pool->workers[id].used)
+    id++;
+
+  if (id >= pool->total)
+    return false;
+
+  worker       = &pool->workers[id];
+  worker->pool = pool;
+  worker->work = NULL;
+
+  /*
+
+   * spread the workers between the NUMA nodes of the CPUs, a worker can run
+   * on any of the CPUs of it's node, so the memory it allocates stays local
+
+  */
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (NULL != pool->cpus)
+    ctorm_cpus_attr(pool->cpus, &attr, id, true);
+
+  // create a new (detached) worker thread
+  ret = pthread_create(&thread, &attr, _ctorm_pool_worker, worker);
+  pthread_attr_destroy(&attr);
+
+  if (ret != 0) {
+    pool_debug("failed to create thread %u: %s", id, strerror(ret));
+    errno = ret;
+    return false;
+  }
+
+  worker->used = true;
+  pool->running++;
+  return true;
+}
+
+ctorm_pool_t *ctorm_pool_new(uint32_t min, uint32_t max, ctorm_cpus_t *cpus) {
   ctorm_pool_t *pool = calloc(1, sizeof(ctorm_pool_t));
-  pthread_t     thread;
 
   if (NULL == pool)
     return NULL;
 
   pool->active  = true;
-  pool->total   = count;
-  pool->ongoing = calloc(count, sizeof(*pool->ongoing));
+  pool->min     = min;
+  pool->total   = max < min ? min : max;
+  pool->cpus    = cpus;
+  pool->workers = calloc(pool->total, sizeof(*pool->workers));
   pthread_mutex_init(&pool->mutex, NULL);
   pthread_cond_init(&pool->work_cond, NULL);
   pthread_cond_init(&pool->done_cond, NULL);
   pthread_cond_init(&pool->exit_cond, NULL);
 
-  for (; count > 0; count--) {
-    // create a new worker thread
-    if (pthread_create(&thread, NULL, _ctorm_pool_worker, pool) != 0) {
-      pool_debug("failed to create thread %d: %s", count, ctorm_error());
-      ctorm_pool_free(pool);
-      return NULL; // errno set by pthread_create()
-    }
+  if (NULL == pool->workers) {
+    ctorm_pool_free(pool);
+    return NULL;
+  }
 
-    // detach thread so the resources will be freed on exit
-    if (pthread_detach(thread) != 0) {
-      pool_debug("failed to deattach thread %d: %s", count, ctorm_error());
+  // start with the min thread count, more threads are created when needed
+  pool_lock();
+
+  while (pool->running < min) {
+    if (!_ctorm_pool_spawn(pool)) {
+      pool_unlock();
       ctorm_pool_free(pool);
-      return NULL; // errno set by pthread_detach()
+      return NULL; // errno set by _ctorm_pool_spawn()
     }
   }
 
+  pool_unlock();
   return pool;
 }
 
@@ -128,9 +203,16 @@ bool ctorm_pool_add(ctorm_pool_t *pool, ctorm_pool_func_t start,
     return false;
   }
 
-  struct ctorm_work *work = calloc(1, sizeof(struct ctorm_work));
+  struct ctorm_work *work = NULL;
+
+  pool_lock();
+
+  // reuse a completed work, or allocate a new one
+  if (NULL != (work = pool->spare))
+    pool->spare = work->next;
 
-  if (work == NULL) {
+  else if (NULL == (work = malloc(sizeof(struct ctorm_work)))) {
+    pool_unlock();
     errno = CTORM_ERR_ALLOC_FAIL;
     return false;
   }
@@ -138,8 +220,7 @@ bool ctorm_pool_add(ctorm_pool_t *pool, ctorm_pool_func_t start,
   work->start = start;
   work->stop  = stop;
   work->data  = data;
-
-  pool_lock();
+  work->next  = NULL;
 
   // add work to the queue
   if (NULL == pool->head)
@@ -148,6 +229,18 @@ bool ctorm_pool_add(ctorm_pool_t *pool, ctorm_pool_func_t start,
     pool->tail = pool->tail->next = work;
 
   pool->len++;
+  pool->queued++;
+
+  /*
+
+   * if there are more works waiting in the queue than the idle threads, the
+   * new work would have to wait, so create an extra thread if we can, idle
+   * extra threads exit after a timeout, see _ctorm_pool_idle()
+
+  */
+  if (pool->queued > pool->idle && pool->running < pool->total &&
+      !_ctorm_pool_spawn(pool))
+    pool_debug("failed to create an extra thread: %s", ctorm_error());
 
   // we have new work, tell it to the bois
   pthread_cond_broadcast(&pool->work_cond);
@@ -175,9 +268,9 @@ void ctorm_pool_free(ctorm_pool_t *pool) {
   pool_unlock();
 
   // call the stop function for all the ongoing (current) works
-  for (; NULL != pool->ongoing && pool->total > 0; pool->total--) {
-    if (NULL != pool->ongoing[pool->total - 1])
-      pool_work_stop(pool->ongoing[pool->total - 1]);
+  for (uint32_t i = 0; NULL != pool->workers && i < pool->total; i++) {
+    if (NULL != pool->workers[i].work)
+      pool_work_stop(pool->workers[i].work);
   }
 
   // wait for all the threads to exit
@@ -191,15 +284,31 @@ void ctorm_pool_free(ctorm_pool_t *pool) {
   pool_debug("done waiting for threads");
   pool_unlock();
 
+  // free the completed works
+  for (next = pool->spare; NULL != (cur = next);) {
+    next = cur->next;
+    free(cur);
+  }
+
   // free all the resources
   pthread_mutex_destroy(&pool->mutex);
   pthread_cond_destroy(&pool->work_cond);
   pthread_cond_destroy(&pool->done_cond);
   pthread_cond_destroy(&pool->exit_cond);
-  free(pool->ongoing);
+  free(pool->workers);
   free(pool);
 }
 
+uint32_t ctorm_pool_size(ctorm_pool_t *pool) {
+  uint32_t result = 0;
+
+  pool_lock();
+  result = pool->running;
+  pool_unlock();
+
+  return result;
+}
+
 uint32_t ctorm_pool_remaining(ctorm_pool_t *pool) {
   int64_t result = 0;
 
@@ -0,0 +1,211 @@
+#include "prefork.h"
+#include "socket.h"
+#include "error.h"
+#include "log.h"
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <poll.h>
+
+// slot count of the counters, there's a single slot if prefork is disabled
+#define prefork_slots(workers) ((workers) > 0 ? (workers) : 1)
+
+struct ctorm_stats *ctorm_stats_new(uint32_t workers) {
+  struct ctorm_stats *stats = NULL;
+  uint64_t            size  = sizeof(struct ctorm_stats);
+
+  size += sizeof(struct ctorm_stats_slot) * prefork_slots(workers);
+
+  // counters are updated by the workers, so they are in the shared memory
+  stats = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+      -1, 0);
+
+  if (MAP_FAILED == stats) {
+    debug("failed to map the counters: %s", strerror(errno));
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  stats->size = size;
+  return stats;
+}
+
+void ctorm_stats_get(
+    struct ctorm_stats *stats, uint32_t workers, ctorm_app_stats_t *out) {
+  struct ctorm_stats_slot *slot = NULL;
+
+  memset(out, 0, sizeof(*out));
+  out->restarts = __atomic_load_n(&stats->restarts, __ATOMIC_RELAXED);
+
+  for (uint32_t i = 0; i < prefork_slots(workers); i++) {
+    slot = &stats->slots[i];
+
+    out->requests += __atomic_load_n(&slot->requests, __ATOMIC_RELAXED);
+    out->connections += __atomic_load_n(&slot->connections, __ATOMIC_RELAXED);
+
+    if (workers > 0 && 0 != __atomic_load_n(&slot->pid, __ATOMIC_RELAXED))
+      out->workers++;
+  }
+}
+
+void ctorm_stats_free(struct ctorm_stats *stats) {
+  if (NULL != stats)
+    munmap(stats, stats->size);
+}
+
+// runs in the worker process, accepts the connections until it's stopped
+void _ctorm_prefork_worker(ctorm_app_t *app) {
+  bool ret = false;
+
+  // threads are not copied by fork(), so they are created by each worker
+  if (!ctorm_app_setup(app))
+    debug("failed to setup worker %u: %s", app->worker, ctorm_error());
+  else
+    ret = ctorm_socket_serve(app);
+
+  app->running = false;
+
+  // let the ongoing requests of the worker complete
+  if (ret && app->config->drain_timeout > 0)
+    ctorm_socket_drain(app);
+
+  // stops the threads, and flushes the request logger
+  ctorm_app_free(app);
+  fflush(NULL);
+
+  _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*
+
+ * spawns the worker, and opens a pidfd for it, which becomes readable when the
+ * worker exits, fd is set to -1 if pidfds are not supported
+
+*/
+bool _ctorm_prefork_spawn(ctorm_app_t *app, uint32_t i, int *fd) {
+  struct ctorm_stats_slot *slot = &app->stats->slots[i];
+  pid_t                    pid  = -1;
+
+  // connections of the previous worker are closed with it
+  __atomic_store_n(&slot->connections, 0, __ATOMIC_RELAXED);
+
+  // don't write the buffered output twice
+  fflush(NULL);
+
+  if ((pid = fork()) < 0) {
+    debug("failed to fork worker %u: %s", i, strerror(errno));
+    errno = CTORM_ERR_FORK_FAIL;
+    return false;
+  }
+
+  if (0 == pid) {
+    app->worker = i;
+    _ctorm_prefork_worker(app);
+  }
+
+  debug("started worker %u (%d)", i, pid);
+
+#ifdef SYS_pidfd_open
+  *fd = syscall(SYS_pidfd_open, pid, 0);
+#else
+  *fd = -1;
+#endif
+
+  slot->start = time(NULL);
+  __atomic_store_n(&slot->pid, pid, __ATOMIC_RELAXED);
+
+  return true;
+}
+
+bool ctorm_prefork_run(ctorm_app_t *app) {
+  uint32_t                 count = app->config->workers, i = 0;
+  struct ctorm_stats_slot *slot  = NULL;
+  struct pollfd           *fds   = NULL;
+  bool                     ret   = false;
+  pid_t                    pid   = -1;
+  int                      status;
+
+  if (NULL == (fds = calloc(count, sizeof(*fds)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  for (i = 0; i < count; i++) {
+    fds[i].fd     = -1;
+    fds[i].events = POLLIN;
+  }
+
+  for (i = 0; i < count; i++)
+    if (!_ctorm_prefork_spawn(app, i, &fds[i].fd))
+      goto end; // errno set by _ctorm_prefork_spawn()
+
+  // wait for the workers, and restart the ones that exit
+  while (app->running) {
+    // without the pidfds, the workers are checked every CTORM_PREFORK_DELAY
+    if (poll(fds, count, CTORM_PREFORK_DELAY * 1000) < 0 && EINTR != errno) {
+      debug("failed to wait for the workers: %s", strerror(errno));
+      errno = CTORM_ERR_FORK_FAIL;
+      goto end;
+    }
+
+    for (i = 0; i < count && app->running; i++) {
+      slot = &app->stats->slots[i];
+
+      // only wait for the workers, other child processes belong to the app
+      if (0 == slot->pid || waitpid(slot->pid, &status, WNOHANG) <= 0)
+        continue;
+
+      debug("worker %u (%d) exited with %d", i, slot->pid, status);
+      __atomic_store_n(&slot->pid, 0, __ATOMIC_RELAXED);
+
+      if (fds[i].fd >= 0)
+        close(fds[i].fd);
+      fds[i].fd = -1;
+
+      // don't restart a worker that fails on start in a busy loop
+      if (time(NULL) - slot->start < CTORM_PREFORK_DELAY)
+        sleep(CTORM_PREFORK_DELAY);
+
+      if (!app->running)
+        break;
+
+      __atomic_add_fetch(&app->stats->restarts, 1, __ATOMIC_RELAXED);
+
+      if (!_ctorm_prefork_spawn(app, i, &fds[i].fd))
+        goto end; // errno set by _ctorm_prefork_spawn()
+    }
+  }
+
+  ret = true;
+
+end:
+  // stop the workers, they drain their connections if a timeout is set
+  for (i = 0; i < count; i++)
+    if (0 != (pid = app->stats->slots[i].pid))
+      kill(pid, SIGTERM);
+
+  for (i = 0; i < count; i++) {
+    if (0 == (pid = app->stats->slots[i].pid))
+      continue;
+
+    while (waitpid(pid, NULL, 0) < 0 && EINTR == errno)
+      continue;
+
+    __atomic_store_n(&app->stats->slots[i].pid, 0, __ATOMIC_RELAXED);
+  }
+
+  for (i = 0; i < count; i++)
+    if (fds[i].fd >= 0)
+      close(fds[i].fd);
+
+  free(fds);
+  return ret;
+}
@@ -8,7 +8,9 @@
 #include "util.h"
 
 #include "uri.h"
+#include "app.h"
 #include "req.h"
+#include "ws.h"
 #include "log.h"
 
 #include <sys/socket.h>
@@ -18,6 +20,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #define req_debug(f, ...)                                                      \
   debug("(" FG_BOLD "request " FG_CYAN "0x%p %d" FG_RESET FG_BOLD FG_RESET     \
@@ -30,6 +33,7 @@
 #define req_recv_until(buf, max, del) _ctorm_req_recv_until(req, buf, max, del)
 #define req_recv_alloc(buf, max, del) _ctorm_req_recv_alloc(req, buf, max, del)
 #define req_recv_char(char)           _ctorm_req_recv_char(req, char)
+#define req_peek(len)                 _ctorm_req_peek(req, len)
 
 int64_t _ctorm_req_recv(ctorm_req_t *req, char *buf, uint64_t len, int flags) {
   int64_t ret = ctorm_conn_recv(req->conn, buf, len, flags);
@@ -47,6 +51,22 @@ int64_t _ctorm_req_recv(ctorm_req_t *req, char *buf, uint64_t len, int flags) {
   return ret;
 }
 
+char *_ctorm_req_peek(ctorm_req_t *req, uint32_t len) {
+  char *buf = ctorm_conn_peek(req->conn, len);
+
+  if (NULL != buf)
+    return buf;
+
+  switch (errno) {
+  case ETIMEDOUT:
+  case EAGAIN:
+    req->code = 408;
+    break;
+  }
+
+  return NULL;
+}
+
 int64_t _ctorm_req_recv_until(
     ctorm_req_t *req, char *buf, int64_t max, char del) {
   int64_t indx = 0;
@@ -131,11 +151,11 @@ void ctorm_req_init(ctorm_req_t *req, ctorm_conn_t *conn) {
 }
 
 void ctorm_req_free(ctorm_req_t *req) {
-  if (!ctorm_http_code_is_error(req->code)) {
+  if (NULL == req->body && !req->expect &&
+      !ctorm_http_code_is_error(req->code)) {
     // receive rest of the body from the connection
-    for (char c = 0; req->body_size > 0; req->body_size--)
-      if (req_recv_char(&c) != 1)
-        break;
+    for (char *chunk = NULL; ctorm_req_chunk(req, &chunk) > 0;)
+      continue;
   }
 
   if (NULL != req->body_form)
@@ -144,33 +164,60 @@ void ctorm_req_free(ctorm_req_t *req) {
   if (NULL != req->body_json)
     ctorm_json_free(req->body_json);
 
+  ctorm_multipart_free(req->body_parts);
+
   ctorm_pair_free(req->locals);
 
   ctorm_query_free(req->queries);
   ctorm_pair_free(req->params);
 
   ctorm_headers_free(req->headers);
+
+  // free the WebSocket if the connection is not upgraded
+  ctorm_ws_free(req->ws);
+
+  // path may point to the target, see _ctorm_req_parse_origin()
+  if (req->path != req->target)
+    free(req->path);
+
+  free(req->target);
+  free(req->host);
 }
 
 // 5.3.1. origin-form
 bool _ctorm_req_parse_origin(ctorm_req_t *req) {
-  ctorm_uri_t uri;
-  ctorm_uri_init(&uri);
+  uint32_t path_len = 0;
+  char    *end      = NULL;
+
+  /*
+
+   * only split the target into the path and the query, the query is parsed
+   * when it's first accessed with ctorm_req_query()
 
-  if (NULL == ctorm_uri_parse_path(&uri, req->target)) {
+  */
+  if (NULL == (end = ctorm_uri_split_path(
+                   req->target, &path_len, &req->query, &req->query_size))) {
     req_debug("failed to parse: %s", ctorm_error());
     return false;
   }
 
-  // save all the URI fields
-  req->path    = uri.path;
-  req->queries = uri.query;
+  // if the target only contains a path that needs no decoding, just use it
+  if (*end == 0 && NULL == req->query &&
+      NULL == memchr(req->target, '%', path_len) &&
+      NULL == memchr(req->target, '+', path_len)) {
+    req->path = req->target;
+    return true;
+  }
 
-  // remove the used fields to prevent them from being freed
-  uri.path  = NULL;
-  uri.query = NULL;
+  if (NULL == (req->path = malloc(path_len + 1))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  memcpy(req->path, req->target, path_len);
+  req->path[path_len] = 0;
+  ctorm_percent_decode(req->path, path_len);
 
-  ctorm_uri_free(&uri);
   return true;
 }
 
@@ -236,26 +283,42 @@ bool _ctorm_req_parse_asterisk(ctorm_req_t *req) {
   return true;
 }
 
-bool ctorm_req_recv(ctorm_req_t *req) {
-  char    http_method[CTORM_HTTP_METHOD_MAX + 1];
-  char    http_version[CTORM_HTTP_VERSION_LEN + 1];
-  int64_t size = 0;
+bool ctorm_req_parse_target(ctorm_req_t *req) {
+  // parse the request target (see "5.3. Request Target")
+  switch (*req->target) {
+  // origin-form
+  case '/':
+    return _ctorm_req_parse_origin(req);
+
+  // asterisk-form
+  case '*':
+    return _ctorm_req_parse_asterisk(req);
+  }
 
-  // clear the method and the version buffer
-  memset(http_method, 0, sizeof(http_method));
-  memset(http_version, 0, sizeof(http_version));
+  // absolute-form or authority-form
+  return _ctorm_req_parse_absolute(req) || _ctorm_req_parse_authority(req);
+}
+
+bool ctorm_req_recv(ctorm_req_t *req) {
+  char    *buf  = NULL;
+  int64_t  size = 0;
+  uint32_t len  = 0;
 
-  // receive the method from the request line
-  if (req_recv_until(http_method, sizeof(http_method), ' ') < 0) {
+  // receive the method from the request line, straight from the buffer
+  if (NULL == (buf = req_peek(CTORM_HTTP_METHOD_MAX + 1))) {
     req_debug("failed to receive the HTTP method");
     return false;
   }
 
-  if (!ctorm_http_method(http_method, &req->method)) {
-    req_debug("received an invalid HTTP method: %s", http_method);
+  if (0 == (len = ctorm_http_method(buf, &req->method))) {
+    req_debug("received an invalid HTTP method");
     return false;
   }
 
+  // request is started, draining app should not close the connection anymore
+  __atomic_store_n(&req->conn->idle, false, __ATOMIC_SEQ_CST);
+  ctorm_conn_skip(req->conn, len);
+
   // receive the HTTP request target
   if ((size = req_recv_alloc(&req->target, ctorm_http_target_max, ' ')) < 0) {
     req_debug("failed to receive the HTTP request target");
@@ -267,42 +330,28 @@ bool ctorm_req_recv(ctorm_req_t *req) {
     return false;
   }
 
-  // parse the request target (see "5.3. Request Target")
-  switch (*req->target) {
-  // origin-form
-  case '/':
-    if (!_ctorm_req_parse_origin(req))
-      return false;
-    break;
-
-  // asterisk-form
-  case '*':
-    if (!_ctorm_req_parse_asterisk(req))
-      return false;
-    break;
-
-  // absolute-form or authority-form
-  default:
-    if (!_ctorm_req_parse_absolute(req) && !_ctorm_req_parse_authority(req))
-      return false;
-  }
+  if (!ctorm_req_parse_target(req))
+    return false;
 
-  // receive the HTTP version
-  if (req_recv_until(http_version, sizeof(http_version), '\r') < 0) {
+  // receive the HTTP version and the CRLF
+  if (NULL == (buf = req_peek(CTORM_HTTP_VERSION_LEN + 2))) {
     req_debug("failed to receive the HTTP version");
     return false;
   }
 
-  if (req_recv_char(NULL) != '\n') {
-    req_debug("failed to receive the CRLF of the request line");
+  if (!ctorm_http_version(buf, &req->version)) {
+    req_debug("received an invalid HTTP version");
     return false;
   }
 
-  if (!ctorm_http_version(http_version, &req->version)) {
-    req_debug("received an invalid HTTP version: %s", http_version);
+  if (buf[CTORM_HTTP_VERSION_LEN] != '\r' ||
+      buf[CTORM_HTTP_VERSION_LEN + 1] != '\n') {
+    req_debug("failed to receive the CRLF of the request line");
     return false;
   }
 
+  ctorm_conn_skip(req->conn, CTORM_HTTP_VERSION_LEN + 2);
+
   char   *name = NULL, *value = NULL;
   uint8_t count = 0;
   char    c     = 0;
@@ -384,6 +433,7 @@ bool ctorm_req_recv(ctorm_req_t *req) {
   char *content_len  = ctorm_req_get(req, CTORM_HTTP_CONTENT_LENGTH);
   char *transfer_enc = ctorm_req_get(req, CTORM_HTTP_TRANSFER_ENCODING);
   char *host         = ctorm_req_get(req, CTORM_HTTP_HOST);
+  char *expect       = ctorm_req_get(req, CTORM_HTTP_EXPECT);
 
   // if no host is specified in the URI, read it from the host header
   if (NULL == req->host && NULL != host)
@@ -415,6 +465,23 @@ bool ctorm_req_recv(ctorm_req_t *req) {
     return false;
   }
 
+  /*
+
+   * client waits for "100 Continue" before sending the body, it's sent when
+   * the body is first read, so if the request is rejected before that (by a
+   * middleware or a route), the client doesn't send a body we would discard
+
+  */
+  if (NULL != expect && CTORM_HTTP_1_0 != req->version) {
+    if (strcasecmp(expect, "100-continue") != 0) {
+      req_debug("unsupported expectation: %s", expect);
+      req->code = 417;
+      return false;
+    }
+
+    req->expect = req->body_size > 0;
+  }
+
   req->code = 200;
   return true;
 }
@@ -425,6 +492,16 @@ char *ctorm_req_query(ctorm_req_t *req, char *name) {
     return NULL;
   }
 
+  // parse the target query on the first access, a failed parse is not repeated
+  if (NULL == req->queries && NULL != req->query && 0 == req->query_err &&
+      NULL == (req->queries = ctorm_query_parse(req->query, req->query_size)))
+    req->query_err = errno;
+
+  if (0 != req->query_err) {
+    errno = req->query_err;
+    return NULL;
+  }
+
   return ctorm_query_get(req->queries, name);
 }
 
@@ -450,13 +527,14 @@ void *ctorm_req_local(ctorm_req_t *req, char *name, ...) {
 
   va_start(args, name);
 
-  if (NULL == (value = va_arg(args, char *)))
-    local = ctorm_pair_find(req->locals, name);
-  else
+  // request locals override the app locals with the same name
+  if (NULL != (value = va_arg(args, char *)))
     local = ctorm_pair_add(&req->locals, name, value);
+  else if (NULL == (local = ctorm_pair_find(req->locals, name)))
+    value = ctorm_locals_get(req->app_locals, name);
 
   va_end(args);
-  return NULL == local ? NULL : local->value;
+  return NULL == local ? value : local->value;
 }
 
 ctorm_query_t *ctorm_req_form(ctorm_req_t *req) {
@@ -477,14 +555,20 @@ ctorm_query_t *ctorm_req_form(ctorm_req_t *req) {
     return NULL;
   }
 
-  char data[size];
-  memset(data, 0, size);
+  // body can be large, so don't use the stack (coroutine stacks are small)
+  char *data = NULL;
 
-  if (ctorm_req_body(req, data, size) != size)
-    return NULL; // errno set by ctorm_req_body()
+  if (NULL == (data = malloc(size))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  // errno is set by ctorm_req_body() or ctorm_query_parse() if they fail
+  if (ctorm_req_body(req, data, size) == size)
+    req->body_form = ctorm_query_parse(data, size);
 
-  // errno is set by ctorm_query_parse() if the it fails
-  return req->body_form = ctorm_query_parse(data, size);
+  free(data);
+  return req->body_form;
 }
 
 cJSON *ctorm_req_json(ctorm_req_t *req) {
@@ -506,20 +590,68 @@ cJSON *ctorm_req_json(ctorm_req_t *req) {
   }
 
   // receive all the data to provide to ctorm_json_decode()
-  char data[size + 1];
-  memset(data, 0, size + 1);
+  char *data = NULL;
+
+  if (NULL == (data = calloc(1, size + 1))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
 
-  if (ctorm_req_body(req, data, size) != size)
-    return NULL; // errno set by ctorm_req_body()
+  // errno is set by ctorm_req_body() or ctorm_json_decode() if they fail
+  if (ctorm_req_body(req, data, size) == size)
+    req->body_json = ctorm_json_decode(data);
 
-  // errno is set by ctorm_json_decode() if the it fails
-  return req->body_json = ctorm_json_decode(data);
+  free(data);
+  return req->body_json;
 #else
   errno = CTORM_ERR_NO_JSON_SUPPORT;
   return NULL;
 #endif
 }
 
+// reads the body for the multipart parser
+int64_t _ctorm_req_multipart_read(void *req, char *buf, int64_t size) {
+  if (((ctorm_req_t *)req)->body_size <= 0)
+    return 0;
+  return ctorm_req_body(req, buf, size);
+}
+
+ctorm_part_t *ctorm_req_multipart(ctorm_req_t *req) {
+  if (NULL != req->body_parts)
+    return req->body_parts;
+
+  char *type = ctorm_req_get(req, CTORM_HTTP_CONTENT_TYPE);
+
+  if (NULL == type || !cu_startswith(type, "multipart/form-data")) {
+    errno = CTORM_ERR_BAD_CONTENT_TYPE;
+    return NULL;
+  }
+
+  if (req->body_size <= 0) {
+    errno = CTORM_ERR_EMPTY_BODY;
+    return NULL;
+  }
+
+  // errno is set by ctorm_multipart_parse() if it fails
+  return req->body_parts =
+             ctorm_multipart_parse(type, _ctorm_req_multipart_read, req);
+}
+
+ctorm_part_t *ctorm_req_part(ctorm_req_t *req, char *name) {
+  ctorm_part_t *part = NULL;
+
+  if (NULL == name) {
+    errno = CTORM_ERR_BAD_PART_PTR;
+    return NULL;
+  }
+
+  for (part = ctorm_req_multipart(req); NULL != part; part = part->next)
+    if (cu_streq(part->name, name))
+      return part;
+
+  return NULL;
+}
+
 const char *ctorm_req_method(ctorm_req_t *req) {
   if (ctorm_http_code_is_error(req->code))
     return NULL;
@@ -535,6 +667,20 @@ char *ctorm_req_get(ctorm_req_t *req, char *name) {
   return ctorm_headers_get(req->headers, name);
 }
 
+// sends "100 Continue" if the client is waiting for it to send the body
+bool _ctorm_req_continue(ctorm_req_t *req) {
+  char         status[] = "HTTP/1.1 100\r\n\r\n";
+  struct iovec iov      = {.iov_base = status, .iov_len = sizeof(status) - 1};
+
+  if (!req->expect)
+    return true;
+
+  req->expect = false;
+  req_debug("sending 100 Continue");
+
+  return ctorm_conn_sendv(req->conn, &iov, 1);
+}
+
 int64_t ctorm_req_body(ctorm_req_t *req, char *buffer, int64_t size) {
   if (NULL == buffer || size <= 0) {
     errno = CTORM_ERR_BAD_BUFFER;
@@ -553,9 +699,57 @@ int64_t ctorm_req_body(ctorm_req_t *req, char *buffer, int64_t size) {
   if (size == 0)
     return 0;
 
+  // body may be already received (i.e. HTTP/2 streams)
+  if (NULL != req->body) {
+    memcpy(buffer, req->body, size);
+    req->body += size;
+    return size;
+  }
+
+  if (!_ctorm_req_continue(req))
+    return -1;
+
   return req_recv(buffer, size, MSG_WAITALL);
 }
 
+int64_t ctorm_req_chunk(ctorm_req_t *req, char **chunk) {
+  int64_t size = req->body_size;
+
+  if (NULL == chunk) {
+    errno = CTORM_ERR_BAD_BUFFER;
+    return -1;
+  }
+
+  // no more body left to receive
+  if (size <= 0)
+    return 0;
+
+  // body may be already received (i.e. HTTP/2 streams)
+  if (NULL != req->body) {
+    *chunk = req->body;
+    req->body += size;
+    req->body_size = 0;
+    return size;
+  }
+
+  if (!_ctorm_req_continue(req))
+    return -1;
+
+  if ((size = ctorm_conn_chunk(req->conn, chunk, size)) > 0) {
+    req->body_size -= size;
+    return size;
+  }
+
+  switch (errno) {
+  case ETIMEDOUT:
+  case EAGAIN:
+    req->code = 408;
+    break;
+  }
+
+  return -1;
+}
+
 bool ctorm_req_persist(ctorm_req_t *req) {
   if (ctorm_http_code_is_error(req->code))
     return false;
@@ -571,6 +765,9 @@ bool ctorm_req_persist(ctorm_req_t *req) {
 
   case CTORM_HTTP_1_0:
     return NULL != con && cu_streq(con, "keep-alive");
+
+  case CTORM_HTTP_2:
+    return true;
   }
 
   return false;
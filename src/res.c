@@ -5,10 +5,13 @@
 #include "http.h"
 #include "util.h"
 
+#include "socket.h"
+#include "cache.h"
 #include "res.h"
 #include "log.h"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,38 +29,6 @@
       res,                                                                     \
       ##__VA_ARGS__)
 
-#define res_send(buf, len, flags) ctorm_conn_send(res->conn, buf, len, flags)
-
-bool _ctorm_res_send_str(ctorm_res_t *res, char *str) {
-  if (NULL == str)
-    return true;
-
-  for (; *str != 0; str++)
-    res_send(str, 1, MSG_NOSIGNAL);
-
-  return false;
-}
-
-void _ctorm_res_send_fmt(ctorm_res_t *res, char *fmt, ...) {
-  int     size = 0;
-  va_list args, args_cp;
-
-  va_start(args, fmt);
-  va_copy(args_cp, args);
-
-  size = vsnprintf(NULL, 0, fmt, args) + 1;
-  char buf[size];
-  vsnprintf(buf, size, fmt, args_cp);
-
-  res_send(buf, size - 1, MSG_NOSIGNAL);
-
-  va_end(args);
-  va_end(args_cp);
-}
-
-#define res_send_str(str)      _ctorm_res_send_str(res, str)
-#define res_send_fmt(fmt, ...) _ctorm_res_send_fmt(res, fmt, ##__VA_ARGS__)
-
 void ctorm_res_init(ctorm_res_t *res, ctorm_conn_t *conn) {
   if (NULL == res || NULL == conn)
     return;
@@ -91,6 +62,9 @@ void ctorm_res_init(ctorm_res_t *res, ctorm_conn_t *conn) {
 void ctorm_res_free(ctorm_res_t *res) {
   ctorm_headers_free(res->headers);
   ctorm_res_clear(res);
+
+  ctorm_cache_release(res->cache);
+  res->cache = NULL;
 }
 
 bool ctorm_res_code(ctorm_res_t *res, uint16_t code) {
@@ -138,8 +112,7 @@ uint32_t ctorm_res_body(ctorm_res_t *res, char *data, uint32_t size) {
 
   ctorm_res_clear(res);
 
-  if (size <= 0)
-    res->body_size = cu_strlen(data);
+  res->body_size = size > 0 ? size : cu_strlen(data);
 
   if (res->body_size <= 0)
     return 0;
@@ -295,43 +268,186 @@ void ctorm_res_redirect(ctorm_res_t *res, char *uri) {
   ctorm_res_set(res, "location", uri);
 }
 
-bool ctorm_res_send(ctorm_res_t *res) {
+// appends a string to the response head buffer, see ctorm_res_head()
+#define res_head_add(str, len)                                                 \
+  do {                                                                         \
+    if (total + (len) <= size)                                                 \
+      memcpy(buf + total, str, len);                                           \
+    total += (len);                                                            \
+  } while (0)
+
+uint32_t ctorm_res_head(
+    ctorm_res_t *res, char *buf, uint32_t size, bool cached) {
   ctorm_header_pos_t pos;
+  uint32_t           total = 0, len = 0;
+  char               line[64];
+
+  // status line
+  len = snprintf(line,
+      sizeof(line),
+      "HTTP/1.%c %hu\r\n",
+      CTORM_HTTP_1_0 == res->version ? '0' : '1',
+      res->code);
+  res_head_add(line, len);
+
+  // response headers
+  ctorm_headers_start(&pos);
+
+  while (ctorm_headers_next(res->headers, &pos)) {
+    if (cached && ctorm_cache_stable(pos.name))
+      continue;
 
-  switch (res->version) {
-  case CTORM_HTTP_1_0:
-    res_send_fmt("HTTP/1.0 %hu", res->code);
-    break;
+    len = cu_strlen(pos.name);
+    res_head_add(pos.name, len);
+    res_head_add(": ", 2);
 
-  case CTORM_HTTP_1_1:
-    res_send_fmt("HTTP/1.1 %hu", res->code);
-    break;
+    len = cu_strlen(pos.value);
+    res_head_add(pos.value, len);
+    res_head_add("\r\n", 2);
   }
 
-  // send the newline
-  res_send_str("\r\n");
+  /*
 
-  // send response headers
-  ctorm_headers_start(&pos);
+   * content length (1xx responses can't have one, and a streamed response
+   * doesn't have a known length), and the end of the head
 
-  while (ctorm_headers_next(res->headers, &pos))
-    res_send_fmt("%s: %s\r\n", pos.name, pos.value);
+  */
+  if (cached)
+    len = 0;
+  else if (res->code < 200 || res->stream)
+    len = snprintf(line, sizeof(line), "\r\n");
+  else
+    len = snprintf(
+        line, sizeof(line), "content-length: %u\r\n\r\n", res->body_size);
 
-  res_send_fmt("content-length: %lu\r\n", res->body_size);
-  res_send_str("\r\n");
+  res_head_add(line, len);
 
-  // if a file is specified read the body from file and send it
-  if (res->body_fd > 0) {
-    size_t read_size = 0;
-    char   read_buff[50];
+  return total;
+}
 
-    while ((read_size = read(res->body_fd, read_buff, sizeof(read_buff))) > 0)
-      res_send(read_buff, read_size, MSG_NOSIGNAL);
+bool ctorm_res_send(ctorm_res_t *res) {
+  struct iovec iov[2];
+  char         stack[1024], *head = stack;
+  uint32_t     size = 0;
+  bool         ret = false, cached = false;
+
+  /*
+
+   * if we have a cached response, the status line and the headers that are
+   * not cached are created for this request, and sent before the cached data
+
+  */
+  if (NULL != res->cache && ctorm_cache_put(res->cache, res)) {
+    res->code = res->cache->code;
+    cached    = true;
   }
 
-  // if a body is specified, send it
-  else if (res->body_size > 0)
-    res_send(res->body, res->body_size, MSG_NOSIGNAL);
+  // serialize the status line and the headers, use the heap if it's too large
+  if ((size = ctorm_res_head(res, head, sizeof(stack), cached)) >
+      sizeof(stack)) {
+    if (NULL == (head = malloc(size))) {
+      errno = CTORM_ERR_ALLOC_FAIL;
+      return false;
+    }
+
+    ctorm_res_head(res, head, size, cached);
+  }
+
+  iov[0].iov_base = head;
+  iov[0].iov_len  = size;
+  iov[1].iov_base = cached ? res->cache->data : res->body;
+  iov[1].iov_len  = cached ? res->cache->size : res->body_size;
+
+  // send the head and the body together, or the head followed by the file
+  if (cached)
+    ret = ctorm_conn_sendv(res->conn, iov, 2);
+  else if (res->body_fd > 0)
+    ret = ctorm_conn_sendfile(res->conn, iov, 1, res->body_fd,
+        lseek(res->body_fd, 0, SEEK_CUR), res->body_size);
+  else
+    ret = ctorm_conn_sendv(res->conn, iov, res->body_size > 0 ? 2 : 1);
+
+  if (head != stack)
+    free(head);
+
+  return ret;
+}
+
+ctorm_defer_t *ctorm_res_defer(ctorm_res_t *res) {
+  // deferred request is resumed on it's HTTP/1.x connection
+  if (CTORM_HTTP_2 == res->version || res->stream) {
+    errno = CTORM_ERR_NO_DEFER_SUPPORT;
+    return NULL;
+  }
+
+  if (NULL != res->defer)
+    return res->defer;
+
+  if (NULL == (res->defer = calloc(1, sizeof(*res->defer)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  /*
+
+   * deferred responses are not cached, remove the pending cache entry, so the
+   * other requests for the same key don't wait for this response
+
+  */
+  ctorm_cache_release(res->cache);
+  res->cache = NULL;
+
+  pthread_mutex_init(&res->defer->mutex, NULL);
+  return res->defer;
+}
+
+bool ctorm_defer_resume(
+    ctorm_defer_t *defer, ctorm_resume_t resume, void *data) {
+  bool moved = false;
+
+  if (NULL == defer) {
+    errno = CTORM_ERR_BAD_DEFER_PTR;
+    return false;
+  }
+
+  pthread_mutex_lock(&defer->mutex);
+  defer->resume  = resume;
+  defer->data    = data;
+  defer->resumed = true;
+  moved          = defer->moved;
+  pthread_mutex_unlock(&defer->mutex);
+
+  // if the handler already returned, resume the connection
+  if (moved)
+    ctorm_socket_resume(defer->socket);
 
   return true;
 }
+
+void ctorm_defer_move(struct ctorm_defer *defer,
+    struct ctorm_socket_data *socket, ctorm_req_t *req, ctorm_res_t *res,
+    struct timeval *start) {
+  bool resumed = false;
+
+  memcpy(&defer->req, req, sizeof(*req));
+  memcpy(&defer->res, res, sizeof(*res));
+  memcpy(&defer->start, start, sizeof(*start));
+  defer->socket = socket;
+
+  pthread_mutex_lock(&defer->mutex);
+  defer->moved = true;
+  resumed      = defer->resumed;
+  pthread_mutex_unlock(&defer->mutex);
+
+  // if the response is resumed before the handler returned, resume it now
+  if (resumed)
+    ctorm_socket_resume(socket);
+}
+
+void ctorm_defer_free(struct ctorm_defer *defer) {
+  ctorm_req_free(&defer->req);
+  ctorm_res_free(&defer->res);
+
+  pthread_mutex_destroy(&defer->mutex);
+  free(defer);
+}
@@ -6,15 +6,26 @@
 
 #include "pool.h"
 #include "conn.h"
+#include "uring.h"
 #include "uri.h"
+#include "sse.h"
+#include "ws.h"
+#include "handoff.h"
+#include "prefork.h"
+#include "h2.h"
+#include "co.h"
 #include "log.h"
 
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/un.h>
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -22,20 +33,30 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <errno.h>
+#include <poll.h>
 
 // stores data to pass to the threads
 struct ctorm_socket_data {
-  ctorm_app_t *app;
-  ctorm_conn_t con;
+  ctorm_app_t        *app;
+  ctorm_conn_t        con;
+  struct ctorm_defer *defer; // deferred response to resume
+
+  struct ctorm_socket_data *prev, *next; // open connections of the app
 };
 
 // request thread lock/unlock macro
 #define socket_lock()                                                          \
   if ((data)->app->config->lock_request)                                       \
-  pthread_mutex_lock(&(data)->app->req_mutex)
+  ctorm_co_lock(&(data)->app->req_mutex)
 #define socket_unlock()                                                        \
   if ((data)->app->config->lock_request)                                       \
-  pthread_mutex_unlock(&(data)->app->req_mutex)
+  ctorm_co_unlock(&(data)->app->req_mutex)
+
+// gets the path of a "unix:" address, NULL if it's not a Unix socket address
+#define socket_unix(addr)                                                      \
+  (strncmp(addr, "unix:", sizeof("unix:") - 1) == 0                            \
+          ? (addr) + sizeof("unix:") - 1                                       \
+          : NULL)
 
 // a neat debug macro
 #define socket_debug(f, ...)                                                   \
@@ -44,23 +65,190 @@ struct ctorm_socket_data {
       ##__VA_ARGS__)
 
 void _ctorm_socket_free(struct ctorm_socket_data *data) {
+  ctorm_app_t *app = data->app;
+
+  // remove from the open connections before closing, so drain can't use the fd
+  pthread_mutex_lock(&app->conn_mutex);
+
+  if (NULL != data->next)
+    data->next->prev = data->prev;
+
+  if (NULL != data->prev)
+    data->prev->next = data->next;
+  else
+    app->conns = data->next;
+
+  // wake up the drain, or the accept loop that waits for the connection limit
+  if ((app->draining && NULL == app->conns) ||
+      app->conn_count == app->config->max_connections)
+    pthread_cond_broadcast(&app->conn_cond);
+
+  app->conn_count--;
+
+  pthread_mutex_unlock(&app->conn_mutex);
+
+  ctorm_stats_add(app, connections, -1);
+
+  if (NULL != data->defer)
+    ctorm_defer_free(data->defer);
+
   ctorm_conn_close(&data->con);
-  memset(data, 0, sizeof(*data));
+
+  // keep the object for a new connection, unless there are enough of them
+  pthread_mutex_lock(&app->conn_mutex);
+
+  if (app->spare_count < CTORM_SOCKET_SPARE_MAX) {
+    data->next = app->spare;
+    app->spare = data;
+    app->spare_count++;
+    data = NULL;
+  }
+
+  pthread_mutex_unlock(&app->conn_mutex);
   free(data);
 }
 
+// checks if the connection already received (a part of) the next request
+bool _ctorm_socket_pending(struct ctorm_socket_data *data) {
+  int pending = 0;
+
+  if (data->con.buf_len > data->con.buf_pos)
+    return true;
+
+  return ioctl(data->con.socket, FIONREAD, &pending) == 0 && pending > 0;
+}
+
+// sends the response, returns true if the connection should persist
+bool _ctorm_socket_respond(struct ctorm_socket_data *data, ctorm_req_t *req,
+    ctorm_res_t *res, bool ret, struct timeval *start) {
+  ctorm_logger_t *logger  = data->app->logger;
+  bool            persist = ctorm_req_persist(req);
+  struct timeval  end;
+
+  socket_debug("sending a %d response", res->code);
+
+  /*
+
+   * don't receive the body if it's rejected, or if the client is still waiting
+   * for "100 Continue", just close the connection after the response
+
+  */
+  if (req->body_size > 0 && NULL == req->body &&
+      (413 == res->code || req->expect)) {
+    ctorm_res_set(res, "connection", "close");
+    req->body_size = 0;
+    persist        = false;
+  }
+
+  // app is draining the connections, this is the last request
+  else if (persist && __atomic_load_n(&data->app->draining, __ATOMIC_SEQ_CST)) {
+    ctorm_res_set(res, "connection", "close");
+    persist = false;
+  }
+
+  // send the complete response
+  if (!ctorm_res_send(res)) {
+    socket_debug("failed to send the response: %s", ctorm_error());
+    return false;
+  }
+
+  // count the requests that are received and routed
+  if (ret)
+    ctorm_stats_add(data->app, requests, 1);
+
+  /*
+
+   * finish process time measurement and log the request, this just queues
+   * the log entry, the logger thread does the actual formatting and writing,
+   * so no need to lock the request mutex here
+
+  */
+  if (ret && NULL != logger) {
+    gettimeofday(&end, NULL);
+
+    uint64_t env_val   = 1000000 * end.tv_sec + end.tv_usec;
+    uint64_t start_val = 1000000 * start->tv_sec + start->tv_usec;
+
+    log(logger, req, res, env_val - start_val);
+  }
+
+  // pass the upgraded connection to the WebSocket event loop
+  if (NULL != req->ws && 101 == res->code) {
+    socket_debug("upgraded to WebSocket");
+    ctorm_ws_start(data->app, req->ws, &data->con);
+
+    req->ws          = NULL;
+    data->con.socket = -1;
+    persist          = false;
+  }
+
+  // pass the connection to the event stream the client subscribed to
+  else if (NULL != req->sse && res->stream) {
+    socket_debug("subscribed to event stream");
+    ctorm_sse_add(req->sse, &data->con);
+
+    data->con.socket = -1;
+    persist          = false;
+  }
+
+  return persist;
+}
+
 void _ctorm_socket_handle(void *_data) {
-  struct ctorm_socket_data *data = _data;
-  socket_debug("handling new connection");
+  struct ctorm_socket_data *data  = _data;
+  struct ctorm_defer       *defer = data->defer;
+  bool                      ret = false, persist = true, reused = false;
+  struct timeval            start;
 
-  bool ret = false, persist = false, log = !data->app->config->disable_logging;
-  struct timeval start, end;
+  // use the io_uring of the current thread, if it's enabled and available
+  if (data->app->config->io_uring && NULL == data->app->co_loops)
+    data->con.ring = ctorm_uring_thread();
 
   // define the HTTP request and the response
   ctorm_req_t req;
   ctorm_res_t res;
 
-  do {
+  // complete the deferred response first, then continue with the connection
+  if (NULL != defer) {
+    socket_debug("resuming deferred response");
+
+    if (NULL != defer->resume) {
+      socket_lock();
+      defer->resume(&defer->req, &defer->res, defer->data);
+      socket_unlock();
+    }
+
+    persist = _ctorm_socket_respond(
+        data, &defer->req, &defer->res, true, &defer->start);
+    reused  = true;
+
+    data->defer = NULL;
+    ctorm_defer_free(defer);
+  }
+
+  // HTTP/2 with prior knowledge, connection starts with the HTTP/2 preface
+  else if (data->app->config->http2 && ctorm_h2_preface(&data->con)) {
+    socket_debug("received the HTTP/2 connection preface");
+    ctorm_h2_handle(data->app, &data->con, NULL);
+    persist = false;
+  }
+
+  else
+    socket_debug("handling new connection");
+
+  while (persist) {
+    /*
+
+     * stop at the request boundary if the app is draining the connections, a
+     * new connection is not closed, since the client is sending a request
+
+    */
+    __atomic_store_n(&data->con.idle, true, __ATOMIC_SEQ_CST);
+
+    if (reused && __atomic_load_n(&data->app->draining, __ATOMIC_SEQ_CST) &&
+        !_ctorm_socket_pending(data))
+      break;
+
     // initialize the HTTP request and the response
     ctorm_req_init(&req, &data->con);
     ctorm_res_init(&res, &data->con);
@@ -70,7 +258,17 @@ void _ctorm_socket_handle(void *_data) {
       ctorm_res_del(&res, CTORM_HTTP_SERVER);
 
     // receive the HTTP request
-    ret         = ctorm_req_recv(&req);
+    ret = ctorm_req_recv(&req);
+    __atomic_store_n(&data->con.idle, false, __ATOMIC_SEQ_CST);
+
+    // reject large bodies before routing the request, see ctorm_req_chunk()
+    if (ret && data->app->config->max_body_size > 0 &&
+        (uint64_t)req.body_size > data->app->config->max_body_size) {
+      socket_debug("request body is too large");
+      req.code = 413;
+      ret      = false;
+    }
+
     res.version = req.version;
     res.code    = req.code;
 
@@ -81,9 +279,18 @@ void _ctorm_socket_handle(void *_data) {
      * logging the request and response
 
     */
-    if (log)
+    if (NULL != data->app->logger)
       gettimeofday(&start, NULL);
 
+    // upgrade to HTTP/2, the request is responded on the first HTTP/2 stream
+    if (ret && data->app->config->http2 && ctorm_h2_upgrade(&req, &res)) {
+      socket_debug("upgraded to HTTP/2");
+      ctorm_h2_handle(data->app, &data->con, &req);
+
+      persist = false;
+      goto next;
+    }
+
     // route the request if we successfuly received a HTTP request
     if (ret) {
       /*
@@ -96,38 +303,34 @@ void _ctorm_socket_handle(void *_data) {
       socket_lock();
       ctorm_app_route(data->app, &req, &res);
       socket_unlock();
-    }
 
-    // debug print if we failed to receive a HTTP request
-    else
-      socket_debug("received an invalid HTTP request");
+      /*
 
-    persist = ctorm_req_persist(&req);
-    socket_debug("sending a %d response", res.code);
+       * if the response is deferred, the request and the response are moved
+       * to it, and the thread is released, connection continues on a pool
+       * thread (or on a new coroutine) after the response is resumed
 
-    // send the complete response
-    if (!ctorm_res_send(&res)) {
-      socket_debug("failed to send the response: %s", ctorm_error());
-      goto next;
+      */
+      if (NULL != res.defer) {
+        socket_debug("deferred the response");
+        data->defer = res.defer;
+        ctorm_defer_move(res.defer, data, &req, &res, &start);
+        return;
+      }
     }
 
-    // finish process time measurement and log the request
-    if (ret && log) {
-      gettimeofday(&end, NULL);
-
-      uint64_t env_val   = 1000000 * end.tv_sec + end.tv_usec;
-      uint64_t start_val = 1000000 * start.tv_sec + start.tv_usec;
+    // debug print if we failed to receive a HTTP request
+    else
+      socket_debug("received an invalid HTTP request");
 
-      socket_lock();
-      log(&req, &res, env_val - start_val);
-      socket_unlock();
-    }
+    persist = _ctorm_socket_respond(data, &req, &res, ret, &start);
 
   next:
     // reset the request and response data
     ctorm_req_free(&req);
     ctorm_res_free(&res);
-  } while (persist);
+    reused = true;
+  }
 
   // close & free the connection
   socket_debug("closing connection");
@@ -139,47 +342,169 @@ void _ctorm_socket_kill(void *_data) {
   shutdown(data->con.socket, SHUT_RDWR);
 }
 
+// handles the connection on a coroutine, or on a pool thread
+bool _ctorm_socket_run(struct ctorm_socket_data *data) {
+  ctorm_app_t *app = data->app;
+  uint32_t     i   = 0;
+
+  if (NULL == app->co_loops)
+    return ctorm_pool_add(
+        app->pool, _ctorm_socket_handle, _ctorm_socket_kill, data);
+
+  // distribute the connections between the coroutine loops
+  i = __atomic_fetch_add(&app->co_next, 1, __ATOMIC_RELAXED) % app->co_count;
+  return ctorm_co_start(app->co_loops[i], _ctorm_socket_handle, data);
+}
+
+void ctorm_socket_resume(struct ctorm_socket_data *data) {
+  if (_ctorm_socket_run(data))
+    return;
+
+  socket_debug("failed to resume the connection: %s", ctorm_error());
+  _ctorm_socket_free(data);
+}
+
+void ctorm_socket_free_spare(ctorm_app_t *app) {
+  struct ctorm_socket_data *data = NULL;
+
+  pthread_mutex_lock(&app->conn_mutex);
+
+  while (NULL != (data = app->spare)) {
+    app->spare = data->next;
+    free(data);
+  }
+
+  app->spare_count = 0;
+  pthread_mutex_unlock(&app->conn_mutex);
+}
+
 bool _ctorm_socket_new(ctorm_app_t *app, int socket, struct sockaddr *addr) {
-  struct ctorm_socket_data *data = calloc(1, sizeof(*data));
+  struct ctorm_socket_data *data = NULL;
+  struct timespec           deadline;
+
+  pthread_mutex_lock(&app->conn_mutex);
 
-  if (NULL == data) {
+  /*
+
+   * coroutines are not limited by the thread pool, so wait for a connection to
+   * close if we have too many of them, check if the app is stopped every sec
+
+  */
+  while (NULL != app->co_loops && app->running &&
+         app->conn_count >= app->config->max_connections) {
+    debug("reached connection limit, waiting for one to close");
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec++;
+    pthread_cond_timedwait(&app->conn_cond, &app->conn_mutex, &deadline);
+  }
+
+  // reuse the object of a closed connection, or allocate a new one
+  if (NULL != (data = app->spare)) {
+    app->spare = data->next;
+    app->spare_count--;
+  }
+
+  else if (NULL == (data = malloc(sizeof(*data)))) {
+    pthread_mutex_unlock(&app->conn_mutex);
     errno = CTORM_ERR_ALLOC_FAIL;
     return false;
   }
 
-  // setup the socket data for the connection
-  data->app        = app;
-  data->con.socket = socket;
+  /*
+
+   * setup the socket data for the connection, the receive buffer is not
+   * cleared, since only the data between buf_pos and buf_len is used
+
+  */
+  data->app         = app;
+  data->defer       = NULL;
+  data->prev        = NULL;
+  data->con.socket  = socket;
+  data->con.buf_pos = 0;
+  data->con.buf_len = 0;
+  data->con.ring    = NULL;
+  data->con.timeout = app->config->tcp_timeout;
+  data->con.idle    = false;
   memcpy(&data->con.addr, addr, sizeof(data->con.addr));
 
+  if (NULL != (data->next = app->conns))
+    app->conns->prev = data;
+  app->conns = data;
+  app->conn_count++;
+
+  pthread_mutex_unlock(&app->conn_mutex);
+
+  ctorm_stats_add(app, connections, 1);
+
   // make sure we don't have too many connections in the pool
-  if (ctorm_pool_remaining(app->pool) >= app->config->max_connections) {
+  if (NULL == app->co_loops &&
+      ctorm_pool_remaining(app->pool) >= app->config->max_connections) {
     debug("reached connection limit, waiting for one to finish");
     ctorm_pool_wait(app->pool, 1);
   }
 
-  // add new connection to the pool
-  if (!ctorm_pool_add(
-          app->pool, _ctorm_socket_handle, _ctorm_socket_kill, data)) {
-    free(data);
-    return false; // errno set by ctorm_pool_add()
+  // add new connection to the pool, or to a coroutine loop
+  if (!_ctorm_socket_run(data)) {
+    data->con.socket = -1; // closed by the caller
+    _ctorm_socket_free(data);
+    return false; // errno set by _ctorm_socket_run()
   }
 
   return true;
 }
 
-bool ctorm_socket_resolve(char *addr, struct addrinfo *info) {
+// resolves a Unix socket path, or an abstract socket name that starts with "@"
+bool _ctorm_socket_resolve_unix(
+    char *path, struct sockaddr_storage *addr, socklen_t *len) {
+  struct sockaddr_un *un   = (struct sockaddr_un *)addr;
+  uint64_t            size = strlen(path);
+
+  if (0 == size || ('@' == *path && 1 == size) ||
+      size >= sizeof(un->sun_path)) {
+    errno = CTORM_ERR_BAD_PATH;
+    return false;
+  }
+
+  memset(un, 0, sizeof(*un));
+  un->sun_family = AF_UNIX;
+  memcpy(un->sun_path, path, size);
+
+  // abstract socket names start with a null byte, and they are not terminated
+  if ('@' == *path) {
+    un->sun_path[0] = '\0';
+    *len            = offsetof(struct sockaddr_un, sun_path) + size;
+  }
+
+  else
+    *len = offsetof(struct sockaddr_un, sun_path) + size + 1;
+
+  return true;
+}
+
+bool ctorm_socket_resolve(
+    char *addr, struct sockaddr_storage *info, socklen_t *len) {
   struct addrinfo *hostinfo = NULL, *cur = NULL;
   ctorm_uri_t      uri;
-  bool             ret = false;
+  char            *host = NULL;
+  bool             ret  = false;
+
+  if (NULL != socket_unix(addr))
+    return _ctorm_socket_resolve_unix(socket_unix(addr), info, len);
 
   ctorm_uri_init(&uri);
 
   if (NULL == ctorm_uri_parse_host(&uri, addr))
     return false; // errno set by ctorm_uri_parse_host()
 
+  // remove the brackets around an IPv6 address
+  if ('[' == *(host = uri.host) && ']' == host[strlen(host) - 1]) {
+    host[strlen(host) - 1] = '\0';
+    host++;
+  }
+
   // resolve the host name
-  if (getaddrinfo(uri.host, NULL, NULL, &hostinfo) != 0 || NULL == info) {
+  if (getaddrinfo(host, NULL, NULL, &hostinfo) != 0 || NULL == info) {
     ctorm_uri_free(&uri);
     return false; // errno set by getaddrinfo()
   }
@@ -196,10 +521,11 @@ bool ctorm_socket_resolve(char *addr, struct addrinfo *info) {
     }
   }
 
-  // copy the addrinfo for the host to the provided info structure
+  // copy the address, since the addrinfo of the host is freed
   if (NULL != cur) {
-    memcpy(info, cur, sizeof(*cur));
-    ret = true;
+    memcpy(info, cur->ai_addr, cur->ai_addrlen);
+    *len = cur->ai_addrlen;
+    ret  = true;
   }
 
   // free the host addrinfo
@@ -209,126 +535,438 @@ bool ctorm_socket_resolve(char *addr, struct addrinfo *info) {
   return ret;
 }
 
-bool ctorm_socket_set_opts(ctorm_app_t *app, int sockfd) {
-  struct timeval timeout;
-  int            flag = 1;
+// sets the receive timeout and the buffer sizes of the socket
+bool _ctorm_socket_set_sock_opts(ctorm_app_t *app, int sockfd) {
+  ctorm_config_t *config = app->config;
+  struct timeval  timeout;
+  int             size = 0;
 
   // clear the timeout structure
   memset(&timeout, 0, sizeof(timeout));
 
+  // set the socket timeout
+  if (config->tcp_timeout > 0) {
+    timeout.tv_sec  = config->tcp_timeout;
+    timeout.tv_usec = 0;
+
+    setsockopt(
+        sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+  }
+
+  if ((size = config->rcvbuf_size) > 0 &&
+      setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+    return false;
+
+  if ((size = config->sndbuf_size) > 0 &&
+      setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0)
+    return false;
+
+  return true;
+}
+
+/*
+
+ * sets the options of a listening socket, accepted TCP sockets inherit the
+ * timeout, the buffer sizes and TCP_NODELAY from it, so these are not set for
+ * every connection
+
+*/
+bool _ctorm_socket_set_listen_opts(ctorm_app_t *app, int ssock, int family) {
+  ctorm_config_t *config = app->config;
+  int             flag   = 1;
+
+  // Unix sockets don't inherit the options, they are set after accept()
+  if (AF_UNIX == family)
+    return true;
+
+  // buffer sizes should be set before listen(), for the TCP window scaling
+  if (!_ctorm_socket_set_sock_opts(app, ssock))
+    goto fail;
+
+  /*
+
+   * Nagle's algorithm buffers and combines outgoing packets to solve the
+   * "small-packet problem", we want to send all the packets as fast as possible
+   * so we can disable this buffering with TCP_NODELAY
+
+  */
+  if (setsockopt(ssock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) < 0)
+    goto fail;
+
+#ifdef TCP_DEFER_ACCEPT
+  // don't wake up the acceptor until the client sends the request
+  if ((flag = config->defer_accept) > 0 &&
+      setsockopt(ssock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &flag, sizeof(flag)) < 0)
+    goto fail;
+#endif
+
+#ifdef TCP_FASTOPEN
+  // allow the clients to send the request with the SYN
+  if ((flag = config->fastopen) > 0 &&
+      setsockopt(ssock, IPPROTO_TCP, TCP_FASTOPEN, &flag, sizeof(flag)) < 0)
+    goto fail;
+#endif
+
+  return true;
+
+fail:
+  debug("failed to set the listener options: %s", strerror(errno));
+  ctorm_error_set(app, CTORM_ERR_SOCKET_OPT_FAIL);
+  return false;
+}
+
+bool ctorm_socket_set_opts(ctorm_app_t *app, int sockfd, int family) {
+  int flag = 1;
+
+  // Unix sockets don't have the TCP options
+  if (AF_UNIX == family) {
+    if (_ctorm_socket_set_sock_opts(app, sockfd))
+      return true;
+
+    ctorm_error_set(app, CTORM_ERR_SOCKET_OPT_FAIL);
+    return false;
+  }
+
 #ifdef TCP_QUICKACK
   /*
 
    * TCP delayed acknowledgment, buffers and combines multiple ACKs to reduce
    * overhead it may delay the ACK response by up to 500ms, and we don't want
-   * that because slow bad fast good
+   * that because slow bad fast good, this is not inherited from the listener
 
   */
   if (setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &flag, sizeof(flag)) < 0) {
     ctorm_error_set(app, CTORM_ERR_SOCKET_OPT_FAIL);
     return false;
   }
+#else
+  cu_unused(flag);
 #endif
 
+  return true;
+}
+
+// accepts a new connection, using io_uring if the ring is available
+int _ctorm_socket_accept(struct ctorm_uring **ring, int ssock,
+    struct sockaddr *addr, socklen_t *len, int flags) {
+  struct pollfd pfd  = {.fd = ssock, .events = POLLIN, .revents = 0};
+  int           sock = -1;
+
+again:
+  if (NULL == *ring)
+    sock = accept4(ssock, addr, len, flags);
+
+  // multishot accept does not return the address, so we need to get it
+  else if ((sock = ctorm_uring_accept(*ring, ssock, flags)) >= 0)
+    getpeername(sock, addr, len);
+
+  // kernel does not support multishot accept, fall back to accept()
+  else if (errno == EINVAL) {
+    debug("multishot accept is not supported, using accept()");
+    ctorm_uring_free(*ring);
+    *ring = NULL;
+    goto again;
+  }
+
   /*
 
-   * Nagle's algorithm buffers and combines outgoing packets to solve the
-   * "small-packet problem", we want to send all the packets as fast as possible
-   * so we can disable this buffering with TCP_NODELAY
+   * listening socket is non-blocking if it's shared with a process that
+   * listens on multiple addresses (see ctorm_socket_serve()), so wait for a
+   * connection, another process may accept it first
 
   */
-  if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) < 0) {
-    ctorm_error_set(app, CTORM_ERR_SOCKET_OPT_FAIL);
-    return false;
-  }
+  if (sock < 0 && (EAGAIN == errno || EWOULDBLOCK == errno) &&
+      poll(&pfd, 1, -1) >= 0)
+    goto again;
 
-  // set the socket timeout
-  if (app->config->tcp_timeout > 0) {
-    timeout.tv_sec  = app->config->tcp_timeout;
-    timeout.tv_usec = 0;
+  return sock;
+}
 
-    setsockopt(
-        sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+/*
+
+ * accepts a new connection from any of the listening sockets, ready sockets
+ * are accepted in turns, so a busy listener can't starve the others
+
+*/
+int _ctorm_socket_accept_any(struct pollfd *fds, uint32_t count,
+    uint32_t *next, struct sockaddr *addr, socklen_t *len, int flags) {
+  struct pollfd *fd   = NULL;
+  int            sock = -1;
+
+  while (true) {
+    for (uint32_t i = 0; i < count; i++) {
+      fd = &fds[(*next + i) % count];
+
+      if (!(fd->revents & POLLIN))
+        continue;
+
+      fd->revents = 0;
+
+      if ((sock = accept4(fd->fd, addr, len, flags)) >= 0) {
+        *next = (fd - fds + 1) % count;
+        return sock;
+      }
+
+      // connection may be accepted by another worker process
+      if (EAGAIN != errno && EWOULDBLOCK != errno && ECONNABORTED != errno)
+        return -1;
+    }
+
+    if (poll(fds, count, -1) < 0)
+      return -1;
   }
+}
 
-  // make the socket blocking
-  if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) & (~O_NONBLOCK)) == -1) {
-    errno = CTORM_ERR_FCNTL_FAIL;
+// checks if the socket is the listening socket of the address
+bool _ctorm_socket_is(int sock, struct sockaddr_storage *addr, socklen_t len) {
+  struct sockaddr_storage cur;
+  socklen_t               cur_len = sizeof(cur);
+
+  if (getsockname(sock, (struct sockaddr *)&cur, &cur_len) < 0)
     return false;
-  }
 
-  return true;
+  return cur_len == len && memcmp(&cur, addr, len) == 0;
 }
 
-bool ctorm_socket_start(ctorm_app_t *app, char *addr) {
-  int             ssock = 0, csock = 0, flag = 1;
-  struct sockaddr caddr;
-  struct addrinfo info;
-  socklen_t       clen = sizeof(caddr);
-  bool            ret  = false;
+// checks if a Unix socket file is left by a process that is not running
+bool _ctorm_socket_stale(struct sockaddr_storage *addr, socklen_t len) {
+  struct stat st;
+  bool        ret  = false;
+  int         sock = -1;
+  char       *path = ((struct sockaddr_un *)addr)->sun_path;
 
-  // clear the client address and address info structure
-  memset(&caddr, 0, sizeof(caddr));
+  if ('\0' == *path || lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode))
+    return false;
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return false;
+
+  ret = connect(sock, (struct sockaddr *)addr, len) < 0 &&
+        ECONNREFUSED == errno;
+
+  close(sock);
+  return ret;
+}
+
+// creates the listening socket for the address, or uses a received one
+int _ctorm_socket_listen(
+    ctorm_app_t *app, char *addr, int *received, int32_t count) {
+  struct sockaddr_storage info;
+  socklen_t               len     = 0;
+  uint32_t                backlog = app->config->backlog;
+  int                     ssock   = -1, flag = 1;
+
+  // clear the address info structure
   memset(&info, 0, sizeof(info));
 
-  // parse the host to get the addrinfo structure
-  if (!ctorm_socket_resolve(addr, &info)) {
+  // parse the host to get the socket address
+  if (!ctorm_socket_resolve(addr, &info, &len)) {
     debug("failed to resolve the address: %s", ctorm_error());
     ctorm_error_set(app, CTORM_ERR_RESOLVE_FAIL);
-    goto end;
+    return -1;
+  }
+
+  if (0 == backlog)
+    backlog = app->config->max_connections;
+
+  // use the socket of the previous process, if it passed one for the address
+  for (int32_t i = 0; i < count; i++) {
+    if (received[i] < 0 || !_ctorm_socket_is(received[i], &info, len))
+      continue;
+
+    ssock       = received[i];
+    received[i] = -1;
+
+    debug("received the listening socket %d for %s", ssock, addr);
+    goto opts;
   }
 
-  // create a new TCP socket
-  if ((ssock = socket(info.ai_family, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+  // create a new TCP (or Unix) socket
+  if ((ssock = socket(info.ss_family, SOCK_STREAM,
+           AF_UNIX == info.ss_family ? 0 : IPPROTO_TCP)) < 0) {
     debug("failed to create socket: %s", strerror(errno));
     ctorm_error_set(app, CTORM_ERR_SOCKET_FAIL);
-    goto end;
+    return -1;
   }
 
   debug("created socket %d for %p", ssock, app);
 
   // prevent EADDRINUSE
-  if (setsockopt(ssock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) < 0) {
+  if (AF_UNIX == info.ss_family) {
+    if (_ctorm_socket_stale(&info, len))
+      unlink(((struct sockaddr_un *)&info)->sun_path);
+  }
+
+  else if (setsockopt(
+               ssock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) < 0) {
     debug("failed to set the REUSEADDR: %s", strerror(errno));
     ctorm_error_set(app, CTORM_ERR_SOCKET_OPT_FAIL);
-    goto end;
+    goto fail;
+  }
+
+  // IPv6 socket also accepts IPv4 by default, which conflicts with IPv4 ones
+  if (AF_INET6 == info.ss_family && app->listener_count > 1 &&
+      setsockopt(ssock, IPPROTO_IPV6, IPV6_V6ONLY, &flag, sizeof(flag)) < 0) {
+    debug("failed to set the V6ONLY: %s", strerror(errno));
+    ctorm_error_set(app, CTORM_ERR_SOCKET_OPT_FAIL);
+    goto fail;
   }
 
   // bind and listen on the provided host
-  if (bind(ssock, info.ai_addr, info.ai_addrlen) < 0) {
+  if (bind(ssock, (struct sockaddr *)&info, len) < 0) {
     debug("failed to bind the socket: %s", strerror(errno));
     ctorm_error_set(app, CTORM_ERR_BIND_FAIL);
-    goto end;
+    goto fail;
   }
 
-  if (listen(ssock, app->config->max_connections) < 0) {
+opts:
+  // options of the received sockets may be set by an older version
+  if (!_ctorm_socket_set_listen_opts(app, ssock, info.ss_family))
+    goto fail; // error set by _ctorm_socket_set_listen_opts()
+
+  // listen() again on a received socket only updates the backlog
+  if (listen(ssock, backlog) < 0) {
     debug("failed to listen socket: %s", strerror(errno));
     ctorm_error_set(app, CTORM_ERR_LISTEN_FAIL);
-    goto end;
+    goto fail;
   }
 
+  return ssock;
+
+fail:
+  close(ssock);
+  return -1;
+}
+
+bool ctorm_socket_start(ctorm_app_t *app) {
+  struct ctorm_handoff  *handoff  = NULL;
+  struct ctorm_listener *listener = NULL;
+  char                  *path     = NULL;
+  int                    received[CTORM_LISTEN_MAX];
+  int32_t                count = 0, i = 0;
+  bool                   ret = false, passed = false;
+
+  // take over the listening sockets of the running process, if there's one
+  if (NULL != app->config->handoff_path &&
+      (count = ctorm_handoff_recv(app->config->handoff_path, received)) > 0)
+    debug("received %d listening sockets", count);
+
+  for (i = 0; i < (int32_t)app->listener_count; i++) {
+    listener       = &app->listeners[i];
+    listener->sock = _ctorm_socket_listen(app, listener->addr, received, count);
+
+    if (listener->sock < 0)
+      goto end; // error set by _ctorm_socket_listen()
+  }
+
+  // pass the listening sockets to the next process that asks for them
+  if (NULL != app->config->handoff_path &&
+      NULL == (handoff = ctorm_handoff_new(app, app->config->handoff_path)))
+    goto end; // errno set by ctorm_handoff_new()
+
+  // accept the connections in the worker processes
+  if (app->config->workers > 0)
+    ret = ctorm_prefork_run(app);
+  else
+    ret = ctorm_socket_serve(app);
+
+end:
+  // stop passing the listening sockets, and remove the socket if not passed
+  passed = NULL != handoff && handoff->passed;
+  ctorm_handoff_free(handoff);
+
+  // close the received sockets that are not used by the app
+  for (i = 0; i < count; i++)
+    if (received[i] >= 0)
+      close(received[i]);
+
+  // close the server sockets, the new process uses the socket files if passed
+  for (i = 0; i < (int32_t)app->listener_count; i++) {
+    listener = &app->listeners[i];
+
+    if (listener->sock < 0)
+      continue;
+
+    close(listener->sock);
+    listener->sock = -1;
+
+    if (!passed && NULL != (path = socket_unix(listener->addr)) && '@' != *path)
+      unlink(path);
+  }
+
+  return ret;
+}
+
+bool ctorm_socket_serve(ctorm_app_t *app) {
+  struct pollfd           fds[CTORM_LISTEN_MAX];
+  uint32_t                count = app->listener_count, next = 0;
+  int                     ssock = app->listeners[0].sock, csock = -1;
+  struct sockaddr_storage caddr;
+  struct sockaddr        *cptr  = (struct sockaddr *)&caddr;
+  socklen_t               clen  = sizeof(caddr);
+  bool                    ret   = false;
+  int                     flags = SOCK_CLOEXEC;
+
+  struct ctorm_uring *ring = NULL;
+
+  // clear the client address
+  memset(&caddr, 0, sizeof(caddr));
+
+  // coroutines wait for the non-blocking sockets, others use blocking sockets
+  if (app->config->coroutines)
+    flags |= SOCK_NONBLOCK;
+
+  // run the acceptor on the listed CPUs, along with the other threads
+  if (NULL != app->cpus)
+    ctorm_cpus_pin(app->cpus);
+
+  // wait for the connections on all the listening sockets
+  for (uint32_t i = 0; count > 1 && i < count; i++) {
+    fds[i].fd      = app->listeners[i].sock;
+    fds[i].events  = POLLIN;
+    fds[i].revents = 0;
+
+    // other workers may accept the connection after poll(), so don't block
+    fcntl(fds[i].fd, F_SETFL, fcntl(fds[i].fd, F_GETFL, 0) | O_NONBLOCK);
+  }
+
+  // use io_uring to accept the connections, if it's enabled and available
+  if (app->config->io_uring && count > 1)
+    debug("io_uring is only used to accept from a single listening socket");
+
+  else if (app->config->io_uring &&
+           NULL == (ring = ctorm_uring_new(CTORM_URING_ENTRIES)))
+    debug("io_uring is not available, using the default I/O backend");
+
   // new connection handler loop
-  while (app->running && (csock = accept(ssock, &caddr, &clen)) != -1) {
+  while (app->running &&
+         (csock = count > 1 ? _ctorm_socket_accept_any(
+                                  fds, count, &next, cptr, &clen, flags)
+                            : _ctorm_socket_accept(
+                                  &ring, ssock, cptr, &clen, flags)) != -1) {
     debug("new connection: %d", csock);
 
-    if (!ctorm_socket_set_opts(app, csock)) {
+    if (!ctorm_socket_set_opts(app, csock, caddr.ss_family)) {
       debug("setsockopt failed for %d: %s", csock, strerror(errno));
       errno = CTORM_ERR_SOCKET_OPT_FAIL;
       goto end;
     }
 
-    if (!_ctorm_socket_new(app, csock, &caddr)) {
+    if (!_ctorm_socket_new(app, csock, cptr)) {
       debug("failed to create a new socket for %d: %s", ctorm_error());
       goto end; // errno set by _ctorm_socket_new()
     }
 
+    // connection is closed by it's handler
+    csock = -1;
+
     // clear client address and address length
     memset(&caddr, 0, sizeof(caddr));
     clen = sizeof(caddr);
   }
 
   // check if accept() got interrupted
-  if (csock == -1 && errno != EINTR) {
+  if (csock == -1 && app->running && errno != EINTR) {
     debug("failed to accept new connection: %s", strerror(errno));
     ctorm_error_set(app, CTORM_ERR_ACCEPT_FAIL);
     goto end;
@@ -340,9 +978,8 @@ bool ctorm_socket_start(ctorm_app_t *app, char *addr) {
   ret = true;
 
 end:
-  // close the server socket
-  if (ssock != -1)
-    close(ssock);
+  // free the io_uring, closes the connections that are not yet accepted
+  ctorm_uring_free(ring);
 
   // close the recent client socket
   if (csock != -1)
@@ -350,3 +987,44 @@ end:
 
   return ret;
 }
+
+void ctorm_socket_drain(ctorm_app_t *app) {
+  struct ctorm_socket_data *data = NULL;
+  struct timespec           deadline;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += app->config->drain_timeout;
+
+  pthread_mutex_lock(&app->conn_mutex);
+  __atomic_store_n(&app->draining, true, __ATOMIC_SEQ_CST);
+
+  /*
+
+   * close the connections that are waiting for a new request, others are
+   * closed after their current request, connection sets the idle flag before
+   * checking the draining flag, so we either see the flag, or it sees ours
+
+  */
+  for (data = app->conns; NULL != data; data = data->next) {
+    if (!__atomic_load_n(&data->con.idle, __ATOMIC_SEQ_CST))
+      continue;
+
+    // request may be already received, if so, let it complete
+    if (_ctorm_socket_pending(data))
+      continue;
+
+    shutdown(data->con.socket, SHUT_RD);
+  }
+
+  while (NULL != app->conns) {
+    debug("waiting for the open connections to close");
+
+    if (pthread_cond_timedwait(
+            &app->conn_cond, &app->conn_mutex, &deadline) == ETIMEDOUT) {
+      debug("drain timed out, remaining connections will be killed");
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&app->conn_mutex);
+}
@@ -0,0 +1,485 @@
+#include "error.h"
+#include "conn.h"
+#include "util.h"
+
+#include "sse.h"
+#include "log.h"
+
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+// i-th event in the client's queue
+#define sse_queue_at(c, i)                                                     \
+  ((c)->queue[((c)->queue_pos + (i)) & ((c)->queue_cap - 1)])
+
+// releases a reference to a serialized event
+void _ctorm_sse_release(struct ctorm_sse_event *ev) {
+  if (--ev->refs == 0)
+    free(ev);
+}
+
+// removes the first queued event from the client's queue
+void _ctorm_sse_pop(struct ctorm_sse_client *client) {
+  struct ctorm_sse_event *ev = sse_queue_at(client, 0);
+
+  client->queue_pos = (client->queue_pos + 1) & (client->queue_cap - 1);
+  client->queue_len--;
+  client->queued -= ev->size;
+
+  _ctorm_sse_release(ev);
+}
+
+// adds an event to the end of the client's queue
+bool _ctorm_sse_push(
+    struct ctorm_sse_client *client, struct ctorm_sse_event *ev) {
+  struct ctorm_sse_event **queue = NULL;
+  uint32_t                 cap = 0, i = 0;
+
+  // grow the ring, and move the queued events to the start of the new one
+  if (client->queue_len == client->queue_cap) {
+    cap = client->queue_cap == 0 ? 8 : client->queue_cap * 2;
+
+    if (NULL == (queue = malloc(cap * sizeof(*queue)))) {
+      errno = CTORM_ERR_ALLOC_FAIL;
+      return false;
+    }
+
+    for (i = 0; i < client->queue_len; i++)
+      queue[i] = sse_queue_at(client, i);
+
+    free(client->queue);
+    client->queue     = queue;
+    client->queue_cap = cap;
+    client->queue_pos = 0;
+  }
+
+  sse_queue_at(client, client->queue_len) = ev;
+  client->queue_len++;
+  client->queued += ev->size;
+  ev->refs++;
+
+  return true;
+}
+
+// shutdowns the client connection, which is later freed by the loop thread
+void _ctorm_sse_kill(struct ctorm_sse_client *client) {
+  if (client->dead)
+    return;
+
+  shutdown(client->socket, SHUT_RDWR);
+  client->dead = true;
+}
+
+// closes the client connection, and frees the client
+void _ctorm_sse_remove(struct ctorm_sse *sse, struct ctorm_sse_client *client) {
+  epoll_ctl(sse->epfd, EPOLL_CTL_DEL, client->socket, NULL);
+
+  if (NULL == client->prev)
+    sse->head = client->next;
+  else
+    client->prev->next = client->next;
+
+  if (NULL != client->next)
+    client->next->prev = client->prev;
+
+  while (client->queue_len > 0)
+    _ctorm_sse_pop(client);
+
+  debug("closing event stream connection %d", client->socket);
+  close(client->socket);
+
+  free(client->queue);
+  free(client);
+
+  sse->count--;
+}
+
+// enables/disables EPOLLOUT for the client
+bool _ctorm_sse_watch(
+    struct ctorm_sse *sse, struct ctorm_sse_client *client, bool writing) {
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = client};
+
+  if (client->writing == writing)
+    return true;
+
+  if (writing)
+    ev.events |= EPOLLOUT;
+
+  if (epoll_ctl(sse->epfd, EPOLL_CTL_MOD, client->socket, &ev) != 0)
+    return false;
+
+  client->writing = writing;
+  return true;
+}
+
+/*
+
+ * sends the queued events without blocking, if the socket buffer is full, the
+ * loop thread sends the rest when the socket is writable again, returns false
+ * if the client should be closed
+
+*/
+bool _ctorm_sse_flush(struct ctorm_sse *sse, struct ctorm_sse_client *client) {
+  struct iovec            iov[CTORM_SSE_IOV_MAX];
+  struct msghdr           msg = {.msg_iov = iov};
+  struct ctorm_sse_event *ev  = NULL;
+  int64_t                 ret = 0;
+  uint32_t                i   = 0;
+
+  while (client->queue_len > 0) {
+    for (i = 0; i < client->queue_len && i < CTORM_SSE_IOV_MAX; i++) {
+      ev              = sse_queue_at(client, i);
+      iov[i].iov_base = ev->data;
+      iov[i].iov_len  = ev->size;
+    }
+
+    // skip the part of the first event that is already sent
+    iov[0].iov_base = (char *)iov[0].iov_base + client->sent;
+    iov[0].iov_len -= client->sent;
+    msg.msg_iovlen = i;
+
+    if ((ret = sendmsg(client->socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL)) <
+        0) {
+      if (errno == EINTR)
+        continue;
+
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return _ctorm_sse_watch(sse, client, true);
+
+      return false;
+    }
+
+    // remove the sent events from the queue
+    while (ret > 0) {
+      ev = sse_queue_at(client, 0);
+
+      if ((uint64_t)ret < ev->size - client->sent) {
+        client->sent += ret;
+        break;
+      }
+
+      ret -= ev->size - client->sent;
+      client->sent = 0;
+      _ctorm_sse_pop(client);
+    }
+  }
+
+  return _ctorm_sse_watch(sse, client, false);
+}
+
+// applies the drop policy, returns true if the new event should be queued
+bool _ctorm_sse_drop(struct ctorm_sse *sse, struct ctorm_sse_client *client,
+    struct ctorm_sse_event *ev) {
+  struct ctorm_sse_event *first = NULL;
+  uint32_t                keep  = 0;
+
+  switch (sse->opts.drop) {
+  case CTORM_SSE_DROP_NEWEST:
+    return false;
+
+  case CTORM_SSE_DROP_CLIENT:
+    debug("event stream client %d is too slow", client->socket);
+    _ctorm_sse_kill(client);
+    return false;
+
+  default:
+    break;
+  }
+
+  // partially sent event can't be dropped, it's kept at the start of the queue
+  keep = client->sent > 0 ? 1 : 0;
+
+  while (client->queue_len > keep &&
+         client->queued + ev->size > sse->opts.max_queue) {
+    if (keep) {
+      first                   = sse_queue_at(client, 0);
+      sse_queue_at(client, 0) = sse_queue_at(client, 1);
+      sse_queue_at(client, 1) = first;
+    }
+
+    _ctorm_sse_pop(client);
+  }
+
+  return true;
+}
+
+// loop thread, flushes the slow clients and detects the closed connections
+void *_ctorm_sse_loop(void *_sse) {
+  struct ctorm_sse        *sse = _sse;
+  struct ctorm_sse_client *client;
+  struct epoll_event       events[CTORM_SSE_EVENTS];
+  int                      count = 0, i = 0;
+  char                     buf[512];
+  int64_t                  ret = 0;
+
+  while ((count = epoll_wait(sse->epfd, events, CTORM_SSE_EVENTS, -1)) >= 0 ||
+         errno == EINTR) {
+    for (i = 0; i < count; i++) {
+      // loop is stopped
+      if (NULL == (client = events[i].data.ptr))
+        return NULL;
+
+      pthread_mutex_lock(&sse->mutex);
+
+      if (client->dead || events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+        goto remove;
+
+      // clients are not expected to send anything, discard the received data
+      if (events[i].events & EPOLLIN) {
+        while ((ret = recv(client->socket, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+          continue;
+
+        if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+          goto remove;
+      }
+
+      if (events[i].events & EPOLLOUT && !_ctorm_sse_flush(sse, client))
+        goto remove;
+
+      pthread_mutex_unlock(&sse->mutex);
+      continue;
+
+    remove:
+      _ctorm_sse_remove(sse, client);
+      pthread_mutex_unlock(&sse->mutex);
+    }
+  }
+
+  debug("event stream loop failed: %s", strerror(errno));
+  return NULL;
+}
+
+ctorm_sse_t *ctorm_sse_new(ctorm_sse_opts_t *opts) {
+  struct ctorm_sse  *sse = NULL;
+  struct epoll_event ev  = {.events = EPOLLIN, .data.ptr = NULL};
+
+  if (NULL != opts && opts->drop > CTORM_SSE_DROP_CLIENT) {
+    errno = CTORM_ERR_BAD_SSE_DROP;
+    return NULL;
+  }
+
+  if (NULL == (sse = calloc(1, sizeof(*sse)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  if (NULL != opts)
+    memcpy(&sse->opts, opts, sizeof(sse->opts));
+
+  if (sse->opts.max_queue == 0)
+    sse->opts.max_queue = CTORM_SSE_MAX_QUEUE;
+
+  sse->stopfd = -1;
+
+  if ((sse->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    goto fail_free;
+
+  if ((sse->stopfd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+      epoll_ctl(sse->epfd, EPOLL_CTL_ADD, sse->stopfd, &ev) < 0)
+    goto fail_close;
+
+  if (pthread_mutex_init(&sse->mutex, NULL) != 0) {
+    errno = CTORM_ERR_MUTEX_FAIL;
+    goto fail_close;
+  }
+
+  if (pthread_create(&sse->thread, NULL, _ctorm_sse_loop, sse) != 0) {
+    pthread_mutex_destroy(&sse->mutex);
+    goto fail_close;
+  }
+
+  return sse;
+
+fail_close:
+  if (sse->stopfd >= 0)
+    close(sse->stopfd);
+  close(sse->epfd);
+
+fail_free:
+  free(sse);
+  return NULL;
+}
+
+void ctorm_sse_free(ctorm_sse_t *sse) {
+  uint64_t val = 1;
+
+  if (NULL == sse)
+    return;
+
+  // wake up the loop thread, and wait for it to exit
+  if (write(sse->stopfd, &val, sizeof(val)) == sizeof(val))
+    pthread_join(sse->thread, NULL);
+
+  // close all the remaining connections
+  while (NULL != sse->head)
+    _ctorm_sse_remove(sse, sse->head);
+
+  pthread_mutex_destroy(&sse->mutex);
+  close(sse->stopfd);
+  close(sse->epfd);
+  free(sse);
+}
+
+bool ctorm_sse_subscribe(ctorm_sse_t *sse, ctorm_req_t *req, ctorm_res_t *res) {
+  if (NULL == sse) {
+    errno = CTORM_ERR_BAD_SSE_PTR;
+    return false;
+  }
+
+  ctorm_res_code(res, 200);
+  ctorm_res_set(res, "content-type", "text/event-stream");
+  ctorm_res_set(res, "cache-control", "no-cache");
+
+  // connection is passed to the stream after the response is sent
+  res->stream = true;
+  req->sse    = sse;
+
+  return true;
+}
+
+void ctorm_sse_add(struct ctorm_sse *sse, ctorm_conn_t *conn) {
+  struct ctorm_sse_client *client = NULL;
+  struct epoll_event       ev = {.events = EPOLLIN | EPOLLRDHUP};
+  int                      flags = fcntl(conn->socket, F_GETFL, 0);
+
+  if (flags < 0 || fcntl(conn->socket, F_SETFL, flags | O_NONBLOCK) < 0 ||
+      NULL == (client = calloc(1, sizeof(*client)))) {
+    ctorm_conn_close(conn);
+    return;
+  }
+
+  client->socket = conn->socket;
+  ev.data.ptr    = client;
+
+  pthread_mutex_lock(&sse->mutex);
+
+  if (epoll_ctl(sse->epfd, EPOLL_CTL_ADD, client->socket, &ev) != 0) {
+    pthread_mutex_unlock(&sse->mutex);
+    ctorm_conn_close(conn);
+    free(client);
+    return;
+  }
+
+  if (NULL != (client->next = sse->head))
+    client->next->prev = client;
+  sse->head = client;
+  sse->count++;
+
+  pthread_mutex_unlock(&sse->mutex);
+}
+
+// serializes the data lines of an event to dst (if not NULL), returns the size
+uint32_t _ctorm_sse_lines(const char *data, char *dst) {
+  uint32_t total = 0, len = 0;
+
+  // every line is sent as a separate "data" field
+  for (;;) {
+    len = strcspn(data, "\r\n");
+
+    if (NULL != dst) {
+      memcpy(dst + total, "data: ", 6);
+      memcpy(dst + total + 6, data, len);
+      dst[total + 6 + len] = '\n';
+    }
+
+    total += len + 7;
+
+    if (*(data += len) == 0)
+      break;
+
+    if (data[0] == '\r' && data[1] == '\n')
+      data++;
+    data++;
+  }
+
+  return total;
+}
+
+bool ctorm_sse_publish(ctorm_sse_t *sse, const char *event, const char *data) {
+  struct ctorm_sse_client *client = NULL;
+  struct ctorm_sse_event  *ev     = NULL;
+  uint32_t                 size = 1, len = 0;
+
+  if (NULL == sse) {
+    errno = CTORM_ERR_BAD_SSE_PTR;
+    return false;
+  }
+
+  // event name is a single line
+  if (NULL != event && event[strcspn(event, "\r\n")] != 0) {
+    errno = EINVAL;
+    return false;
+  }
+
+  if (NULL == data)
+    data = "";
+
+  if (NULL != event)
+    size += (len = cu_strlen((char *)event)) + 8;
+  size += _ctorm_sse_lines(data, NULL);
+
+  // serialize the event once, all the clients share the same buffer
+  if (NULL == (ev = malloc(sizeof(*ev) + size))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  ev->refs = 1;
+  ev->size = size;
+
+  if (NULL != event) {
+    memcpy(ev->data, "event: ", 7);
+    memcpy(ev->data + 7, event, len);
+    ev->data[7 + len] = '\n';
+    len += 8;
+  }
+
+  len += _ctorm_sse_lines(data, ev->data + len);
+  ev->data[len] = '\n';
+
+  pthread_mutex_lock(&sse->mutex);
+
+  for (client = sse->head; NULL != client; client = client->next) {
+    if (client->dead)
+      continue;
+
+    // backpressure, client's queue is full
+    if (client->queued > 0 &&
+        client->queued + ev->size > sse->opts.max_queue &&
+        !_ctorm_sse_drop(sse, client, ev))
+      continue;
+
+    if (!_ctorm_sse_push(client, ev))
+      _ctorm_sse_kill(client);
+
+    // if the client is waiting for EPOLLOUT, loop thread sends the event
+    else if (!client->writing && !_ctorm_sse_flush(sse, client))
+      _ctorm_sse_kill(client);
+  }
+
+  _ctorm_sse_release(ev);
+  pthread_mutex_unlock(&sse->mutex);
+
+  return true;
+}
+
+uint64_t ctorm_sse_count(ctorm_sse_t *sse) {
+  uint64_t count = 0;
+
+  if (NULL == sse)
+    return 0;
+
+  pthread_mutex_lock(&sse->mutex);
+  count = sse->count;
+  pthread_mutex_unlock(&sse->mutex);
+
+  return count;
+}
@@ -244,73 +244,95 @@ fail:
   return uri->host = NULL;
 }
 
-char *ctorm_uri_parse_path(ctorm_uri_t *uri, char *path) {
-  cu_null_check(uri, CTORM_ERR_BAD_URI_PTR, NULL);
+char *ctorm_uri_split_path(
+    char *path, uint32_t *path_len, char **query, uint32_t *query_len) {
   cu_null_check(path, CTORM_ERR_BAD_PATH_PTR, NULL);
 
-  // path-empty
-  if (*path == 0)
-    return path;
+  char *pos = path;
 
-  cu_str_t str;
-  cu_str_clear(&str);
-
-  if (*path != '/')
-    cu_str_add(&str, '/');
+  *path_len  = 0;
+  *query     = NULL;
+  *query_len = 0;
 
-  for (; *path != 0 && *path != '?' && *path != '#'; path++) {
+  for (; *pos != 0 && *pos != '?' && *pos != '#'; pos++) {
     // check the path char
-    if (!uri_check_path(*path)) {
+    if (!uri_check_path(*pos)) {
       errno = CTORM_ERR_BAD_PATH;
-      goto fail;
+      return NULL;
     }
 
     // check the length of the path
-    if (str.len > URI_PATH_MAX) {
+    if (pos - path > URI_PATH_MAX) {
       errno = CTORM_ERR_PATH_TOO_LARGE;
-      goto fail;
+      return NULL;
     }
+  }
 
-    // add char to the path
-    cu_str_add(&str, *path);
+  *path_len = pos - path;
+
+  if (*pos != '?')
+    return pos;
+
+  for (path = ++pos; *pos != 0 && *pos != '#'; pos++) {
+    // check the query char
+    if (!uri_check_query(*pos)) {
+      errno = CTORM_ERR_BAD_QUERY;
+      return NULL;
+    }
+
+    // check the length of the query
+    if (pos - path > URI_QUERY_MAX) {
+      errno = CTORM_ERR_QUERY_TOO_LARGE;
+      return NULL;
+    }
   }
 
-  // percent decode the path and save it
-  str.len   = ctorm_percent_decode(str.buf, str.len);
-  uri->path = str.buf;
-  cu_str_clear(&str);
+  // empty query is same as no query
+  if ((*query_len = pos - path) != 0)
+    *query = path;
 
+  return pos;
+}
+
+char *ctorm_uri_parse_path(ctorm_uri_t *uri, char *path) {
+  cu_null_check(uri, CTORM_ERR_BAD_URI_PTR, NULL);
+  cu_null_check(path, CTORM_ERR_BAD_PATH_PTR, NULL);
+
+  // path-empty
   if (*path == 0)
     return path;
 
-  if (*path == '?' && *(++path) != 0) {
-    for (; *path != 0 && *path != '#'; path++) {
-      // check the query char
-      if (!uri_check_query(*path)) {
-        errno = CTORM_ERR_BAD_QUERY;
-        goto fail;
-      }
+  char    *query = NULL, *pos = NULL;
+  uint32_t path_len = 0, query_len = 0;
+  bool     slash    = *path != '/';
 
-      // check the length of the query
-      if (str.len > URI_QUERY_MAX) {
-        errno = CTORM_ERR_QUERY_TOO_LARGE;
-        goto fail;
-      }
+  if (NULL == (pos = ctorm_uri_split_path(path, &path_len, &query, &query_len)))
+    return NULL; // errno set by ctorm_uri_split_path()
 
-      // add char to the query
-      cu_str_add(&str, *path);
-    }
+  // copy the path (with the leading '/') and percent decode it
+  if (NULL == (uri->path = malloc(path_len + slash + 1))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
   }
 
-  uri->query = ctorm_query_parse(str.buf, str.len);
-  cu_str_clear(&str);
+  *uri->path = '/';
+  memcpy(uri->path + slash, path, path_len);
+  uri->path[path_len + slash] = 0;
+  ctorm_percent_decode(uri->path, path_len + slash);
 
-  if (*path == 0)
-    return path;
+  // parse the query
+  if (NULL != query)
+    uri->query = ctorm_query_parse(query, query_len);
 
-  for (; *path != 0; path++) {
+  if (*pos == 0)
+    return pos;
+
+  cu_str_t str;
+  cu_str_clear(&str);
+
+  for (pos++; *pos != 0; pos++) {
     // check the query char
-    if (!uri_check_query(*path)) {
+    if (!uri_check_query(*pos)) {
       errno = CTORM_ERR_BAD_QUERY;
       goto fail;
     }
@@ -322,20 +344,19 @@ char *ctorm_uri_parse_path(ctorm_uri_t *uri, char *path) {
     }
 
     // add char to the query
-    cu_str_add(&str, *path);
+    cu_str_add(&str, *pos);
   }
 
   str.len       = ctorm_percent_decode(str.buf, str.len);
   uri->fragment = str.buf;
   cu_str_clear(&str);
-  return path;
+  return pos;
 
 fail:
   cu_str_free(&str);
   free(uri->path);
   ctorm_query_free(uri->query);
-  free(uri->fragment);
 
-  uri->query       = NULL;
-  return uri->path = uri->fragment = NULL;
+  uri->query      = NULL;
+  return uri->path = NULL;
 }
@@ -0,0 +1,572 @@
+#define _GNU_SOURCE
+
+#include "options.h"
+#include "uring.h"
+#include "util.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if CTORM_URING_SUPPORT
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#define uring_load(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define uring_store(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+#define URING_PROBE_OPS 256 // max operation count for the probe
+
+// user data of the SQEs, used to tell the CQEs apart
+enum {
+  URING_OP_NONE,
+  URING_OP_ACCEPT,
+  URING_OP_RECV,
+  URING_OP_TIMEOUT,
+  URING_OP_SEND,
+  URING_OP_SPLICE_IN,
+  URING_OP_SPLICE_OUT,
+  URING_OP_MAX,
+};
+
+// operations that are used by the backend, checked when a ring is created
+static const uint8_t _ctorm_uring_ops[] = {
+    IORING_OP_ACCEPT,
+    IORING_OP_RECV,
+    IORING_OP_SENDMSG,
+    IORING_OP_SPLICE,
+    IORING_OP_LINK_TIMEOUT,
+};
+
+pthread_key_t  _ctorm_uring_key;
+pthread_once_t _ctorm_uring_once = PTHREAD_ONCE_INIT;
+
+// set if io_uring is not supported, so we don't try to setup a ring again
+bool _ctorm_uring_unavailable = false;
+
+// checks if the kernel supports all the operations we need
+bool _ctorm_uring_probe(struct ctorm_uring *ring) {
+  struct io_uring_probe *probe = NULL;
+  uint32_t               i = 0, size = 0;
+  bool                   ret = false;
+
+  size = sizeof(*probe) + sizeof(probe->ops[0]) * URING_PROBE_OPS;
+
+  if (NULL == (probe = calloc(1, size)))
+    return false;
+
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe,
+          URING_PROBE_OPS) < 0)
+    goto end;
+
+  for (; i < sizeof(_ctorm_uring_ops); i++) {
+    if (_ctorm_uring_ops[i] > probe->last_op ||
+        !(probe->ops[_ctorm_uring_ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+      errno = EOPNOTSUPP;
+      goto end;
+    }
+  }
+
+  ret = true;
+
+end:
+  free(probe);
+  return ret;
+}
+
+struct ctorm_uring *ctorm_uring_new(uint32_t entries) {
+  struct io_uring_params params;
+  struct ctorm_uring    *ring = NULL;
+
+  if (_ctorm_uring_unavailable) {
+    errno = ENOSYS;
+    return NULL;
+  }
+
+  if (NULL == (ring = calloc(1, sizeof(*ring)))) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  memset(&params, 0, sizeof(params));
+  ring->pipe[0] = ring->pipe[1] = -1;
+
+  if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+    // io_uring is not supported or it's disabled
+    if (errno == ENOSYS || errno == EPERM)
+      _ctorm_uring_unavailable = true;
+    goto fail;
+  }
+
+  // map the submission queue, completion queue and the SQE array
+  ring->sq_size   = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cq_size   = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  // with a single mmap, both of the queues are in the same mapping
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_size > ring->sq_size)
+      ring->sq_size = ring->cq_size;
+    ring->cq_size = ring->sq_size;
+  }
+
+  if (MAP_FAILED == (ring->sq_ptr = mmap(NULL, ring->sq_size,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING))) {
+    ring->sq_ptr = NULL;
+    goto fail;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ptr = ring->sq_ptr;
+
+  else if (MAP_FAILED == (ring->cq_ptr = mmap(NULL, ring->cq_size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring->fd,
+                              IORING_OFF_CQ_RING))) {
+    ring->cq_ptr = NULL;
+    goto fail;
+  }
+
+  if (MAP_FAILED == (ring->sqes = mmap(NULL, ring->sqes_size,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQES))) {
+    ring->sqes = NULL;
+    goto fail;
+  }
+
+  ring->sq_head  = (void *)((char *)ring->sq_ptr + params.sq_off.head);
+  ring->sq_tail  = (void *)((char *)ring->sq_ptr + params.sq_off.tail);
+  ring->sq_mask  = (void *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+  ring->sq_array = (void *)((char *)ring->sq_ptr + params.sq_off.array);
+
+  ring->cq_head = (void *)((char *)ring->cq_ptr + params.cq_off.head);
+  ring->cq_tail = (void *)((char *)ring->cq_ptr + params.cq_off.tail);
+  ring->cq_mask = (void *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+  ring->cqes    = (void *)((char *)ring->cq_ptr + params.cq_off.cqes);
+
+  if (!_ctorm_uring_probe(ring)) {
+    _ctorm_uring_unavailable = true;
+    goto fail;
+  }
+
+  return ring;
+
+fail:
+  debug("failed to setup io_uring: %s", strerror(errno));
+  ctorm_uring_free(ring);
+  return NULL;
+}
+
+// pops a single CQE from the completion queue, returns false if it's empty
+bool _ctorm_uring_pop(struct ctorm_uring *ring, struct io_uring_cqe *cqe) {
+  uint32_t head = *ring->cq_head;
+
+  if (head == uring_load(ring->cq_tail))
+    return false;
+
+  memcpy(cqe, &ring->cqes[head & *ring->cq_mask], sizeof(*cqe));
+  uring_store(ring->cq_head, head + 1);
+  return true;
+}
+
+void ctorm_uring_free(struct ctorm_uring *ring) {
+  if (NULL == ring)
+    return;
+
+  struct io_uring_cqe cqe;
+
+  // close the accepted connections that were never picked up
+  if (NULL != ring->cq_ptr)
+    while (_ctorm_uring_pop(ring, &cqe))
+      if (cqe.user_data == URING_OP_ACCEPT && cqe.res >= 0)
+        close(cqe.res);
+
+  if (NULL != ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+
+  if (NULL != ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    munmap(ring->cq_ptr, ring->cq_size);
+
+  if (NULL != ring->sq_ptr)
+    munmap(ring->sq_ptr, ring->sq_size);
+
+  if (ring->fd >= 0)
+    close(ring->fd);
+
+  if (ring->pipe[0] >= 0) {
+    close(ring->pipe[0]);
+    close(ring->pipe[1]);
+  }
+
+  free(ring);
+}
+
+void _ctorm_uring_key_init(void) {
+  pthread_key_create(&_ctorm_uring_key, (void (*)(void *))ctorm_uring_free);
+}
+
+struct ctorm_uring *ctorm_uring_thread(void) {
+  struct ctorm_uring *ring = NULL;
+
+  if (_ctorm_uring_unavailable)
+    return NULL;
+
+  // every thread uses it's own ring, which is freed when the thread exits
+  pthread_once(&_ctorm_uring_once, _ctorm_uring_key_init);
+
+  if (NULL != (ring = pthread_getspecific(_ctorm_uring_key)))
+    return ring;
+
+  if (NULL != (ring = ctorm_uring_new(CTORM_URING_ENTRIES)))
+    pthread_setspecific(_ctorm_uring_key, ring);
+
+  return ring;
+}
+
+// queues a new SQE, SQEs are submitted by _ctorm_uring_wait()
+struct io_uring_sqe *_ctorm_uring_sqe(
+    struct ctorm_uring *ring, uint8_t op, int fd, uint64_t data) {
+  uint32_t             index = *ring->sq_tail + ring->sq_pending;
+  struct io_uring_sqe *sqe   = &ring->sqes[index &= *ring->sq_mask];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode    = op;
+  sqe->fd        = fd;
+  sqe->user_data = data;
+
+  ring->sq_array[index] = index;
+  ring->sq_pending++;
+
+  return sqe;
+}
+
+/*
+
+ * submits the queued SQEs, and waits for a CQE, if intr is true, returns -1
+ * (with EINTR) when it's interrupted by a signal, otherwise it keeps waiting
+
+*/
+int _ctorm_uring_wait(
+    struct ctorm_uring *ring, struct io_uring_cqe *cqe, bool intr) {
+  uint32_t submit = 0;
+
+  while (!_ctorm_uring_pop(ring, cqe)) {
+    // make the queued SQEs visible to the kernel
+    if (ring->sq_pending > 0) {
+      uring_store(ring->sq_tail, *ring->sq_tail + ring->sq_pending);
+      ring->sq_pending = 0;
+    }
+
+    // submit all the SQEs that are not yet consumed by the kernel
+    submit = *ring->sq_tail - uring_load(ring->sq_head);
+
+    if (syscall(__NR_io_uring_enter, ring->fd, submit, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0) >= 0)
+      continue;
+
+    if (errno != EINTR || intr)
+      return -1;
+  }
+
+  return 0;
+}
+
+// waits for the provided count of CQEs, and stores their results
+bool _ctorm_uring_complete(
+    struct ctorm_uring *ring, uint32_t count, int32_t *res) {
+  struct io_uring_cqe cqe;
+
+  while (count > 0) {
+    if (_ctorm_uring_wait(ring, &cqe, false) < 0)
+      return false;
+
+    if (cqe.user_data < URING_OP_MAX)
+      res[cqe.user_data] = cqe.res;
+
+    count--;
+  }
+
+  return true;
+}
+
+int ctorm_uring_accept(struct ctorm_uring *ring, int sock, int flags) {
+  struct io_uring_sqe *sqe = NULL;
+  struct io_uring_cqe  cqe;
+
+  for (;;) {
+    // a single multishot accept SQE keeps posting CQEs for new connections
+    if (!ring->accepting) {
+      sqe = _ctorm_uring_sqe(ring, IORING_OP_ACCEPT, sock, URING_OP_ACCEPT);
+      sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+      sqe->accept_flags = flags;
+      ring->accepting   = true;
+    }
+
+    if (_ctorm_uring_wait(ring, &cqe, true) < 0)
+      return -1;
+
+    // multishot accept is terminated, we need to submit it again
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+      ring->accepting = false;
+
+    if (cqe.user_data != URING_OP_ACCEPT)
+      continue;
+
+    if (cqe.res < 0) {
+      errno = -cqe.res;
+      return -1;
+    }
+
+    return cqe.res;
+  }
+}
+
+int64_t ctorm_uring_recv(struct ctorm_uring *ring, int sock, void *buf,
+    uint64_t len, int flags, time_t timeout) {
+  struct __kernel_timespec ts  = {.tv_sec = timeout, .tv_nsec = 0};
+  struct io_uring_sqe     *sqe = NULL;
+  int32_t                  res[URING_OP_MAX];
+
+  sqe            = _ctorm_uring_sqe(ring, IORING_OP_RECV, sock, URING_OP_RECV);
+  sqe->addr      = (uintptr_t)buf;
+  sqe->len       = len > UINT32_MAX ? UINT32_MAX : len;
+  sqe->msg_flags = flags;
+
+  // io_uring ignores SO_RCVTIMEO, so link a timeout to the receive operation
+  if (timeout > 0) {
+    sqe->flags |= IOSQE_IO_LINK;
+
+    sqe = _ctorm_uring_sqe(ring, IORING_OP_LINK_TIMEOUT, -1, URING_OP_TIMEOUT);
+    sqe->addr = (uintptr_t)&ts;
+    sqe->len  = 1;
+  }
+
+  if (!_ctorm_uring_complete(ring, timeout > 0 ? 2 : 1, res))
+    return -1;
+
+  // receive operation is canceled by the timeout
+  if (res[URING_OP_RECV] == -ECANCELED) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  if (res[URING_OP_RECV] < 0) {
+    errno = -res[URING_OP_RECV];
+    return -1;
+  }
+
+  return res[URING_OP_RECV];
+}
+
+int64_t ctorm_uring_sendmsg(
+    struct ctorm_uring *ring, int sock, struct msghdr *msg) {
+  struct io_uring_sqe *sqe = NULL;
+  int32_t              res[URING_OP_MAX];
+
+  sqe = _ctorm_uring_sqe(ring, IORING_OP_SENDMSG, sock, URING_OP_SEND);
+  sqe->addr      = (uintptr_t)msg;
+  sqe->msg_flags = MSG_NOSIGNAL;
+
+  if (!_ctorm_uring_complete(ring, 1, res))
+    return -1;
+
+  if (res[URING_OP_SEND] < 0) {
+    errno = -res[URING_OP_SEND];
+    return -1;
+  }
+
+  return res[URING_OP_SEND];
+}
+
+// splices the data in the pipe to the socket
+bool _ctorm_uring_drain(struct ctorm_uring *ring, int sock, int32_t size) {
+  struct io_uring_sqe *sqe = NULL;
+  int32_t              res[URING_OP_MAX];
+
+  while (size > 0) {
+    sqe = _ctorm_uring_sqe(ring, IORING_OP_SPLICE, sock, URING_OP_SPLICE_OUT);
+    sqe->splice_fd_in  = ring->pipe[0];
+    sqe->splice_off_in = -1;
+    sqe->off           = -1;
+    sqe->len           = size;
+    sqe->splice_flags  = SPLICE_F_MOVE;
+
+    if (!_ctorm_uring_complete(ring, 1, res))
+      return false;
+
+    if (res[URING_OP_SPLICE_OUT] <= 0) {
+      errno = res[URING_OP_SPLICE_OUT] < 0 ? -res[URING_OP_SPLICE_OUT] : EPIPE;
+      return false;
+    }
+
+    size -= res[URING_OP_SPLICE_OUT];
+  }
+
+  return true;
+}
+
+/*
+
+ * sends the message, followed by size bytes from the file, the message and the
+ * file chunks are sent with linked SQEs, so every chunk needs a single syscall,
+ * file is spliced into a pipe, and then from the pipe to the socket
+
+*/
+bool ctorm_uring_sendfile(struct ctorm_uring *ring, int sock,
+    struct msghdr *msg, int fd, off_t offset, uint64_t size) {
+  struct io_uring_sqe *sqe   = NULL;
+  uint32_t             count = 0, chunk = 0, total = 0, i = 0;
+  int32_t              res[URING_OP_MAX];
+
+  if (ring->pipe[0] < 0 && pipe2(ring->pipe, O_CLOEXEC) < 0) {
+    ring->pipe[0] = ring->pipe[1] = -1;
+    return false;
+  }
+
+  for (i = 0; NULL != msg && i < msg->msg_iovlen; i++)
+    total += msg->msg_iov[i].iov_len;
+
+  while (NULL != msg || size > 0) {
+    chunk = size > CTORM_URING_CHUNK ? CTORM_URING_CHUNK : size;
+    count = 0;
+
+    // send the entire message before splicing the file
+    if (NULL != msg) {
+      sqe = _ctorm_uring_sqe(ring, IORING_OP_SENDMSG, sock, URING_OP_SEND);
+      sqe->addr      = (uintptr_t)msg;
+      sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+      sqe->flags |= chunk > 0 ? IOSQE_IO_LINK : 0;
+      count++;
+    }
+
+    if (chunk > 0) {
+      sqe = _ctorm_uring_sqe(ring, IORING_OP_SPLICE, ring->pipe[1],
+          URING_OP_SPLICE_IN);
+      sqe->splice_fd_in  = fd;
+      sqe->splice_off_in = offset;
+      sqe->off           = -1;
+      sqe->len           = chunk;
+      sqe->splice_flags  = SPLICE_F_MOVE;
+      sqe->flags |= IOSQE_IO_LINK;
+
+      sqe = _ctorm_uring_sqe(ring, IORING_OP_SPLICE, sock, URING_OP_SPLICE_OUT);
+      sqe->splice_fd_in  = ring->pipe[0];
+      sqe->splice_off_in = -1;
+      sqe->off           = -1;
+      sqe->len           = chunk;
+      sqe->splice_flags  = SPLICE_F_MOVE;
+      count += 2;
+    }
+
+    if (!_ctorm_uring_complete(ring, count, res))
+      goto fail;
+
+    if (NULL != msg && res[URING_OP_SEND] != (int32_t)total) {
+      errno = res[URING_OP_SEND] < 0 ? -res[URING_OP_SEND] : EPIPE;
+      goto fail;
+    }
+
+    msg = NULL;
+
+    if (chunk == 0)
+      break;
+
+    if (res[URING_OP_SPLICE_IN] <= 0) {
+      errno = res[URING_OP_SPLICE_IN] < 0 ? -res[URING_OP_SPLICE_IN] : EIO;
+      goto fail;
+    }
+
+    // a short splice breaks the link, so the second splice might be canceled
+    if (res[URING_OP_SPLICE_OUT] == -ECANCELED)
+      res[URING_OP_SPLICE_OUT] = 0;
+
+    else if (res[URING_OP_SPLICE_OUT] < 0) {
+      errno = -res[URING_OP_SPLICE_OUT];
+      goto fail;
+    }
+
+    // send the rest of the data that is still in the pipe
+    if (!_ctorm_uring_drain(ring, sock,
+            res[URING_OP_SPLICE_IN] - res[URING_OP_SPLICE_OUT]))
+      goto fail;
+
+    offset += res[URING_OP_SPLICE_IN];
+    size -= res[URING_OP_SPLICE_IN];
+  }
+
+  return true;
+
+fail:
+  // pipe may still contain some data, so we can't use it again
+  close(ring->pipe[0]);
+  close(ring->pipe[1]);
+  ring->pipe[0] = ring->pipe[1] = -1;
+  return false;
+}
+
+#else
+
+struct ctorm_uring *ctorm_uring_new(uint32_t entries) {
+  cu_unused(entries);
+  errno = ENOSYS;
+  return NULL;
+}
+
+struct ctorm_uring *ctorm_uring_thread(void) {
+  return NULL;
+}
+
+void ctorm_uring_free(struct ctorm_uring *ring) {
+  cu_unused(ring);
+}
+
+int ctorm_uring_accept(struct ctorm_uring *ring, int sock, int flags) {
+  cu_unused(ring);
+  cu_unused(sock);
+  cu_unused(flags);
+  errno = ENOSYS;
+  return -1;
+}
+
+int64_t ctorm_uring_recv(struct ctorm_uring *ring, int sock, void *buf,
+    uint64_t len, int flags, time_t timeout) {
+  cu_unused(ring);
+  cu_unused(sock);
+  cu_unused(buf);
+  cu_unused(len);
+  cu_unused(flags);
+  cu_unused(timeout);
+  errno = ENOSYS;
+  return -1;
+}
+
+int64_t ctorm_uring_sendmsg(
+    struct ctorm_uring *ring, int sock, struct msghdr *msg) {
+  cu_unused(ring);
+  cu_unused(sock);
+  cu_unused(msg);
+  errno = ENOSYS;
+  return -1;
+}
+
+bool ctorm_uring_sendfile(struct ctorm_uring *ring, int sock,
+    struct msghdr *msg, int fd, off_t offset, uint64_t size) {
+  cu_unused(ring);
+  cu_unused(sock);
+  cu_unused(msg);
+  cu_unused(fd);
+  cu_unused(offset);
+  cu_unused(size);
+  errno = ENOSYS;
+  return false;
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "util.h"
+#include <strings.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -73,3 +74,23 @@ bool cu_endswith(char *str, char *suf) {
 
   return cu_streq(str + (str_len - suf_len), suf);
 }
+
+// checks if the comma separated header value contains the token
+bool cu_has_token(char *value, char *token) {
+  uint32_t len = cu_strlen(token);
+
+  for (; NULL != value && *value != 0; value++) {
+    while (*value == ' ' || *value == '\t' || *value == ',')
+      value++;
+
+    if (strncasecmp(value, token, len) == 0 &&
+        (value[len] == 0 || value[len] == ',' || value[len] == ' ' ||
+            value[len] == '\t'))
+      return true;
+
+    if (NULL == (value = strchr(value, ',')))
+      break;
+  }
+
+  return false;
+}
@@ -0,0 +1,674 @@
+#include "encoding.h"
+#include "error.h"
+#include "conn.h"
+#include "util.h"
+
+#include "app.h"
+#include "ws.h"
+#include "log.h"
+#include "co.h"
+
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define WS_GUID     "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_LEN  (24) // length of the base64 encoded 16 byte key
+#define WS_HEAD_MAX (14) // max frame header size
+
+// close status codes, see section "7.4.1. Defined Status Codes"
+#define WS_CLOSE_NORMAL    (1000)
+#define WS_CLOSE_AWAY      (1001)
+#define WS_CLOSE_PROTOCOL  (1002)
+#define WS_CLOSE_NO_STATUS (1005)
+#define WS_CLOSE_ABNORMAL  (1006)
+#define WS_CLOSE_TOO_BIG   (1009)
+
+#define ws_is_control(op) ((op) & 0x8)
+#define ws_avail(ws)      ((ws)->conn.buf_len - (ws)->conn.buf_pos)
+#define ws_pos(ws)        ((uint8_t *)(ws)->conn.buf + (ws)->conn.buf_pos)
+
+// lock & unlock the app request mutex (if enabled) before calling a handler
+#define ws_lock()                                                              \
+  if (ws->app->config->lock_request)                                           \
+  ctorm_co_lock(&ws->app->req_mutex)
+#define ws_unlock()                                                            \
+  if (ws->app->config->lock_request)                                           \
+  ctorm_co_unlock(&ws->app->req_mutex)
+
+bool ctorm_ws_upgrade(
+    ctorm_req_t *req, ctorm_res_t *res, ctorm_ws_opts_t *opts) {
+  char     buf[WS_KEY_LEN + sizeof(WS_GUID)], accept[29], *key = NULL;
+  uint8_t  digest[20];
+  char    *version = ctorm_req_get(req, "sec-websocket-version");
+  struct ctorm_ws *ws = NULL;
+
+  if (NULL == opts) {
+    errno = CTORM_ERR_BAD_WS_OPTS_PTR;
+    return false;
+  }
+
+  // check the upgrade request, see section "4.2.1" of RFC 6455
+  if (req->method != CTORM_HTTP_GET || req->version != CTORM_HTTP_1_1 ||
+      !cu_has_token(ctorm_req_get(req, "upgrade"), "websocket") ||
+      !cu_has_token(ctorm_req_get(req, "connection"), "upgrade") ||
+      NULL == (key = ctorm_req_get(req, "sec-websocket-key")) ||
+      cu_strlen(key) != WS_KEY_LEN) {
+    errno = CTORM_ERR_BAD_WS_UPGRADE;
+    return false;
+  }
+
+  // we only support the version 13
+  if (NULL == version || !cu_streq(version, "13")) {
+    ctorm_res_set(res, "sec-websocket-version", "13");
+    errno = CTORM_ERR_BAD_WS_UPGRADE;
+    return false;
+  }
+
+  if (NULL == (ws = calloc(1, sizeof(*ws)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return false;
+  }
+
+  if (pthread_mutex_init(&ws->send_mutex, NULL) != 0) {
+    free(ws);
+    errno = CTORM_ERR_MUTEX_FAIL;
+    return false;
+  }
+
+  memcpy(&ws->opts, opts, sizeof(ws->opts));
+
+  if (ws->opts.max_size == 0)
+    ws->opts.max_size = CTORM_WS_MAX_SIZE;
+
+  // accept key is the base64 encoded SHA-1 digest of the key and the GUID
+  memcpy(buf, key, WS_KEY_LEN);
+  memcpy(buf + WS_KEY_LEN, WS_GUID, sizeof(WS_GUID) - 1);
+  ctorm_sha1(buf, WS_KEY_LEN + sizeof(WS_GUID) - 1, digest);
+  ctorm_base64_encode(digest, sizeof(digest), accept);
+
+  ctorm_res_clear(res);
+  ctorm_res_code(res, 101);
+  ctorm_res_set(res, "upgrade", "websocket");
+  ctorm_res_set(res, "connection", "Upgrade");
+  ctorm_res_set(res, "sec-websocket-accept", accept);
+
+  // connection is passed to the WebSocket after the response is sent
+  ctorm_ws_free(req->ws);
+  req->ws = ws;
+
+  return true;
+}
+
+void ctorm_ws_free(struct ctorm_ws *ws) {
+  if (NULL == ws)
+    return;
+
+  pthread_mutex_destroy(&ws->send_mutex);
+  free(ws->msg);
+  free(ws);
+}
+
+// sends a single frame, server frames are not masked
+bool _ctorm_ws_send(
+    struct ctorm_ws *ws, uint8_t op, const void *data, uint64_t size) {
+  struct iovec iov[2];
+  uint8_t      head[WS_HEAD_MAX];
+  uint8_t      len = 2, i = 0;
+
+  head[0] = 0x80 | op;
+
+  if (size < 126)
+    head[1] = size;
+
+  else if (size <= UINT16_MAX) {
+    head[1] = 126;
+    head[2] = size >> 8;
+    head[3] = size;
+    len += 2;
+  }
+
+  else {
+    head[1] = 127;
+
+    for (i = 0; i < 8; i++)
+      head[2 + i] = size >> ((7 - i) * 8);
+
+    len += 8;
+  }
+
+  iov[0].iov_base = head;
+  iov[0].iov_len  = len;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len  = size;
+
+  return ctorm_conn_sendv(&ws->conn, iov, size > 0 ? 2 : 1);
+}
+
+bool ctorm_ws_send(
+    ctorm_ws_t *ws, ctorm_ws_op_t op, const void *data, uint64_t size) {
+  bool ret = false;
+
+  if (NULL == ws) {
+    errno = CTORM_ERR_BAD_WS_PTR;
+    return false;
+  }
+
+  // control frames can't be fragmented, so their payload is limited
+  if ((op != CTORM_WS_TEXT && op != CTORM_WS_BINARY && op != CTORM_WS_PING) ||
+      (op == CTORM_WS_PING && size > 125) || (NULL == data && size > 0)) {
+    errno = EINVAL;
+    return false;
+  }
+
+  pthread_mutex_lock(&ws->send_mutex);
+
+  if (ws->closing)
+    errno = CTORM_ERR_WS_CLOSED;
+  else
+    ret = _ctorm_ws_send(ws, op, data, size);
+
+  pthread_mutex_unlock(&ws->send_mutex);
+  return ret;
+}
+
+bool ctorm_ws_close(ctorm_ws_t *ws, uint16_t code) {
+  uint8_t payload[2] = {code >> 8, code & 0xff};
+  bool    ret        = false;
+
+  if (NULL == ws) {
+    errno = CTORM_ERR_BAD_WS_PTR;
+    return false;
+  }
+
+  pthread_mutex_lock(&ws->send_mutex);
+
+  if (ws->closing)
+    errno = CTORM_ERR_WS_CLOSED;
+
+  else if ((ret = _ctorm_ws_send(ws, CTORM_WS_CLOSE, payload, 2))) {
+    // no more data will be sent, wait for the client to close the connection
+    shutdown(ws->conn.socket, SHUT_WR);
+    ws->closing = true;
+  }
+
+  pthread_mutex_unlock(&ws->send_mutex);
+  return ret;
+}
+
+void *ctorm_ws_data(ctorm_ws_t *ws) {
+  return NULL == ws ? NULL : ws->opts.data;
+}
+
+// unmasks the payload data, and copies it to the destination
+void _ctorm_ws_unmask(struct ctorm_ws *ws, uint8_t *dst, uint8_t *src,
+    uint64_t size) {
+  for (; size > 0; size--, ws->mask_pos = (ws->mask_pos + 1) & 3)
+    *(dst++) = *(src++) ^ ws->mask[ws->mask_pos];
+}
+
+// calls the message handler
+void _ctorm_ws_message(struct ctorm_ws *ws, char *data, uint64_t size) {
+  uint8_t op = ws->msg_op;
+
+  ws->msg_op  = 0;
+  ws->msg_len = 0;
+
+  if (NULL == ws->opts.message)
+    return;
+
+  ws_lock();
+  ws->opts.message(ws, op, data, size);
+  ws_unlock();
+}
+
+// handles a complete control frame, returns false if the connection is closed
+bool _ctorm_ws_control(
+    struct ctorm_ws *ws, uint8_t *data, uint64_t size, uint16_t *code) {
+  switch (ws->op) {
+  case CTORM_WS_PING:
+    pthread_mutex_lock(&ws->send_mutex);
+
+    if (!ws->closing)
+      _ctorm_ws_send(ws, CTORM_WS_PONG, data, size);
+
+    pthread_mutex_unlock(&ws->send_mutex);
+    return true;
+
+  case CTORM_WS_PONG:
+    return true;
+  }
+
+  // close frame, payload starts with an optional status code
+  if (size == 1) {
+    *code = WS_CLOSE_PROTOCOL;
+    return false;
+  }
+
+  *code = size >= 2 ? (data[0] << 8 | data[1]) : WS_CLOSE_NO_STATUS;
+
+  // echo the status code, if we didn't send a close frame already
+  pthread_mutex_lock(&ws->send_mutex);
+
+  if (!ws->closing) {
+    _ctorm_ws_send(ws, CTORM_WS_CLOSE, data, size >= 2 ? 2 : 0);
+    ws->closing = true;
+  }
+
+  pthread_mutex_unlock(&ws->send_mutex);
+  return false;
+}
+
+// parses the next frame header, returns 0 if more data is needed
+int _ctorm_ws_header(struct ctorm_ws *ws, uint16_t *code) {
+  uint8_t *pos  = ws_pos(ws);
+  uint64_t len  = 0;
+  uint8_t  size = 6, i = 0;
+
+  if (ws_avail(ws) < 2)
+    return 0;
+
+  if ((len = pos[1] & 0x7f) == 126)
+    size += 2;
+  else if (len == 127)
+    size += 8;
+
+  if (ws_avail(ws) < size)
+    return 0;
+
+  ws->fin = pos[0] & 0x80;
+  ws->op  = pos[0] & 0x0f;
+
+  // reserved bits must be clear, and the client frames must be masked
+  if ((pos[0] & 0x70) || !(pos[1] & 0x80))
+    goto protocol;
+
+  // extended payload length
+  if (size > 6)
+    for (len = 0, i = 2; i < size - 4; i++)
+      len = len << 8 | pos[i];
+
+  switch (ws->op) {
+  case CTORM_WS_CONT:
+    if (ws->msg_op == 0)
+      goto protocol;
+    break;
+
+  case CTORM_WS_TEXT:
+  case CTORM_WS_BINARY:
+    if (ws->msg_op != 0)
+      goto protocol;
+
+    ws->msg_op  = ws->op;
+    ws->msg_len = 0;
+    break;
+
+  case CTORM_WS_CLOSE:
+  case CTORM_WS_PING:
+  case CTORM_WS_PONG:
+    // control frames can't be fragmented, and they can't be large
+    if (!ws->fin || len > 125)
+      goto protocol;
+    break;
+
+  default:
+    goto protocol;
+  }
+
+  if (!ws_is_control(ws->op) && len > ws->opts.max_size - ws->msg_len) {
+    *code = WS_CLOSE_TOO_BIG;
+    return -1;
+  }
+
+  memcpy(ws->mask, pos + size - 4, 4);
+  ws->mask_pos = 0;
+  ws->left     = len;
+  ws->in_frame = true;
+
+  ctorm_conn_skip(&ws->conn, size);
+  return 1;
+
+protocol:
+  *code = WS_CLOSE_PROTOCOL;
+  return -1;
+}
+
+/*
+
+ * processes the received data, returns 1 if some data is processed, 0 if more
+ * data is needed, and -1 if the connection should be closed
+
+*/
+int _ctorm_ws_process(struct ctorm_ws *ws, uint16_t *code) {
+  uint8_t *pos  = NULL;
+  uint64_t size = 0;
+  char    *msg  = NULL;
+
+  if (!ws->in_frame)
+    return _ctorm_ws_header(ws, code);
+
+  pos  = ws_pos(ws);
+  size = ws_avail(ws);
+
+  // control frames are handled when they are completely received
+  if (ws_is_control(ws->op)) {
+    if (size < ws->left)
+      return 0;
+
+    _ctorm_ws_unmask(ws, pos, pos, ws->left);
+    ctorm_conn_skip(&ws->conn, ws->left);
+    ws->in_frame = false;
+
+    return _ctorm_ws_control(ws, pos, ws->left, code) ? 1 : -1;
+  }
+
+  // unfragmented message that is completely received, unmask it in place
+  if (ws->fin && ws->msg_len == 0 && size >= ws->left) {
+    _ctorm_ws_unmask(ws, pos, pos, ws->left);
+    ctorm_conn_skip(&ws->conn, ws->left);
+    ws->in_frame = false;
+
+    _ctorm_ws_message(ws, (char *)pos, ws->left);
+    return 1;
+  }
+
+  // otherwise copy the payload to the message buffer
+  if (size > ws->left)
+    size = ws->left;
+
+  if (size == 0 && ws->left > 0)
+    return 0;
+
+  if (ws->msg_len + ws->left > ws->msg_cap) {
+    if (NULL == (msg = realloc(ws->msg, ws->msg_len + ws->left))) {
+      *code = WS_CLOSE_TOO_BIG;
+      return -1;
+    }
+
+    ws->msg     = msg;
+    ws->msg_cap = ws->msg_len + ws->left;
+  }
+
+  _ctorm_ws_unmask(ws, (uint8_t *)ws->msg + ws->msg_len, pos, size);
+  ctorm_conn_skip(&ws->conn, size);
+  ws->msg_len += size;
+
+  if ((ws->left -= size) > 0)
+    return 1;
+
+  ws->in_frame = false;
+
+  if (ws->fin)
+    _ctorm_ws_message(ws, ws->msg, ws->msg_len);
+
+  return 1;
+}
+
+// receives the available data without blocking, returns -1 on EAGAIN
+int64_t _ctorm_ws_recv(struct ctorm_ws *ws) {
+  ctorm_conn_t *conn = &ws->conn;
+  int64_t       ret  = 0;
+
+  // move the unread data to the start of the buffer to make room
+  memmove(conn->buf, conn->buf + conn->buf_pos, conn->buf_len - conn->buf_pos);
+  conn->buf_len -= conn->buf_pos;
+  conn->buf_pos = 0;
+
+  ret = recv(conn->socket, conn->buf + conn->buf_len,
+      sizeof(conn->buf) - conn->buf_len, MSG_DONTWAIT);
+
+  if (ret > 0)
+    conn->buf_len += ret;
+
+  return ret;
+}
+
+// closes the connection and frees the WebSocket
+void _ctorm_ws_destroy(struct ctorm_ws *ws, uint16_t code) {
+  struct ctorm_ws_loop *loop = ws->loop;
+
+  // send a close frame if we didn't send one yet (i.e. protocol error)
+  pthread_mutex_lock(&ws->send_mutex);
+
+  if (!ws->closing && code != WS_CLOSE_ABNORMAL) {
+    uint8_t payload[2] = {code >> 8, code & 0xff};
+    _ctorm_ws_send(ws, CTORM_WS_CLOSE, payload, 2);
+  }
+
+  ws->closing = true;
+  pthread_mutex_unlock(&ws->send_mutex);
+
+  if (NULL != ws->opts.close) {
+    ws_lock();
+    ws->opts.close(ws, code);
+    ws_unlock();
+  }
+
+  // remove the connection from the event loop
+  pthread_mutex_lock(&loop->mutex);
+
+  if (ws->armed)
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ws->conn.socket, NULL);
+
+  if (NULL == ws->prev)
+    loop->head = ws->next;
+  else
+    ws->prev->next = ws->next;
+
+  if (NULL != ws->next)
+    ws->next->prev = ws->prev;
+
+  pthread_mutex_unlock(&loop->mutex);
+
+  debug("closing WebSocket connection %d (%hu)", ws->conn.socket, code);
+  ctorm_conn_close(&ws->conn);
+  ctorm_ws_free(ws);
+}
+
+// handles all the received data, and waits for more data using epoll
+void _ctorm_ws_handle(void *_ws) {
+  struct ctorm_ws   *ws   = _ws;
+  struct epoll_event ev   = {.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT};
+  uint16_t           code = WS_CLOSE_ABNORMAL;
+  int64_t            ret  = 0;
+
+  for (;;) {
+    if ((ret = _ctorm_ws_process(ws, &code)) > 0)
+      continue;
+
+    if (ret < 0)
+      goto close;
+
+    // buffer is full, but the frame header is still not complete
+    if (ws->conn.buf_pos == 0 && ws->conn.buf_len == sizeof(ws->conn.buf)) {
+      code = WS_CLOSE_PROTOCOL;
+      goto close;
+    }
+
+    if ((ret = _ctorm_ws_recv(ws)) > 0)
+      continue;
+
+    if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      code = ws->closing ? WS_CLOSE_NORMAL : WS_CLOSE_ABNORMAL;
+      goto close;
+    }
+
+    break;
+  }
+
+  /*
+
+   * no more data to read, so let epoll watch the connection, after this we
+   * can't access the connection, since another thread may start handling it
+
+  */
+  ev.data.ptr = ws;
+  pthread_mutex_lock(&ws->loop->mutex);
+
+  if (epoll_ctl(ws->loop->epfd, ws->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+          ws->conn.socket, &ev) == 0) {
+    ws->armed = true;
+    pthread_mutex_unlock(&ws->loop->mutex);
+    return;
+  }
+
+  pthread_mutex_unlock(&ws->loop->mutex);
+  debug("failed to add WebSocket to epoll: %s", strerror(errno));
+
+close:
+  _ctorm_ws_destroy(ws, code);
+}
+
+void _ctorm_ws_kill(void *_ws) {
+  struct ctorm_ws *ws = _ws;
+  shutdown(ws->conn.socket, SHUT_RDWR);
+}
+
+// event loop thread, passes the readable connections to the thread pool
+void *_ctorm_ws_loop(void *_loop) {
+  struct ctorm_ws_loop *loop = _loop;
+  struct epoll_event    events[CTORM_WS_EVENTS];
+  int                   count = 0, i = 0;
+
+  while ((count = epoll_wait(loop->epfd, events, CTORM_WS_EVENTS, -1)) >= 0 ||
+         errno == EINTR) {
+    for (i = 0; i < count; i++) {
+      // loop is stopped
+      if (NULL == events[i].data.ptr)
+        return NULL;
+
+      if (!ctorm_pool_add(
+              loop->pool, _ctorm_ws_handle, _ctorm_ws_kill, events[i].data.ptr))
+        _ctorm_ws_destroy(events[i].data.ptr, WS_CLOSE_AWAY);
+    }
+  }
+
+  debug("WebSocket event loop failed: %s", strerror(errno));
+  return NULL;
+}
+
+struct ctorm_ws_loop *_ctorm_ws_loop_new(ctorm_pool_t *pool) {
+  struct ctorm_ws_loop *loop = NULL;
+  struct epoll_event    ev   = {.events = EPOLLIN, .data.ptr = NULL};
+
+  if (NULL == (loop = calloc(1, sizeof(*loop)))) {
+    errno = CTORM_ERR_ALLOC_FAIL;
+    return NULL;
+  }
+
+  loop->pool   = pool;
+  loop->stopfd = -1;
+
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    goto fail_free;
+
+  if ((loop->stopfd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+      epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->stopfd, &ev) < 0)
+    goto fail_close;
+
+  if (pthread_mutex_init(&loop->mutex, NULL) != 0) {
+    errno = CTORM_ERR_MUTEX_FAIL;
+    goto fail_close;
+  }
+
+  if (pthread_create(&loop->thread, NULL, _ctorm_ws_loop, loop) != 0) {
+    pthread_mutex_destroy(&loop->mutex);
+    goto fail_close;
+  }
+
+  return loop;
+
+fail_close:
+  if (loop->stopfd >= 0)
+    close(loop->stopfd);
+  close(loop->epfd);
+
+fail_free:
+  free(loop);
+  return NULL;
+}
+
+void ctorm_ws_start(
+    struct ctorm_app *app, struct ctorm_ws *ws, ctorm_conn_t *conn) {
+  int flags = 0;
+
+  // create the event loop of the app, when the first connection is upgraded
+  pthread_mutex_lock(&app->mod_mutex);
+
+  if (NULL == app->ws_loop && NULL == (app->ws_loop = _ctorm_ws_loop_new(
+                                            app->pool))) {
+    pthread_mutex_unlock(&app->mod_mutex);
+    debug("failed to create the WebSocket event loop: %s", ctorm_error());
+    ctorm_conn_close(conn);
+    ctorm_ws_free(ws);
+    return;
+  }
+
+  pthread_mutex_unlock(&app->mod_mutex);
+
+  /*
+
+   * in coroutine mode the sockets are non-blocking, however the WebSocket is
+   * handled on the thread pool (and messages can be sent from any thread),
+   * where a send can't wait for the socket, so make it blocking again, the
+   * receive calls don't block, since they use MSG_DONTWAIT
+
+  */
+  if (NULL != app->co_loops && (flags = fcntl(conn->socket, F_GETFL, 0)) >= 0)
+    fcntl(conn->socket, F_SETFL, flags & ~O_NONBLOCK);
+
+  // connection (with the received data) now belongs to the WebSocket
+  memcpy(&ws->conn, conn, sizeof(ws->conn));
+  ws->conn.ring = NULL;
+  ws->app       = app;
+  ws->loop      = app->ws_loop;
+
+  pthread_mutex_lock(&ws->loop->mutex);
+
+  if (NULL != (ws->next = ws->loop->head))
+    ws->next->prev = ws;
+  ws->loop->head = ws;
+
+  pthread_mutex_unlock(&ws->loop->mutex);
+
+  if (NULL != ws->opts.open) {
+    ws_lock();
+    ws->opts.open(ws);
+    ws_unlock();
+  }
+
+  // handle the data that is received with the upgrade request
+  _ctorm_ws_handle(ws);
+}
+
+void ctorm_ws_loop_stop(struct ctorm_ws_loop *loop) {
+  uint64_t val = 1;
+
+  if (NULL == loop)
+    return;
+
+  // wake up the loop thread, and wait for it to exit
+  if (write(loop->stopfd, &val, sizeof(val)) == sizeof(val))
+    pthread_join(loop->thread, NULL);
+}
+
+void ctorm_ws_loop_free(struct ctorm_ws_loop *loop) {
+  if (NULL == loop)
+    return;
+
+  // close all the remaining connections
+  while (NULL != loop->head)
+    _ctorm_ws_destroy(loop->head, WS_CLOSE_AWAY);
+
+  pthread_mutex_destroy(&loop->mutex);
+  close(loop->stopfd);
+  close(loop->epfd);
+  free(loop);
+}